@@ -10,10 +10,12 @@
 #include <uxtheme.h>
 #include <dwmapi.h>
 #include <shlwapi.h>
+#include <shobjidl.h>
 #include <propvarutil.h>
 #include <filesystem>
 #include <vector>
 #include <array>
+#include <bit>
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
@@ -22,12 +24,19 @@
 #include <iomanip>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
 #include <wrl.h>
 #include <WebView2.h>
 #include "resource.h"
-#include "md4c.h"
-#include "md4c-html.h"
-#include "entity.h"
+#include "FloatVisionCore.h"
 #pragma comment(lib, "d2d1.lib")
 #pragma comment(lib, "windowscodecs.lib")
 #pragma comment(lib, "dwrite.lib")
@@ -48,8 +57,7 @@ ID2D1Factory* g_d2dFactory = nullptr;
 ID2D1HwndRenderTarget* g_renderTarget = nullptr;
 ID2D1Bitmap* g_bitmap = nullptr;
 ID2D1SolidColorBrush* g_placeholderBrush = nullptr;
-ID2D1SolidColorBrush* g_checkerBrushA = nullptr;
-ID2D1SolidColorBrush* g_checkerBrushB = nullptr;
+ID2D1BitmapBrush* g_checkerPatternBrush = nullptr;
 ID2D1SolidColorBrush* g_customColorBrush = nullptr;
 ID2D1SolidColorBrush* g_textBrush = nullptr;
 HWND g_hwnd = nullptr;
@@ -59,6 +67,16 @@ IDWriteTextFormat* g_placeholderFormat = nullptr;
 IDWriteTextFormat* g_textFormat = nullptr;
 IWICBitmapSource* g_wicSourceStraight = nullptr;
 IWICBitmapSource* g_wicSourcePremultiplied = nullptr;
+
+// Scaled pixels handed to UpdateLayeredWindow, reused while state says they are current.
+struct LayeredSurfaceCache
+{
+    LayeredSurfaceState state;
+    HDC memDc = nullptr;
+    HBITMAP dib = nullptr;
+    HGDIOBJ oldBitmap = nullptr;
+};
+LayeredSurfaceCache g_layeredSurface;
 Microsoft::WRL::ComPtr<ICoreWebView2Controller> g_webviewController;
 Microsoft::WRL::ComPtr<ICoreWebView2Controller2> g_webviewController2;
 Microsoft::WRL::ComPtr<ICoreWebView2> g_webview;
@@ -82,7 +100,6 @@ float g_dragStartWidth = 0.0f;
 float g_dragStartHeight = 0.0f;
 
 bool g_hasText = false;
-std::wstring g_textContent;
 std::wstring g_textFontName = L"Consolas";
 std::wstring g_textFontFaceName;
 float g_textFontSize = 18.0f;
@@ -91,23 +108,84 @@ COLORREF g_textBackground = RGB(20, 20, 20);
 bool g_textWrap = true;
 UINT g_textWindowWidth = 800;
 UINT g_textWindowHeight = 600;
-float g_textScroll = 0.0f;
+
+// Plain-text files are viewed natively: the file is mapped in windows and only visible lines are shaped.
+constexpr uint64_t kTextViewWindowBytes = 16ull * 1024 * 1024;
+
+{
+    std::wstring path;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+    uint64_t size = 0;
+    uint64_t dataStart = 0;
+    TextFileIdentity identity;
+    const char* view = nullptr;
+    uint64_t viewOffset = 0;
+    size_t viewSize = 0;
+    std::mutex indexMutex;
+    TextLineIndex index;
+    bool indexComplete = false;
+    std::thread indexer;
+    std::atomic<bool> cancelIndexing{ false };
+};
+TextDocument g_textDocument;
+uint64_t g_textTopLine = 0;
+float g_textTopOffset = 0.0f;
+float g_textLayoutWidth = 0.0f;
+std::unordered_map<uint64_t, float> g_textLineHeights;
+// Follow mode: watch the open text file, index appended bytes and stay pinned to the end.
+bool g_textFollow = false;
+bool g_textScrollToEndPending = false;
+struct TextFileWatcher
+{
+    std::thread thread;
+    HANDLE stopEvent = nullptr;
+    std::wstring directory;
+    std::atomic<bool> changePosted{ false };
+};
+TextFileWatcher g_textFileWatcher;
 bool g_hasHtml = false;
-std::wstring g_pendingHtmlContent;
+std::string g_pendingHtmlContent;
+MarkdownHtmlCache g_markdownHtmlCache;
+// The markdown page currently shown in the WebView; the base for incremental reloads.
+std::shared_ptr<const MarkdownPage> g_liveMarkdownPage;
+std::wstring g_liveMarkdownPath;
+uint64_t g_liveMarkdownStyleKey = 0;
+// blockBounds[0] is where the page body starts and each later entry ends a run of complete
+// top-level blocks; empty when the page cannot be delivered progressively.
+std::vector<size_t> g_pendingHtmlBlockBounds;
+struct ProgressiveHtmlState
+{
+    std::string html;
+    std::vector<size_t> blockBounds;
+    size_t nextBlock = 0;
+    uint64_t generation = 0;
+    // Batches wait for the first page's own navigation (navigationId, once it has started) to
+    // complete successfully.
+    bool awaitingNavigation = false;
+    bool navigationStarted = false;
+    uint64_t navigationId = 0;
+};
+ProgressiveHtmlState g_progressiveHtml;
 std::wstring g_webviewTempHtmlPath;
 std::wstring g_webviewTempHtmlUrl;
 bool g_webviewPendingShow = false;
 double g_htmlBaseZoomFactor = 1.0;
 bool g_keepLayeredWhileHtmlPending = false;
 EventRegistrationToken g_webviewNavigationToken{};
+EventRegistrationToken g_webviewNavigationStartingToken{};
 bool g_webviewInputTimerActive = false;
-bool g_animationPlaying = false;
+// Timeline, frame delays and visibility state of the playing animation.
+AnimationPlayback g_animationPlayback;
+// The frame on screen; the timeline's frame is only shown once it has been decoded.
 size_t g_animationFrameIndex = 0;
 std::vector<IWICBitmapSource*> g_animationFramesStraight;
 std::vector<IWICBitmapSource*> g_animationFramesPremultiplied;
-std::vector<UINT> g_animationFrameDelaysMs;
 std::vector<UINT> g_animationFrameWidths;
 std::vector<UINT> g_animationFrameHeights;
+// Region that changes when stepping from the previous frame to this one (frame 0 steps from the last).
+std::vector<CanvasRect> g_animationFrameDirtyRects;
+AnimationSurface g_animationSurface;
 UINT g_currentFrameWidth = 0;
 UINT g_currentFrameHeight = 0;
 enum class HtmlInputKey
@@ -139,18 +217,155 @@ enum class TransparencyMode
     SolidColor = 2
 };
 
-enum class SortMode
+// A ZIP file mapped read-only as a whole; members are viewed a range at a time so archives larger
+// than the address space still open.
+struct ZipArchive
+{
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+    uint64_t size = 0;
+    std::vector<ZipMember> members;
+};
+
+// A member's bytes: a view into the mapping for stored members, an inflated buffer otherwise.
+struct ZipMemberData
+{
+    void* view = nullptr;
+    const BYTE* data = nullptr;
+    size_t size = 0;
+    std::shared_ptr<std::vector<BYTE>> inflated;
+};
+
+// Inflated members next to the current one, filled on a worker thread.
+struct ArchivePrefetch
 {
-    NameAsc,
-    NameDesc,
-    TimeAsc,
-    TimeDesc
+    std::thread thread;
+    std::atomic<bool> cancel{ false };
+    std::mutex mutex;
+    std::vector<std::pair<uint32_t, std::shared_ptr<std::vector<BYTE>>>> members;
 };
 
 struct ImageEntry
 {
     std::filesystem::path path;
     std::filesystem::file_time_type writeTime;
+    uint32_t id = 0;
+    uint64_t size = 0;
+    uint32_t member = 0;
+};
+
+// The catalog's metadata one column per field, indexed by entry id, so a sort or filter walks a
+// single dense array. flags holds kMetadataProbed and kMetadataHasAlpha.
+struct CatalogMetadata
+{
+    std::vector<uint32_t> width;
+    std::vector<uint32_t> height;
+    std::vector<uint32_t> frameCount;
+    std::vector<uint64_t> dateTaken;
+    std::vector<uint8_t> flags;
+};
+
+// Files of the current document's folder in display order. An entry's id follows the file
+// through renames and re-sorts; order holds the ids and precomputed sort keys position for
+// position with entries, and is keyed by the case-folded file name. When archive is set, directory is
+// the archive file, entries are its image members and names are paths inside the archive. When
+// roots is set, the catalog is a playlist of every file under those folders, named by full path.
+// metadata is filled by the indexer in the background and on demand by sorts and filters.
+struct DirectoryCatalog
+{
+    std::filesystem::path directory;
+    std::shared_ptr<ZipArchive> archive;
+    std::vector<std::filesystem::path> roots;
+    std::vector<ImageEntry> entries;
+    CatalogOrder order;
+    CatalogMetadata metadata;
+    uint32_t nextId = 1;
+    bool imageOnly = false;
+    bool scanning = false;
+};
+
+// Action 0 means the notification buffer overflowed and the folder has to be read again.
+struct DirectoryChange
+{
+    DWORD action = 0;
+    std::wstring name;
+};
+
+struct DirectoryWatcher
+{
+    std::thread thread;
+    HANDLE stopEvent = nullptr;
+    std::wstring directory;
+    std::mutex mutex;
+    std::vector<DirectoryChange> changes;
+    std::atomic<bool> watching{ false };
+    std::atomic<bool> changePosted{ false };
+};
+
+// Background listing of the catalog's folder. pending and finished belong to the scan numbered
+// generation; a scan that has been superseded finds the number changed and drops its results.
+struct CatalogScanner
+{
+    std::thread thread;
+    std::atomic<bool> cancel{ false };
+    std::mutex mutex;
+    uint32_t generation = 0;
+    std::vector<ImageEntry> pending;
+    bool finished = false;
+    // pending replaces the catalog instead of being merged into it.
+    bool replace = false;
+    std::atomic<bool> batchPosted{ false };
+};
+
+// Metadata of every image probed so far, keyed by a hash of the case-folded full path and kept
+// next to the ini file between runs.
+struct MetadataCache
+{
+    std::mutex mutex;
+    std::unordered_map<uint64_t, MetadataCacheRecord> records;
+    bool loaded = false;
+    bool dirty = false;
+};
+
+struct MetadataIndexResult
+{
+    uint32_t id = 0;
+    uint64_t writeTime = 0;
+    ImageMetadata metadata;
+};
+
+// Background probe of the catalog's images. pending belongs to the run numbered generation and
+// is written into the columns on the UI thread.
+struct MetadataIndexer
+{
+    std::thread thread;
+    std::atomic<bool> cancel{ false };
+    std::mutex mutex;
+    uint32_t generation = 0;
+    std::vector<MetadataIndexResult> pending;
+    std::atomic<bool> batchPosted{ false };
+    // Cleared when a run has probed everything it was given; its last results may still be queued.
+    std::atomic<bool> running{ false };
+};
+
+struct ResolvedFontInfo
+{
+    std::wstring familyName;
+    DWRITE_FONT_WEIGHT weight = DWRITE_FONT_WEIGHT_REGULAR;
+    DWRITE_FONT_STYLE style = DWRITE_FONT_STYLE_NORMAL;
+    DWRITE_FONT_STRETCH stretch = DWRITE_FONT_STRETCH_NORMAL;
+    bool matched = false;
+};
+
+// The system font names, listed on a background thread the first time a font is resolved and
+// again after the font collection changes. index is swapped in whole once a build completes.
+struct FontCatalog
+{
+    std::thread thread;
+    std::atomic<bool> cancel{ false };
+    std::mutex mutex;
+    std::shared_ptr<const FontCatalogIndex> index;
+    bool checkForUpdates = false;
 };
 
 struct HotkeyColors
@@ -338,16 +553,32 @@ static LRESULT CALLBACK HotkeySubclassProc(HWND hwnd, UINT msg, WPARAM wParam, L
     return DefSubclassProc(hwnd, msg, wParam, lParam);
 }
 
-std::vector<ImageEntry> g_imageList;
+DirectoryCatalog g_catalog;
+DirectoryWatcher g_directoryWatcher;
+CatalogScanner g_catalogScanner;
+ArchivePrefetch g_archivePrefetch;
+MetadataCache g_metadataCache;
+MetadataIndexer g_metadataIndexer;
+FontCatalog g_fontCatalog;
+StartupTrace g_startupTrace;
+// Set while a file from the command line is still to be loaded, so the placeholder is not drawn
+// (and DirectWrite not created for it) in the meantime.
+bool g_startupContentPending = false;
 size_t g_currentIndex = 0;
 SortMode g_sortMode = SortMode::NameAsc;
 bool g_sortImageOnly = true;
+// Navigation filters; entries that fail them are stepped over.
+bool g_filterAnimatedOnly = false;
+bool g_filterAlphaOnly = false;
+// A filtered step that reached a file the indexer has not probed yet; retried as results arrive.
+int g_pendingFilterNavigation = 0;
 std::filesystem::path g_currentImagePath;
 const float g_zoomMin = 0.05f;
 const float g_zoomMax = 20.0f;
 const float g_edgeDragMargin = 12.0f;
 bool g_alwaysOnTop = false;
 std::wstring g_iniPath;
+SettingsStore g_settingsStore;
 POINT g_windowPos{ CW_USEDEFAULT, CW_USEDEFAULT };
 bool g_hasSavedWindowPos = false;
 enum class WindowPositionMode
@@ -373,15 +604,203 @@ constexpr int kMenuSettings = 1010;
 constexpr int kMenuReload = 1011;
 constexpr int kMenuAbout = 1012;
 constexpr int kMenuMinimize = 1013;
+constexpr int kMenuFollowText = 1014;
+constexpr int kMenuOutline = 1015;
+constexpr int kMenuOpenFolder = 1016;
 constexpr int kMenuSortNameAsc = 1101;
 constexpr int kMenuSortNameDesc = 1102;
 constexpr int kMenuSortTimeAsc = 1103;
 constexpr int kMenuSortTimeDesc = 1104;
 constexpr int kMenuSortImageOnly = 1105;
+constexpr int kMenuSortNatural = 1106;
+constexpr int kMenuSortSizeAsc = 1107;
+constexpr int kMenuSortDimensionsAsc = 1108;
+constexpr int kMenuSortDateTakenAsc = 1109;
+constexpr int kMenuFilterAnimated = 1110;
+constexpr int kMenuFilterAlpha = 1111;
 constexpr UINT_PTR kWebViewInputTimerId = 2001;
 constexpr UINT kWebViewInputTimerIntervalMs = 50;
 constexpr UINT_PTR kAnimationTimerId = 2002;
-constexpr UINT kDefaultAnimationFrameDelayMs = 100;
+constexpr UINT kMessageTextIndexProgress = WM_APP + 1;
+constexpr ULONGLONG kTextIndexProgressIntervalMs = 100;
+constexpr UINT kMessageTextFileChanged = WM_APP + 2;
+constexpr UINT_PTR kTextFollowPollTimerId = 2004;
+constexpr UINT kTextFollowPollIntervalMs = 1000;
+constexpr UINT kMessageDirectoryChanged = WM_APP + 3;
+constexpr DWORD kDirectoryWatchBufferBytes = 64 * 1024;
+constexpr size_t kCatalogProbeChunkEntries = 32;
+constexpr UINT kMessageCatalogBatch = WM_APP + 4;
+constexpr size_t kCatalogScanFirstBatch = 256;
+constexpr size_t kCatalogScanMaxBatch = 65536;
+constexpr UINT kMessageMetadataBatch = WM_APP + 5;
+constexpr size_t kMetadataIndexBatch = 64;
+constexpr size_t kMetadataCacheMaxRecords = 1 << 20;
+constexpr size_t kStartupReadAheadChunkBytes = 1 << 20;
+constexpr uint64_t kStartupReadAheadMaxBytes = 256ull << 20;
+
+// =====================
+// 設定スキーマ
+// =====================
+// How a setting's text is read. Integer, Bool and Color are all plain integers in the ini; the
+// markdown settings file also accepts true/false and #RRGGBB for Bool and Color.
+enum class SettingKind : unsigned char
+{
+    Integer,
+    Bool,
+    Color,
+    Float,
+    FontName
+};
+
+// What happens to an ini value outside [minValue, maxValue].
+enum class SettingRange : unsigned char
+{
+    None,
+    Reject,
+    Clamp
+};
+
+// One persisted setting. target points at the global it loads into; assign and read convert
+// between that global's type and a double. markdownName is the normalized key the markdown
+// settings file uses, empty when the setting cannot be set from there. A loadOnly setting is read
+// when present and dropped from the ini on save.
+struct SettingField
+{
+    std::wstring_view section;
+    std::wstring_view key;
+    std::wstring_view markdownName;
+    SettingKind kind = SettingKind::Integer;
+    SettingRange range = SettingRange::None;
+    bool loadOnly = false;
+    void* target = nullptr;
+    double defaultValue = 0.0;
+    double minValue = 0.0;
+    double maxValue = 0.0;
+    void (*assign)(void* target, double value) = nullptr;
+    double (*read)(const void* target) = nullptr;
+};
+
+template <typename T>
+void AssignSettingValue(void* target, double value)
+{
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        *static_cast<T*>(target) = static_cast<T>(value);
+    }
+    else
+    {
+        *static_cast<T*>(target) = static_cast<T>(static_cast<int64_t>(value));
+    }
+}
+
+template <typename T>
+double ReadSettingValue(const void* target)
+{
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        return static_cast<double>(*static_cast<const T*>(target));
+    }
+    else
+    {
+        return static_cast<double>(static_cast<int64_t>(*static_cast<const T*>(target)));
+    }
+}
+
+template <typename T>
+constexpr SettingField MakeSetting(std::wstring_view section, std::wstring_view key, T* target, double defaultValue)
+{
+    SettingField field;
+    field.section = section;
+    field.key = key;
+    field.target = target;
+    field.defaultValue = defaultValue;
+    if constexpr (std::is_same_v<T, std::wstring>)
+    {
+        field.kind = SettingKind::FontName;
+    }
+    else
+    {
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            field.kind = SettingKind::Bool;
+        }
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            field.kind = SettingKind::Float;
+        }
+        field.assign = &AssignSettingValue<T>;
+        field.read = &ReadSettingValue<T>;
+    }
+    return field;
+}
+
+constexpr SettingField WithRange(SettingField field, SettingRange range, double minValue, double maxValue)
+{
+    field.range = range;
+    field.minValue = minValue;
+    field.maxValue = maxValue;
+    return field;
+}
+
+constexpr SettingField WithKind(SettingField field, SettingKind kind)
+{
+    field.kind = kind;
+    return field;
+}
+
+constexpr SettingField WithMarkdownName(SettingField field, std::wstring_view markdownName)
+{
+    field.markdownName = markdownName;
+    return field;
+}
+
+constexpr SettingField LoadOnly(SettingField field)
+{
+    field.loadOnly = true;
+    return field;
+}
+
+// Every ini setting, in the order a new ini file lists them. Window X/Y are not here: they are
+// saved with the window placement, not with the settings.
+constexpr double kSettingNoLimit = 1e18;
+constexpr std::array kSettingFields{
+    WithRange(MakeSetting(L"Settings", L"SortMode", &g_sortMode, 0), SettingRange::Reject, 0, static_cast<int>(SortMode::DateTakenAsc)),
+    MakeSetting(L"Settings", L"SortImageOnly", &g_sortImageOnly, 1),
+    MakeSetting(L"Settings", L"FilterAnimatedOnly", &g_filterAnimatedOnly, 0),
+    MakeSetting(L"Settings", L"FilterAlphaOnly", &g_filterAlphaOnly, 0),
+    MakeSetting(L"Settings", L"AlwaysOnTop", &g_alwaysOnTop, 0),
+    WithRange(MakeSetting(L"Settings", L"TransparencyMode", &g_transparencyMode, 0), SettingRange::Reject, 0, 2),
+    WithKind(MakeSetting(L"Settings", L"TransparencyColor", &g_customColor, 0), SettingKind::Color),
+    WithRange(MakeSetting(L"Window", L"PositionMode", &g_windowPositionMode, 0), SettingRange::Reject, 0, 2),
+    MakeSetting(L"Window", L"CustomX", &g_customWindowPos.x, 0),
+    MakeSetting(L"Window", L"CustomY", &g_customWindowPos.y, 0),
+    WithMarkdownName(MakeSetting(L"Text", L"FontName", &g_textFontName, 0), L"font"),
+    LoadOnly(WithRange(MakeSetting(L"Text", L"FontSize", &g_textFontSize, 18), SettingRange::Clamp, 8, kSettingNoLimit)),
+    WithMarkdownName(WithKind(MakeSetting(L"Text", L"FontColor", &g_textColor, 15790320), SettingKind::Color), L"fontcolor"),
+    WithMarkdownName(WithKind(MakeSetting(L"Text", L"BackgroundColor", &g_textBackground, 1315860), SettingKind::Color), L"background"),
+    WithMarkdownName(MakeSetting(L"Text", L"Wrap", &g_textWrap, 1), L"wrap"),
+    MakeSetting(L"Text", L"Follow", &g_textFollow, 0),
+    WithRange(MakeSetting(L"Text", L"Width", &g_textWindowWidth, 800), SettingRange::Clamp, 200, kSettingNoLimit),
+    WithRange(MakeSetting(L"Text", L"Height", &g_textWindowHeight, 600), SettingRange::Clamp, 200, kSettingNoLimit),
+    WithRange(MakeSetting(L"KeyConfig", L"NextFile", &g_keyNextFile, 'J'), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"PrevFile", &g_keyPrevFile, 'K'), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"ZoomIn", &g_keyZoomIn, VK_OEM_PLUS), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"ZoomOut", &g_keyZoomOut, VK_OEM_MINUS), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"OriginalSize", &g_keyOriginalSize, '0'), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"OpenFile", &g_keyOpenFile, 'O'), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"Exit", &g_keyExit, VK_ESCAPE), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"AlwaysOnTop", &g_keyAlwaysOnTop, 'P'), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"Minimize", &g_keyMinimize, 'M'), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"Reload", &g_keyReload, 'R'), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"ScrollUp", &g_keyScrollUp, VK_UP), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"ScrollDown", &g_keyScrollDown, VK_DOWN), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"ScrollLeft", &g_keyScrollLeft, VK_LEFT), SettingRange::Reject, 1, 0xFE),
+    WithRange(MakeSetting(L"KeyConfig", L"ScrollRight", &g_keyScrollRight, VK_RIGHT), SettingRange::Reject, 1, 0xFE)
+};
+
+constexpr auto kSettingIniTable = BuildSettingHashTable<std::bit_ceil(kSettingFields.size() * 4)>(kSettingFields, false);
+constexpr auto kSettingMarkdownTable = BuildSettingHashTable<16>(kSettingFields, true);
+static_assert(kSettingIniTable.seed != 0 && kSettingMarkdownTable.seed != 0, "no collision-free seed for the settings schema");
 
 // =====================
 // 前方宣言
@@ -390,21 +809,102 @@ void Render(HWND hwnd);
 bool InitDirect2D(HWND hwnd);
 bool InitWIC();
 bool InitDirectWrite();
+bool EnsureDirectWrite();
 bool LoadImageFromFile(const wchar_t* path);
+bool LoadImageFromMemory(const BYTE* data, size_t size);
+bool LoadImageFromSource(const wchar_t* path, const BYTE* data, size_t size);
+HRESULT CreateDecoderFromMemory(IWICImagingFactory* factory, const BYTE* data, size_t size, IWICStream** stream, IWICBitmapDecoder** decoder);
 bool LoadTextFromFile(const wchar_t* path);
 void NavigateImage(int delta);
 void CleanupResources();
 void DiscardRenderTarget();
 void RefreshImageList(const std::filesystem::path& imagePath);
+std::wstring FoldCatalogName(const std::filesystem::path& name);
+std::wstring GetCatalogName(const std::filesystem::path& path);
+void BuildCatalogSortKey(const ImageEntry& entry, uint64_t& primary, std::wstring& name);
+size_t FindCatalogEntry(const std::filesystem::path& path);
+uint32_t RemoveCatalogEntry(const std::wstring& name);
+void UpdateCatalogFile(const std::wstring& name, uint32_t id);
+void BuildCatalogSortKeys(size_t first, size_t last);
+void ResortCatalog();
+void PermuteCatalog(const std::vector<uint32_t>& permutation);
+void MergeCatalogBatch(std::vector<ImageEntry>& batch);
+uint32_t AllocateCatalogId();
+void ClearCatalogEntries();
+void ResetCatalog(const std::filesystem::path& dir);
+uint32_t BeginCatalogScan();
+void StartCatalogScan(const std::filesystem::path& dir);
+void StopCatalogScan();
+void PostCatalogBatch(std::vector<ImageEntry>& batch, uint32_t generation, bool finished, bool replace);
+void ScanCatalogDirectory(std::filesystem::path dir, bool imageOnly, uint32_t generation);
+void MergeCatalogScanResults();
+void WatchCatalogDirectory(std::wstring directory, HANDLE stopEvent);
+void StopCatalogWatcher();
+void StartCatalogWatcher(const std::filesystem::path& dir);
+bool IsArchiveFile(const std::filesystem::path& path);
+bool MapZipRange(const ZipArchive& archive, uint64_t offset, uint64_t length, ZipMemberData& range);
+void ReleaseZipMemberData(ZipMemberData& data);
+void CloseZipArchive(ZipArchive& archive);
+bool DecodeZipName(std::string_view raw, bool utf8, std::wstring& name);
+bool OpenZipArchive(const wchar_t* path, ZipArchive& archive);
+bool ReadZipMember(const ZipArchive& archive, const ZipMember& member, ZipMemberData& data);
+std::filesystem::file_time_type ConvertDosTimeToFileTime(uint16_t dosDate, uint16_t dosTime);
+bool OpenArchiveCatalog(const std::filesystem::path& archivePath);
+bool IsArchiveCatalogPath(const std::filesystem::path& path);
+void PrefetchArchiveMembers(std::shared_ptr<ZipArchive> archive, std::vector<uint32_t> members);
+void WaitArchivePrefetch();
+void StopArchivePrefetch();
+void StartArchivePrefetch(size_t index);
+bool LoadArchiveImage(size_t index);
+void ApplyDirectoryChanges();
+uint64_t GetFileTimeTicks(const FILETIME& time);
+std::wstring JoinPlaylistPath(const std::wstring& directory, const std::wstring& name);
+std::filesystem::path GetSettingsSidePath(const wchar_t* extension);
+bool WriteFileAtomically(const std::filesystem::path& path, const void* data, size_t size);
+bool SavePlaylistIndex(const PlaylistIndex& index);
+bool LoadPlaylistIndex(PlaylistIndex& index);
+bool ListPlaylistDirectory(PlaylistDirectory& directory);
+void AppendPlaylistEntries(const PlaylistDirectory& directory, bool imageOnly, std::vector<ImageEntry>& entries);
+void ScanPlaylist(std::vector<std::wstring> roots, bool imageOnly, uint32_t generation, std::shared_ptr<const PlaylistIndex> index, bool replace);
+bool SamePlaylistRoots(const std::vector<std::wstring>& a, const std::vector<std::filesystem::path>& b);
+void StartPlaylistScan(const std::vector<std::filesystem::path>& roots);
+bool OpenPlaylist(const std::vector<std::filesystem::path>& folders);
+uint64_t ReadExifDateTaken(IWICBitmapFrameDecode* frame);
+ImageMetadata ProbeImageMetadata(IWICImagingFactory* factory, const ZipArchive* archive, const ImageEntry& entry);
+uint64_t GetMetadataCacheKey(const ImageEntry& entry);
+void LoadMetadataCache();
+bool SaveMetadataCache();
+bool FindCachedMetadata(const ImageEntry& entry, ImageMetadata& metadata);
+void StoreCachedMetadata(const ImageEntry& entry, const ImageMetadata& metadata);
+void SetCatalogMetadata(uint32_t id, const ImageMetadata& metadata);
+bool LoadCatalogMetadataFromCache(const ImageEntry& entry);
+bool PassesCatalogFilter(const ImageEntry& entry);
+bool IsCatalogFilterPending(const ImageEntry& entry);
+void IndexCatalogMetadata(std::vector<ImageEntry> jobs, std::shared_ptr<ZipArchive> archive, uint32_t generation);
+void StartMetadataIndexer();
+void StopMetadataIndexer();
+void MergeCatalogMetadata();
+void BuildFontCatalog(IDWriteFactory* factory, bool checkForUpdates);
+void StartFontCatalog();
+void StopFontCatalog();
+void InvalidateFontCatalog();
+std::shared_ptr<const FontCatalogIndex> GetFontCatalogIndex(bool wait);
+ResolvedFontInfo ResolveFontInfo(IDWriteFactory* factory, const std::wstring& name);
+void BeginStartupTrace();
+void MarkStartupPhase(const wchar_t* name);
+void ReportStartupTrace();
+void WarmUpStartupImage(std::filesystem::path path);
 bool LoadImageByIndex(size_t index);
 void SetFitToWindow(bool fit);
 void AdjustZoom(float factor, const POINT& screenPoint);
 bool ShowOpenImageDialog(HWND hwnd);
+bool ShowOpenFolderDialog(HWND hwnd);
 void UpdateWindowSizeToImage(HWND hwnd, float drawWidth, float drawHeight);
 void UpdateFitZoomFromWindow(HWND hwnd);
 void UpdateWindowToZoomedImage();
 void UpdateZoomToFitScreen(HWND hwnd);
 void LoadSettings();
+void ApplyStoredSettings();
 void SaveSettings();
 void ApplyAlwaysOnTop();
 void LoadWindowPlacement();
@@ -414,12 +914,17 @@ POINT CalculateCenteredWindowPosition(HWND hwnd);
 void ApplyWindowPositionModeAfterContentLoad(HWND hwnd);
 void UpdateLayeredStyle(bool enable);
 bool UpdateLayeredWindowFromWic(HWND hwnd, float drawWidth, float drawHeight);
-bool QueryPixelFormatHasAlpha(const WICPixelFormatGUID& format);
+void ReleaseLayeredSurfaceCache();
+bool EnsureCheckerPatternBrush();
+bool QueryPixelFormatHasAlpha(IWICImagingFactory* factory, const WICPixelFormatGUID& format);
 bool ImageHasTransparency(IWICBitmapSource* source);
 void StopAnimationPlayback();
 void ClearAnimationFrames();
 bool SetCurrentAnimationFrame(size_t frameIndex);
-UINT GetAnimationFrameDelayMs(size_t frameIndex);
+bool IsAnimationWindowShown(HWND hwnd);
+bool IsAnimationWindowUncovered(HWND hwnd);
+void StartAnimationPlayback();
+void UpdateAnimationPlayback();
 bool TryGetMetadataUInt32(IWICMetadataQueryReader* reader, const wchar_t* key, UINT32& value);
 UINT ExtractFrameDelayMs(IWICBitmapFrameDecode* frame);
 void ApplyTransparencyMode();
@@ -429,26 +934,70 @@ void UpdateTextFormat();
 void UpdateTextBrush();
 void ResizeWindowByFactor(HWND hwnd, float factor);
 void ScrollTextBy(float delta);
+TextFileIdentity GetTextFileIdentity(const BY_HANDLE_FILE_INFORMATION& info);
+bool OpenTextDocument(const wchar_t* path);
+void CloseTextDocument();
+void IndexTextDocument(uint64_t begin, uint64_t end);
+const char* MapTextRange(uint64_t offset, size_t length);
+uint64_t GetTextDocumentLineCount();
+bool ReadTextLine(uint64_t line, std::wstring& text);
+IDWriteTextLayout* CreateTextLineLayout(uint64_t line, float maxWidth);
+float RememberTextLineHeight(uint64_t line, float maxWidth, IDWriteTextLayout* layout);
+float MeasureTextLineHeight(uint64_t line, float maxWidth);
+bool HandleTextViewKeyDown(WPARAM wParam);
+void ReleaseTextMapping();
+void ScrollTextToEnd();
+void ApplyPendingTextScrollToEnd();
+bool IsTextViewAtBottom();
+void WatchTextFileDirectory(std::wstring directory, HANDLE stopEvent);
+void StopTextFileWatcher();
+void UpdateTextFollowWatcher();
+void RefreshFollowedTextDocument();
 void ApplyDocumentWindowSize(HWND hwnd);
 bool LoadHtmlFromFile(const wchar_t* path);
 bool LoadMarkdownFromFile(const wchar_t* path);
-std::wstring InjectHtmlBaseStyles(const std::wstring& html);
-bool ReadFileBytes(const wchar_t* path, std::string& bytes);
-bool ReadFileBytesRaw(const wchar_t* path, std::string& bytes);
-bool Utf8ToWide(const std::string& bytes, std::wstring& text);
-bool WideToUtf8(const std::wstring& text, std::string& bytes);
-std::wstring TrimString(const std::wstring& value);
-bool ApplyHtmlContent(std::wstring html);
-bool RenderMarkdownToHtml(const std::string& markdown, std::string& html);
+std::string InjectHtmlBaseStyles(std::string_view html);
+bool ReadDocumentBuffer(const wchar_t* path, DocumentBuffer& document);
+bool DecodeIniText(const DocumentBuffer& document, std::wstring& content);
+bool AnsiToWide(std::string_view bytes, std::wstring& text);
+bool GetSettingsFileStamp(const std::filesystem::path& path, uint64_t& writeTime, uint64_t& size);
+void LoadSettingsStore(const std::filesystem::path& path);
+bool TryGetSetting(const std::wstring& section, const std::wstring& key, std::wstring& value);
+void StoreSettingsChange(SettingsChange change);
+void SetSetting(const std::wstring& section, const std::wstring& key, const std::wstring& value);
+void SetSettingInt(const std::wstring& section, const std::wstring& key, int value);
+void RemoveSetting(const std::wstring& section, const std::wstring& key);
+bool FlushSettingsStore();
+const SettingField* FindSettingField(std::wstring_view name, bool markdown);
+void AssignSettingNumber(const SettingField& field, double value);
+void ApplySettingValue(const SettingField& field, const std::wstring& value);
+void ApplyMarkdownSettingValue(const SettingField& field, const std::wstring& value);
+std::wstring FormatSettingValue(const SettingField& field);
+void LoadSchemaSettings();
+void SaveSchemaSettings();
+bool ApplyHtmlContent(std::string html, std::vector<size_t> blockBounds);
+bool RenderMarkdownToHtml(std::string_view markdown, MarkdownPage& page);
+uint64_t ComputeMarkdownStyleKey();
+bool ApplyMarkdownPage(const wchar_t* path, uint64_t styleKey, const std::shared_ptr<const MarkdownPage>& page);
+void ForgetLiveMarkdownPage();
+bool PatchLiveMarkdownPage(const wchar_t* path, std::string_view markdown, uint64_t styleKey, uint64_t cacheKey);
 void UpdateWebViewInputTimer();
 WORD GetHtmlInputVirtualKey();
 void UpdateWebViewInputState();
 bool ExecuteWebViewScript(const wchar_t* script);
 bool BuildFileUrlFromPath(const std::wstring& path, std::wstring& url);
 bool EnsureWebViewTempHtmlTarget();
-bool WriteHtmlToTempFile(const std::wstring& html, std::wstring& path);
-bool NavigateWebViewHtml(const std::wstring& html);
+bool WriteHtmlToTempFile(std::string_view html, std::wstring& path);
+bool NavigateWebViewHtml(const std::string& html);
+bool NavigatePendingHtml();
+void CancelProgressiveHtml();
+void SendNextProgressiveHtmlBatch();
+void HandleProgressiveHtmlNavigationStarting(ICoreWebView2NavigationStartingEventArgs* args);
+void HandleProgressiveHtmlNavigationCompleted(ICoreWebView2NavigationCompletedEventArgs* args);
+void AppendJsStringLiteral(std::wstring& script, const std::wstring& text);
 bool HandleHtmlOverlayKeyDown(WPARAM wParam);
+bool JumpToAdjacentHeading(int direction);
+bool JumpToMarkdownHeading(const MarkdownPage& page, size_t index);
 bool HandleHtmlOverlayShortcutKeyDown(WORD key);
 bool GetWebViewZoomFactor(double& factor);
 bool SetWebViewZoomFactor(double factor);
@@ -460,6 +1009,7 @@ void CloseWebView();
 void RefreshMenuTheme();
 void ReloadCurrentFile(bool reloadSettings);
 void ShowAboutDialog(HWND hwnd);
+void ShowMarkdownOutlineDialog(HWND hwnd);
 bool IsDarkModeEnabled();
 void ApplyImmersiveDarkMode(HWND target, bool enabled);
 static void ApplyExplorerTheme(HWND target);
@@ -630,993 +1180,4160 @@ void ShowAboutDialog(HWND hwnd)
     );
 }
 
-bool IsImageFile(const std::filesystem::path& path)
+constexpr int kIdOutlineFilter = 2301;
+constexpr int kIdOutlineList = 2302;
+
+struct OutlineDialogState
 {
-    if (!path.has_extension())
+    std::shared_ptr<const MarkdownPage> page;
+    std::vector<std::wstring> labels;
+    std::vector<std::wstring> foldedLabels;
+    std::vector<size_t> visible;
+    size_t selectedHeading = 0;
+    HBRUSH dialogBrush = nullptr;
+    HBRUSH controlBrush = nullptr;
+    COLORREF dialogBackgroundColor = RGB(255, 255, 255);
+    COLORREF dialogTextColor = RGB(0, 0, 0);
+    COLORREF controlBackgroundColor = RGB(255, 255, 255);
+};
+
+void FillMarkdownOutlineList(HWND dlg, OutlineDialogState& state)
+{
+    wchar_t filter[256]{};
+    int filterLength = GetDlgItemTextW(dlg, kIdOutlineFilter, filter, static_cast<int>(std::size(filter)));
+    if (filterLength > 0)
     {
-        return false;
+        CharLowerBuffW(filter, static_cast<DWORD>(filterLength));
     }
-    std::wstring ext = path.extension().wstring();
-    std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
-    return ext == L".png" || ext == L".jpg" || ext == L".jpeg" || ext == L".bmp"
-        || ext == L".gif" || ext == L".tif" || ext == L".tiff" || ext == L".webp";
-}
 
-bool IsTextFile(const std::filesystem::path& path)
-{
-    if (!path.has_extension())
+    HWND list = GetDlgItem(dlg, kIdOutlineList);
+    SendMessageW(list, WM_SETREDRAW, FALSE, 0);
+    SendMessageW(list, LB_RESETCONTENT, 0, 0);
+    state.visible.clear();
+    for (size_t i = 0; i < state.labels.size(); ++i)
     {
-        return false;
+        if (filterLength > 0 && state.foldedLabels[i].find(filter) == std::wstring::npos)
+        {
+            continue;
+        }
+        SendMessageW(list, LB_ADDSTRING, 0, reinterpret_cast<LPARAM>(state.labels[i].c_str()));
+        state.visible.push_back(i);
     }
-    std::wstring ext = path.extension().wstring();
-    std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
-    return ext == L".txt";
+    SendMessageW(list, LB_SETCURSEL, 0, 0);
+    SendMessageW(list, WM_SETREDRAW, TRUE, 0);
+    InvalidateRect(list, nullptr, TRUE);
 }
 
-bool IsHtmlFile(const std::filesystem::path& path)
+// Arrow and page keys typed in the filter box move the list selection instead.
+static LRESULT CALLBACK OutlineFilterSubclassProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam, UINT_PTR, DWORD_PTR refData)
 {
-    if (!path.has_extension())
+    if (msg == WM_KEYDOWN && (wParam == VK_UP || wParam == VK_DOWN || wParam == VK_PRIOR || wParam == VK_NEXT))
     {
-        return false;
+        SendMessageW(reinterpret_cast<HWND>(refData), msg, wParam, lParam);
+        return 0;
     }
-    std::wstring ext = path.extension().wstring();
-    std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
-    return ext == L".html" || ext == L".htm";
+    if (msg == WM_NCDESTROY)
+    {
+        RemoveWindowSubclass(hwnd, OutlineFilterSubclassProc, 0);
+    }
+    return DefSubclassProc(hwnd, msg, wParam, lParam);
 }
 
-bool IsMarkdownFile(const std::filesystem::path& path)
+void ShowMarkdownOutlineDialog(HWND hwnd)
 {
-    if (!path.has_extension())
+    std::shared_ptr<const MarkdownPage> page = g_liveMarkdownPage;
+    if (!page || page->headings.empty() || !g_hasHtml || !g_webview)
     {
-        return false;
+        return;
     }
-    std::wstring ext = path.extension().wstring();
-    std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
-    return ext == L".md" || ext == L".markdown";
-}
 
-bool IsSupportedFile(const std::filesystem::path& path)
-{
-    return IsImageFile(path) || IsTextFile(path) || IsHtmlFile(path) || IsMarkdownFile(path);
-}
+    auto alignDword = [](std::vector<BYTE>& buffer)
+    {
+        while (buffer.size() % 4 != 0)
+        {
+            buffer.push_back(0);
+        }
+    };
 
-void SortImageList()
-{
-    auto compareNameAsc = [](const ImageEntry& a, const ImageEntry& b)
+    auto appendWord = [](std::vector<BYTE>& buffer, WORD value)
     {
-        return a.path.filename().wstring() < b.path.filename().wstring();
+        buffer.push_back(static_cast<BYTE>(value & 0xFF));
+        buffer.push_back(static_cast<BYTE>((value >> 8) & 0xFF));
     };
-    auto compareNameDesc = [&](const ImageEntry& a, const ImageEntry& b)
+
+    auto appendDword = [&](std::vector<BYTE>& buffer, DWORD value)
     {
-        return compareNameAsc(b, a);
+        appendWord(buffer, static_cast<WORD>(value & 0xFFFF));
+        appendWord(buffer, static_cast<WORD>((value >> 16) & 0xFFFF));
     };
-    auto compareTimeAsc = [](const ImageEntry& a, const ImageEntry& b)
+
+    auto appendString = [&](std::vector<BYTE>& buffer, const wchar_t* text)
     {
-        if (a.writeTime == b.writeTime)
+        while (*text)
         {
-            return a.path.filename().wstring() < b.path.filename().wstring();
+            appendWord(buffer, static_cast<WORD>(*text));
+            ++text;
         }
-        return a.writeTime < b.writeTime;
+        appendWord(buffer, 0);
     };
-    auto compareTimeDesc = [&](const ImageEntry& a, const ImageEntry& b)
+
+    auto addControl = [&](std::vector<BYTE>& buffer, DWORD style, short x, short y, short cx, short cy, WORD id, WORD classAtom, const wchar_t* text)
     {
-        return compareTimeAsc(b, a);
+        alignDword(buffer);
+        appendDword(buffer, style);
+        appendDword(buffer, 0);
+        appendWord(buffer, static_cast<WORD>(x));
+        appendWord(buffer, static_cast<WORD>(y));
+        appendWord(buffer, static_cast<WORD>(cx));
+        appendWord(buffer, static_cast<WORD>(cy));
+        appendWord(buffer, id);
+        appendWord(buffer, 0xFFFF);
+        appendWord(buffer, classAtom);
+        appendString(buffer, text);
+        appendWord(buffer, 0);
     };
 
-    switch (g_sortMode)
-    {
-    case SortMode::NameAsc:
-        std::sort(g_imageList.begin(), g_imageList.end(), compareNameAsc);
-        break;
-    case SortMode::NameDesc:
-        std::sort(g_imageList.begin(), g_imageList.end(), compareNameDesc);
-        break;
-    case SortMode::TimeAsc:
-        std::sort(g_imageList.begin(), g_imageList.end(), compareTimeAsc);
-        break;
-    case SortMode::TimeDesc:
-        std::sort(g_imageList.begin(), g_imageList.end(), compareTimeDesc);
-        break;
-    }
-}
+    std::vector<BYTE> tmpl;
+    tmpl.reserve(512);
 
-// =====================
-// ウィンドウプロシージャ
-// =====================
-LRESULT CALLBACK WndProc(
-    HWND hwnd,
-    UINT msg,
-    WPARAM wParam,
-    LPARAM lParam
-)
-{
-    switch (msg)
-    {
-    case WM_PAINT:
-    {
-        PAINTSTRUCT ps;
-        BeginPaint(hwnd, &ps);
-        Render(hwnd);
-        EndPaint(hwnd, &ps);
-        return 0;
-    }
+    DWORD dialogStyle = WS_POPUP | WS_CAPTION | WS_SYSMENU | DS_MODALFRAME | DS_SETFONT | DS_SHELLFONT | DS_CENTER;
+    appendDword(tmpl, dialogStyle);
+    appendDword(tmpl, 0);
+    appendWord(tmpl, 4);
+    appendWord(tmpl, 0);
+    appendWord(tmpl, 0);
+    appendWord(tmpl, 260);
+    appendWord(tmpl, 226);
+    appendWord(tmpl, 0);
+    appendWord(tmpl, 0);
+    appendString(tmpl, L"Outline");
+    appendWord(tmpl, 9);
+    appendString(tmpl, L"Segoe UI");
 
-    case WM_SIZE:
+    addControl(tmpl, WS_CHILD | WS_VISIBLE | WS_TABSTOP | WS_BORDER | ES_AUTOHSCROLL, 8, 8, 244, 14, kIdOutlineFilter, 0x0081, L"");
+    addControl(tmpl, WS_CHILD | WS_VISIBLE | WS_TABSTOP | WS_BORDER | WS_VSCROLL | LBS_NOTIFY | LBS_NOINTEGRALHEIGHT,
+        8, 28, 244, 170, kIdOutlineList, 0x0083, L"");
+    addControl(tmpl, WS_CHILD | WS_VISIBLE | WS_TABSTOP | BS_DEFPUSHBUTTON, 144, 204, 52, 16, IDOK, 0x0080, L"Go");
+    addControl(tmpl, WS_CHILD | WS_VISIBLE | WS_TABSTOP | BS_PUSHBUTTON, 200, 204, 52, 16, IDCANCEL, 0x0080, L"Cancel");
+
+    OutlineDialogState state;
+    state.page = page;
+    state.labels.reserve(page->headings.size());
+    state.foldedLabels.reserve(page->headings.size());
+    for (const MarkdownHeading& heading : page->headings)
     {
-        if (g_webviewController)
-        {
-            UpdateWebViewBounds();
-        }
-        if (g_renderTarget)
-        {
-            UINT w = LOWORD(lParam);
-            UINT h = HIWORD(lParam);
-            g_renderTarget->Resize(D2D1::SizeU(w, h));
-        }
-        if (g_fitToWindow)
+        std::wstring text;
+        Utf8ToWide(heading.text, text);
+        std::wstring label(static_cast<size_t>((heading.level - 1) * 4), L' ');
+        label += text;
+        std::wstring folded = text;
+        if (!folded.empty())
         {
-            UpdateFitZoomFromWindow(hwnd);
-            InvalidateRect(hwnd, nullptr, TRUE);
+            CharLowerBuffW(folded.data(), static_cast<DWORD>(folded.size()));
         }
-        return 0;
+        state.labels.push_back(std::move(label));
+        state.foldedLabels.push_back(std::move(folded));
     }
 
-    case WM_DROPFILES:
+    auto dialogProc = [](HWND dlg, UINT msg, WPARAM wParam, LPARAM lParam) -> INT_PTR
     {
-        HDROP drop = reinterpret_cast<HDROP>(wParam);
-        UINT fileCount = DragQueryFileW(drop, 0xFFFFFFFF, nullptr, 0);
-        if (fileCount > 0)
+        auto* dialogState = reinterpret_cast<OutlineDialogState*>(GetWindowLongPtr(dlg, GWLP_USERDATA));
+        switch (msg)
         {
-            // 複数ファイルは先頭のみ読み込む（必要なら後で拡張）
-            UINT pathLength = DragQueryFileW(drop, 0, nullptr, 0);
-            if (pathLength > 0)
-            {
-                std::wstring path(pathLength + 1, L'\0');
-                DragQueryFileW(drop, 0, path.data(), pathLength + 1);
-                path.resize(pathLength);
-                if (IsMarkdownFile(path))
+        case WM_INITDIALOG:
+        {
+            dialogState = reinterpret_cast<OutlineDialogState*>(lParam);
+            SetWindowLongPtr(dlg, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(dialogState));
+
+            bool darkMode = IsDarkModeEnabled();
+            dialogState->dialogBackgroundColor = darkMode ? RGB(32, 32, 32) : RGB(255, 255, 255);
+            dialogState->dialogTextColor = darkMode ? RGB(240, 240, 240) : RGB(0, 0, 0);
+            dialogState->controlBackgroundColor = darkMode ? RGB(48, 48, 48) : RGB(255, 255, 255);
+            dialogState->dialogBrush = CreateSolidBrush(dialogState->dialogBackgroundColor);
+            dialogState->controlBrush = CreateSolidBrush(dialogState->controlBackgroundColor);
+
+            const wchar_t* themeName = darkMode ? L"DarkMode_Explorer" : L"Explorer";
+            ApplyImmersiveDarkMode(dlg, darkMode);
+            SetWindowTheme(dlg, themeName, nullptr);
+            EnumChildWindows(
+                dlg,
+                [](HWND child, LPARAM param) -> BOOL
                 {
-                    if (LoadMarkdownFromFile(path.c_str()))
-                    {
-                        RefreshImageList(path);
-                        ApplyWindowPositionModeAfterContentLoad(hwnd);
-                        InvalidateRect(hwnd, nullptr, TRUE);
-                    }
+                    const auto* themeName = reinterpret_cast<const wchar_t*>(param);
+                    SetWindowTheme(child, themeName, nullptr);
+                    return TRUE;
+                },
+                reinterpret_cast<LPARAM>(themeName)
+            );
+
+            SetWindowSubclass(GetDlgItem(dlg, kIdOutlineFilter), OutlineFilterSubclassProc, 0,
+                reinterpret_cast<DWORD_PTR>(GetDlgItem(dlg, kIdOutlineList)));
+            FillMarkdownOutlineList(dlg, *dialogState);
+            SetFocus(GetDlgItem(dlg, kIdOutlineFilter));
+            return FALSE;
+        }
+        case WM_COMMAND:
+        {
+            switch (LOWORD(wParam))
+            {
+            case kIdOutlineFilter:
+                if (HIWORD(wParam) == EN_CHANGE && dialogState)
+                {
+                    FillMarkdownOutlineList(dlg, *dialogState);
                 }
-                else if (IsHtmlFile(path))
+                return TRUE;
+            case kIdOutlineList:
+                if (HIWORD(wParam) == LBN_DBLCLK)
                 {
-                    if (LoadHtmlFromFile(path.c_str()))
-                    {
-                        RefreshImageList(path);
-                        ApplyWindowPositionModeAfterContentLoad(hwnd);
-                        InvalidateRect(hwnd, nullptr, TRUE);
-                    }
+                    SendMessageW(dlg, WM_COMMAND, IDOK, 0);
                 }
-                else if (IsTextFile(path))
+                return TRUE;
+            case IDOK:
+            {
+                LRESULT selection = SendDlgItemMessageW(dlg, kIdOutlineList, LB_GETCURSEL, 0, 0);
+                if (!dialogState || selection == LB_ERR || static_cast<size_t>(selection) >= dialogState->visible.size())
                 {
-                    if (LoadTextFromFile(path.c_str()))
-                    {
-                        RefreshImageList(path);
-                        ApplyWindowPositionModeAfterContentLoad(hwnd);
-                        InvalidateRect(hwnd, nullptr, TRUE);
-                    }
+                    return TRUE;
                 }
-                else if (LoadImageFromFile(path.c_str()))
+                dialogState->selectedHeading = dialogState->visible[static_cast<size_t>(selection)];
+                EndDialog(dlg, IDOK);
+                return TRUE;
+            }
+            case IDCANCEL:
+                EndDialog(dlg, IDCANCEL);
+                return TRUE;
+            }
+            break;
+        }
+        case WM_CTLCOLORDLG:
+        case WM_CTLCOLORSTATIC:
+        case WM_CTLCOLORBTN:
+        {
+            if (!dialogState)
+            {
+                break;
+            }
+            HDC hdc = reinterpret_cast<HDC>(wParam);
+            SetTextColor(hdc, dialogState->dialogTextColor);
+            SetBkColor(hdc, dialogState->dialogBackgroundColor);
+            SetBkMode(hdc, TRANSPARENT);
+            return reinterpret_cast<INT_PTR>(dialogState->dialogBrush);
+        }
+        case WM_CTLCOLOREDIT:
+        case WM_CTLCOLORLISTBOX:
+        {
+            if (!dialogState)
+            {
+                break;
+            }
+            HDC hdc = reinterpret_cast<HDC>(wParam);
+            SetTextColor(hdc, dialogState->dialogTextColor);
+            SetBkColor(hdc, dialogState->controlBackgroundColor);
+            SetBkMode(hdc, OPAQUE);
+            return reinterpret_cast<INT_PTR>(dialogState->controlBrush);
+        }
+        case WM_DESTROY:
+            if (dialogState)
+            {
+                if (dialogState->dialogBrush)
                 {
-                    RefreshImageList(path);
-                    UpdateZoomToFitScreen(hwnd);
-                    ApplyWindowPositionModeAfterContentLoad(hwnd);
-                    InvalidateRect(hwnd, nullptr, TRUE);
+                    DeleteObject(dialogState->dialogBrush);
+                    dialogState->dialogBrush = nullptr;
+                }
+                if (dialogState->controlBrush)
+                {
+                    DeleteObject(dialogState->controlBrush);
+                    dialogState->controlBrush = nullptr;
                 }
             }
+            break;
         }
-        DragFinish(drop);
-        return 0;
+        return FALSE;
+    };
+
+    INT_PTR result = DialogBoxIndirectParamW(
+        GetModuleHandle(nullptr),
+        reinterpret_cast<DLGTEMPLATE*>(tmpl.data()),
+        hwnd,
+        dialogProc,
+        reinterpret_cast<LPARAM>(&state)
+    );
+    if (result == IDOK && page == g_liveMarkdownPage)
+    {
+        JumpToMarkdownHeading(*page, state.selectedHeading);
     }
+}
 
-    case WM_CONTEXTMENU:
+bool IsImageFile(const std::filesystem::path& path)
+{
+    if (!path.has_extension())
     {
-        HMENU menu = CreatePopupMenu();
-        AppendMenu(menu, MF_STRING, kMenuOpen, L"Open...");
-        AppendMenu(menu, MF_STRING, kMenuReload, L"Reload");
-        AppendMenu(menu, MF_STRING, kMenuMinimize, L"Minimize");
-        AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
-        AppendMenu(menu, MF_STRING, kMenuPrev, L"Previous");
-        AppendMenu(menu, MF_STRING, kMenuNext, L"Next");
-        AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
-        AppendMenu(menu, MF_STRING, kMenuZoomIn, L"Zoom In");
-        AppendMenu(menu, MF_STRING, kMenuZoomOut, L"Zoom Out");
-        AppendMenu(menu, MF_STRING, kMenuOriginalSize, L"Original Size");
-        AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
-        AppendMenu(menu, MF_STRING, kMenuAlwaysOnTop, L"Always on Top");
-        AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
-        AppendMenu(menu, MF_STRING, kMenuSortNameAsc, L"Sort: Name (A-Z)");
-        AppendMenu(menu, MF_STRING, kMenuSortNameDesc, L"Sort: Name (Z-A)");
-        AppendMenu(menu, MF_STRING, kMenuSortTimeAsc, L"Sort: Modified (Old-New)");
-        AppendMenu(menu, MF_STRING, kMenuSortTimeDesc, L"Sort: Modified (New-Old)");
-        AppendMenu(menu, MF_STRING, kMenuSortImageOnly, L"Sort: Image only");
-        AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
-        AppendMenu(menu, MF_STRING, kMenuSettings, L"Settings");
-        AppendMenu(menu, MF_STRING, kMenuAbout, L"About");
-        AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
-        AppendMenu(menu, MF_STRING, kMenuExit, L"Exit");
+        return false;
+    }
+    std::wstring ext = path.extension().wstring();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
+    return ext == L".png" || ext == L".jpg" || ext == L".jpeg" || ext == L".bmp"
+        || ext == L".gif" || ext == L".tif" || ext == L".tiff" || ext == L".webp";
+}
 
-        if (g_imageList.size() < 2)
-        {
-            EnableMenuItem(menu, kMenuPrev, MF_BYCOMMAND | MF_GRAYED);
-            EnableMenuItem(menu, kMenuNext, MF_BYCOMMAND | MF_GRAYED);
-        }
+bool IsTextFile(const std::filesystem::path& path)
+{
+    if (!path.has_extension())
+    {
+        return false;
+    }
+    std::wstring ext = path.extension().wstring();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
+    return ext == L".txt";
+}
 
-        CheckMenuItem(menu, kMenuSortNameAsc, MF_BYCOMMAND | (g_sortMode == SortMode::NameAsc ? MF_CHECKED : MF_UNCHECKED));
-        CheckMenuItem(menu, kMenuSortNameDesc, MF_BYCOMMAND | (g_sortMode == SortMode::NameDesc ? MF_CHECKED : MF_UNCHECKED));
-        CheckMenuItem(menu, kMenuSortTimeAsc, MF_BYCOMMAND | (g_sortMode == SortMode::TimeAsc ? MF_CHECKED : MF_UNCHECKED));
-        CheckMenuItem(menu, kMenuSortTimeDesc, MF_BYCOMMAND | (g_sortMode == SortMode::TimeDesc ? MF_CHECKED : MF_UNCHECKED));
-        CheckMenuItem(menu, kMenuSortImageOnly, MF_BYCOMMAND | (g_sortImageOnly ? MF_CHECKED : MF_UNCHECKED));
-        CheckMenuItem(menu, kMenuAlwaysOnTop, MF_BYCOMMAND | (g_alwaysOnTop ? MF_CHECKED : MF_UNCHECKED));
+bool IsHtmlFile(const std::filesystem::path& path)
+{
+    if (!path.has_extension())
+    {
+        return false;
+    }
+    std::wstring ext = path.extension().wstring();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
+    return ext == L".html" || ext == L".htm";
+}
 
-        POINT pt{ GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
-        RefreshMenuTheme();
-        TrackPopupMenu(menu, TPM_RIGHTBUTTON, pt.x, pt.y, 0, hwnd, nullptr);
-        DestroyMenu(menu);
-        return 0;
+bool IsMarkdownFile(const std::filesystem::path& path)
+{
+    if (!path.has_extension())
+    {
+        return false;
     }
+    std::wstring ext = path.extension().wstring();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
+    return ext == L".md" || ext == L".markdown";
+}
 
-    case WM_COMMAND:
+bool IsArchiveFile(const std::filesystem::path& path)
+{
+    if (!path.has_extension())
     {
-        switch (LOWORD(wParam))
+        return false;
+    }
+    std::wstring ext = path.extension().wstring();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
+    return ext == L".zip" || ext == L".cbz";
+}
+
+bool IsSupportedFile(const std::filesystem::path& path)
+{
+    return IsImageFile(path) || IsTextFile(path) || IsHtmlFile(path) || IsMarkdownFile(path);
+}
+
+void FoldCaseText(std::wstring& text)
+{
+    if (!text.empty())
+    {
+        CharLowerBuffW(text.data(), static_cast<DWORD>(text.size()));
+    }
+}
+
+std::wstring FoldCatalogName(const std::filesystem::path& name)
+{
+    std::wstring folded = name.native();
+    FoldCaseText(folded);
+    return folded;
+}
+
+// The name the catalog knows path by: the file name in a folder, the member path in an archive
+// and the full path in a playlist.
+std::wstring GetCatalogName(const std::filesystem::path& path)
+{
+    if (!g_catalog.roots.empty())
+    {
+        return path.native();
+    }
+    if (IsArchiveCatalogPath(path))
+    {
+        return path.native().substr(g_catalog.directory.native().size() + 1);
+    }
+    return path.filename().native();
+}
+
+// The sort key of an entry under the catalog's sort mode: a number compared first, then a name.
+// Metadata orders never probe: files the indexer has not reached sort after the others by name,
+// and move into place when MergeCatalogMetadata re-sorts.
+void BuildCatalogSortKey(const ImageEntry& entry, uint64_t& primary, std::wstring& name)
+{
+    const CatalogMetadata& metadata = g_catalog.metadata;
+    switch (g_catalog.order.sortMode)
+    {
+    case SortMode::TimeAsc:
+    case SortMode::TimeDesc:
+        // Sign bit flipped so earlier times compare lower as unsigned.
+        primary = static_cast<uint64_t>(entry.writeTime.time_since_epoch().count()) ^ (1ull << 63);
+        name = GetCatalogName(entry.path);
+        break;
+    case SortMode::NaturalAsc:
+        primary = 0;
+        name = MakeNaturalSortKey(GetCatalogName(entry.path));
+        break;
+    case SortMode::SizeAsc:
+        primary = entry.size;
+        name = MakeNaturalSortKey(GetCatalogName(entry.path));
+        break;
+    case SortMode::DimensionsAsc:
+        primary = LoadCatalogMetadataFromCache(entry)
+            ? static_cast<uint64_t>(metadata.width[entry.id]) * metadata.height[entry.id]
+            : kCatalogSortKeyPending;
+        name = MakeNaturalSortKey(GetCatalogName(entry.path));
+        break;
+    case SortMode::DateTakenAsc:
+        if (LoadCatalogMetadataFromCache(entry))
         {
-        case kMenuOpen:
-            if (ShowOpenImageDialog(hwnd))
-            {
-                if (g_bitmap && !g_hasHtml)
-                {
-                    UpdateZoomToFitScreen(hwnd);
-                }
-                InvalidateRect(hwnd, nullptr, TRUE);
-            }
-            return 0;
-        case kMenuPrev:
-            NavigateImage(-1);
-            return 0;
-        case kMenuNext:
-            NavigateImage(1);
-            return 0;
-        case kMenuZoomIn:
+            // Files without an EXIF date fall back to their modified time.
+            primary = metadata.dateTaken[entry.id] != 0
+                ? metadata.dateTaken[entry.id]
+                : static_cast<uint64_t>(entry.writeTime.time_since_epoch().count());
+            primary ^= 1ull << 63;
+            primary = (std::min)(primary, kCatalogSortKeyPending - 1);
+        }
+        else
         {
-            if (g_hasHtml)
-            {
-                HandleHtmlOverlayShortcutKeyDown(g_keyZoomIn);
-                return 0;
-            }
-            POINT pt{};
-            GetCursorPos(&pt);
-            AdjustZoom(1.1f, pt);
-            InvalidateRect(hwnd, nullptr, TRUE);
-            return 0;
+            primary = kCatalogSortKeyPending;
         }
-        case kMenuZoomOut:
+        name = MakeNaturalSortKey(GetCatalogName(entry.path));
+        break;
+    case SortMode::NameAsc:
+    case SortMode::NameDesc:
+    default:
+        primary = 0;
+        name = GetCatalogName(entry.path);
+        break;
+    }
+}
+
+// Fills the key columns for entries [first, last); large ranges are keyed on all cores.
+void BuildCatalogSortKeys(size_t first, size_t last)
+{
+    DirectoryCatalog& catalog = g_catalog;
+    CatalogOrder& order = catalog.order;
+    order.sortPrimary.resize(catalog.entries.size());
+    order.sortNames.resize(catalog.entries.size());
+
+    size_t count = last - first;
+    size_t chunkCount = GetCatalogChunkCount(count, kCatalogSortChunkEntries);
+    RunCatalogChunks(chunkCount, [&](size_t chunk)
+    {
+        for (size_t i = first + count * chunk / chunkCount; i < first + count * (chunk + 1) / chunkCount; ++i)
         {
-            if (g_hasHtml)
-            {
-                HandleHtmlOverlayShortcutKeyDown(g_keyZoomOut);
-                return 0;
-            }
-            POINT pt{};
-            GetCursorPos(&pt);
-            AdjustZoom(1.0f / 1.1f, pt);
-            InvalidateRect(hwnd, nullptr, TRUE);
-            return 0;
+            BuildCatalogSortKey(catalog.entries[i], order.sortPrimary[i], order.sortNames[i]);
         }
-        case kMenuOriginalSize:
-            if (g_hasHtml)
-            {
-                HandleHtmlOverlayShortcutKeyDown(g_keyOriginalSize);
-                return 0;
-            }
-            g_fitToWindow = false;
-            g_zoom = 1.0f;
-            UpdateWindowToZoomedImage();
-            InvalidateRect(hwnd, nullptr, TRUE);
-            return 0;
-        case kMenuAlwaysOnTop:
-            g_alwaysOnTop = !g_alwaysOnTop;
-            ApplyAlwaysOnTop();
-            SaveSettings();
-            return 0;
-        case kMenuMinimize:
-            ShowWindow(hwnd, SW_MINIMIZE);
-            return 0;
-        case kMenuSettings:
-            ShowSettingsDialog(hwnd);
-            return 0;
-        case kMenuAbout:
-            ShowAboutDialog(hwnd);
-            return 0;
-        case kMenuReload:
-            ReloadCurrentFile(true);
-            return 0;
-        case kMenuExit:
-            DestroyWindow(hwnd);
-            return 0;
-        case kMenuSortNameAsc:
-            g_sortMode = SortMode::NameAsc;
-            if (!g_currentImagePath.empty())
+    });
+}
+
+// Moves entries and their keys into the given order at once.
+void PermuteCatalog(const std::vector<uint32_t>& permutation)
+{
+    DirectoryCatalog& catalog = g_catalog;
+    std::vector<ImageEntry> entries;
+    entries.reserve(permutation.size());
+    for (uint32_t index : permutation)
+    {
+        entries.push_back(std::move(catalog.entries[index]));
+    }
+    catalog.entries.swap(entries);
+    PermuteCatalogOrder(catalog.order, permutation);
+}
+
+// Keys are built once per entry into columns parallel to entries, an index permutation is sorted
+// over them and the entries are moved into place once.
+void SortImageList()
+{
+    DirectoryCatalog& catalog = g_catalog;
+    catalog.order.sortMode = g_sortMode;
+    BuildCatalogSortKeys(0, catalog.entries.size());
+    ResortCatalog();
+}
+
+// Sorts the catalog by the key columns as they stand.
+void ResortCatalog()
+{
+    PermuteCatalog(MakeCatalogPermutation(g_catalog.order, 0));
+}
+
+// Adds a batch of scanned files: names the catalog already lists (the opened file, or files the
+// watcher reported) are skipped, the rest are keyed, sorted among themselves and merged in.
+void MergeCatalogBatch(std::vector<ImageEntry>& batch)
+{
+    DirectoryCatalog& catalog = g_catalog;
+    CatalogOrder& order = catalog.order;
+    if (order.sortMode != g_sortMode)
+    {
+        SortImageList();
+    }
+    size_t previousCount = catalog.entries.size();
+    for (ImageEntry& entry : batch)
+    {
+        auto [it, inserted] = order.idByName.try_emplace(FoldCatalogName(GetCatalogName(entry.path)), catalog.nextId);
+        if (!inserted)
+        {
+            continue;
+        }
+        entry.id = AllocateCatalogId();
+        order.ids.push_back(entry.id);
+        catalog.entries.push_back(std::move(entry));
+    }
+    size_t count = catalog.entries.size();
+    if (count == previousCount)
+    {
+        return;
+    }
+
+    BuildCatalogSortKeys(previousCount, count);
+    PermuteCatalog(MakeCatalogPermutation(order, previousCount));
+}
+
+size_t FindCatalogEntry(const std::filesystem::path& path)
+{
+    return FindCatalogPosition(g_catalog.order, FoldCatalogName(GetCatalogName(path)));
+}
+
+// Removes the entry named name and returns its id, or 0 when the catalog does not list it.
+uint32_t RemoveCatalogEntry(const std::wstring& name)
+{
+    DirectoryCatalog& catalog = g_catalog;
+    uint32_t id = 0;
+    size_t position = RemoveCatalogPosition(catalog.order, FoldCatalogName(name), id);
+    if (position != kNoCatalogEntry)
+    {
+        catalog.entries.erase(catalog.entries.begin() + position);
+    }
+    return id;
+}
+
+// Adds or refreshes the file called name from disk. An existing entry keeps its id and only moves
+// when its sort key changed; a new one takes id (a rename) or a fresh id. Files that are gone or
+// filtered out are dropped.
+void UpdateCatalogFile(const std::wstring& name, uint32_t id)
+{
+    DirectoryCatalog& catalog = g_catalog;
+    std::filesystem::path filePath = catalog.directory / name;
+    std::error_code ec;
+    std::filesystem::file_time_type time = std::filesystem::last_write_time(filePath, ec);
+    bool include = !ec && std::filesystem::is_regular_file(filePath, ec) && !ec
+        && (catalog.imageOnly ? IsImageFile(filePath) : IsSupportedFile(filePath));
+    uint64_t size = include ? std::filesystem::file_size(filePath, ec) : 0;
+    if (ec)
+    {
+        size = 0;
+    }
+
+    CatalogOrder& order = catalog.order;
+    std::wstring key = FoldCatalogName(name);
+    size_t position = FindCatalogPosition(order, key);
+    if (position != kNoCatalogEntry)
+    {
+        if (!include)
+        {
+            RemoveCatalogEntry(name);
+            return;
+        }
+        ImageEntry& entry = catalog.entries[position];
+        entry.path = filePath;
+        entry.writeTime = time;
+        entry.size = size;
+        catalog.metadata.flags[entry.id] = 0;
+        BuildCatalogSortKey(entry, order.sortPrimary[position], order.sortNames[position]);
+        if (IsCatalogPositionInOrder(order, position))
+        {
+            return;
+        }
+        id = RemoveCatalogEntry(name);
+    }
+    else if (!include)
+    {
+        return;
+    }
+
+    if (id == 0)
+    {
+        id = AllocateCatalogId();
+    }
+    ImageEntry entry{ filePath, time, id, size };
+    uint64_t primary = 0;
+    std::wstring sortName;
+    BuildCatalogSortKey(entry, primary, sortName);
+    position = FindCatalogInsertPosition(order, primary, sortName);
+    catalog.entries.insert(catalog.entries.begin() + position, std::move(entry));
+    InsertCatalogPosition(order, position, id, std::move(key), primary, std::move(sortName));
+}
+
+// Hands out the next entry id and makes room for it in the position table and the metadata
+// columns.
+uint32_t AllocateCatalogId()
+{
+    DirectoryCatalog& catalog = g_catalog;
+    CatalogMetadata& metadata = catalog.metadata;
+    catalog.order.positionById.push_back(kNoCatalogEntry);
+    metadata.width.push_back(0);
+    metadata.height.push_back(0);
+    metadata.frameCount.push_back(0);
+    metadata.dateTaken.push_back(0);
+    metadata.flags.push_back(0);
+    return catalog.nextId++;
+}
+
+void ClearCatalogEntries()
+{
+    StopMetadataIndexer();
+    DirectoryCatalog& catalog = g_catalog;
+    catalog.entries.clear();
+    ClearCatalogOrder(catalog.order);
+    CatalogMetadata& metadata = catalog.metadata;
+    metadata.width.assign(1, 0);
+    metadata.height.assign(1, 0);
+    metadata.frameCount.assign(1, 0);
+    metadata.dateTaken.assign(1, 0);
+    metadata.flags.assign(1, 0);
+    catalog.nextId = 1;
+}
+
+// Empties the catalog and points it at dir; an archive or playlist that was open is let go.
+void ResetCatalog(const std::filesystem::path& dir)
+{
+    StopArchivePrefetch();
+    DirectoryCatalog& catalog = g_catalog;
+    catalog.archive.reset();
+    catalog.roots.clear();
+    catalog.directory = dir;
+    ClearCatalogEntries();
+    catalog.imageOnly = g_sortImageOnly;
+    catalog.order.sortMode = g_sortMode;
+}
+
+// Numbers a new scan; results of any earlier one are dropped from here on.
+uint32_t BeginCatalogScan()
+{
+    CatalogScanner& scanner = g_catalogScanner;
+    uint32_t generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(scanner.mutex);
+        generation = ++scanner.generation;
+        scanner.pending.clear();
+        scanner.finished = false;
+        scanner.replace = false;
+    }
+    scanner.cancel = false;
+    return generation;
+}
+
+// Empties the catalog for dir and lists it on the scanner thread; batches are merged as they
+// arrive, so navigation works over whatever has been found so far.
+void StartCatalogScan(const std::filesystem::path& dir)
+{
+    StopCatalogScan();
+    ResetCatalog(dir);
+    DirectoryCatalog& catalog = g_catalog;
+    catalog.scanning = true;
+    uint32_t generation = BeginCatalogScan();
+    g_catalogScanner.thread = std::thread(ScanCatalogDirectory, dir, catalog.imageOnly, generation);
+}
+
+void StopCatalogScan()
+{
+    CatalogScanner& scanner = g_catalogScanner;
+    scanner.cancel = true;
+    if (scanner.thread.joinable())
+    {
+        scanner.thread.join();
+    }
+    std::lock_guard<std::mutex> lock(scanner.mutex);
+    ++scanner.generation;
+    scanner.pending.clear();
+    scanner.finished = false;
+    scanner.replace = false;
+    g_catalog.scanning = false;
+}
+
+// Queues batch for the window thread unless the scan numbered generation has been superseded.
+// Safe to call from several threads of one scan.
+void PostCatalogBatch(std::vector<ImageEntry>& batch, uint32_t generation, bool finished, bool replace)
+{
+    CatalogScanner& scanner = g_catalogScanner;
+    {
+        std::lock_guard<std::mutex> lock(scanner.mutex);
+        if (scanner.generation != generation)
+        {
+            return;
+        }
+        if (replace)
+        {
+            scanner.pending.clear();
+            scanner.replace = true;
+        }
+        scanner.pending.insert(
+            scanner.pending.end(),
+            std::make_move_iterator(batch.begin()),
+            std::make_move_iterator(batch.end())
+        );
+        scanner.finished = finished;
+    }
+    batch.clear();
+    if (!scanner.batchPosted.exchange(true))
+    {
+        PostMessageW(g_hwnd, kMessageCatalogBatch, 0, 0);
+    }
+}
+
+// Runs on the scanner thread. Batches start small so the first neighbours show up at once and
+// double up to kCatalogScanMaxBatch, which keeps the number of merges logarithmic.
+void ScanCatalogDirectory(std::filesystem::path dir, bool imageOnly, uint32_t generation)
+{
+    CatalogScanner& scanner = g_catalogScanner;
+    std::vector<ImageEntry> batch;
+    size_t batchLimit = kCatalogScanFirstBatch;
+
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec))
+    {
+        if (scanner.cancel)
+        {
+            return;
+        }
+        if (ec)
+        {
+            break;
+        }
+        // A file deleted under the scan fails here on its own; it must not end the listing.
+        std::error_code entryEc;
+        if (!entry.is_regular_file(entryEc))
+        {
+            continue;
+        }
+        std::filesystem::path filePath = entry.path();
+        bool shouldInclude = imageOnly ? IsImageFile(filePath) : IsSupportedFile(filePath);
+        if (!shouldInclude)
+        {
+            continue;
+        }
+        std::filesystem::file_time_type time = entry.last_write_time(entryEc);
+        uint64_t size = entry.file_size(entryEc);
+        if (entryEc)
+        {
+            size = 0;
+        }
+        batch.push_back({ std::move(filePath), time, 0, size });
+        if (batch.size() >= batchLimit)
+        {
+            PostCatalogBatch(batch, generation, false, false);
+            batchLimit = (std::min)(batchLimit * 2, kCatalogScanMaxBatch);
+        }
+    }
+    PostCatalogBatch(batch, generation, true, false);
+}
+
+// Merges what the scanner has queued. Once the scan is complete, the notifications held back
+// while it ran are applied on top of the listing.
+void MergeCatalogScanResults()
+{
+    CatalogScanner& scanner = g_catalogScanner;
+    scanner.batchPosted = false;
+    std::vector<ImageEntry> batch;
+    bool finished = false;
+    bool replace = false;
+    {
+        std::lock_guard<std::mutex> lock(scanner.mutex);
+        batch.swap(scanner.pending);
+        finished = scanner.finished;
+        replace = scanner.replace;
+        scanner.finished = false;
+        scanner.replace = false;
+    }
+    if (!g_catalog.scanning)
+    {
+        return;
+    }
+
+    if (replace)
+    {
+        ClearCatalogEntries();
+    }
+    MergeCatalogBatch(batch);
+    if (finished)
+    {
+        if (scanner.thread.joinable())
+        {
+            scanner.thread.join();
+        }
+        g_catalog.scanning = false;
+        ApplyDirectoryChanges();
+        StartMetadataIndexer();
+    }
+
+    size_t index = FindCatalogEntry(g_currentImagePath);
+    if (index != kNoCatalogEntry)
+    {
+        g_currentIndex = index;
+    }
+    else if (g_currentImagePath.empty() && !g_catalog.entries.empty())
+    {
+        // A playlist opened before any of its files had been found.
+        if (LoadImageByIndex(0) && g_hwnd)
+        {
+            InvalidateRect(g_hwnd, nullptr, TRUE);
+        }
+    }
+}
+
+// Runs on the watcher thread: queues what changed and posts once until the UI drains the queue.
+void WatchCatalogDirectory(std::wstring directory, HANDLE stopEvent)
+{
+    DirectoryWatcher& watcher = g_directoryWatcher;
+    HANDLE dir = CreateFileW(
+        directory.c_str(),
+        FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+        nullptr
+    );
+    OVERLAPPED overlapped{};
+    overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (dir == INVALID_HANDLE_VALUE || !overlapped.hEvent)
+    {
+        if (dir != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(dir);
+        }
+        if (overlapped.hEvent)
+        {
+            CloseHandle(overlapped.hEvent);
+        }
+        watcher.watching = false;
+        return;
+    }
+
+    std::vector<DWORD> buffer(kDirectoryWatchBufferBytes / sizeof(DWORD));
+    HANDLE handles[] = { stopEvent, overlapped.hEvent };
+    for (;;)
+    {
+        ResetEvent(overlapped.hEvent);
+        if (!ReadDirectoryChangesW(
+            dir,
+            buffer.data(),
+            static_cast<DWORD>(buffer.size() * sizeof(DWORD)),
+            FALSE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE,
+            nullptr,
+            &overlapped,
+            nullptr))
+        {
+            break;
+        }
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+        {
+            CancelIoEx(dir, &overlapped);
+            DWORD ignored = 0;
+            GetOverlappedResult(dir, &overlapped, &ignored, TRUE);
+            break;
+        }
+
+        DWORD transferred = 0;
+        bool overflowed = false;
+        if (!GetOverlappedResult(dir, &overlapped, &transferred, FALSE))
+        {
+            if (GetLastError() != ERROR_NOTIFY_ENUM_DIR)
             {
-                RefreshImageList(g_currentImagePath);
-                InvalidateRect(hwnd, nullptr, TRUE);
+                break;
             }
-            SaveSettings();
-            return 0;
-        case kMenuSortNameDesc:
-            g_sortMode = SortMode::NameDesc;
-            if (!g_currentImagePath.empty())
+            overflowed = true;
+        }
+        std::vector<DirectoryChange> batch;
+        if (overflowed || transferred == 0)
+        {
+            // The kernel dropped events; the UI re-enumerates.
+            batch.push_back({ 0, {} });
+        }
+        else
+        {
+            const BYTE* record = reinterpret_cast<const BYTE*>(buffer.data());
+            for (;;)
             {
-                RefreshImageList(g_currentImagePath);
-                InvalidateRect(hwnd, nullptr, TRUE);
+                const auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(record);
+                batch.push_back({ info->Action, std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR)) });
+                if (info->NextEntryOffset == 0)
+                {
+                    break;
+                }
+                record += info->NextEntryOffset;
             }
-            SaveSettings();
-            return 0;
-        case kMenuSortTimeAsc:
-            g_sortMode = SortMode::TimeAsc;
-            if (!g_currentImagePath.empty())
-            {
-                RefreshImageList(g_currentImagePath);
-                InvalidateRect(hwnd, nullptr, TRUE);
+        }
+        {
+            std::lock_guard<std::mutex> lock(watcher.mutex);
+            watcher.changes.insert(
+                watcher.changes.end(),
+                std::make_move_iterator(batch.begin()),
+                std::make_move_iterator(batch.end())
+            );
+        }
+        if (!watcher.changePosted.exchange(true))
+        {
+            PostMessageW(g_hwnd, kMessageDirectoryChanged, 0, 0);
+        }
+    }
+    CloseHandle(overlapped.hEvent);
+    CloseHandle(dir);
+    watcher.watching = false;
+}
+
+void StopCatalogWatcher()
+{
+    DirectoryWatcher& watcher = g_directoryWatcher;
+    if (watcher.stopEvent)
+    {
+        SetEvent(watcher.stopEvent);
+    }
+    if (watcher.thread.joinable())
+    {
+        watcher.thread.join();
+    }
+    if (watcher.stopEvent)
+    {
+        CloseHandle(watcher.stopEvent);
+        watcher.stopEvent = nullptr;
+    }
+    watcher.directory.clear();
+    watcher.watching = false;
+    watcher.changePosted = false;
+    std::lock_guard<std::mutex> lock(watcher.mutex);
+    watcher.changes.clear();
+}
+
+void StartCatalogWatcher(const std::filesystem::path& dir)
+{
+    StopCatalogWatcher();
+    DirectoryWatcher& watcher = g_directoryWatcher;
+    watcher.stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!watcher.stopEvent)
+    {
+        return;
+    }
+    watcher.directory = dir.wstring();
+    watcher.watching = true;
+    watcher.thread = std::thread(WatchCatalogDirectory, watcher.directory, watcher.stopEvent);
+}
+
+// Folds queued notifications into the catalog. The current file keeps its index when it is still
+// listed; when it was removed, the index stays where it was so the next file is one step away.
+// While the folder is still being scanned the queue is left alone; the last merge applies it.
+void ApplyDirectoryChanges()
+{
+    DirectoryWatcher& watcher = g_directoryWatcher;
+    watcher.changePosted = false;
+    if (g_catalog.scanning)
+    {
+        return;
+    }
+    std::vector<DirectoryChange> changes;
+    {
+        std::lock_guard<std::mutex> lock(watcher.mutex);
+        changes.swap(watcher.changes);
+    }
+    if (changes.empty() || g_catalog.directory.empty())
+    {
+        return;
+    }
+
+    DirectoryCatalog& catalog = g_catalog;
+    if (catalog.order.sortMode != g_sortMode)
+    {
+        SortImageList();
+    }
+    size_t current = FindCatalogEntry(g_currentImagePath);
+    uint32_t currentId = (current != kNoCatalogEntry) ? catalog.entries[current].id : 0;
+    bool rescan = false;
+    uint32_t renamedId = 0;
+    for (const DirectoryChange& change : changes)
+    {
+        switch (change.action)
+        {
+        case FILE_ACTION_ADDED:
+        case FILE_ACTION_MODIFIED:
+            UpdateCatalogFile(change.name, 0);
+            break;
+        case FILE_ACTION_REMOVED:
+            RemoveCatalogEntry(change.name);
+            break;
+        case FILE_ACTION_RENAMED_OLD_NAME:
+            renamedId = RemoveCatalogEntry(change.name);
+            break;
+        case FILE_ACTION_RENAMED_NEW_NAME:
+            UpdateCatalogFile(change.name, renamedId);
+            renamedId = 0;
+            break;
+        default:
+            rescan = true;
+            break;
+        }
+        if (rescan)
+        {
+            break;
+        }
+    }
+    if (rescan)
+    {
+        StartCatalogScan(std::filesystem::path(catalog.directory));
+        UpdateCatalogFile(g_currentImagePath.filename().wstring(), 0);
+        currentId = 0;
+    }
+    else
+    {
+        // Added and rewritten files come back unprobed.
+        StartMetadataIndexer();
+    }
+
+    if (currentId != 0 && catalog.order.positionById[currentId] != kNoCatalogEntry)
+    {
+        // Still listed, possibly under a new name after a rename.
+        g_currentIndex = catalog.order.positionById[currentId];
+        g_currentImagePath = catalog.entries[g_currentIndex].path;
+        return;
+    }
+    size_t index = FindCatalogEntry(g_currentImagePath);
+    if (index != kNoCatalogEntry)
+    {
+        g_currentIndex = index;
+    }
+    else if (!catalog.entries.empty())
+    {
+        g_currentIndex = (std::min)(g_currentIndex, catalog.entries.size() - 1);
+    }
+    else
+    {
+        g_currentIndex = 0;
+    }
+}
+
+uint64_t GetFileTimeTicks(const FILETIME& time)
+{
+    return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+}
+
+std::wstring JoinPlaylistPath(const std::wstring& directory, const std::wstring& name)
+{
+    if (!directory.empty() && directory.back() == L'\\')
+    {
+        return directory + name;
+    }
+    return directory + L'\\' + name;
+}
+
+// Indexes and caches live next to the ini file, so a portable copy keeps its own.
+std::filesystem::path GetSettingsSidePath(const wchar_t* extension)
+{
+    if (g_iniPath.empty())
+    {
+        return {};
+    }
+    std::filesystem::path sidePath(g_iniPath);
+    sidePath.replace_extension(extension);
+    return sidePath;
+}
+
+// Written aside and moved over the old file, so a crash never leaves half a file behind.
+bool WriteFileAtomically(const std::filesystem::path& path, const void* data, size_t size)
+{
+    std::filesystem::path tempPath = path;
+    tempPath += L".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            return false;
+        }
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        if (!file)
+        {
+            return false;
+        }
+    }
+    return MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+}
+
+bool SavePlaylistIndex(const PlaylistIndex& index)
+{
+    std::filesystem::path indexPath = GetSettingsSidePath(L".playlist");
+    if (indexPath.empty())
+    {
+        return false;
+    }
+    std::vector<BYTE> out;
+    EncodePlaylistIndex(index, out);
+    return WriteFileAtomically(indexPath, out.data(), out.size());
+}
+
+bool LoadPlaylistIndex(PlaylistIndex& index)
+{
+    index = PlaylistIndex{};
+    std::filesystem::path indexPath = GetSettingsSidePath(L".playlist");
+    DocumentBuffer document;
+    if (indexPath.empty() || !ReadDocumentBuffer(indexPath.c_str(), document))
+    {
+        return false;
+    }
+    return DecodePlaylistIndex(reinterpret_cast<const BYTE*>(document.data.get()), document.size, index);
+}
+
+// Lists one folder: its supported files with time and size, and the subfolders to walk. Linked
+// folders are not followed, so a link cannot send the walk round in circles.
+bool ListPlaylistDirectory(PlaylistDirectory& directory)
+{
+    WIN32_FIND_DATAW data{};
+    HANDLE find = FindFirstFileExW(
+        JoinPlaylistPath(directory.path, L"*").c_str(),
+        FindExInfoBasic,
+        &data,
+        FindExSearchNameMatch,
+        nullptr,
+        FIND_FIRST_EX_LARGE_FETCH
+    );
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    do
+    {
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            if ((data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0
+                && wcscmp(data.cFileName, L".") != 0 && wcscmp(data.cFileName, L"..") != 0)
+            {
+                directory.subdirectories.emplace_back(data.cFileName);
             }
-            SaveSettings();
-            return 0;
-        case kMenuSortTimeDesc:
-            g_sortMode = SortMode::TimeDesc;
-            if (!g_currentImagePath.empty())
+            continue;
+        }
+        if (!IsSupportedFile(data.cFileName))
+        {
+            continue;
+        }
+        uint64_t size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+        directory.files.push_back({ data.cFileName, GetFileTimeTicks(data.ftLastWriteTime), size });
+    } while (FindNextFileW(find, &data));
+    FindClose(find);
+
+    std::sort(directory.files.begin(), directory.files.end(), [](const PlaylistFile& a, const PlaylistFile& b)
+    {
+        return a.name < b.name;
+    });
+    std::sort(directory.subdirectories.begin(), directory.subdirectories.end());
+    return true;
+}
+
+void AppendPlaylistEntries(const PlaylistDirectory& directory, bool imageOnly, std::vector<ImageEntry>& entries)
+{
+    for (const PlaylistFile& file : directory.files)
+    {
+        std::filesystem::path filePath = JoinPlaylistPath(directory.path, file.name);
+        if (imageOnly && !IsImageFile(filePath))
+        {
+            continue;
+        }
+        std::filesystem::file_time_type time{ std::filesystem::file_time_type::duration(static_cast<int64_t>(file.writeTime)) };
+        entries.push_back({ std::move(filePath), time, 0, file.size });
+    }
+}
+
+// Runs on the scanner thread. Folders are taken from a shared queue by one walker per core. A
+// folder whose time matches the index is taken from it, subfolders included; only the others
+// are listed. With replace, the catalog already shows the index and is rebuilt once at the end,
+// and only if something changed; otherwise batches stream in as folders are listed.
+void ScanPlaylist(std::vector<std::wstring> roots, bool imageOnly, uint32_t generation, std::shared_ptr<const PlaylistIndex> index, bool replace)
+{
+    CatalogScanner& scanner = g_catalogScanner;
+    std::unordered_map<std::wstring, const PlaylistDirectory*> known;
+    if (index)
+    {
+        known.reserve(index->directories.size());
+        for (const PlaylistDirectory& directory : index->directories)
+        {
+            known.emplace(FoldCatalogName(directory.path), &directory);
+        }
+    }
+
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::vector<std::wstring> queue(roots.rbegin(), roots.rend());
+    size_t busy = 0;
+    std::atomic<bool> changed{ !index };
+    size_t workerCount = (std::max)(1u, std::thread::hardware_concurrency());
+    std::vector<std::vector<PlaylistDirectory>> results(workerCount);
+    RunCatalogChunks(workerCount, [&](size_t worker)
+    {
+        std::vector<ImageEntry> batch;
+        size_t batchLimit = kCatalogScanFirstBatch;
+        for (;;)
+        {
+            PlaylistDirectory directory;
             {
-                RefreshImageList(g_currentImagePath);
-                InvalidateRect(hwnd, nullptr, TRUE);
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueReady.wait(lock, [&]()
+                {
+                    return !queue.empty() || busy == 0 || scanner.cancel;
+                });
+                if (queue.empty() || scanner.cancel)
+                {
+                    break;
+                }
+                directory.path = std::move(queue.back());
+                queue.pop_back();
+                ++busy;
             }
-            SaveSettings();
-            return 0;
-        case kMenuSortImageOnly:
-            g_sortImageOnly = !g_sortImageOnly;
-            if (!g_currentImagePath.empty())
+
+            // The folder's time is read before it is listed, so anything that changes during the
+            // listing makes it look stale next time.
+            WIN32_FILE_ATTRIBUTE_DATA attributes{};
+            bool listed = GetFileAttributesExW(directory.path.c_str(), GetFileExInfoStandard, &attributes)
+                && (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+            if (listed)
             {
-                RefreshImageList(g_currentImagePath);
-                InvalidateRect(hwnd, nullptr, TRUE);
+                directory.writeTime = GetFileTimeTicks(attributes.ftLastWriteTime);
+                auto it = known.find(FoldCatalogName(directory.path));
+                if (it != known.end() && it->second->writeTime == directory.writeTime)
+                {
+                    directory.files = it->second->files;
+                    directory.subdirectories = it->second->subdirectories;
+                }
+                else
+                {
+                    // A folder that cannot be read is kept empty rather than retried every time.
+                    changed = true;
+                    ListPlaylistDirectory(directory);
+                }
             }
-            SaveSettings();
-            return 0;
+            else
+            {
+                changed = true;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                for (const std::wstring& name : directory.subdirectories)
+                {
+                    queue.push_back(JoinPlaylistPath(directory.path, name));
+                }
+                --busy;
+            }
+            queueReady.notify_all();
+            if (!listed)
+            {
+                continue;
+            }
+            if (!replace)
+            {
+                AppendPlaylistEntries(directory, imageOnly, batch);
+                if (batch.size() >= batchLimit)
+                {
+                    PostCatalogBatch(batch, generation, false, false);
+                    batchLimit = (std::min)(batchLimit * 2, kCatalogScanMaxBatch);
+                }
+            }
+            results[worker].push_back(std::move(directory));
         }
-        break;
+        if (!replace && !scanner.cancel)
+        {
+            PostCatalogBatch(batch, generation, false, false);
+        }
+    });
+    if (scanner.cancel)
+    {
+        return;
+    }
+
+    std::vector<ImageEntry> batch;
+    if (changed)
+    {
+        PlaylistIndex updated;
+        updated.roots = roots;
+        for (auto& directories : results)
+        {
+            std::move(directories.begin(), directories.end(), std::back_inserter(updated.directories));
+        }
+        std::sort(updated.directories.begin(), updated.directories.end(), [](const PlaylistDirectory& a, const PlaylistDirectory& b)
+        {
+            return a.path < b.path;
+        });
+        SavePlaylistIndex(updated);
+        if (replace)
+        {
+            for (const PlaylistDirectory& directory : updated.directories)
+            {
+                AppendPlaylistEntries(directory, imageOnly, batch);
+            }
+        }
+    }
+    PostCatalogBatch(batch, generation, true, replace && changed);
+}
+
+bool SamePlaylistRoots(const std::vector<std::wstring>& a, const std::vector<std::filesystem::path>& b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        if (FoldCatalogName(a[i]) != FoldCatalogName(b[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Catalogs every supported file under roots. A saved index of the same roots is listed at once
+// and the walk then only has to re-list folders whose time changed; without one, files show up
+// as the walk finds them.
+void StartPlaylistScan(const std::vector<std::filesystem::path>& roots)
+{
+    StopCatalogScan();
+    StopCatalogWatcher();
+    ResetCatalog(roots.front());
+    DirectoryCatalog& catalog = g_catalog;
+    catalog.roots = roots;
+    catalog.scanning = true;
+
+    auto index = std::make_shared<PlaylistIndex>();
+    bool indexed = LoadPlaylistIndex(*index) && SamePlaylistRoots(index->roots, roots);
+    if (indexed)
+    {
+        std::vector<ImageEntry> entries;
+        for (const PlaylistDirectory& directory : index->directories)
+        {
+            AppendPlaylistEntries(directory, catalog.imageOnly, entries);
+        }
+        MergeCatalogBatch(entries);
+    }
+    else
+    {
+        index.reset();
+    }
+
+    std::vector<std::wstring> rootNames;
+    for (const std::filesystem::path& root : roots)
+    {
+        rootNames.push_back(root.native());
+    }
+    uint32_t generation = BeginCatalogScan();
+    g_catalogScanner.thread = std::thread(ScanPlaylist, std::move(rootNames), catalog.imageOnly, generation,
+        std::shared_ptr<const PlaylistIndex>(std::move(index)), indexed);
+}
+
+// Opens the given folders as one playlist and shows its first file as soon as there is one.
+// Returns false when none of them is a folder.
+bool OpenPlaylist(const std::vector<std::filesystem::path>& folders)
+{
+    std::vector<std::filesystem::path> roots;
+    for (const std::filesystem::path& folder : folders)
+    {
+        std::error_code ec;
+        std::filesystem::path root = std::filesystem::absolute(folder, ec).lexically_normal();
+        if (ec || !std::filesystem::is_directory(root, ec))
+        {
+            continue;
+        }
+        if (!root.has_filename() && root != root.root_path())
+        {
+            root = root.parent_path();
+        }
+        roots.push_back(std::move(root));
+    }
+    if (roots.empty())
+    {
+        return false;
+    }
+    std::sort(roots.begin(), roots.end(), [](const std::filesystem::path& a, const std::filesystem::path& b)
+    {
+        return FoldCatalogName(a) < FoldCatalogName(b);
+    });
+    roots.erase(std::unique(roots.begin(), roots.end(), [](const std::filesystem::path& a, const std::filesystem::path& b)
+    {
+        return FoldCatalogName(a) == FoldCatalogName(b);
+    }), roots.end());
+
+    StartPlaylistScan(roots);
+    g_currentImagePath.clear();
+    g_currentIndex = 0;
+    if (!g_catalog.entries.empty())
+    {
+        LoadImageByIndex(0);
+    }
+    return true;
+}
+
+// =====================
+// メタデータ索引
+// =====================
+
+// EXIF DateTimeOriginal ("YYYY:MM:DD HH:MM:SS" in the camera's local time) as UTC FILETIME ticks,
+// 0 when the frame has none. JPEG keeps EXIF under APP1, TIFF at the top level.
+uint64_t ReadExifDateTaken(IWICBitmapFrameDecode* frame)
+{
+    IWICMetadataQueryReader* reader = nullptr;
+    if (FAILED(frame->GetMetadataQueryReader(&reader)))
+    {
+        return 0;
+    }
+    const wchar_t* keys[] = { L"/app1/ifd/exif/{ushort=36867}", L"/ifd/exif/{ushort=36867}" };
+    uint64_t ticks = 0;
+    for (const wchar_t* key : keys)
+    {
+        PROPVARIANT variant;
+        PropVariantInit(&variant);
+        int year = 0;
+        int month = 0;
+        int day = 0;
+        int hour = 0;
+        int minute = 0;
+        int second = 0;
+        if (SUCCEEDED(reader->GetMetadataByName(key, &variant)) && variant.vt == VT_LPSTR && variant.pszVal
+            && sscanf_s(variant.pszVal, "%4d:%2d:%2d %2d:%2d:%2d", &year, &month, &day, &hour, &minute, &second) == 6
+            && year > 1601 && month > 0 && day > 0 && hour >= 0 && minute >= 0 && second >= 0)
+        {
+            SYSTEMTIME time{};
+            time.wYear = static_cast<WORD>(year);
+            time.wMonth = static_cast<WORD>(month);
+            time.wDay = static_cast<WORD>(day);
+            time.wHour = static_cast<WORD>(hour);
+            time.wMinute = static_cast<WORD>(minute);
+            time.wSecond = static_cast<WORD>(second);
+            FILETIME localTime{};
+            FILETIME utcTime{};
+            if (SystemTimeToFileTime(&time, &localTime) && LocalFileTimeToFileTime(&localTime, &utcTime))
+            {
+                ticks = GetFileTimeTicks(utcTime);
+            }
+        }
+        PropVariantClear(&variant);
+        if (ticks != 0)
+        {
+            break;
+        }
+    }
+    reader->Release();
+    return ticks;
+}
+
+// Reads the decoder header and the first frame's properties; no pixels are decoded. Archive
+// members have to be read out of archive first; deflated ones are inflated for it.
+ImageMetadata ProbeImageMetadata(IWICImagingFactory* factory, const ZipArchive* archive, const ImageEntry& entry)
+{
+    ImageMetadata metadata;
+    if (!factory || !IsImageFile(entry.path))
+    {
+        return metadata;
+    }
+    IWICBitmapDecoder* decoder = nullptr;
+    IWICStream* stream = nullptr;
+    ZipMemberData data;
+    HRESULT hr = E_FAIL;
+    if (!archive)
+    {
+        hr = factory->CreateDecoderFromFilename(
+            entry.path.c_str(),
+            nullptr,
+            GENERIC_READ,
+            WICDecodeMetadataCacheOnDemand,
+            &decoder
+        );
+    }
+    else if (ReadZipMember(*archive, archive->members[entry.member], data))
+    {
+        hr = CreateDecoderFromMemory(factory, data.data, data.size, &stream, &decoder);
+    }
+    if (FAILED(hr))
+    {
+        if (decoder) decoder->Release();
+        if (stream) stream->Release();
+        ReleaseZipMemberData(data);
+        return metadata;
+    }
+    UINT frameCount = 0;
+    if (SUCCEEDED(decoder->GetFrameCount(&frameCount)))
+    {
+        metadata.frameCount = frameCount;
+    }
+    IWICBitmapFrameDecode* frame = nullptr;
+    if (SUCCEEDED(decoder->GetFrame(0, &frame)))
+    {
+        UINT width = 0;
+        UINT height = 0;
+        if (SUCCEEDED(frame->GetSize(&width, &height)))
+        {
+            metadata.width = width;
+            metadata.height = height;
+        }
+        WICPixelFormatGUID pixelFormat{};
+        if (SUCCEEDED(frame->GetPixelFormat(&pixelFormat)))
+        {
+            metadata.hasAlpha = QueryPixelFormatHasAlpha(factory, pixelFormat);
+        }
+        metadata.dateTaken = ReadExifDateTaken(frame);
+        frame->Release();
+    }
+    decoder->Release();
+    if (stream) stream->Release();
+    ReleaseZipMemberData(data);
+    return metadata;
+}
+
+uint64_t GetMetadataCacheKey(const ImageEntry& entry)
+{
+    std::wstring folded = FoldCatalogName(entry.path);
+    return HashBytes(folded.data(), folded.size() * sizeof(wchar_t), 0);
+}
+
+// Called with the cache lock held.
+void LoadMetadataCache()
+{
+    MetadataCache& cache = g_metadataCache;
+    cache.loaded = true;
+    std::filesystem::path cachePath = GetSettingsSidePath(L".metadata");
+    DocumentBuffer document;
+    if (cachePath.empty() || !ReadDocumentBuffer(cachePath.c_str(), document))
+    {
+        return;
+    }
+    DecodeMetadataCache(reinterpret_cast<const BYTE*>(document.data.get()), document.size, cache.records);
+}
+
+bool SaveMetadataCache()
+{
+    MetadataCache& cache = g_metadataCache;
+    std::vector<BYTE> out;
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        if (!cache.dirty)
+        {
+            return true;
+        }
+        cache.dirty = false;
+        EncodeMetadataCache(cache.records, out);
+    }
+    std::filesystem::path cachePath = GetSettingsSidePath(L".metadata");
+    return !cachePath.empty() && WriteFileAtomically(cachePath, out.data(), out.size());
+}
+
+// A record is only trusted while the file keeps the time and size it was probed at.
+bool FindCachedMetadata(const ImageEntry& entry, ImageMetadata& metadata)
+{
+    uint64_t key = GetMetadataCacheKey(entry);
+    MetadataCache& cache = g_metadataCache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (!cache.loaded)
+    {
+        LoadMetadataCache();
+    }
+    auto it = cache.records.find(key);
+    if (it == cache.records.end() || it->second.writeTime != static_cast<uint64_t>(entry.writeTime.time_since_epoch().count())
+        || it->second.size != entry.size)
+    {
+        return false;
+    }
+    metadata = it->second.metadata;
+    return true;
+}
+
+void StoreCachedMetadata(const ImageEntry& entry, const ImageMetadata& metadata)
+{
+    uint64_t key = GetMetadataCacheKey(entry);
+    MetadataCache& cache = g_metadataCache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (!cache.loaded)
+    {
+        LoadMetadataCache();
+    }
+    // Records of files long gone are never pruned one by one; past the cap the cache starts over.
+    if (cache.records.size() >= kMetadataCacheMaxRecords)
+    {
+        cache.records.clear();
+    }
+    MetadataCacheRecord& record = cache.records[key];
+    record.writeTime = static_cast<uint64_t>(entry.writeTime.time_since_epoch().count());
+    record.size = entry.size;
+    record.metadata = metadata;
+    cache.dirty = true;
+}
+
+void SetCatalogMetadata(uint32_t id, const ImageMetadata& metadata)
+{
+    CatalogMetadata& columns = g_catalog.metadata;
+    columns.width[id] = metadata.width;
+    columns.height[id] = metadata.height;
+    columns.frameCount[id] = metadata.frameCount;
+    columns.dateTaken[id] = metadata.dateTaken;
+    columns.flags[id] = static_cast<uint8_t>(kMetadataProbed | (metadata.hasAlpha ? kMetadataHasAlpha : 0));
+}
+
+// Fills entry's metadata columns from the metadata cache only; a file the cache does not know is
+// left for the background indexer. Returns whether the columns are filled.
+bool LoadCatalogMetadataFromCache(const ImageEntry& entry)
+{
+    if (g_catalog.metadata.flags[entry.id] & kMetadataProbed)
+    {
+        return true;
+    }
+    ImageMetadata metadata;
+    if (IsImageFile(entry.path) && !FindCachedMetadata(entry, metadata))
+    {
+        return false;
+    }
+    SetCatalogMetadata(entry.id, metadata);
+    return true;
+}
+
+// Whether entry passes the animated / alpha navigation filters. An image the indexer has not
+// probed yet does not pass; IsCatalogFilterPending tells it apart from one that fails.
+bool PassesCatalogFilter(const ImageEntry& entry)
+{
+    if (!g_filterAnimatedOnly && !g_filterAlphaOnly)
+    {
+        return true;
+    }
+    if (!IsImageFile(entry.path) || !LoadCatalogMetadataFromCache(entry))
+    {
+        return false;
+    }
+    const CatalogMetadata& columns = g_catalog.metadata;
+    return (!g_filterAnimatedOnly || columns.frameCount[entry.id] > 1)
+        && (!g_filterAlphaOnly || (columns.flags[entry.id] & kMetadataHasAlpha) != 0);
+}
+
+bool IsCatalogFilterPending(const ImageEntry& entry)
+{
+    return (g_filterAnimatedOnly || g_filterAlphaOnly) && IsImageFile(entry.path)
+        && !(g_catalog.metadata.flags[entry.id] & kMetadataProbed);
+}
+
+// Runs on the indexer thread. Workers take files one at a time, so a slow one (a large archive
+// member, a file on a network share) only holds up its own worker.
+void IndexCatalogMetadata(std::vector<ImageEntry> jobs, std::shared_ptr<ZipArchive> archive, uint32_t generation)
+{
+    MetadataIndexer& indexer = g_metadataIndexer;
+    std::atomic<size_t> next{ 0 };
+    RunCatalogChunks(GetCatalogChunkCount(jobs.size(), kCatalogProbeChunkEntries), [&](size_t)
+    {
+        bool comInitialized = SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+        IWICImagingFactory* factory = nullptr;
+        CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
+        std::vector<MetadataIndexResult> batch;
+        auto flush = [&]()
+        {
+            {
+                std::lock_guard<std::mutex> lock(indexer.mutex);
+                if (indexer.generation != generation)
+                {
+                    return;
+                }
+                indexer.pending.insert(indexer.pending.end(), batch.begin(), batch.end());
+            }
+            batch.clear();
+            if (!indexer.batchPosted.exchange(true))
+            {
+                PostMessageW(g_hwnd, kMessageMetadataBatch, 0, 0);
+            }
+        };
+        for (size_t i = next++; i < jobs.size() && !indexer.cancel; i = next++)
+        {
+            const ImageEntry& job = jobs[i];
+            MetadataIndexResult result{ job.id, static_cast<uint64_t>(job.writeTime.time_since_epoch().count()) };
+            if (!FindCachedMetadata(job, result.metadata))
+            {
+                result.metadata = ProbeImageMetadata(factory, archive.get(), job);
+                StoreCachedMetadata(job, result.metadata);
+            }
+            batch.push_back(result);
+            if (batch.size() >= kMetadataIndexBatch)
+            {
+                flush();
+            }
+        }
+        flush();
+        if (factory)
+        {
+            factory->Release();
+        }
+        if (comInitialized)
+        {
+            CoUninitialize();
+        }
+    });
+    if (!indexer.cancel)
+    {
+        SaveMetadataCache();
+    }
+    // One more merge, so a step waiting on this run is retried with the run marked done.
+    indexer.running = false;
+    if (!indexer.batchPosted.exchange(true))
+    {
+        PostMessageW(g_hwnd, kMessageMetadataBatch, 0, 0);
+    }
+}
+
+// Indexes, in the background, every image of the catalog whose metadata columns are still empty.
+void StartMetadataIndexer()
+{
+    StopMetadataIndexer();
+    const DirectoryCatalog& catalog = g_catalog;
+    std::vector<ImageEntry> jobs;
+    for (const ImageEntry& entry : catalog.entries)
+    {
+        if (!(catalog.metadata.flags[entry.id] & kMetadataProbed) && IsImageFile(entry.path))
+        {
+            jobs.push_back(entry);
+        }
+    }
+    if (jobs.empty())
+    {
+        return;
+    }
+    MetadataIndexer& indexer = g_metadataIndexer;
+    uint32_t generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(indexer.mutex);
+        generation = ++indexer.generation;
+        indexer.pending.clear();
+    }
+    indexer.cancel = false;
+    indexer.running = true;
+    indexer.thread = std::thread(IndexCatalogMetadata, std::move(jobs), catalog.archive, generation);
+}
+
+void StopMetadataIndexer()
+{
+    MetadataIndexer& indexer = g_metadataIndexer;
+    indexer.cancel = true;
+    if (indexer.thread.joinable())
+    {
+        indexer.thread.join();
+    }
+    indexer.running = false;
+    g_pendingFilterNavigation = 0;
+    std::lock_guard<std::mutex> lock(indexer.mutex);
+    ++indexer.generation;
+    indexer.pending.clear();
+}
+
+// Writes what the indexer has queued into the columns. A file rewritten since it was queued is
+// left for the next probe.
+void MergeCatalogMetadata()
+{
+    MetadataIndexer& indexer = g_metadataIndexer;
+    indexer.batchPosted = false;
+    std::vector<MetadataIndexResult> results;
+    {
+        std::lock_guard<std::mutex> lock(indexer.mutex);
+        results.swap(indexer.pending);
+    }
+    DirectoryCatalog& catalog = g_catalog;
+    CatalogOrder& order = catalog.order;
+    bool rekey = IsMetadataSortMode(order.sortMode);
+    bool moved = false;
+    for (const MetadataIndexResult& result : results)
+    {
+        size_t position = result.id < order.positionById.size() ? order.positionById[result.id] : kNoCatalogEntry;
+        if (position == kNoCatalogEntry
+            || static_cast<uint64_t>(catalog.entries[position].writeTime.time_since_epoch().count()) != result.writeTime)
+        {
+            continue;
+        }
+        SetCatalogMetadata(result.id, result.metadata);
+        if (rekey)
+        {
+            uint64_t primary = 0;
+            std::wstring sortName;
+            BuildCatalogSortKey(catalog.entries[position], primary, sortName);
+            moved = moved || primary != order.sortPrimary[position];
+            order.sortPrimary[position] = primary;
+            order.sortNames[position] = std::move(sortName);
+        }
+    }
+    if (moved)
+    {
+        ResortCatalog();
+        size_t index = FindCatalogEntry(g_currentImagePath);
+        if (index != kNoCatalogEntry)
+        {
+            g_currentIndex = index;
+        }
+    }
+
+    if (g_pendingFilterNavigation != 0)
+    {
+        int delta = g_pendingFilterNavigation;
+        g_pendingFilterNavigation = 0;
+        NavigateImage(delta);
+    }
+}
+
+// =====================
+// ウィンドウプロシージャ
+// =====================
+LRESULT CALLBACK WndProc(
+    HWND hwnd,
+    UINT msg,
+    WPARAM wParam,
+    LPARAM lParam
+)
+{
+    switch (msg)
+    {
+    case WM_PAINT:
+    {
+        PAINTSTRUCT ps;
+        BeginPaint(hwnd, &ps);
+        Render(hwnd);
+        EndPaint(hwnd, &ps);
+        ReportStartupTrace();
+        return 0;
+    }
+
+    case WM_SIZE:
+    {
+        if (g_animationPlayback.playing)
+        {
+            // Minimizing suspends playback at once, and restoring resumes it on the due frame.
+            UpdateAnimationPlayback();
+        }
+        if (g_webviewController)
+        {
+            UpdateWebViewBounds();
+        }
+        if (g_renderTarget)
+        {
+            UINT w = LOWORD(lParam);
+            UINT h = HIWORD(lParam);
+            g_renderTarget->Resize(D2D1::SizeU(w, h));
+        }
+        if (g_fitToWindow)
+        {
+            UpdateFitZoomFromWindow(hwnd);
+            InvalidateRect(hwnd, nullptr, TRUE);
+        }
+        return 0;
+    }
+
+    case WM_DROPFILES:
+    {
+        HDROP drop = reinterpret_cast<HDROP>(wParam);
+        UINT fileCount = DragQueryFileW(drop, 0xFFFFFFFF, nullptr, 0);
+        // Dropped folders are opened together as one playlist.
+        std::vector<std::filesystem::path> folders;
+        for (UINT i = 0; i < fileCount; ++i)
+        {
+            UINT folderLength = DragQueryFileW(drop, i, nullptr, 0);
+            std::wstring folder(folderLength + 1, L'\0');
+            DragQueryFileW(drop, i, folder.data(), folderLength + 1);
+            folder.resize(folderLength);
+            std::error_code ec;
+            if (std::filesystem::is_directory(folder, ec))
+            {
+                folders.push_back(std::move(folder));
+            }
+        }
+        if (!folders.empty())
+        {
+            if (OpenPlaylist(folders))
+            {
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+        }
+        else if (fileCount > 0)
+        {
+            // 複数ファイルは先頭のみ読み込む（必要なら後で拡張）
+            UINT pathLength = DragQueryFileW(drop, 0, nullptr, 0);
+            if (pathLength > 0)
+            {
+                std::wstring path(pathLength + 1, L'\0');
+                DragQueryFileW(drop, 0, path.data(), pathLength + 1);
+                path.resize(pathLength);
+                if (IsArchiveFile(path))
+                {
+                    if (OpenArchiveCatalog(path) && LoadImageByIndex(0))
+                    {
+                        InvalidateRect(hwnd, nullptr, TRUE);
+                    }
+                }
+                else if (IsMarkdownFile(path))
+                {
+                    if (LoadMarkdownFromFile(path.c_str()))
+                    {
+                        RefreshImageList(path);
+                        ApplyWindowPositionModeAfterContentLoad(hwnd);
+                        InvalidateRect(hwnd, nullptr, TRUE);
+                    }
+                }
+                else if (IsHtmlFile(path))
+                {
+                    if (LoadHtmlFromFile(path.c_str()))
+                    {
+                        RefreshImageList(path);
+                        ApplyWindowPositionModeAfterContentLoad(hwnd);
+                        InvalidateRect(hwnd, nullptr, TRUE);
+                    }
+                }
+                else if (IsTextFile(path))
+                {
+                    if (LoadTextFromFile(path.c_str()))
+                    {
+                        RefreshImageList(path);
+                        ApplyWindowPositionModeAfterContentLoad(hwnd);
+                        InvalidateRect(hwnd, nullptr, TRUE);
+                    }
+                }
+                else if (LoadImageFromFile(path.c_str()))
+                {
+                    RefreshImageList(path);
+                    UpdateZoomToFitScreen(hwnd);
+                    ApplyWindowPositionModeAfterContentLoad(hwnd);
+                    InvalidateRect(hwnd, nullptr, TRUE);
+                }
+            }
+        }
+        DragFinish(drop);
+        return 0;
+    }
+
+    case WM_CONTEXTMENU:
+    {
+        HMENU menu = CreatePopupMenu();
+        AppendMenu(menu, MF_STRING, kMenuOpen, L"Open...");
+        AppendMenu(menu, MF_STRING, kMenuOpenFolder, L"Open Folder...");
+        AppendMenu(menu, MF_STRING, kMenuReload, L"Reload");
+        AppendMenu(menu, MF_STRING, kMenuFollowText, L"Follow File");
+        AppendMenu(menu, MF_STRING, kMenuOutline, L"Outline...");
+        AppendMenu(menu, MF_STRING, kMenuMinimize, L"Minimize");
+        AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
+        AppendMenu(menu, MF_STRING, kMenuPrev, L"Previous");
+        AppendMenu(menu, MF_STRING, kMenuNext, L"Next");
+        AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
+        AppendMenu(menu, MF_STRING, kMenuZoomIn, L"Zoom In");
+        AppendMenu(menu, MF_STRING, kMenuZoomOut, L"Zoom Out");
+        AppendMenu(menu, MF_STRING, kMenuOriginalSize, L"Original Size");
+        AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
+        AppendMenu(menu, MF_STRING, kMenuAlwaysOnTop, L"Always on Top");
+        AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
+        AppendMenu(menu, MF_STRING, kMenuSortNameAsc, L"Sort: Name (A-Z)");
+        AppendMenu(menu, MF_STRING, kMenuSortNameDesc, L"Sort: Name (Z-A)");
+        AppendMenu(menu, MF_STRING, kMenuSortTimeAsc, L"Sort: Modified (Old-New)");
+        AppendMenu(menu, MF_STRING, kMenuSortTimeDesc, L"Sort: Modified (New-Old)");
+        AppendMenu(menu, MF_STRING, kMenuSortNatural, L"Sort: Name (Natural)");
+        AppendMenu(menu, MF_STRING, kMenuSortSizeAsc, L"Sort: Size (Small-Large)");
+        AppendMenu(menu, MF_STRING, kMenuSortDimensionsAsc, L"Sort: Dimensions (Small-Large)");
+        AppendMenu(menu, MF_STRING, kMenuSortDateTakenAsc, L"Sort: Date Taken (Old-New)");
+        AppendMenu(menu, MF_STRING, kMenuSortImageOnly, L"Sort: Image only");
+        AppendMenu(menu, MF_STRING, kMenuFilterAnimated, L"Filter: Animated only");
+        AppendMenu(menu, MF_STRING, kMenuFilterAlpha, L"Filter: Has alpha");
+        AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
+        AppendMenu(menu, MF_STRING, kMenuSettings, L"Settings");
+        AppendMenu(menu, MF_STRING, kMenuAbout, L"About");
+        AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
+        AppendMenu(menu, MF_STRING, kMenuExit, L"Exit");
+
+        if (g_catalog.entries.size() < 2)
+        {
+            EnableMenuItem(menu, kMenuPrev, MF_BYCOMMAND | MF_GRAYED);
+            EnableMenuItem(menu, kMenuNext, MF_BYCOMMAND | MF_GRAYED);
+        }
+
+        CheckMenuItem(menu, kMenuSortNameAsc, MF_BYCOMMAND | (g_sortMode == SortMode::NameAsc ? MF_CHECKED : MF_UNCHECKED));
+        CheckMenuItem(menu, kMenuSortNameDesc, MF_BYCOMMAND | (g_sortMode == SortMode::NameDesc ? MF_CHECKED : MF_UNCHECKED));
+        CheckMenuItem(menu, kMenuSortTimeAsc, MF_BYCOMMAND | (g_sortMode == SortMode::TimeAsc ? MF_CHECKED : MF_UNCHECKED));
+        CheckMenuItem(menu, kMenuSortTimeDesc, MF_BYCOMMAND | (g_sortMode == SortMode::TimeDesc ? MF_CHECKED : MF_UNCHECKED));
+        CheckMenuItem(menu, kMenuSortNatural, MF_BYCOMMAND | (g_sortMode == SortMode::NaturalAsc ? MF_CHECKED : MF_UNCHECKED));
+        CheckMenuItem(menu, kMenuSortSizeAsc, MF_BYCOMMAND | (g_sortMode == SortMode::SizeAsc ? MF_CHECKED : MF_UNCHECKED));
+        CheckMenuItem(menu, kMenuSortDimensionsAsc, MF_BYCOMMAND | (g_sortMode == SortMode::DimensionsAsc ? MF_CHECKED : MF_UNCHECKED));
+        CheckMenuItem(menu, kMenuSortDateTakenAsc, MF_BYCOMMAND | (g_sortMode == SortMode::DateTakenAsc ? MF_CHECKED : MF_UNCHECKED));
+        CheckMenuItem(menu, kMenuSortImageOnly, MF_BYCOMMAND | (g_sortImageOnly ? MF_CHECKED : MF_UNCHECKED));
+        CheckMenuItem(menu, kMenuFilterAnimated, MF_BYCOMMAND | (g_filterAnimatedOnly ? MF_CHECKED : MF_UNCHECKED));
+        CheckMenuItem(menu, kMenuFilterAlpha, MF_BYCOMMAND | (g_filterAlphaOnly ? MF_CHECKED : MF_UNCHECKED));
+        CheckMenuItem(menu, kMenuAlwaysOnTop, MF_BYCOMMAND | (g_alwaysOnTop ? MF_CHECKED : MF_UNCHECKED));
+        CheckMenuItem(menu, kMenuFollowText, MF_BYCOMMAND | (g_textFollow ? MF_CHECKED : MF_UNCHECKED));
+        if (!g_hasText)
+        {
+            EnableMenuItem(menu, kMenuFollowText, MF_BYCOMMAND | MF_GRAYED);
+        }
+        if (!g_liveMarkdownPage || g_liveMarkdownPage->headings.empty())
+        {
+            EnableMenuItem(menu, kMenuOutline, MF_BYCOMMAND | MF_GRAYED);
+        }
+
+        POINT pt{ GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+        RefreshMenuTheme();
+        TrackPopupMenu(menu, TPM_RIGHTBUTTON, pt.x, pt.y, 0, hwnd, nullptr);
+        DestroyMenu(menu);
+        return 0;
+    }
+
+    case WM_COMMAND:
+    {
+        switch (LOWORD(wParam))
+        {
+        case kMenuOpen:
+            if (ShowOpenImageDialog(hwnd))
+            {
+                if (g_bitmap && !g_hasHtml)
+                {
+                    UpdateZoomToFitScreen(hwnd);
+                }
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            return 0;
+        case kMenuOpenFolder:
+            if (ShowOpenFolderDialog(hwnd))
+            {
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            return 0;
+        case kMenuPrev:
+            NavigateImage(-1);
+            return 0;
+        case kMenuNext:
+            NavigateImage(1);
+            return 0;
+        case kMenuZoomIn:
+        {
+            if (g_hasHtml)
+            {
+                HandleHtmlOverlayShortcutKeyDown(g_keyZoomIn);
+                return 0;
+            }
+            POINT pt{};
+            GetCursorPos(&pt);
+            AdjustZoom(1.1f, pt);
+            InvalidateRect(hwnd, nullptr, TRUE);
+            return 0;
+        }
+        case kMenuZoomOut:
+        {
+            if (g_hasHtml)
+            {
+                HandleHtmlOverlayShortcutKeyDown(g_keyZoomOut);
+                return 0;
+            }
+            POINT pt{};
+            GetCursorPos(&pt);
+            AdjustZoom(1.0f / 1.1f, pt);
+            InvalidateRect(hwnd, nullptr, TRUE);
+            return 0;
+        }
+        case kMenuOriginalSize:
+            if (g_hasHtml)
+            {
+                HandleHtmlOverlayShortcutKeyDown(g_keyOriginalSize);
+                return 0;
+            }
+            g_fitToWindow = false;
+            g_zoom = 1.0f;
+            UpdateWindowToZoomedImage();
+            InvalidateRect(hwnd, nullptr, TRUE);
+            return 0;
+        case kMenuAlwaysOnTop:
+            g_alwaysOnTop = !g_alwaysOnTop;
+            ApplyAlwaysOnTop();
+            SaveSettings();
+            return 0;
+        case kMenuMinimize:
+            ShowWindow(hwnd, SW_MINIMIZE);
+            return 0;
+        case kMenuSettings:
+            ShowSettingsDialog(hwnd);
+            return 0;
+        case kMenuAbout:
+            ShowAboutDialog(hwnd);
+            return 0;
+        case kMenuReload:
+            ReloadCurrentFile(true);
+            return 0;
+        case kMenuOutline:
+            ShowMarkdownOutlineDialog(hwnd);
+            return 0;
+        case kMenuFollowText:
+            g_textFollow = !g_textFollow;
+            UpdateTextFollowWatcher();
+            if (g_textFollow && g_hasText)
+            {
+                RefreshFollowedTextDocument();
+                ScrollTextToEnd();
+                InvalidateRect(hwnd, nullptr, FALSE);
+            }
+            SaveSettings();
+            return 0;
+        case kMenuExit:
+            DestroyWindow(hwnd);
+            return 0;
+        case kMenuSortNameAsc:
+            g_sortMode = SortMode::NameAsc;
+            if (!g_currentImagePath.empty())
+            {
+                RefreshImageList(g_currentImagePath);
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            SaveSettings();
+            return 0;
+        case kMenuSortNameDesc:
+            g_sortMode = SortMode::NameDesc;
+            if (!g_currentImagePath.empty())
+            {
+                RefreshImageList(g_currentImagePath);
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            SaveSettings();
+            return 0;
+        case kMenuSortTimeAsc:
+            g_sortMode = SortMode::TimeAsc;
+            if (!g_currentImagePath.empty())
+            {
+                RefreshImageList(g_currentImagePath);
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            SaveSettings();
+            return 0;
+        case kMenuSortTimeDesc:
+            g_sortMode = SortMode::TimeDesc;
+            if (!g_currentImagePath.empty())
+            {
+                RefreshImageList(g_currentImagePath);
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            SaveSettings();
+            return 0;
+        case kMenuSortNatural:
+            g_sortMode = SortMode::NaturalAsc;
+            if (!g_currentImagePath.empty())
+            {
+                RefreshImageList(g_currentImagePath);
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            SaveSettings();
+            return 0;
+        case kMenuSortSizeAsc:
+            g_sortMode = SortMode::SizeAsc;
+            if (!g_currentImagePath.empty())
+            {
+                RefreshImageList(g_currentImagePath);
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            SaveSettings();
+            return 0;
+        case kMenuSortDimensionsAsc:
+            g_sortMode = SortMode::DimensionsAsc;
+            if (!g_currentImagePath.empty())
+            {
+                RefreshImageList(g_currentImagePath);
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            SaveSettings();
+            return 0;
+        case kMenuSortDateTakenAsc:
+            g_sortMode = SortMode::DateTakenAsc;
+            if (!g_currentImagePath.empty())
+            {
+                RefreshImageList(g_currentImagePath);
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            SaveSettings();
+            return 0;
+        case kMenuFilterAnimated:
+            g_filterAnimatedOnly = !g_filterAnimatedOnly;
+            SaveSettings();
+            return 0;
+        case kMenuFilterAlpha:
+            g_filterAlphaOnly = !g_filterAlphaOnly;
+            SaveSettings();
+            return 0;
+        case kMenuSortImageOnly:
+            g_sortImageOnly = !g_sortImageOnly;
+            if (!g_currentImagePath.empty())
+            {
+                RefreshImageList(g_currentImagePath);
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            SaveSettings();
+            return 0;
+        }
+        break;
+    }
+
+    case WM_MOUSEWHEEL:
+    {
+        if (g_hasHtml)
+        {
+            WORD inputKey = GetHtmlInputVirtualKey();
+            bool keyDown = (GetKeyState(inputKey) & 0x8000) != 0;
+            if (keyDown && g_webviewWindow)
+            {
+                WPARAM adjustedWParam = wParam;
+                if (inputKey == VK_SHIFT)
+                {
+                    WORD keyState = GET_KEYSTATE_WPARAM(wParam);
+                    adjustedWParam = MAKEWPARAM(keyState & ~MK_SHIFT, GET_WHEEL_DELTA_WPARAM(wParam));
+                }
+                SendMessageW(g_webviewWindow, WM_MOUSEWHEEL, adjustedWParam, lParam);
+                return 0;
+            }
+            return DefWindowProc(hwnd, msg, wParam, lParam);
+        }
+        if (!g_bitmap && !g_hasText)
+        {
+            return 0;
+        }
+        int delta = GET_WHEEL_DELTA_WPARAM(wParam);
+        float steps = static_cast<float>(delta) / WHEEL_DELTA;
+        if (g_hasText)
+        {
+            ScrollTextBy(-steps * 40.0f);
+            InvalidateRect(hwnd, nullptr, TRUE);
+        }
+        else
+        {
+            float factor = std::pow(1.1f, steps);
+            POINT pt{};
+            GetCursorPos(&pt);
+            AdjustZoom(factor, pt);
+            InvalidateRect(hwnd, nullptr, TRUE);
+        }
+        return 0;
+    }
+
+    case WM_XBUTTONUP:
+    {
+        if (GET_XBUTTON_WPARAM(wParam) == XBUTTON1)
+        {
+            NavigateImage(-1);
+            return 0;
+        }
+        if (GET_XBUTTON_WPARAM(wParam) == XBUTTON2)
+        {
+            NavigateImage(1);
+            return 0;
+        }
+        break;
+    }
+
+    case WM_LBUTTONDOWN:
+    {
+        POINT pt{ GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+        RECT rc{};
+        GetClientRect(hwnd, &rc);
+        bool nearEdge = pt.x <= g_edgeDragMargin || pt.y <= g_edgeDragMargin
+            || pt.x >= (rc.right - g_edgeDragMargin) || pt.y >= (rc.bottom - g_edgeDragMargin);
+        if (nearEdge && (g_bitmap || g_hasText || g_hasHtml))
+        {
+            g_fitToWindow = false;
+            g_isEdgeDragging = true;
+            g_dragStartPoint = pt;
+            g_dragStartZoom = g_zoom;
+            g_dragStartScale = std::max(1.0f, (std::min)(static_cast<float>(rc.right - rc.left), static_cast<float>(rc.bottom - rc.top)));
+            g_dragStartWidth = static_cast<float>(rc.right - rc.left);
+            g_dragStartHeight = static_cast<float>(rc.bottom - rc.top);
+            if (g_bitmap)
+            {
+                UpdateWindowToZoomedImage();
+            }
+            SetCapture(hwnd);
+            return 0;
+        }
+        POINT cursor{};
+        if (GetCursorPos(&cursor))
+        {
+            RECT windowRect{};
+            if (GetWindowRect(hwnd, &windowRect))
+            {
+                g_isWindowDragging = true;
+                g_windowDragStartCursor = cursor;
+                g_windowDragStartPos = POINT{ windowRect.left, windowRect.top };
+                SetCapture(hwnd);
+                return 0;
+            }
+        }
+        return 0;
+    }
+
+    case WM_MOUSEMOVE:
+    {
+        if (g_isEdgeDragging && (wParam & MK_LBUTTON))
+        {
+            POINT pt{ GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+            float deltaX = static_cast<float>(pt.x - g_dragStartPoint.x);
+            float deltaY = static_cast<float>(pt.y - g_dragStartPoint.y);
+            if (g_hasText || g_hasHtml)
+            {
+                float nextWidth = std::max(200.0f, g_dragStartWidth + deltaX);
+                float nextHeight = std::max(200.0f, g_dragStartHeight + deltaY);
+                SetWindowPos(hwnd, nullptr, 0, 0, static_cast<int>(nextWidth), static_cast<int>(nextHeight),
+                    SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE);
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            else
+            {
+                float nextScale = std::max(1.0f, g_dragStartScale + deltaY);
+                float zoom = (g_dragStartScale > 0.0f) ? (g_dragStartZoom * (nextScale / g_dragStartScale)) : g_dragStartZoom;
+                g_zoom = std::max(g_zoomMin, (std::min)(zoom, g_zoomMax));
+                UpdateWindowToZoomedImage();
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+        }
+        else if (g_isWindowDragging && (wParam & MK_LBUTTON))
+        {
+            POINT cursor{};
+            if (GetCursorPos(&cursor))
+            {
+                int nextX = g_windowDragStartPos.x + (cursor.x - g_windowDragStartCursor.x);
+                int nextY = g_windowDragStartPos.y + (cursor.y - g_windowDragStartCursor.y);
+                SetWindowPos(hwnd, nullptr, nextX, nextY, 0, 0, SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE);
+            }
+        }
+        else
+        {
+            POINT pt{ GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+            RECT rc{};
+            GetClientRect(hwnd, &rc);
+            bool nearEdge = pt.x <= g_edgeDragMargin || pt.y <= g_edgeDragMargin
+                || pt.x >= (rc.right - g_edgeDragMargin) || pt.y >= (rc.bottom - g_edgeDragMargin);
+            SetCursor(LoadCursor(nullptr, nearEdge ? IDC_SIZENWSE : IDC_ARROW));
+        }
+        return 0;
+    }
+
+    case WM_LBUTTONUP:
+    {
+        if (g_isEdgeDragging || g_isWindowDragging)
+        {
+            g_isEdgeDragging = false;
+            g_isWindowDragging = false;
+            ReleaseCapture();
+        }
+        return 0;
+    }
+
+    case WM_KEYDOWN:
+    {
+        WORD key = static_cast<WORD>(wParam);
+        bool handled = false;
+
+        if (key == g_keyExit)
+        {
+            DestroyWindow(hwnd);
+            handled = true;
+        }
+        else if (key == g_keyAlwaysOnTop)
+        {
+            g_alwaysOnTop = !g_alwaysOnTop;
+            ApplyAlwaysOnTop();
+            SaveSettings();
+            handled = true;
+        }
+        else if (key == g_keyMinimize)
+        {
+            ShowWindow(hwnd, SW_MINIMIZE);
+            handled = true;
+        }
+        else if (key == g_keyReload)
+        {
+            ReloadCurrentFile(true);
+            handled = true;
+        }
+        else if (key == g_keyOpenFile)
+        {
+            if (ShowOpenImageDialog(hwnd))
+            {
+                if (g_bitmap && !g_hasHtml)
+                {
+                    UpdateZoomToFitScreen(hwnd);
+                }
+                InvalidateRect(hwnd, nullptr, TRUE);
+            }
+            handled = true;
+        }
+        else if (key == g_keyNextFile && !g_catalog.entries.empty())
+        {
+            NavigateImage(1);
+            handled = true;
+        }
+        else if (key == g_keyPrevFile && !g_catalog.entries.empty())
+        {
+            NavigateImage(-1);
+            handled = true;
+        }
+
+        if (g_hasHtml)
+        {
+            WORD inputKey = GetHtmlInputVirtualKey();
+            if (wParam == inputKey)
+            {
+                UpdateWebViewInputState();
+                return 0;
+            }
+
+            if (handled)
+            {
+                return 0;
+            }
+
+            if (HandleHtmlOverlayShortcutKeyDown(key))
+            {
+                return 0;
+            }
+
+            HandleHtmlOverlayKeyDown(wParam);
+            return 0;
+        }
+
+        if (handled)
+        {
+            return 0;
+        }
+        if ((key == g_keyZoomIn || key == g_keyZoomOut) && g_hasText)
+        {
+            float delta = (key == g_keyZoomIn) ? -40.0f : 40.0f;
+            ScrollTextBy(delta);
+            InvalidateRect(hwnd, nullptr, TRUE);
+            return 0;
+        }
+        if (g_hasText && HandleTextViewKeyDown(wParam))
+        {
+            return 0;
+        }
+        if ((key == g_keyZoomIn || key == g_keyZoomOut) && g_bitmap)
+        {
+            float factor = (key == g_keyZoomIn) ? 1.1f : (1.0f / 1.1f);
+            POINT pt{};
+            GetCursorPos(&pt);
+            AdjustZoom(factor, pt);
+            InvalidateRect(hwnd, nullptr, TRUE);
+            return 0;
+        }
+        if (key == g_keyOriginalSize && g_bitmap)
+        {
+            g_fitToWindow = false;
+            g_zoom = 1.0f;
+            UpdateWindowToZoomedImage();
+            InvalidateRect(hwnd, nullptr, TRUE);
+            return 0;
+        }
+        if (wParam == VK_ADD || wParam == VK_OEM_PLUS)
+        {
+            POINT pt{};
+            GetCursorPos(&pt);
+            AdjustZoom(1.1f, pt);
+            InvalidateRect(hwnd, nullptr, TRUE);
+            return 0;
+        }
+        if (wParam == VK_SUBTRACT || wParam == VK_OEM_MINUS)
+        {
+            POINT pt{};
+            GetCursorPos(&pt);
+            AdjustZoom(1.0f / 1.1f, pt);
+            InvalidateRect(hwnd, nullptr, TRUE);
+            return 0;
+        }
+        if ((GetKeyState(VK_CONTROL) & 0x8000) && wParam == '0')
+        {
+            SetFitToWindow(true);
+            InvalidateRect(hwnd, nullptr, TRUE);
+            return 0;
+        }
+        if ((GetKeyState(VK_CONTROL) & 0x8000) && wParam == '1')
+        {
+            g_fitToWindow = false;
+            g_zoom = 1.0f;
+            InvalidateRect(hwnd, nullptr, TRUE);
+            return 0;
+        }
+        return 0;
+    }
+
+    case WM_KEYUP:
+    {
+        if (g_hasHtml)
+        {
+            WORD inputKey = GetHtmlInputVirtualKey();
+            if (wParam == inputKey)
+            {
+                UpdateWebViewInputState();
+            }
+            return 0;
+        }
+        return 0;
+    }
+
+    case WM_SYSKEYDOWN:
+    case WM_SYSKEYUP:
+    {
+        if (g_hasHtml)
+        {
+            WORD inputKey = GetHtmlInputVirtualKey();
+            if (wParam == inputKey)
+            {
+                UpdateWebViewInputState();
+            }
+            return 0;
+        }
+        break;
+    }
+
+    case WM_TIMER:
+    {
+        if (wParam == kWebViewInputTimerId)
+        {
+            if (g_hasHtml)
+            {
+                UpdateWebViewInputState();
+            }
+            else
+            {
+                UpdateWebViewInputTimer();
+            }
+            return 0;
+        }
+        if (wParam == kAnimationTimerId)
+        {
+            UpdateAnimationPlayback();
+            return 0;
+        }
+        if (wParam == kTextFollowPollTimerId)
+        {
+            RefreshFollowedTextDocument();
+            return 0;
+        }
+        break;
+    }
+
+    case kMessageTextIndexProgress:
+    {
+        if (g_hasText)
+        {
+            ApplyPendingTextScrollToEnd();
+            InvalidateRect(hwnd, nullptr, FALSE);
+        }
+        return 0;
+    }
+
+    case kMessageTextFileChanged:
+    {
+        g_textFileWatcher.changePosted = false;
+        RefreshFollowedTextDocument();
+        return 0;
+    }
+
+    case kMessageDirectoryChanged:
+    {
+        ApplyDirectoryChanges();
+        return 0;
+    }
+
+    case kMessageCatalogBatch:
+    {
+        MergeCatalogScanResults();
+        return 0;
+    }
+
+    case kMessageMetadataBatch:
+    {
+        MergeCatalogMetadata();
+        return 0;
+    }
+
+    case WM_FONTCHANGE:
+    {
+        InvalidateFontCatalog();
+        return 0;
+    }
+
+    case WM_DESTROY:
+    {
+        CloseWebView();
+        SaveWindowPlacement();
+        SaveSettings();
+        PostQuitMessage(0);
+        return 0;
+    }
+
+    default:
+        break;
+    }
+
+    return DefWindowProc(hwnd, msg, wParam, lParam);
+}
+
+// =====================
+// Direct2D 初期化
+// =====================
+bool InitDirect2D(HWND hwnd)
+{
+    if (FAILED(D2D1CreateFactory(
+        D2D1_FACTORY_TYPE_SINGLE_THREADED,
+        &g_d2dFactory)))
+    {
+        return false;
+    }
+
+    RECT rc;
+    GetClientRect(hwnd, &rc);
+
+    if (FAILED(g_d2dFactory->CreateHwndRenderTarget(
+        D2D1::RenderTargetProperties(),
+        D2D1::HwndRenderTargetProperties(
+            hwnd,
+            D2D1::SizeU(
+                rc.right - rc.left,
+                rc.bottom - rc.top
+            )
+        ),
+        &g_renderTarget)))
+    {
+        return false;
+    }
+
+    g_renderTarget->SetDpi(96.0f, 96.0f);
+
+    if (FAILED(g_renderTarget->CreateSolidColorBrush(
+        D2D1::ColorF(0.992f, 0.992f, 0.992f),
+        &g_placeholderBrush)))
+    {
+        return false;
+    }
+
+    UpdateCustomColorBrush();
+    UpdateTextBrush();
+
+    return true;
+}
+
+bool EnsureCheckerPatternBrush()
+{
+    if (g_checkerPatternBrush)
+    {
+        return true;
+    }
+    if (!g_renderTarget)
+    {
+        return false;
+    }
+
+    std::array<uint32_t, kCheckerTileSize * kCheckerTileSize> pixels = MakeCheckerTile();
+    ID2D1Bitmap* tile = nullptr;
+    HRESULT hr = g_renderTarget->CreateBitmap(
+        D2D1::SizeU(kCheckerTileSize, kCheckerTileSize),
+        pixels.data(),
+        kCheckerTileSize * 4,
+        D2D1::BitmapProperties(
+            D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)
+        ),
+        &tile
+    );
+    if (FAILED(hr))
+    {
+        return false;
+    }
+
+    hr = g_renderTarget->CreateBitmapBrush(
+        tile,
+        D2D1::BitmapBrushProperties(
+            D2D1_EXTEND_MODE_WRAP,
+            D2D1_EXTEND_MODE_WRAP,
+            D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR
+        ),
+        &g_checkerPatternBrush
+    );
+    tile->Release();
+    return SUCCEEDED(hr);
+}
+
+void DiscardRenderTarget()
+{
+    StopAnimationPlayback();
+    ClearAnimationFrames();
+
+    if (g_placeholderBrush)
+    {
+        g_placeholderBrush->Release();
+        g_placeholderBrush = nullptr;
+    }
+    if (g_checkerPatternBrush)
+    {
+        g_checkerPatternBrush->Release();
+        g_checkerPatternBrush = nullptr;
+    }
+    if (g_customColorBrush)
+    {
+        g_customColorBrush->Release();
+        g_customColorBrush = nullptr;
+    }
+    if (g_textBrush)
+    {
+        g_textBrush->Release();
+        g_textBrush = nullptr;
+    }
+    if (g_bitmap)
+    {
+        g_bitmap->Release();
+        g_bitmap = nullptr;
+    }
+    if (g_renderTarget)
+    {
+        g_renderTarget->Release();
+        g_renderTarget = nullptr;
+    }
+    if (g_wicSourceStraight)
+    {
+        g_wicSourceStraight->Release();
+        g_wicSourceStraight = nullptr;
+    }
+    if (g_wicSourcePremultiplied)
+    {
+        g_wicSourcePremultiplied->Release();
+        g_wicSourcePremultiplied = nullptr;
+    }
+    ReleaseLayeredSurfaceCache();
+    g_imageWidth = 0;
+    g_imageHeight = 0;
+    g_currentFrameWidth = 0;
+    g_currentFrameHeight = 0;
+    g_imageHasAlpha = false;
+}
+
+void CleanupResources()
+{
+    DiscardRenderTarget();
+    CloseWebView();
+    CloseTextDocument();
+    StopCatalogScan();
+    StopCatalogWatcher();
+    StopArchivePrefetch();
+    StopMetadataIndexer();
+    SaveMetadataCache();
+    StopFontCatalog();
+    g_catalog.archive.reset();
+    ClearMarkdownHtmlCache(g_markdownHtmlCache);
+
+    if (g_placeholderFormat)
+    {
+        g_placeholderFormat->Release();
+        g_placeholderFormat = nullptr;
+    }
+    if (g_textFormat)
+    {
+        g_textFormat->Release();
+        g_textFormat = nullptr;
+    }
+    if (g_dwriteFactory)
+    {
+        g_dwriteFactory->Release();
+        g_dwriteFactory = nullptr;
+    }
+    if (g_wicFactory)
+    {
+        g_wicFactory->Release();
+        g_wicFactory = nullptr;
+    }
+    if (g_d2dFactory)
+    {
+        g_d2dFactory->Release();
+        g_d2dFactory = nullptr;
+    }
+}
+
+// =====================
+// WIC 初期化
+// =====================
+bool InitWIC()
+{
+    HRESULT hr = CoCreateInstance(
+        CLSID_WICImagingFactory,
+        nullptr,
+        CLSCTX_INPROC_SERVER,
+        IID_PPV_ARGS(&g_wicFactory)
+    );
+    return SUCCEEDED(hr);
+}
+
+// =====================
+// DirectWrite 初期化
+// =====================
+bool InitDirectWrite()
+{
+    HRESULT hr = DWriteCreateFactory(
+        DWRITE_FACTORY_TYPE_SHARED,
+        __uuidof(IDWriteFactory),
+        reinterpret_cast<IUnknown**>(&g_dwriteFactory)
+    );
+    if (FAILED(hr))
+    {
+        return false;
+    }
+
+    hr = g_dwriteFactory->CreateTextFormat(
+        L"Segoe UI",
+        nullptr,
+        DWRITE_FONT_WEIGHT_REGULAR,
+        DWRITE_FONT_STYLE_NORMAL,
+        DWRITE_FONT_STRETCH_NORMAL,
+        24.0f,
+        L"ja-jp",
+        &g_placeholderFormat
+    );
+    if (FAILED(hr))
+    {
+        return false;
+    }
+
+    g_placeholderFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_CENTER);
+    g_placeholderFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
+
+    UpdateTextFormat();
+
+    return true;
+}
+
+// DirectWrite is created the first time something draws text: a text document, the placeholder
+// or the font dialog. Sessions that only show images never load it.
+bool EnsureDirectWrite()
+{
+    return g_dwriteFactory || InitDirectWrite();
+}
+
+void ClearAnimationFrames()
+{
+    for (IWICBitmapSource* source : g_animationFramesStraight)
+    {
+        if (source)
+        {
+            source->Release();
+        }
+    }
+    g_animationFramesStraight.clear();
+
+    for (IWICBitmapSource* source : g_animationFramesPremultiplied)
+    {
+        if (source)
+        {
+            source->Release();
+        }
+    }
+    g_animationFramesPremultiplied.clear();
+    g_animationPlayback.frameDelaysMs.clear();
+    g_animationFrameWidths.clear();
+    g_animationFrameHeights.clear();
+    g_animationFrameDirtyRects.clear();
+    g_animationSurface = AnimationSurface{};
+    g_animationFrameIndex = 0;
+    g_currentFrameWidth = 0;
+    g_currentFrameHeight = 0;
+}
+
+void StopAnimationPlayback()
+{
+    AnimationPlayback& playback = g_animationPlayback;
+    if (playback.playing && g_hwnd)
+    {
+        KillTimer(g_hwnd, kAnimationTimerId);
+    }
+    playback.playing = false;
+    playback.suspended = false;
+    if (playback.skippedFrames > 0)
+    {
+        wchar_t message[96]{};
+        _snwprintf_s(message, _TRUNCATE, L"FloatVision: animation skipped %zu frames\n", playback.skippedFrames);
+        OutputDebugStringW(message);
+        playback.skippedFrames = 0;
+    }
+}
+
+void StartAnimationPlayback()
+{
+    // One delay is recorded per decoded frame, so the timeline plays when there are two or more.
+    StartAnimationTimeline(g_animationPlayback, g_animationFrameIndex, GetTickCount64());
+    if (g_animationPlayback.playing && g_hwnd)
+    {
+        UpdateAnimationPlayback();
+    }
+}
+
+static bool IsWindowCloaked(HWND hwnd)
+{
+    DWORD cloaked = 0;
+    return SUCCEEDED(DwmGetWindowAttribute(hwnd, DWMWA_CLOAKED, &cloaked, sizeof(cloaked))) && cloaked != 0;
+}
+
+// Asked on every animation tick, so only window state: shown, not minimized, not cloaked, and on
+// a monitor.
+bool IsAnimationWindowShown(HWND hwnd)
+{
+    if (!hwnd || !IsWindowVisible(hwnd) || IsIconic(hwnd) || IsWindowCloaked(hwnd))
+    {
+        return false;
+    }
+    RECT windowRect{};
+    return GetWindowRect(hwnd, &windowRect) && !IsRectEmpty(&windowRect)
+        && MonitorFromRect(&windowRect, MONITOR_DEFAULTTONULL) != nullptr;
+}
+
+// Walks the z-order, so TickAnimationTimeline asks it only every kAnimationOcclusionCheckMs.
+bool IsAnimationWindowUncovered(HWND hwnd)
+{
+    RECT windowRect{};
+    if (!GetWindowRect(hwnd, &windowRect))
+    {
+        return true;
+    }
+
+    // Subtract every opaque window above us; nothing left means fully covered.
+    HRGN uncovered = CreateRectRgnIndirect(&windowRect);
+    if (!uncovered)
+    {
+        return true;
+    }
+    bool visible = true;
+    for (HWND above = GetWindow(hwnd, GW_HWNDPREV); above; above = GetWindow(above, GW_HWNDPREV))
+    {
+        if (!IsWindowVisible(above) || IsIconic(above) || IsWindowCloaked(above))
+        {
+            continue;
+        }
+        LONG_PTR exStyle = GetWindowLongPtr(above, GWL_EXSTYLE);
+        if ((exStyle & (WS_EX_LAYERED | WS_EX_TRANSPARENT)) != 0)
+        {
+            continue;
+        }
+        RECT aboveRect{};
+        if (!GetWindowRect(above, &aboveRect))
+        {
+            continue;
+        }
+        HRGN aboveRegion = CreateRectRgnIndirect(&aboveRect);
+        if (!aboveRegion)
+        {
+            continue;
+        }
+        int result = CombineRgn(uncovered, uncovered, aboveRegion, RGN_DIFF);
+        DeleteObject(aboveRegion);
+        if (result == NULLREGION)
+        {
+            visible = false;
+            break;
+        }
+    }
+    DeleteObject(uncovered);
+    return visible;
+}
+
+// Runs on every animation timer tick, and when the window is minimized or restored. The timer
+// either waits out the shown frame or, while the window cannot be seen, polls for it to return.
+void UpdateAnimationPlayback()
+{
+    AnimationPlayback& playback = g_animationPlayback;
+    if (!playback.playing || g_animationFramesPremultiplied.size() < 2 || !g_bitmap || !g_hwnd)
+    {
+        StopAnimationPlayback();
+        return;
+    }
+    const AnimationVisibility visibility{
+        []() { return IsAnimationWindowShown(g_hwnd); },
+        []() { return IsAnimationWindowUncovered(g_hwnd); }
+    };
+    AnimationTick tick = TickAnimationTimeline(playback, GetTickCount64(), visibility);
+    if (!tick.suspended && tick.frame != g_animationFrameIndex)
+    {
+        // Only the due frame is decoded, however many were passed over.
+        if (!SetCurrentAnimationFrame(tick.frame))
+        {
+            StopAnimationPlayback();
+            return;
+        }
+        InvalidateRect(g_hwnd, nullptr, TRUE);
+    }
+    SetTimer(g_hwnd, kAnimationTimerId, (std::max)(tick.waitMs, static_cast<UINT>(USER_TIMER_MINIMUM)), nullptr);
+}
+
+bool SetCurrentAnimationFrame(size_t frameIndex)
+{
+    if (frameIndex >= g_animationFramesStraight.size() || frameIndex >= g_animationFramesPremultiplied.size()
+        || frameIndex >= g_animationFrameWidths.size() || frameIndex >= g_animationFrameHeights.size())
+    {
+        return false;
+    }
+
+    IWICBitmapSource* straight = g_animationFramesStraight[frameIndex];
+    IWICBitmapSource* premultiplied = g_animationFramesPremultiplied[frameIndex];
+    if (!straight || !premultiplied)
+    {
+        return false;
+    }
+
+    if (g_wicSourceStraight)
+    {
+        g_wicSourceStraight->Release();
+        g_wicSourceStraight = nullptr;
+    }
+    if (g_wicSourcePremultiplied)
+    {
+        g_wicSourcePremultiplied->Release();
+        g_wicSourcePremultiplied = nullptr;
+    }
+    ReleaseLayeredSurfaceCache();
+
+    g_wicSourceStraight = straight;
+    g_wicSourceStraight->AddRef();
+    g_wicSourcePremultiplied = premultiplied;
+    g_wicSourcePremultiplied->AddRef();
+
+    UINT frameWidth = g_animationFrameWidths[frameIndex];
+    UINT frameHeight = g_animationFrameHeights[frameIndex];
+
+    if (!g_bitmap)
+    {
+        g_animationSurface.valid = false;
+    }
+    const AnimationSurfaceBackend backend{
+        [](size_t frame)
+        {
+            if (g_bitmap)
+            {
+                g_bitmap->Release();
+                g_bitmap = nullptr;
+            }
+            D2D1_BITMAP_PROPERTIES bitmapProperties = D2D1::BitmapProperties(
+                D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)
+            );
+            return SUCCEEDED(g_renderTarget->CreateBitmapFromWicBitmap(g_animationFramesPremultiplied[frame], &bitmapProperties, &g_bitmap));
+        },
+        [](size_t frame, const CanvasRect& rect, uint32_t stride, uint8_t* pixels)
+        {
+            WICRect copyRect{
+                static_cast<INT>(rect.left),
+                static_cast<INT>(rect.top),
+                static_cast<INT>(rect.right - rect.left),
+                static_cast<INT>(rect.bottom - rect.top)
+            };
+            UINT bufferSize = stride * (rect.bottom - rect.top);
+            return SUCCEEDED(g_animationFramesPremultiplied[frame]->CopyPixels(&copyRect, stride, bufferSize, pixels));
+        },
+        [](const CanvasRect& rect, const uint8_t* pixels, uint32_t stride)
+        {
+            D2D1_RECT_U target = D2D1::RectU(rect.left, rect.top, rect.right, rect.bottom);
+            return SUCCEEDED(g_bitmap->CopyFromMemory(&target, pixels, stride));
+        }
+    };
+    if (!PresentAnimationFrame(g_animationSurface, g_animationFrameDirtyRects, frameIndex, frameWidth, frameHeight, backend))
+    {
+        return false;
+    }
+
+    g_animationFrameIndex = frameIndex;
+    g_currentFrameWidth = frameWidth;
+    g_currentFrameHeight = frameHeight;
+    return true;
+}
+
+bool TryGetMetadataUInt32(IWICMetadataQueryReader* reader, const wchar_t* key, UINT32& value)
+{
+    if (!reader)
+    {
+        return false;
+    }
+
+    PROPVARIANT variant;
+    PropVariantInit(&variant);
+    HRESULT hr = reader->GetMetadataByName(key, &variant);
+    if (FAILED(hr))
+    {
+        PropVariantClear(&variant);
+        return false;
+    }
+
+    bool converted = false;
+    UINT32 temp = 0;
+    if (SUCCEEDED(PropVariantToUInt32(variant, &temp)))
+    {
+        converted = true;
+    }
+    else if (variant.vt == VT_UI2)
+    {
+        temp = variant.uiVal;
+        converted = true;
+    }
+    else if (variant.vt == VT_UI1)
+    {
+        temp = variant.bVal;
+        converted = true;
+    }
+
+    PropVariantClear(&variant);
+    if (!converted)
+    {
+        return false;
+    }
+
+    value = temp;
+    return true;
+}
+
+UINT ExtractFrameDelayMs(IWICBitmapFrameDecode* frame)
+{
+    if (!frame)
+    {
+        return kDefaultAnimationFrameDelayMs;
+    }
+
+    IWICMetadataQueryReader* frameMetadata = nullptr;
+    HRESULT hr = frame->GetMetadataQueryReader(&frameMetadata);
+    if (FAILED(hr) || !frameMetadata)
+    {
+        return kDefaultAnimationFrameDelayMs;
+    }
+
+    UINT32 value = 0;
+    UINT delayMs = kDefaultAnimationFrameDelayMs;
+
+    if (TryGetMetadataUInt32(frameMetadata, L"/grctlext/Delay", value)
+        || TryGetMetadataUInt32(frameMetadata, L"/grctlext/DelayTime", value))
+    {
+        if (value > 0 && value <= (UINT_MAX / 10))
+        {
+            delayMs = static_cast<UINT>(value * 10);
+        }
+    }
+    else if (TryGetMetadataUInt32(frameMetadata, L"/ANMF/FrameDuration", value)
+        || TryGetMetadataUInt32(frameMetadata, L"/ANIM/FrameDuration", value))
+    {
+        if (value > 0)
+        {
+            delayMs = static_cast<UINT>(value);
+        }
+    }
+
+    frameMetadata->Release();
+    return delayMs == 0 ? kDefaultAnimationFrameDelayMs : delayMs;
+}
+
+// =====================
+// アーカイブ (ZIP/CBZ)
+// =====================
+// Maps [offset, offset + length) of the archive; the view starts at the allocation granularity
+// below offset and data points at offset inside it.
+bool MapZipRange(const ZipArchive& archive, uint64_t offset, uint64_t length, ZipMemberData& range)
+{
+    if (offset > archive.size || length > archive.size - offset || length > SIZE_MAX / 2)
+    {
+        return false;
+    }
+    SYSTEM_INFO systemInfo{};
+    GetSystemInfo(&systemInfo);
+    uint64_t viewStart = offset - offset % systemInfo.dwAllocationGranularity;
+    uint64_t viewLength = offset + length - viewStart;
+    if (viewLength == 0)
+    {
+        range.data = nullptr;
+        range.size = 0;
+        return true;
+    }
+    void* view = MapViewOfFile(
+        archive.mapping,
+        FILE_MAP_READ,
+        static_cast<DWORD>(viewStart >> 32),
+        static_cast<DWORD>(viewStart & 0xFFFFFFFF),
+        static_cast<SIZE_T>(viewLength)
+    );
+    if (!view)
+    {
+        return false;
+    }
+    range.view = view;
+    range.data = static_cast<const BYTE*>(view) + (offset - viewStart);
+    range.size = static_cast<size_t>(length);
+    return true;
+}
+
+void ReleaseZipMemberData(ZipMemberData& data)
+{
+    if (data.view)
+    {
+        UnmapViewOfFile(data.view);
+        data.view = nullptr;
+    }
+    data.data = nullptr;
+    data.size = 0;
+    data.inflated.reset();
+}
+
+void CloseZipArchive(ZipArchive& archive)
+{
+    if (archive.mapping)
+    {
+        CloseHandle(archive.mapping);
+        archive.mapping = nullptr;
+    }
+    if (archive.file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(archive.file);
+        archive.file = INVALID_HANDLE_VALUE;
+    }
+    archive.members.clear();
+}
+
+bool DecodeZipName(std::string_view raw, bool utf8, std::wstring& name)
+{
+    UINT codePage = utf8 ? CP_UTF8 : 437;
+    int wideLength = MultiByteToWideChar(codePage, 0, raw.data(), static_cast<int>(raw.size()), nullptr, 0);
+    if (wideLength <= 0)
+    {
+        return false;
     }
+    name.assign(static_cast<size_t>(wideLength), L'\0');
+    MultiByteToWideChar(codePage, 0, raw.data(), static_cast<int>(raw.size()), name.data(), wideLength);
+    return true;
+}
 
-    case WM_MOUSEWHEEL:
+// Maps the archive and indexes its central directory; the records are parsed by
+// FindZipDirectory and ParseZipCentralDirectory.
+bool OpenZipArchive(const wchar_t* path, ZipArchive& archive)
+{
+    archive.file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER fileSize{};
+    if (archive.file == INVALID_HANDLE_VALUE || !GetFileSizeEx(archive.file, &fileSize)
+        || fileSize.QuadPart < static_cast<LONGLONG>(kZipEndRecordSize))
     {
-        if (g_hasHtml)
-        {
-            WORD inputKey = GetHtmlInputVirtualKey();
-            bool keyDown = (GetKeyState(inputKey) & 0x8000) != 0;
-            if (keyDown && g_webviewWindow)
-            {
-                WPARAM adjustedWParam = wParam;
-                if (inputKey == VK_SHIFT)
-                {
-                    WORD keyState = GET_KEYSTATE_WPARAM(wParam);
-                    adjustedWParam = MAKEWPARAM(keyState & ~MK_SHIFT, GET_WHEEL_DELTA_WPARAM(wParam));
-                }
-                SendMessageW(g_webviewWindow, WM_MOUSEWHEEL, adjustedWParam, lParam);
-                return 0;
-            }
-            return DefWindowProc(hwnd, msg, wParam, lParam);
-        }
-        if (!g_bitmap && !g_hasText)
+        CloseZipArchive(archive);
+        return false;
+    }
+    archive.size = static_cast<uint64_t>(fileSize.QuadPart);
+    archive.mapping = CreateFileMappingW(archive.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!archive.mapping)
+    {
+        CloseZipArchive(archive);
+        return false;
+    }
+
+    uint64_t tailLength = (std::min)(archive.size, kZipEndSearchBytes);
+    ZipMemberData tail;
+    if (!MapZipRange(archive, archive.size - tailLength, tailLength, tail))
+    {
+        CloseZipArchive(archive);
+        return false;
+    }
+    ZipDirectoryRange range;
+    bool found = FindZipDirectory(tail.data, tail.size, range);
+    ReleaseZipMemberData(tail);
+    if (!found)
+    {
+        CloseZipArchive(archive);
+        return false;
+    }
+    if (range.zip64)
+    {
+        ZipMemberData end64;
+        if (MapZipRange(archive, range.zip64EndOffset, kZip64EndRecordSize, end64))
         {
-            return 0;
+            ReadZip64EndRecord(end64.data, end64.size, range);
+            ReleaseZipMemberData(end64);
         }
-        int delta = GET_WHEEL_DELTA_WPARAM(wParam);
-        float steps = static_cast<float>(delta) / WHEEL_DELTA;
-        if (g_hasText)
+    }
+
+    ZipMemberData directory;
+    if (!MapZipRange(archive, range.offset, range.size, directory))
+    {
+        CloseZipArchive(archive);
+        return false;
+    }
+    ParseZipCentralDirectory(directory.data, directory.size, range.entryCount, archive.members);
+    ReleaseZipMemberData(directory);
+    return true;
+}
+
+// Stored members are handed out as a view straight into the mapped archive; deflated ones are
+// inflated into a buffer and checked against their CRC.
+bool ReadZipMember(const ZipArchive& archive, const ZipMember& member, ZipMemberData& data)
+{
+    ZipMemberData header;
+    if (!MapZipRange(archive, member.localHeaderOffset, kZipLocalHeaderSize, header))
+    {
+        return false;
+    }
+    uint64_t dataOffset = 0;
+    bool valid = ReadZipLocalHeader(header.data, header.size, member, dataOffset);
+    ReleaseZipMemberData(header);
+    if (!valid || !IsZipMemberSizeValid(member))
+    {
+        return false;
+    }
+
+    ZipMemberData compressed;
+    if (!MapZipRange(archive, dataOffset, member.compressedSize, compressed))
+    {
+        return false;
+    }
+    if (member.method == 0)
+    {
+        ReleaseZipMemberData(data);
+        data = std::move(compressed);
+        return true;
+    }
+
+    // This also runs on the prefetch and indexer threads, where an escaping bad_alloc would end
+    // the process.
+    std::shared_ptr<std::vector<BYTE>> inflated;
+    try
+    {
+        inflated = std::make_shared<std::vector<BYTE>>(static_cast<size_t>(member.size));
+    }
+    catch (const std::bad_alloc&)
+    {
+        ReleaseZipMemberData(compressed);
+        return false;
+    }
+    bool inflatedOk = InflateRaw(compressed.data, compressed.size, inflated->data(), inflated->size())
+        && ComputeCrc32(inflated->data(), inflated->size()) == member.crc;
+    ReleaseZipMemberData(compressed);
+    if (!inflatedOk)
+    {
+        return false;
+    }
+    ReleaseZipMemberData(data);
+    data.data = inflated->data();
+    data.size = inflated->size();
+    data.inflated = std::move(inflated);
+    return true;
+}
+
+// MSVC's file_time_type counts FILETIME ticks, so the DOS stamp only needs converting to UTC.
+std::filesystem::file_time_type ConvertDosTimeToFileTime(uint16_t dosDate, uint16_t dosTime)
+{
+    FILETIME localTime{};
+    FILETIME utcTime{};
+    if (!DosDateTimeToFileTime(dosDate, dosTime, &localTime) || !LocalFileTimeToFileTime(&localTime, &utcTime))
+    {
+        return {};
+    }
+    ULARGE_INTEGER ticks{};
+    ticks.LowPart = utcTime.dwLowDateTime;
+    ticks.HighPart = utcTime.dwHighDateTime;
+    return std::filesystem::file_time_type(std::filesystem::file_time_type::duration(static_cast<int64_t>(ticks.QuadPart)));
+}
+
+// Lists the image members of a ZIP/CBZ archive as the catalog. Nothing is extracted; a member is
+// read out of the mapped archive when it is shown.
+bool OpenArchiveCatalog(const std::filesystem::path& archivePath)
+{
+    std::shared_ptr<ZipArchive> archive(new ZipArchive, [](ZipArchive* opened)
+    {
+        CloseZipArchive(*opened);
+        delete opened;
+    });
+    if (!OpenZipArchive(archivePath.c_str(), *archive))
+    {
+        return false;
+    }
+    bool hasImages = std::any_of(archive->members.begin(), archive->members.end(), [](const ZipMember& member)
+    {
+        return IsImageFile(member.name);
+    });
+    if (!hasImages)
+    {
+        return false;
+    }
+
+    StopCatalogScan();
+    StopCatalogWatcher();
+    ResetCatalog(archivePath);
+    DirectoryCatalog& catalog = g_catalog;
+    catalog.archive = std::move(archive);
+    const std::vector<ZipMember>& members = catalog.archive->members;
+    catalog.entries.reserve(members.size());
+    for (uint32_t i = 0; i < members.size(); ++i)
+    {
+        const ZipMember& member = members[i];
+        if (!IsImageFile(member.name))
         {
-            ScrollTextBy(-steps * 40.0f);
-            InvalidateRect(hwnd, nullptr, TRUE);
+            continue;
         }
-        else
+        auto [it, inserted] = catalog.order.idByName.try_emplace(FoldCatalogName(member.name), catalog.nextId);
+        if (!inserted)
         {
-            float factor = std::pow(1.1f, steps);
-            POINT pt{};
-            GetCursorPos(&pt);
-            AdjustZoom(factor, pt);
-            InvalidateRect(hwnd, nullptr, TRUE);
+            continue;
         }
-        return 0;
+        ImageEntry entry{ archivePath / member.name, ConvertDosTimeToFileTime(member.dosDate, member.dosTime), AllocateCatalogId(), member.size };
+        entry.member = i;
+        catalog.order.ids.push_back(entry.id);
+        catalog.entries.push_back(std::move(entry));
     }
+    SortImageList();
+    StartMetadataIndexer();
+    return true;
+}
 
-    case WM_XBUTTONUP:
+bool IsArchiveCatalogPath(const std::filesystem::path& path)
+{
+    const DirectoryCatalog& catalog = g_catalog;
+    if (!catalog.archive)
     {
-        if (GET_XBUTTON_WPARAM(wParam) == XBUTTON1)
+        return false;
+    }
+    const std::wstring& full = path.native();
+    const std::wstring& base = catalog.directory.native();
+    return full.size() > base.size() + 1 && full.compare(0, base.size(), base) == 0 && full[base.size()] == L'\\';
+}
+
+// Runs on the prefetch thread.
+void PrefetchArchiveMembers(std::shared_ptr<ZipArchive> archive, std::vector<uint32_t> members)
+{
+    ArchivePrefetch& prefetch = g_archivePrefetch;
+    for (uint32_t member : members)
+    {
+        if (prefetch.cancel)
         {
-            NavigateImage(-1);
-            return 0;
+            return;
         }
-        if (GET_XBUTTON_WPARAM(wParam) == XBUTTON2)
+        ZipMemberData data;
+        if (!ReadZipMember(*archive, archive->members[member], data))
         {
-            NavigateImage(1);
-            return 0;
+            continue;
         }
-        break;
+        {
+            std::lock_guard<std::mutex> lock(prefetch.mutex);
+            prefetch.members.emplace_back(member, data.inflated);
+        }
+        ReleaseZipMemberData(data);
     }
+}
 
-    case WM_LBUTTONDOWN:
+void WaitArchivePrefetch()
+{
+    ArchivePrefetch& prefetch = g_archivePrefetch;
+    if (prefetch.thread.joinable())
     {
-        POINT pt{ GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
-        RECT rc{};
-        GetClientRect(hwnd, &rc);
-        bool nearEdge = pt.x <= g_edgeDragMargin || pt.y <= g_edgeDragMargin
-            || pt.x >= (rc.right - g_edgeDragMargin) || pt.y >= (rc.bottom - g_edgeDragMargin);
-        if (nearEdge && (g_bitmap || g_hasText || g_hasHtml))
+        prefetch.thread.join();
+    }
+}
+
+void StopArchivePrefetch()
+{
+    ArchivePrefetch& prefetch = g_archivePrefetch;
+    prefetch.cancel = true;
+    WaitArchivePrefetch();
+    std::lock_guard<std::mutex> lock(prefetch.mutex);
+    prefetch.members.clear();
+}
+
+// Inflates the deflated members either side of index ahead of time and drops any other cached
+// member. Stored members need nothing: they are read straight from the mapping.
+void StartArchivePrefetch(size_t index)
+{
+    WaitArchivePrefetch();
+    DirectoryCatalog& catalog = g_catalog;
+    size_t count = catalog.entries.size();
+    uint32_t current = catalog.entries[index].member;
+    uint32_t neighbours[] = {
+        catalog.entries[(index + 1) % count].member,
+        catalog.entries[(index + count - 1) % count].member
+    };
+
+    ArchivePrefetch& prefetch = g_archivePrefetch;
+    std::vector<uint32_t> members;
+    {
+        std::lock_guard<std::mutex> lock(prefetch.mutex);
+        auto keep = [&](uint32_t member)
         {
-            g_fitToWindow = false;
-            g_isEdgeDragging = true;
-            g_dragStartPoint = pt;
-            g_dragStartZoom = g_zoom;
-            g_dragStartScale = std::max(1.0f, (std::min)(static_cast<float>(rc.right - rc.left), static_cast<float>(rc.bottom - rc.top)));
-            g_dragStartWidth = static_cast<float>(rc.right - rc.left);
-            g_dragStartHeight = static_cast<float>(rc.bottom - rc.top);
-            if (g_bitmap)
+            return member == current || member == neighbours[0] || member == neighbours[1];
+        };
+        prefetch.members.erase(
+            std::remove_if(prefetch.members.begin(), prefetch.members.end(), [&](const auto& cached)
             {
-                UpdateWindowToZoomedImage();
+                return !keep(cached.first);
+            }),
+            prefetch.members.end()
+        );
+        for (uint32_t member : neighbours)
+        {
+            bool cached = std::any_of(prefetch.members.begin(), prefetch.members.end(), [&](const auto& entry)
+            {
+                return entry.first == member;
+            });
+            if (!cached && member != current && catalog.archive->members[member].method != 0
+                && std::find(members.begin(), members.end(), member) == members.end())
+            {
+                members.push_back(member);
             }
-            SetCapture(hwnd);
-            return 0;
         }
-        POINT cursor{};
-        if (GetCursorPos(&cursor))
+    }
+    if (members.empty())
+    {
+        return;
+    }
+    prefetch.cancel = false;
+    prefetch.thread = std::thread(PrefetchArchiveMembers, catalog.archive, std::move(members));
+}
+
+// Decodes catalog entry index from the archive: a prefetched buffer when there is one, otherwise
+// the member is read (mapped or inflated) now.
+bool LoadArchiveImage(size_t index)
+{
+    DirectoryCatalog& catalog = g_catalog;
+    const ZipArchive& archive = *catalog.archive;
+    uint32_t member = catalog.entries[index].member;
+    WaitArchivePrefetch();
+
+    ZipMemberData data;
+    bool available = false;
+    {
+        ArchivePrefetch& prefetch = g_archivePrefetch;
+        std::lock_guard<std::mutex> lock(prefetch.mutex);
+        for (const auto& cached : prefetch.members)
         {
-            RECT windowRect{};
-            if (GetWindowRect(hwnd, &windowRect))
+            if (cached.first == member)
             {
-                g_isWindowDragging = true;
-                g_windowDragStartCursor = cursor;
-                g_windowDragStartPos = POINT{ windowRect.left, windowRect.top };
-                SetCapture(hwnd);
-                return 0;
+                data.inflated = cached.second;
+                data.data = data.inflated->data();
+                data.size = data.inflated->size();
+                available = true;
+                break;
             }
         }
-        return 0;
     }
+    if (!available)
+    {
+        available = ReadZipMember(archive, archive.members[member], data);
+    }
+    bool result = available && LoadImageFromMemory(data.data, data.size);
+    ReleaseZipMemberData(data);
+    StartArchivePrefetch(index);
+    return result;
+}
 
-    case WM_MOUSEMOVE:
+// =====================
+// 画像ロード
+// =====================
+bool LoadImageFromFile(const wchar_t* path)
+{
+    return LoadImageFromSource(path, nullptr, 0);
+}
+
+// Decodes an image held in memory, such as an archive member; data only has to stay valid for the
+// call, the frames are copied out.
+bool LoadImageFromMemory(const BYTE* data, size_t size)
+{
+    return LoadImageFromSource(nullptr, data, size);
+}
+
+// The stream reads data in place and is released by the caller after the decoder.
+HRESULT CreateDecoderFromMemory(IWICImagingFactory* factory, const BYTE* data, size_t size, IWICStream** stream, IWICBitmapDecoder** decoder)
+{
+    if (size > 0xFFFFFFFFu)
+    {
+        return E_INVALIDARG;
+    }
+    HRESULT hr = factory->CreateStream(stream);
+    if (SUCCEEDED(hr))
+    {
+        hr = (*stream)->InitializeFromMemory(const_cast<BYTE*>(data), static_cast<DWORD>(size));
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = factory->CreateDecoderFromStream(*stream, nullptr, WICDecodeMetadataCacheOnDemand, decoder);
+    }
+    return hr;
+}
+
+bool LoadImageFromSource(const wchar_t* path, const BYTE* data, size_t size)
+{
+    IWICBitmapDecoder* decoder = nullptr;
+    IWICStream* stream = nullptr;
+    WICPixelFormatGUID pixelFormat = GUID_WICPixelFormatDontCare;
+    D2D1_BITMAP_PROPERTIES bitmapProperties{};
+    UINT frameCount = 0;
+    UINT canvasWidth = 0;
+    UINT canvasHeight = 0;
+    std::vector<BYTE> previousCanvas;
+    std::vector<BYTE> workingCanvas;
+    std::vector<BYTE> firstCanvas;
+    std::vector<BYTE> presentedCanvas;
+    IWICMetadataQueryReader* decoderMetadata = nullptr;
+
+    StopAnimationPlayback();
+    ClearAnimationFrames();
+
+    if (g_bitmap)
+    {
+        g_bitmap->Release();
+        g_bitmap = nullptr;
+    }
+    if (g_wicSourceStraight)
+    {
+        g_wicSourceStraight->Release();
+        g_wicSourceStraight = nullptr;
+    }
+    if (g_wicSourcePremultiplied)
+    {
+        g_wicSourcePremultiplied->Release();
+        g_wicSourcePremultiplied = nullptr;
+    }
+    ReleaseLayeredSurfaceCache();
+    g_imageWidth = 0;
+    g_imageHeight = 0;
+    g_imageHasAlpha = false;
+    g_hasText = false;
+    CloseTextDocument();
+    g_hasHtml = false;
+    g_pendingHtmlContent.clear();
+    g_pendingHtmlBlockBounds.clear();
+    CancelProgressiveHtml();
+    ForgetLiveMarkdownPage();
+    g_webviewPendingShow = false;
+    g_keepLayeredWhileHtmlPending = false;
+    HideWebView();
+
+    HRESULT hr = path
+        ? g_wicFactory->CreateDecoderFromFilename(
+            path,
+            nullptr,
+            GENERIC_READ,
+            WICDecodeMetadataCacheOnDemand,
+            &decoder
+        )
+        : CreateDecoderFromMemory(g_wicFactory, data, size, &stream, &decoder);
+    if (FAILED(hr)) goto cleanup;
+
+    hr = decoder->GetFrameCount(&frameCount);
+    if (FAILED(hr) || frameCount == 0)
+    {
+        goto cleanup;
+    }
+
+    if (SUCCEEDED(decoder->GetMetadataQueryReader(&decoderMetadata)) && decoderMetadata)
     {
-        if (g_isEdgeDragging && (wParam & MK_LBUTTON))
-        {
-            POINT pt{ GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
-            float deltaX = static_cast<float>(pt.x - g_dragStartPoint.x);
-            float deltaY = static_cast<float>(pt.y - g_dragStartPoint.y);
-            if (g_hasText || g_hasHtml)
-            {
-                float nextWidth = std::max(200.0f, g_dragStartWidth + deltaX);
-                float nextHeight = std::max(200.0f, g_dragStartHeight + deltaY);
-                SetWindowPos(hwnd, nullptr, 0, 0, static_cast<int>(nextWidth), static_cast<int>(nextHeight),
-                    SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE);
-                InvalidateRect(hwnd, nullptr, TRUE);
-            }
-            else
-            {
-                float nextScale = std::max(1.0f, g_dragStartScale + deltaY);
-                float zoom = (g_dragStartScale > 0.0f) ? (g_dragStartZoom * (nextScale / g_dragStartScale)) : g_dragStartZoom;
-                g_zoom = std::max(g_zoomMin, (std::min)(zoom, g_zoomMax));
-                UpdateWindowToZoomedImage();
-                InvalidateRect(hwnd, nullptr, TRUE);
-            }
-        }
-        else if (g_isWindowDragging && (wParam & MK_LBUTTON))
+        UINT32 metadataWidth = 0;
+        UINT32 metadataHeight = 0;
+        if (TryGetMetadataUInt32(decoderMetadata, L"/logscrdesc/Width", metadataWidth)
+            && TryGetMetadataUInt32(decoderMetadata, L"/logscrdesc/Height", metadataHeight)
+            && metadataWidth > 0 && metadataHeight > 0)
         {
-            POINT cursor{};
-            if (GetCursorPos(&cursor))
-            {
-                int nextX = g_windowDragStartPos.x + (cursor.x - g_windowDragStartCursor.x);
-                int nextY = g_windowDragStartPos.y + (cursor.y - g_windowDragStartCursor.y);
-                SetWindowPos(hwnd, nullptr, nextX, nextY, 0, 0, SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE);
-            }
+            canvasWidth = metadataWidth;
+            canvasHeight = metadataHeight;
         }
-        else
+        else if (TryGetMetadataUInt32(decoderMetadata, L"/ANIM/CanvasWidth", metadataWidth)
+            && TryGetMetadataUInt32(decoderMetadata, L"/ANIM/CanvasHeight", metadataHeight)
+            && metadataWidth > 0 && metadataHeight > 0)
         {
-            POINT pt{ GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
-            RECT rc{};
-            GetClientRect(hwnd, &rc);
-            bool nearEdge = pt.x <= g_edgeDragMargin || pt.y <= g_edgeDragMargin
-                || pt.x >= (rc.right - g_edgeDragMargin) || pt.y >= (rc.bottom - g_edgeDragMargin);
-            SetCursor(LoadCursor(nullptr, nearEdge ? IDC_SIZENWSE : IDC_ARROW));
+            canvasWidth = metadataWidth;
+            canvasHeight = metadataHeight;
         }
-        return 0;
+        decoderMetadata->Release();
     }
 
-    case WM_LBUTTONUP:
+    for (UINT i = 0; i < frameCount; ++i)
     {
-        if (g_isEdgeDragging || g_isWindowDragging)
+        IWICBitmapFrameDecode* currentFrame = nullptr;
+        IWICFormatConverter* decodedFrameStraight = nullptr;
+        IWICBitmap* composedFrameBitmap = nullptr;
+        IWICFormatConverter* currentPremultiplied = nullptr;
+
+        hr = decoder->GetFrame(i, &currentFrame);
+        if (FAILED(hr) || !currentFrame)
         {
-            g_isEdgeDragging = false;
-            g_isWindowDragging = false;
-            ReleaseCapture();
+            if (currentFrame) currentFrame->Release();
+            goto cleanup;
         }
-        return 0;
-    }
-
-    case WM_KEYDOWN:
-    {
-        WORD key = static_cast<WORD>(wParam);
-        bool handled = false;
 
-        if (key == g_keyExit)
+        UINT frameWidth = 0;
+        UINT frameHeight = 0;
+        hr = currentFrame->GetSize(&frameWidth, &frameHeight);
+        if (FAILED(hr) || frameWidth == 0 || frameHeight == 0)
         {
-            DestroyWindow(hwnd);
-            handled = true;
+            currentFrame->Release();
+            goto cleanup;
         }
-        else if (key == g_keyAlwaysOnTop)
+
+        if (i == 0)
         {
-            g_alwaysOnTop = !g_alwaysOnTop;
-            ApplyAlwaysOnTop();
-            SaveSettings();
-            handled = true;
+            if (canvasWidth == 0 || canvasHeight == 0)
+            {
+                canvasWidth = frameWidth;
+                canvasHeight = frameHeight;
+            }
+            g_imageWidth = canvasWidth;
+            g_imageHeight = canvasHeight;
+            g_currentFrameWidth = canvasWidth;
+            g_currentFrameHeight = canvasHeight;
+
+            hr = currentFrame->GetPixelFormat(&pixelFormat);
+            if (SUCCEEDED(hr))
+            {
+                g_imageHasAlpha = QueryPixelFormatHasAlpha(g_wicFactory, pixelFormat);
+            }
+
+            size_t canvasBufferSize = static_cast<size_t>(canvasWidth) * static_cast<size_t>(canvasHeight) * 4;
+            previousCanvas.assign(canvasBufferSize, 0);
+            workingCanvas.assign(canvasBufferSize, 0);
         }
-        else if (key == g_keyMinimize)
+
+        hr = g_wicFactory->CreateFormatConverter(&decodedFrameStraight);
+        if (FAILED(hr))
         {
-            ShowWindow(hwnd, SW_MINIMIZE);
-            handled = true;
+            currentFrame->Release();
+            goto cleanup;
         }
-        else if (key == g_keyReload)
+
+        hr = decodedFrameStraight->Initialize(
+            currentFrame,
+            GUID_WICPixelFormat32bppBGRA,
+            WICBitmapDitherTypeNone,
+            nullptr,
+            0.0,
+            WICBitmapPaletteTypeCustom
+        );
+        if (FAILED(hr))
         {
-            ReloadCurrentFile(true);
-            handled = true;
+            currentFrame->Release();
+            decodedFrameStraight->Release();
+            goto cleanup;
         }
-        else if (key == g_keyOpenFile)
+
+        UINT32 frameLeft = 0;
+        UINT32 frameTop = 0;
+        UINT32 disposal = 0;
+        IWICMetadataQueryReader* frameMetadata = nullptr;
+        if (SUCCEEDED(currentFrame->GetMetadataQueryReader(&frameMetadata)) && frameMetadata)
         {
-            if (ShowOpenImageDialog(hwnd))
+            TryGetMetadataUInt32(frameMetadata, L"/imgdesc/Left", frameLeft);
+            TryGetMetadataUInt32(frameMetadata, L"/imgdesc/Top", frameTop);
+            if (!TryGetMetadataUInt32(frameMetadata, L"/grctlext/Disposal", disposal))
             {
-                if (g_bitmap && !g_hasHtml)
-                {
-                    UpdateZoomToFitScreen(hwnd);
-                }
-                InvalidateRect(hwnd, nullptr, TRUE);
+                TryGetMetadataUInt32(frameMetadata, L"/grctlext/DisposalMethod", disposal);
             }
-            handled = true;
-        }
-        else if (key == g_keyNextFile && !g_imageList.empty())
-        {
-            NavigateImage(1);
-            handled = true;
+            frameMetadata->Release();
         }
-        else if (key == g_keyPrevFile && !g_imageList.empty())
+
+        UINT srcStride = frameWidth * 4;
+        std::vector<BYTE> framePixels(static_cast<size_t>(srcStride) * frameHeight, 0);
+        WICRect frameRect{ 0, 0, static_cast<INT>(frameWidth), static_cast<INT>(frameHeight) };
+        hr = decodedFrameStraight->CopyPixels(&frameRect, srcStride, static_cast<UINT>(framePixels.size()), framePixels.data());
+        if (FAILED(hr))
         {
-            NavigateImage(-1);
-            handled = true;
+            currentFrame->Release();
+            decodedFrameStraight->Release();
+            goto cleanup;
         }
 
-        if (g_hasHtml)
+        std::vector<BYTE> beforeFrame = previousCanvas;
+        workingCanvas = previousCanvas;
+
+        auto blendPixel = [](BYTE* dst, const BYTE* src)
         {
-            WORD inputKey = GetHtmlInputVirtualKey();
-            if (wParam == inputKey)
+            UINT srcA = src[3];
+            if (srcA == 0)
             {
-                UpdateWebViewInputState();
-                return 0;
+                return;
             }
-
-            if (handled)
+            UINT dstA = dst[3];
+            UINT outA = srcA + ((dstA * (255 - srcA) + 127) / 255);
+            for (int c = 0; c < 3; ++c)
             {
-                return 0;
+                UINT srcC = src[c];
+                UINT dstC = dst[c];
+                UINT outC = srcC + ((dstC * (255 - srcA) + 127) / 255);
+                dst[c] = static_cast<BYTE>(std::min(outC, 255u));
             }
+            dst[3] = static_cast<BYTE>(std::min(outA, 255u));
+        };
 
-            if (HandleHtmlOverlayShortcutKeyDown(key))
+        for (UINT y = 0; y < frameHeight; ++y)
+        {
+            UINT dstY = frameTop + y;
+            if (dstY >= canvasHeight)
             {
-                return 0;
+                continue;
+            }
+            for (UINT x = 0; x < frameWidth; ++x)
+            {
+                UINT dstX = frameLeft + x;
+                if (dstX >= canvasWidth)
+                {
+                    continue;
+                }
+                size_t srcIndex = (static_cast<size_t>(y) * frameWidth + x) * 4;
+                size_t dstIndex = (static_cast<size_t>(dstY) * canvasWidth + dstX) * 4;
+                blendPixel(&workingCanvas[dstIndex], &framePixels[srcIndex]);
             }
-
-            HandleHtmlOverlayKeyDown(wParam);
-            return 0;
         }
 
-        if (handled)
-        {
-            return 0;
-        }
-        if ((key == g_keyZoomIn || key == g_keyZoomOut) && g_hasText)
-        {
-            float delta = (key == g_keyZoomIn) ? -40.0f : 40.0f;
-            ScrollTextBy(delta);
-            InvalidateRect(hwnd, nullptr, TRUE);
-            return 0;
-        }
-        if ((key == g_keyZoomIn || key == g_keyZoomOut) && g_bitmap)
-        {
-            float factor = (key == g_keyZoomIn) ? 1.1f : (1.0f / 1.1f);
-            POINT pt{};
-            GetCursorPos(&pt);
-            AdjustZoom(factor, pt);
-            InvalidateRect(hwnd, nullptr, TRUE);
-            return 0;
-        }
-        if (key == g_keyOriginalSize && g_bitmap)
-        {
-            g_fitToWindow = false;
-            g_zoom = 1.0f;
-            UpdateWindowToZoomedImage();
-            InvalidateRect(hwnd, nullptr, TRUE);
-            return 0;
-        }
-        if (wParam == VK_ADD || wParam == VK_OEM_PLUS)
-        {
-            POINT pt{};
-            GetCursorPos(&pt);
-            AdjustZoom(1.1f, pt);
-            InvalidateRect(hwnd, nullptr, TRUE);
-            return 0;
-        }
-        if (wParam == VK_SUBTRACT || wParam == VK_OEM_MINUS)
+        UINT canvasStride = canvasWidth * 4;
+        hr = g_wicFactory->CreateBitmapFromMemory(
+            canvasWidth,
+            canvasHeight,
+            GUID_WICPixelFormat32bppBGRA,
+            canvasStride,
+            static_cast<UINT>(workingCanvas.size()),
+            workingCanvas.data(),
+            &composedFrameBitmap
+        );
+        if (FAILED(hr))
         {
-            POINT pt{};
-            GetCursorPos(&pt);
-            AdjustZoom(1.0f / 1.1f, pt);
-            InvalidateRect(hwnd, nullptr, TRUE);
-            return 0;
+            currentFrame->Release();
+            decodedFrameStraight->Release();
+            goto cleanup;
         }
-        if ((GetKeyState(VK_CONTROL) & 0x8000) && wParam == '0')
+
+        hr = g_wicFactory->CreateFormatConverter(&currentPremultiplied);
+        if (FAILED(hr))
         {
-            SetFitToWindow(true);
-            InvalidateRect(hwnd, nullptr, TRUE);
-            return 0;
+            currentFrame->Release();
+            decodedFrameStraight->Release();
+            composedFrameBitmap->Release();
+            goto cleanup;
         }
-        if ((GetKeyState(VK_CONTROL) & 0x8000) && wParam == '1')
+
+        hr = currentPremultiplied->Initialize(
+            composedFrameBitmap,
+            GUID_WICPixelFormat32bppPBGRA,
+            WICBitmapDitherTypeNone,
+            nullptr,
+            0.0,
+            WICBitmapPaletteTypeCustom
+        );
+        if (FAILED(hr))
         {
-            g_fitToWindow = false;
-            g_zoom = 1.0f;
-            InvalidateRect(hwnd, nullptr, TRUE);
-            return 0;
+            currentFrame->Release();
+            decodedFrameStraight->Release();
+            composedFrameBitmap->Release();
+            currentPremultiplied->Release();
+            goto cleanup;
         }
-        return 0;
-    }
 
-    case WM_KEYUP:
-    {
-        if (g_hasHtml)
+        if (!g_imageHasAlpha && ImageHasTransparency(composedFrameBitmap))
         {
-            WORD inputKey = GetHtmlInputVirtualKey();
-            if (wParam == inputKey)
-            {
-                UpdateWebViewInputState();
-            }
-            return 0;
+            g_imageHasAlpha = true;
         }
-        return 0;
-    }
 
-    case WM_SYSKEYDOWN:
-    case WM_SYSKEYUP:
-    {
-        if (g_hasHtml)
+        g_animationFramesStraight.push_back(composedFrameBitmap);
+        g_animationFramesPremultiplied.push_back(currentPremultiplied);
+        g_animationPlayback.frameDelaysMs.push_back(ExtractFrameDelayMs(currentFrame));
+        g_animationFrameWidths.push_back(canvasWidth);
+        g_animationFrameHeights.push_back(canvasHeight);
+        if (i == 0)
         {
-            WORD inputKey = GetHtmlInputVirtualKey();
-            if (wParam == inputKey)
-            {
-                UpdateWebViewInputState();
-            }
-            return 0;
+            firstCanvas = workingCanvas;
+            g_animationFrameDirtyRects.push_back(CanvasRect{ 0, 0, canvasWidth, canvasHeight });
+        }
+        else
+        {
+            g_animationFrameDirtyRects.push_back(
+                ComputeCanvasDirtyRect(presentedCanvas, workingCanvas, canvasWidth, canvasHeight));
         }
-        break;
-    }
 
-    case WM_TIMER:
-    {
-        if (wParam == kWebViewInputTimerId)
+        if (disposal == 2)
         {
-            if (g_hasHtml)
-            {
-                UpdateWebViewInputState();
-            }
-            else
+            previousCanvas = workingCanvas;
+            for (UINT y = 0; y < frameHeight; ++y)
             {
-                UpdateWebViewInputTimer();
+                UINT dstY = frameTop + y;
+                if (dstY >= canvasHeight)
+                {
+                    continue;
+                }
+                for (UINT x = 0; x < frameWidth; ++x)
+                {
+                    UINT dstX = frameLeft + x;
+                    if (dstX >= canvasWidth)
+                    {
+                        continue;
+                    }
+                    size_t dstIndex = (static_cast<size_t>(dstY) * canvasWidth + dstX) * 4;
+                    previousCanvas[dstIndex + 0] = 0;
+                    previousCanvas[dstIndex + 1] = 0;
+                    previousCanvas[dstIndex + 2] = 0;
+                    previousCanvas[dstIndex + 3] = 0;
+                }
             }
-            return 0;
         }
-        if (wParam == kAnimationTimerId)
+        else if (disposal == 3)
         {
-            if (!g_animationPlaying || g_animationFramesPremultiplied.size() < 2 || !g_bitmap)
-            {
-                StopAnimationPlayback();
-                return 0;
-            }
-
-            size_t nextFrame = (g_animationFrameIndex + 1) % g_animationFramesPremultiplied.size();
-            if (!SetCurrentAnimationFrame(nextFrame))
-            {
-                StopAnimationPlayback();
-                return 0;
-            }
-
-            UINT nextDelay = GetAnimationFrameDelayMs(nextFrame);
-            SetTimer(hwnd, kAnimationTimerId, nextDelay, nullptr);
-            InvalidateRect(hwnd, nullptr, TRUE);
-            return 0;
+            previousCanvas = beforeFrame;
         }
-        break;
-    }
-
-    case WM_DESTROY:
-    {
-        CloseWebView();
-        SaveWindowPlacement();
-        SaveSettings();
-        PostQuitMessage(0);
-        return 0;
-    }
+        else
+        {
+            previousCanvas = workingCanvas;
+        }
+        presentedCanvas.swap(workingCanvas);
 
-    default:
-        break;
+        currentFrame->Release();
+        decodedFrameStraight->Release();
     }
 
-    return DefWindowProc(hwnd, msg, wParam, lParam);
-}
-
-// =====================
-// Direct2D 初期化
-// =====================
-bool InitDirect2D(HWND hwnd)
-{
-    if (FAILED(D2D1CreateFactory(
-        D2D1_FACTORY_TYPE_SINGLE_THREADED,
-        &g_d2dFactory)))
+    if (g_animationFramesPremultiplied.empty())
     {
-        return false;
+        hr = E_FAIL;
+        goto cleanup;
     }
-
-    RECT rc;
-    GetClientRect(hwnd, &rc);
-
-    if (FAILED(g_d2dFactory->CreateHwndRenderTarget(
-        D2D1::RenderTargetProperties(),
-        D2D1::HwndRenderTargetProperties(
-            hwnd,
-            D2D1::SizeU(
-                rc.right - rc.left,
-                rc.bottom - rc.top
-            )
-        ),
-        &g_renderTarget)))
+    if (g_animationFramesPremultiplied.size() > 1)
     {
-        return false;
+        g_animationFrameDirtyRects[0] = ComputeCanvasDirtyRect(presentedCanvas, firstCanvas, canvasWidth, canvasHeight);
     }
 
-    g_renderTarget->SetDpi(96.0f, 96.0f);
+    bitmapProperties = D2D1::BitmapProperties(
+        D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)
+    );
 
-    if (FAILED(g_renderTarget->CreateSolidColorBrush(
-        D2D1::ColorF(0.992f, 0.992f, 0.992f),
-        &g_placeholderBrush)))
+    hr = g_renderTarget->CreateBitmapFromWicBitmap(
+        g_animationFramesPremultiplied[0],
+        &bitmapProperties,
+        &g_bitmap
+    );
+    if (FAILED(hr))
     {
-        return false;
+        goto cleanup;
     }
 
-    UpdateCustomColorBrush();
-    UpdateTextBrush();
-
-    if (FAILED(g_renderTarget->CreateSolidColorBrush(
-        D2D1::ColorF(0.85f, 0.85f, 0.85f),
-        &g_checkerBrushA)))
-    {
-        return false;
-    }
-    if (FAILED(g_renderTarget->CreateSolidColorBrush(
-        D2D1::ColorF(0.7f, 0.7f, 0.7f),
-        &g_checkerBrushB)))
-    {
-        return false;
-    }
+    g_wicSourceStraight = g_animationFramesStraight[0];
+    g_wicSourceStraight->AddRef();
+    g_wicSourcePremultiplied = g_animationFramesPremultiplied[0];
+    g_wicSourcePremultiplied->AddRef();
 
-    return true;
-}
+    g_animationSurface.width = canvasWidth;
+    g_animationSurface.height = canvasHeight;
+    g_animationSurface.frameIndex = 0;
+    g_animationSurface.valid = true;
 
-void DiscardRenderTarget()
-{
-    StopAnimationPlayback();
-    ClearAnimationFrames();
+    g_animationFrameIndex = 0;
+    g_currentFrameWidth = g_imageWidth;
+    g_currentFrameHeight = g_imageHeight;
+    StartAnimationPlayback();
 
-    if (g_placeholderBrush)
-    {
-        g_placeholderBrush->Release();
-        g_placeholderBrush = nullptr;
-    }
-    if (g_checkerBrushA)
-    {
-        g_checkerBrushA->Release();
-        g_checkerBrushA = nullptr;
-    }
-    if (g_checkerBrushB)
-    {
-        g_checkerBrushB->Release();
-        g_checkerBrushB = nullptr;
-    }
-    if (g_customColorBrush)
-    {
-        g_customColorBrush->Release();
-        g_customColorBrush = nullptr;
-    }
-    if (g_textBrush)
-    {
-        g_textBrush->Release();
-        g_textBrush = nullptr;
-    }
-    if (g_bitmap)
-    {
-        g_bitmap->Release();
-        g_bitmap = nullptr;
-    }
-    if (g_renderTarget)
-    {
-        g_renderTarget->Release();
-        g_renderTarget = nullptr;
-    }
-    if (g_wicSourceStraight)
-    {
-        g_wicSourceStraight->Release();
-        g_wicSourceStraight = nullptr;
-    }
-    if (g_wicSourcePremultiplied)
+cleanup:
+    if (decoder) decoder->Release();
+    if (stream) stream->Release();
+    if (FAILED(hr))
     {
-        g_wicSourcePremultiplied->Release();
-        g_wicSourcePremultiplied = nullptr;
+        StopAnimationPlayback();
+        ClearAnimationFrames();
     }
-    g_imageWidth = 0;
-    g_imageHeight = 0;
-    g_currentFrameWidth = 0;
-    g_currentFrameHeight = 0;
-    g_imageHasAlpha = false;
+
+    ApplyTransparencyMode();
+    return SUCCEEDED(hr);
 }
 
-void CleanupResources()
+bool ReadDocumentBuffer(const wchar_t* path, DocumentBuffer& document)
 {
-    DiscardRenderTarget();
-    CloseWebView();
+    document = DocumentBuffer{};
+    HANDLE file = CreateFileW(
+        path,
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+        nullptr
+    );
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
 
-    if (g_placeholderFormat)
+    LARGE_INTEGER fileSize{};
+    if (!GetFileSizeEx(file, &fileSize) || static_cast<uint64_t>(fileSize.QuadPart) > SIZE_MAX)
     {
-        g_placeholderFormat->Release();
-        g_placeholderFormat = nullptr;
+        CloseHandle(file);
+        return false;
     }
-    if (g_textFormat)
+
+    bool filled = FillDocumentBuffer(
+        static_cast<size_t>(fileSize.QuadPart),
+        [file](char* data, size_t size, size_t& read)
+        {
+            DWORD got = 0;
+            bool ok = ReadFile(file, data, static_cast<DWORD>(size), &got, nullptr) != FALSE;
+            read = got;
+            return ok;
+        },
+        document);
+    CloseHandle(file);
+    return filled;
+}
+
+// The ini file may be UTF-8 with or without a BOM, or a legacy ANSI file.
+bool DecodeIniText(const DocumentBuffer& document, std::wstring& content)
+{
+    if (document.HasUtf8Bom())
     {
-        g_textFormat->Release();
-        g_textFormat = nullptr;
+        return Utf8ToWide(document.Text(), content);
     }
-    if (g_dwriteFactory)
+    return Utf8ToWideStrict(document.Text(), content) || AnsiToWide(document.Text(), content);
+}
+
+bool AnsiToWide(std::string_view bytes, std::wstring& text)
+{
+    if (bytes.empty())
     {
-        g_dwriteFactory->Release();
-        g_dwriteFactory = nullptr;
+        text.clear();
+        return true;
     }
-    if (g_wicFactory)
+    int needed = MultiByteToWideChar(CP_ACP, 0, bytes.data(), static_cast<int>(bytes.size()), nullptr, 0);
+    if (needed <= 0)
     {
-        g_wicFactory->Release();
-        g_wicFactory = nullptr;
+        return false;
     }
-    if (g_d2dFactory)
+    text.assign(needed, L'\0');
+    MultiByteToWideChar(CP_ACP, 0, bytes.data(), static_cast<int>(bytes.size()), text.data(), needed);
+    return true;
+}
+
+bool GetSettingsFileStamp(const std::filesystem::path& path, uint64_t& writeTime, uint64_t& size)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data{};
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data))
     {
-        g_d2dFactory->Release();
-        g_d2dFactory = nullptr;
+        writeTime = 0;
+        size = 0;
+        return false;
     }
+    writeTime = GetFileTimeTicks(data.ftLastWriteTime);
+    size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    return true;
 }
 
-// =====================
-// WIC 初期化
-// =====================
-bool InitWIC()
+// Reads and indexes the ini file once; every later read is served from memory. Pending changes
+// are dropped.
+void LoadSettingsStore(const std::filesystem::path& path)
 {
-    HRESULT hr = CoCreateInstance(
-        CLSID_WICImagingFactory,
-        nullptr,
-        CLSCTX_INPROC_SERVER,
-        IID_PPV_ARGS(&g_wicFactory)
-    );
-    return SUCCEEDED(hr);
+    SettingsStore& store = g_settingsStore;
+    store = SettingsStore{};
+    store.path = path;
+    store.loaded = true;
+    GetSettingsFileStamp(path, store.writeTime, store.size);
+    DocumentBuffer document;
+    std::wstring content;
+    if (!ReadDocumentBuffer(path.c_str(), document) || !DecodeIniText(document, content))
+    {
+        return;
+    }
+    SplitSettingsLines(content, store.lines);
+    IndexSettingsLines(store);
 }
 
-// =====================
-// DirectWrite 初期化
-// =====================
-bool InitDirectWrite()
+bool TryGetSetting(const std::wstring& section, const std::wstring& key, std::wstring& value)
 {
-    HRESULT hr = DWriteCreateFactory(
-        DWRITE_FACTORY_TYPE_SHARED,
-        __uuidof(IDWriteFactory),
-        reinterpret_cast<IUnknown**>(&g_dwriteFactory)
-    );
-    if (FAILED(hr))
+    SettingsStore& store = g_settingsStore;
+    if (!store.loaded)
+    {
+        LoadSettingsStore(g_iniPath);
+    }
+    auto it = store.keyLines.find(MakeSettingsKey(section, key));
+    if (it == store.keyLines.end())
     {
         return false;
     }
+    const std::wstring& line = store.lines[it->second];
+    value = TrimString(line.substr(line.find(L'=') + 1));
+    return true;
+}
 
-    hr = g_dwriteFactory->CreateTextFormat(
-        L"Segoe UI",
-        nullptr,
-        DWRITE_FONT_WEIGHT_REGULAR,
-        DWRITE_FONT_STYLE_NORMAL,
-        DWRITE_FONT_STRETCH_NORMAL,
-        24.0f,
-        L"ja-jp",
-        &g_placeholderFormat
-    );
-    if (FAILED(hr))
+void StoreSettingsChange(SettingsChange change)
+{
+    SettingsStore& store = g_settingsStore;
+    if (!store.loaded)
     {
-        return false;
+        LoadSettingsStore(g_iniPath);
+    }
+    if (ApplySettingsChange(store, change))
+    {
+        store.changes.push_back(std::move(change));
     }
+}
 
-    g_placeholderFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_CENTER);
-    g_placeholderFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
+void SetSetting(const std::wstring& section, const std::wstring& key, const std::wstring& value)
+{
+    StoreSettingsChange({ section, key, value, false });
+}
 
-    UpdateTextFormat();
+void SetSettingInt(const std::wstring& section, const std::wstring& key, int value)
+{
+    SetSetting(section, key, std::to_wstring(value));
+}
 
-    return true;
+void RemoveSetting(const std::wstring& section, const std::wstring& key)
+{
+    StoreSettingsChange({ section, key, std::wstring(), true });
 }
 
-void ClearAnimationFrames()
+// Writes every pending change in one atomic save, as UTF-8 with a BOM. When the file was edited
+// on disk since it was read, the edited file is read again and the changes replayed on top of it.
+// The changes stay pending until a write succeeds, so a failed save is retried by the next flush.
+bool FlushSettingsStore()
 {
-    for (IWICBitmapSource* source : g_animationFramesStraight)
+    SettingsStore& store = g_settingsStore;
+    if (!store.loaded || store.changes.empty() || store.path.empty())
     {
-        if (source)
-        {
-            source->Release();
-        }
+        return true;
     }
-    g_animationFramesStraight.clear();
-
-    for (IWICBitmapSource* source : g_animationFramesPremultiplied)
+    uint64_t writeTime = 0;
+    uint64_t size = 0;
+    GetSettingsFileStamp(store.path, writeTime, size);
+    if (writeTime != store.writeTime || size != store.size)
     {
-        if (source)
+        std::vector<SettingsChange> changes = std::move(store.changes);
+        LoadSettingsStore(store.path);
+        for (const SettingsChange& change : changes)
         {
-            source->Release();
+            ApplySettingsChange(store, change);
         }
+        store.changes = std::move(changes);
     }
-    g_animationFramesPremultiplied.clear();
-    g_animationFrameDelaysMs.clear();
-    g_animationFrameWidths.clear();
-    g_animationFrameHeights.clear();
-    g_animationFrameIndex = 0;
-    g_currentFrameWidth = 0;
-    g_currentFrameHeight = 0;
-}
 
-void StopAnimationPlayback()
-{
-    if (g_animationPlaying && g_hwnd)
+    std::wstring content;
+    for (const std::wstring& line : store.lines)
     {
-        KillTimer(g_hwnd, kAnimationTimerId);
+        content += line;
+        content += L"\r\n";
     }
-    g_animationPlaying = false;
-}
-
-UINT GetAnimationFrameDelayMs(size_t frameIndex)
-{
-    if (frameIndex >= g_animationFrameDelaysMs.size())
+    std::string bytes(kUtf8Bom);
+    std::string utf8Content;
+    if (!WideToUtf8(content, utf8Content))
     {
-        return kDefaultAnimationFrameDelayMs;
+        return false;
     }
-    UINT delay = g_animationFrameDelaysMs[frameIndex];
-    if (delay == 0)
+    bytes += utf8Content;
+    if (!WriteFileAtomically(store.path, bytes.data(), bytes.size()))
     {
-        return kDefaultAnimationFrameDelayMs;
+        return false;
     }
-    return delay;
+    store.changes.clear();
+    GetSettingsFileStamp(store.path, store.writeTime, store.size);
+    return true;
 }
 
-bool SetCurrentAnimationFrame(size_t frameIndex)
+bool LoadTextFromFile(const wchar_t* path)
 {
-    if (frameIndex >= g_animationFramesStraight.size() || frameIndex >= g_animationFramesPremultiplied.size()
-        || frameIndex >= g_animationFrameWidths.size() || frameIndex >= g_animationFrameHeights.size())
+    if (!EnsureDirectWrite())
     {
         return false;
     }
-
-    IWICBitmapSource* straight = g_animationFramesStraight[frameIndex];
-    IWICBitmapSource* premultiplied = g_animationFramesPremultiplied[frameIndex];
-    if (!straight || !premultiplied)
+    // Reloading the same file keeps the reading position.
+    bool reopening = g_hasText && g_textDocument.path == path;
+    uint64_t topLine = g_textTopLine;
+    float topOffset = g_textTopOffset;
+    if (!OpenTextDocument(path))
     {
         return false;
     }
+    if (reopening)
+    {
+        g_textTopLine = topLine;
+        g_textTopOffset = topOffset;
+    }
 
+    StopAnimationPlayback();
+    ClearAnimationFrames();
+    if (g_bitmap)
+    {
+        g_bitmap->Release();
+        g_bitmap = nullptr;
+    }
     if (g_wicSourceStraight)
     {
         g_wicSourceStraight->Release();
@@ -1627,2174 +5344,2502 @@ bool SetCurrentAnimationFrame(size_t frameIndex)
         g_wicSourcePremultiplied->Release();
         g_wicSourcePremultiplied = nullptr;
     }
+    ReleaseLayeredSurfaceCache();
+    g_imageWidth = 0;
+    g_imageHeight = 0;
+    g_imageHasAlpha = false;
+    g_hasHtml = false;
+    g_pendingHtmlContent.clear();
+    g_pendingHtmlBlockBounds.clear();
+    CancelProgressiveHtml();
+    ForgetLiveMarkdownPage();
+    g_webviewPendingShow = false;
+    g_keepLayeredWhileHtmlPending = false;
+    HideWebView();
 
-    g_wicSourceStraight = straight;
-    g_wicSourceStraight->AddRef();
-    g_wicSourcePremultiplied = premultiplied;
-    g_wicSourcePremultiplied->AddRef();
-
-    if (g_bitmap)
-    {
-        g_bitmap->Release();
-        g_bitmap = nullptr;
-    }
-
-    D2D1_BITMAP_PROPERTIES bitmapProperties = D2D1::BitmapProperties(
-        D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)
-    );
-
-    HRESULT hr = g_renderTarget->CreateBitmapFromWicBitmap(
-        g_wicSourcePremultiplied,
-        &bitmapProperties,
-        &g_bitmap
-    );
-    if (FAILED(hr))
+    g_hasText = true;
+    g_fitToWindow = false;
+    g_zoom = 1.0f;
+    g_textScrollToEndPending = g_textFollow && !reopening;
+    UpdateTextFollowWatcher();
+    ApplyTransparencyMode();
+    ApplyDocumentWindowSize(g_hwnd);
+    if (g_hwnd)
     {
-        return false;
+        InvalidateRect(g_hwnd, nullptr, TRUE);
     }
-
-    g_animationFrameIndex = frameIndex;
-    g_currentFrameWidth = g_animationFrameWidths[frameIndex];
-    g_currentFrameHeight = g_animationFrameHeights[frameIndex];
     return true;
 }
 
-bool TryGetMetadataUInt32(IWICMetadataQueryReader* reader, const wchar_t* key, UINT32& value)
+std::wstring NormalizeFontName(const std::wstring& value)
 {
-    if (!reader)
+    std::wstring trimmed = TrimString(value);
+    size_t commaPos = trimmed.find(L',');
+    if (commaPos != std::wstring::npos)
     {
-        return false;
+        trimmed = TrimString(trimmed.substr(0, commaPos));
+    }
+    if (trimmed.size() >= 2)
+    {
+        wchar_t first = trimmed.front();
+        wchar_t last = trimmed.back();
+        if ((first == L'"' && last == L'"') || (first == L'\'' && last == L'\''))
+        {
+            trimmed = TrimString(trimmed.substr(1, trimmed.size() - 2));
+        }
     }
+    size_t dotPos = trimmed.find_last_of(L'.');
+    if (dotPos != std::wstring::npos)
+    {
+        std::wstring ext = trimmed.substr(dotPos);
+        for (auto& ch : ext)
+        {
+            ch = static_cast<wchar_t>(towlower(ch));
+        }
+        if (ext == L".ttf" || ext == L".otf" || ext == L".ttc")
+        {
+            trimmed = TrimString(trimmed.substr(0, dotPos));
+        }
+    }
+    return trimmed;
+}
 
-    PROPVARIANT variant;
-    PropVariantInit(&variant);
-    HRESULT hr = reader->GetMetadataByName(key, &variant);
-    if (FAILED(hr))
+std::wstring NormalizeSettingKey(const std::wstring& key)
+{
+    std::wstring result;
+    result.reserve(key.size());
+    for (wchar_t ch : key)
     {
-        PropVariantClear(&variant);
-        return false;
+        if (ch == L' ' || ch == L'_' || ch == L'-' || ch == L'\t')
+        {
+            continue;
+        }
+        result.push_back(static_cast<wchar_t>(towlower(ch)));
     }
+    return result;
+}
 
-    bool converted = false;
-    UINT32 temp = 0;
-    if (SUCCEEDED(PropVariantToUInt32(variant, &temp)))
+void AppendLocalizedStrings(IDWriteLocalizedStrings* strings, std::vector<std::wstring>& names)
+{
+    UINT32 count = strings->GetCount();
+    for (UINT32 i = 0; i < count; ++i)
     {
-        converted = true;
+        UINT32 length = 0;
+        if (FAILED(strings->GetStringLength(i, &length)) || length == 0)
+        {
+            continue;
+        }
+        std::wstring name(length + 1, L'\0');
+        if (SUCCEEDED(strings->GetString(i, name.data(), length + 1)))
+        {
+            name.resize(length);
+            names.push_back(std::move(name));
+        }
     }
-    else if (variant.vt == VT_UI2)
+}
+
+// Runs on the font catalog thread. Walks every family and face of the system collection once;
+// when two families share a name, the first one in the collection keeps it.
+void BuildFontCatalog(IDWriteFactory* factory, bool checkForUpdates)
+{
+    FontCatalog& catalog = g_fontCatalog;
+    IDWriteFontCollection* collection = nullptr;
+    if (FAILED(factory->GetSystemFontCollection(&collection, checkForUpdates ? TRUE : FALSE)) || !collection)
     {
-        temp = variant.uiVal;
-        converted = true;
+        factory->Release();
+        return;
     }
-    else if (variant.vt == VT_UI1)
+
+    auto index = std::make_shared<FontCatalogIndex>();
+    std::vector<std::wstring> familyNames;
+    std::vector<std::wstring> faceNames;
+    std::vector<std::wstring> gdiNames;
+    UINT32 familyCount = collection->GetFontFamilyCount();
+    for (UINT32 familyIndex = 0; familyIndex < familyCount && !catalog.cancel; ++familyIndex)
     {
-        temp = variant.bVal;
-        converted = true;
+        IDWriteFontFamily* family = nullptr;
+        if (FAILED(collection->GetFontFamily(familyIndex, &family)) || !family)
+        {
+            continue;
+        }
+        familyNames.clear();
+        IDWriteLocalizedStrings* familyStrings = nullptr;
+        if (SUCCEEDED(family->GetFamilyNames(&familyStrings)) && familyStrings)
+        {
+            AppendLocalizedStrings(familyStrings, familyNames);
+            familyStrings->Release();
+        }
+        if (familyNames.empty())
+        {
+            family->Release();
+            continue;
+        }
+        AddFontCatalogFamily(*index, familyNames);
+
+        UINT32 fontCount = family->GetFontCount();
+        for (UINT32 fontIndex = 0; fontIndex < fontCount; ++fontIndex)
+        {
+            IDWriteFont* font = nullptr;
+            if (FAILED(family->GetFont(fontIndex, &font)) || !font)
+            {
+                continue;
+            }
+            faceNames.clear();
+            IDWriteLocalizedStrings* faceStrings = nullptr;
+            if (SUCCEEDED(font->GetFaceNames(&faceStrings)) && faceStrings)
+            {
+                AppendLocalizedStrings(faceStrings, faceNames);
+                faceStrings->Release();
+            }
+            gdiNames.clear();
+            IDWriteLocalizedStrings* gdiStrings = nullptr;
+            BOOL exists = FALSE;
+            if (SUCCEEDED(font->GetInformationalStrings(DWRITE_INFORMATIONAL_STRING_WIN32_FAMILY_NAMES, &gdiStrings, &exists))
+                && gdiStrings)
+            {
+                AppendLocalizedStrings(gdiStrings, gdiNames);
+                gdiStrings->Release();
+            }
+            FontCatalogEntry face;
+            face.familyName = familyNames.front();
+            face.weight = static_cast<uint32_t>(font->GetWeight());
+            face.style = static_cast<uint32_t>(font->GetStyle());
+            face.stretch = static_cast<uint32_t>(font->GetStretch());
+            AddFontCatalogFace(*index, face, faceNames, gdiNames);
+            font->Release();
+        }
+        family->Release();
     }
+    collection->Release();
+    factory->Release();
 
-    PropVariantClear(&variant);
-    if (!converted)
+    if (!catalog.cancel)
     {
-        return false;
+        std::lock_guard<std::mutex> lock(catalog.mutex);
+        catalog.index = std::move(index);
     }
-
-    value = temp;
-    return true;
 }
 
-UINT ExtractFrameDelayMs(IWICBitmapFrameDecode* frame)
+void StartFontCatalog()
 {
-    if (!frame)
+    FontCatalog& catalog = g_fontCatalog;
+    if (!g_dwriteFactory || catalog.thread.joinable())
     {
-        return kDefaultAnimationFrameDelayMs;
+        return;
     }
+    g_dwriteFactory->AddRef();
+    catalog.cancel = false;
+    catalog.thread = std::thread(BuildFontCatalog, g_dwriteFactory, catalog.checkForUpdates);
+    catalog.checkForUpdates = false;
+}
 
-    IWICMetadataQueryReader* frameMetadata = nullptr;
-    HRESULT hr = frame->GetMetadataQueryReader(&frameMetadata);
-    if (FAILED(hr) || !frameMetadata)
+void StopFontCatalog()
+{
+    FontCatalog& catalog = g_fontCatalog;
+    catalog.cancel = true;
+    if (catalog.thread.joinable())
     {
-        return kDefaultAnimationFrameDelayMs;
+        catalog.thread.join();
     }
+    std::lock_guard<std::mutex> lock(catalog.mutex);
+    catalog.index.reset();
+}
 
-    UINT32 value = 0;
-    UINT delayMs = kDefaultAnimationFrameDelayMs;
+// Drops the catalog after WM_FONTCHANGE and lists the refreshed collection again.
+void InvalidateFontCatalog()
+{
+    StopFontCatalog();
+    g_fontCatalog.checkForUpdates = true;
+    StartFontCatalog();
+}
 
-    if (TryGetMetadataUInt32(frameMetadata, L"/grctlext/Delay", value)
-        || TryGetMetadataUInt32(frameMetadata, L"/grctlext/DelayTime", value))
+// Returns the font catalog, starting its build on first use. While the build is running this
+// returns null, unless wait is set, in which case it blocks until the build is done.
+std::shared_ptr<const FontCatalogIndex> GetFontCatalogIndex(bool wait)
+{
+    FontCatalog& catalog = g_fontCatalog;
     {
-        if (value > 0 && value <= (UINT_MAX / 10))
+        std::lock_guard<std::mutex> lock(catalog.mutex);
+        if (catalog.index)
         {
-            delayMs = static_cast<UINT>(value * 10);
+            return catalog.index;
         }
     }
-    else if (TryGetMetadataUInt32(frameMetadata, L"/ANMF/FrameDuration", value)
-        || TryGetMetadataUInt32(frameMetadata, L"/ANIM/FrameDuration", value))
+    StartFontCatalog();
+    if (!wait || !catalog.thread.joinable())
     {
-        if (value > 0)
-        {
-            delayMs = static_cast<UINT>(value);
-        }
+        return nullptr;
     }
-
-    frameMetadata->Release();
-    return delayMs == 0 ? kDefaultAnimationFrameDelayMs : delayMs;
+    catalog.thread.join();
+    std::lock_guard<std::mutex> lock(catalog.mutex);
+    return catalog.index;
 }
 
-// =====================
-// 画像ロード
-// =====================
-bool LoadImageFromFile(const wchar_t* path)
+std::wstring GetFontFamilyNameForSave(const std::wstring& fontName)
 {
-    IWICBitmapDecoder* decoder = nullptr;
-    WICPixelFormatGUID pixelFormat = GUID_WICPixelFormatDontCare;
-    D2D1_BITMAP_PROPERTIES bitmapProperties{};
-    UINT frameCount = 0;
-    UINT canvasWidth = 0;
-    UINT canvasHeight = 0;
-    std::vector<BYTE> previousCanvas;
-    std::vector<BYTE> workingCanvas;
-    IWICMetadataQueryReader* decoderMetadata = nullptr;
-
-    StopAnimationPlayback();
-    ClearAnimationFrames();
-
-    if (g_bitmap)
+    if (fontName.empty())
     {
-        g_bitmap->Release();
-        g_bitmap = nullptr;
+        return fontName;
     }
-    if (g_wicSourceStraight)
+    if (!g_dwriteFactory)
     {
-        g_wicSourceStraight->Release();
-        g_wicSourceStraight = nullptr;
+        return fontName;
     }
-    if (g_wicSourcePremultiplied)
+    std::shared_ptr<const FontCatalogIndex> index = GetFontCatalogIndex(false);
+    if (index)
     {
-        g_wicSourcePremultiplied->Release();
-        g_wicSourcePremultiplied = nullptr;
+        std::wstring familyName;
+        if (FindFontCatalogGdiFamily(*index, fontName, familyName))
+        {
+            return familyName;
+        }
     }
-    g_imageWidth = 0;
-    g_imageHeight = 0;
-    g_imageHasAlpha = false;
-    g_hasText = false;
-    g_textContent.clear();
-    g_hasHtml = false;
-    g_pendingHtmlContent.clear();
-    g_webviewPendingShow = false;
-    g_keepLayeredWhileHtmlPending = false;
-    HideWebView();
-
-    HRESULT hr = g_wicFactory->CreateDecoderFromFilename(
-        path,
-        nullptr,
-        GENERIC_READ,
-        WICDecodeMetadataCacheOnDemand,
-        &decoder
-    );
-    if (FAILED(hr)) goto cleanup;
 
-    hr = decoder->GetFrameCount(&frameCount);
-    if (FAILED(hr) || frameCount == 0)
+    IDWriteGdiInterop* gdiInterop = nullptr;
+    HRESULT hr = g_dwriteFactory->GetGdiInterop(&gdiInterop);
+    if (FAILED(hr) || !gdiInterop)
     {
-        goto cleanup;
+        return fontName;
     }
 
-    if (SUCCEEDED(decoder->GetMetadataQueryReader(&decoderMetadata)) && decoderMetadata)
+    LOGFONT lf{};
+    wcsncpy_s(lf.lfFaceName, fontName.c_str(), LF_FACESIZE - 1);
+    lf.lfHeight = -12;
+    lf.lfCharSet = DEFAULT_CHARSET;
+
+    IDWriteFont* font = nullptr;
+    hr = gdiInterop->CreateFontFromLOGFONT(&lf, &font);
+    gdiInterop->Release();
+    if (FAILED(hr) || !font)
     {
-        UINT32 metadataWidth = 0;
-        UINT32 metadataHeight = 0;
-        if (TryGetMetadataUInt32(decoderMetadata, L"/logscrdesc/Width", metadataWidth)
-            && TryGetMetadataUInt32(decoderMetadata, L"/logscrdesc/Height", metadataHeight)
-            && metadataWidth > 0 && metadataHeight > 0)
-        {
-            canvasWidth = metadataWidth;
-            canvasHeight = metadataHeight;
-        }
-        else if (TryGetMetadataUInt32(decoderMetadata, L"/ANIM/CanvasWidth", metadataWidth)
-            && TryGetMetadataUInt32(decoderMetadata, L"/ANIM/CanvasHeight", metadataHeight)
-            && metadataWidth > 0 && metadataHeight > 0)
-        {
-            canvasWidth = metadataWidth;
-            canvasHeight = metadataHeight;
-        }
-        decoderMetadata->Release();
+        return fontName;
     }
 
-    for (UINT i = 0; i < frameCount; ++i)
+    IDWriteFontFamily* family = nullptr;
+    hr = font->GetFontFamily(&family);
+    font->Release();
+    if (FAILED(hr) || !family)
     {
-        IWICBitmapFrameDecode* currentFrame = nullptr;
-        IWICFormatConverter* decodedFrameStraight = nullptr;
-        IWICBitmap* composedFrameBitmap = nullptr;
-        IWICFormatConverter* currentPremultiplied = nullptr;
-
-        hr = decoder->GetFrame(i, &currentFrame);
-        if (FAILED(hr) || !currentFrame)
-        {
-            if (currentFrame) currentFrame->Release();
-            goto cleanup;
-        }
-
-        UINT frameWidth = 0;
-        UINT frameHeight = 0;
-        hr = currentFrame->GetSize(&frameWidth, &frameHeight);
-        if (FAILED(hr) || frameWidth == 0 || frameHeight == 0)
-        {
-            currentFrame->Release();
-            goto cleanup;
-        }
+        return fontName;
+    }
 
-        if (i == 0)
+    std::wstring result = fontName;
+    IDWriteLocalizedStrings* familyNames = nullptr;
+    hr = family->GetFamilyNames(&familyNames);
+    if (SUCCEEDED(hr) && familyNames)
+    {
+        UINT32 length = 0;
+        if (SUCCEEDED(familyNames->GetStringLength(0, &length)) && length > 0)
         {
-            if (canvasWidth == 0 || canvasHeight == 0)
-            {
-                canvasWidth = frameWidth;
-                canvasHeight = frameHeight;
-            }
-            g_imageWidth = canvasWidth;
-            g_imageHeight = canvasHeight;
-            g_currentFrameWidth = canvasWidth;
-            g_currentFrameHeight = canvasHeight;
-
-            hr = currentFrame->GetPixelFormat(&pixelFormat);
-            if (SUCCEEDED(hr))
+            std::wstring familyName(length + 1, L'\0');
+            if (SUCCEEDED(familyNames->GetString(0, familyName.data(), length + 1)))
             {
-                g_imageHasAlpha = QueryPixelFormatHasAlpha(pixelFormat);
+                familyName.resize(length);
+                result = std::move(familyName);
             }
-
-            size_t canvasBufferSize = static_cast<size_t>(canvasWidth) * static_cast<size_t>(canvasHeight) * 4;
-            previousCanvas.assign(canvasBufferSize, 0);
-            workingCanvas.assign(canvasBufferSize, 0);
-        }
-
-        hr = g_wicFactory->CreateFormatConverter(&decodedFrameStraight);
-        if (FAILED(hr))
-        {
-            currentFrame->Release();
-            goto cleanup;
         }
+        familyNames->Release();
+    }
+    family->Release();
+    return result;
+}
 
-        hr = decodedFrameStraight->Initialize(
-            currentFrame,
-            GUID_WICPixelFormat32bppBGRA,
-            WICBitmapDitherTypeNone,
-            nullptr,
-            0.0,
-            WICBitmapPaletteTypeCustom
-        );
-        if (FAILED(hr))
-        {
-            currentFrame->Release();
-            decodedFrameStraight->Release();
-            goto cleanup;
-        }
+// Family names are tried before face names, whichever family they belong to. Until the catalog
+// is built, a plain family name is still answered straight from the collection.
+ResolvedFontInfo ResolveFontInfo(IDWriteFactory* factory, const std::wstring& name)
+{
+    ResolvedFontInfo resolved;
+    resolved.familyName = name;
+    if (!factory || name.empty())
+    {
+        return resolved;
+    }
 
-        UINT32 frameLeft = 0;
-        UINT32 frameTop = 0;
-        UINT32 disposal = 0;
-        IWICMetadataQueryReader* frameMetadata = nullptr;
-        if (SUCCEEDED(currentFrame->GetMetadataQueryReader(&frameMetadata)) && frameMetadata)
+    std::shared_ptr<const FontCatalogIndex> index = GetFontCatalogIndex(false);
+    if (!index)
+    {
+        IDWriteFontCollection* collection = nullptr;
+        if (SUCCEEDED(factory->GetSystemFontCollection(&collection, FALSE)) && collection)
         {
-            TryGetMetadataUInt32(frameMetadata, L"/imgdesc/Left", frameLeft);
-            TryGetMetadataUInt32(frameMetadata, L"/imgdesc/Top", frameTop);
-            if (!TryGetMetadataUInt32(frameMetadata, L"/grctlext/Disposal", disposal))
+            UINT32 familyIndex = 0;
+            BOOL exists = FALSE;
+            bool found = SUCCEEDED(collection->FindFamilyName(name.c_str(), &familyIndex, &exists)) && exists;
+            collection->Release();
+            if (found)
             {
-                TryGetMetadataUInt32(frameMetadata, L"/grctlext/DisposalMethod", disposal);
+                resolved.matched = true;
+                return resolved;
             }
-            frameMetadata->Release();
         }
-
-        UINT srcStride = frameWidth * 4;
-        std::vector<BYTE> framePixels(static_cast<size_t>(srcStride) * frameHeight, 0);
-        WICRect frameRect{ 0, 0, static_cast<INT>(frameWidth), static_cast<INT>(frameHeight) };
-        hr = decodedFrameStraight->CopyPixels(&frameRect, srcStride, static_cast<UINT>(framePixels.size()), framePixels.data());
-        if (FAILED(hr))
+        index = GetFontCatalogIndex(true);
+        if (!index)
         {
-            currentFrame->Release();
-            decodedFrameStraight->Release();
-            goto cleanup;
+            return resolved;
         }
+    }
 
-        std::vector<BYTE> beforeFrame = previousCanvas;
-        workingCanvas = previousCanvas;
+    FontCatalogEntry entry;
+    if (FindFontCatalogEntry(*index, name, entry))
+    {
+        resolved.familyName = entry.familyName;
+        resolved.weight = static_cast<DWRITE_FONT_WEIGHT>(entry.weight);
+        resolved.style = static_cast<DWRITE_FONT_STYLE>(entry.style);
+        resolved.stretch = static_cast<DWRITE_FONT_STRETCH>(entry.stretch);
+        resolved.matched = true;
+    }
+    return resolved;
+}
 
-        auto blendPixel = [](BYTE* dst, const BYTE* src)
+bool TryParseMarkdownLine(const std::wstring& line, std::wstring& key, std::wstring& value)
+{
+    std::wstring trimmed = TrimString(line);
+    if (trimmed.empty())
+    {
+        return false;
+    }
+    if (trimmed[0] == L'-' || trimmed[0] == L'*')
+    {
+        trimmed = TrimString(trimmed.substr(1));
+    }
+    size_t pipePos = trimmed.find(L'|');
+    if (pipePos != std::wstring::npos)
+    {
+        std::vector<std::wstring> columns;
+        std::wstring current;
+        for (wchar_t ch : trimmed)
         {
-            UINT srcA = src[3];
-            if (srcA == 0)
+            if (ch == L'|')
             {
-                return;
+                columns.push_back(TrimString(current));
+                current.clear();
             }
-            UINT dstA = dst[3];
-            UINT outA = srcA + ((dstA * (255 - srcA) + 127) / 255);
-            for (int c = 0; c < 3; ++c)
+            else
             {
-                UINT srcC = src[c];
-                UINT dstC = dst[c];
-                UINT outC = srcC + ((dstC * (255 - srcA) + 127) / 255);
-                dst[c] = static_cast<BYTE>(std::min(outC, 255u));
+                current.push_back(ch);
             }
-            dst[3] = static_cast<BYTE>(std::min(outA, 255u));
-        };
-
-        for (UINT y = 0; y < frameHeight; ++y)
+        }
+        columns.push_back(TrimString(current));
+        std::wstring first;
+        std::wstring second;
+        for (const auto& column : columns)
         {
-            UINT dstY = frameTop + y;
-            if (dstY >= canvasHeight)
+            if (column.empty())
             {
                 continue;
             }
-            for (UINT x = 0; x < frameWidth; ++x)
+            if (first.empty())
             {
-                UINT dstX = frameLeft + x;
-                if (dstX >= canvasWidth)
-                {
-                    continue;
-                }
-                size_t srcIndex = (static_cast<size_t>(y) * frameWidth + x) * 4;
-                size_t dstIndex = (static_cast<size_t>(dstY) * canvasWidth + dstX) * 4;
-                blendPixel(&workingCanvas[dstIndex], &framePixels[srcIndex]);
+                first = column;
+            }
+            else
+            {
+                second = column;
+                break;
             }
         }
-
-        UINT canvasStride = canvasWidth * 4;
-        hr = g_wicFactory->CreateBitmapFromMemory(
-            canvasWidth,
-            canvasHeight,
-            GUID_WICPixelFormat32bppBGRA,
-            canvasStride,
-            static_cast<UINT>(workingCanvas.size()),
-            workingCanvas.data(),
-            &composedFrameBitmap
-        );
-        if (FAILED(hr))
+        if (!first.empty() && !second.empty())
         {
-            currentFrame->Release();
-            decodedFrameStraight->Release();
-            goto cleanup;
+            key = first;
+            value = second;
+            return true;
         }
+        return false;
+    }
 
-        hr = g_wicFactory->CreateFormatConverter(&currentPremultiplied);
-        if (FAILED(hr))
-        {
-            currentFrame->Release();
-            decodedFrameStraight->Release();
-            composedFrameBitmap->Release();
-            goto cleanup;
-        }
+    size_t colonPos = trimmed.find(L':');
+    if (colonPos != std::wstring::npos)
+    {
+        key = TrimString(trimmed.substr(0, colonPos));
+        value = TrimString(trimmed.substr(colonPos + 1));
+        return !(key.empty() || value.empty());
+    }
+    return false;
+}
 
-        hr = currentPremultiplied->Initialize(
-            composedFrameBitmap,
-            GUID_WICPixelFormat32bppPBGRA,
-            WICBitmapDitherTypeNone,
-            nullptr,
-            0.0,
-            WICBitmapPaletteTypeCustom
-        );
-        if (FAILED(hr))
-        {
-            currentFrame->Release();
-            decodedFrameStraight->Release();
-            composedFrameBitmap->Release();
-            currentPremultiplied->Release();
-            goto cleanup;
-        }
+bool TryParseBoolValue(const std::wstring& value, bool& outValue)
+{
+    std::wstring lowered;
+    lowered.reserve(value.size());
+    for (wchar_t ch : value)
+    {
+        lowered.push_back(static_cast<wchar_t>(towlower(ch)));
+    }
+    lowered = TrimString(lowered);
+    if (lowered == L"1" || lowered == L"true" || lowered == L"yes" || lowered == L"on")
+    {
+        outValue = true;
+        return true;
+    }
+    if (lowered == L"0" || lowered == L"false" || lowered == L"no" || lowered == L"off")
+    {
+        outValue = false;
+        return true;
+    }
+    return false;
+}
 
-        if (!g_imageHasAlpha && ImageHasTransparency(composedFrameBitmap))
+bool TryParseColorValue(const std::wstring& value, COLORREF& outColor)
+{
+    std::wstring trimmed = TrimString(value);
+    if (trimmed.empty())
+    {
+        return false;
+    }
+    if (trimmed[0] == L'#' && trimmed.size() == 7)
+    {
+        wchar_t* endPtr = nullptr;
+        unsigned long rgb = std::wcstoul(trimmed.c_str() + 1, &endPtr, 16);
+        if (endPtr && *endPtr == L'\0')
         {
-            g_imageHasAlpha = true;
+            BYTE r = static_cast<BYTE>((rgb >> 16) & 0xFF);
+            BYTE g = static_cast<BYTE>((rgb >> 8) & 0xFF);
+            BYTE b = static_cast<BYTE>(rgb & 0xFF);
+            outColor = RGB(r, g, b);
+            return true;
         }
+        return false;
+    }
+    wchar_t* endPtr = nullptr;
+    unsigned long valueNum = std::wcstoul(trimmed.c_str(), &endPtr, 0);
+    if (endPtr && *endPtr == L'\0')
+    {
+        outColor = static_cast<COLORREF>(valueNum);
+        return true;
+    }
+    return false;
+}
 
-        g_animationFramesStraight.push_back(composedFrameBitmap);
-        g_animationFramesPremultiplied.push_back(currentPremultiplied);
-        g_animationFrameDelaysMs.push_back(ExtractFrameDelayMs(currentFrame));
-        g_animationFrameWidths.push_back(canvasWidth);
-        g_animationFrameHeights.push_back(canvasHeight);
+// Looks name up in the schema: a case-folded "section\nkey" for the ini, a normalized key for
+// the markdown settings file. nullptr when the schema has no such setting.
+const SettingField* FindSettingField(std::wstring_view name, bool markdown)
+{
+    uint8_t index = markdown ? FindSettingSlot(kSettingMarkdownTable, name) : FindSettingSlot(kSettingIniTable, name);
+    if (index == kSettingSlotEmpty)
+    {
+        return nullptr;
+    }
+    const SettingField& field = kSettingFields[index];
+    return MatchesSettingField(field, name, markdown) ? &field : nullptr;
+}
 
-        if (disposal == 2)
-        {
-            previousCanvas = workingCanvas;
-            for (UINT y = 0; y < frameHeight; ++y)
-            {
-                UINT dstY = frameTop + y;
-                if (dstY >= canvasHeight)
-                {
-                    continue;
-                }
-                for (UINT x = 0; x < frameWidth; ++x)
-                {
-                    UINT dstX = frameLeft + x;
-                    if (dstX >= canvasWidth)
-                    {
-                        continue;
-                    }
-                    size_t dstIndex = (static_cast<size_t>(dstY) * canvasWidth + dstX) * 4;
-                    previousCanvas[dstIndex + 0] = 0;
-                    previousCanvas[dstIndex + 1] = 0;
-                    previousCanvas[dstIndex + 2] = 0;
-                    previousCanvas[dstIndex + 3] = 0;
-                }
-            }
-        }
-        else if (disposal == 3)
-        {
-            previousCanvas = beforeFrame;
-        }
-        else
+// Stores a number, after the field's range check, into the field's global.
+void AssignSettingNumber(const SettingField& field, double value)
+{
+    if (field.range == SettingRange::Clamp)
+    {
+        value = (std::min)((std::max)(value, field.minValue), field.maxValue);
+    }
+    else if (field.range == SettingRange::Reject && (value < field.minValue || value > field.maxValue))
+    {
+        value = field.defaultValue;
+    }
+    field.assign(field.target, value);
+}
+
+void ApplySettingValue(const SettingField& field, const std::wstring& value)
+{
+    if (field.kind == SettingKind::FontName)
+    {
+        std::wstring fontName = NormalizeFontName(value);
+        if (!fontName.empty())
         {
-            previousCanvas = workingCanvas;
+            *static_cast<std::wstring*>(field.target) = std::move(fontName);
         }
-
-        currentFrame->Release();
-        decodedFrameStraight->Release();
+        return;
     }
+    AssignSettingNumber(field, field.kind == SettingKind::Float ? _wtof(value.c_str()) : _wtoi(value.c_str()));
+}
 
-    if (g_animationFramesPremultiplied.empty())
+// Markdown values are applied only when they parse; anything else keeps what the ini set.
+void ApplyMarkdownSettingValue(const SettingField& field, const std::wstring& value)
+{
+    switch (field.kind)
     {
-        hr = E_FAIL;
-        goto cleanup;
+    case SettingKind::Color:
+    {
+        COLORREF color = 0;
+        if (TryParseColorValue(value, color))
+        {
+            AssignSettingNumber(field, color);
+        }
+        break;
     }
-
-    bitmapProperties = D2D1::BitmapProperties(
-        D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)
-    );
-
-    hr = g_renderTarget->CreateBitmapFromWicBitmap(
-        g_animationFramesPremultiplied[0],
-        &bitmapProperties,
-        &g_bitmap
-    );
-    if (FAILED(hr))
+    case SettingKind::Bool:
     {
-        goto cleanup;
+        bool flag = false;
+        if (TryParseBoolValue(value, flag))
+        {
+            AssignSettingNumber(field, flag ? 1 : 0);
+        }
+        break;
     }
+    default:
+        ApplySettingValue(field, value);
+        break;
+    }
+}
 
-    g_wicSourceStraight = g_animationFramesStraight[0];
-    g_wicSourceStraight->AddRef();
-    g_wicSourcePremultiplied = g_animationFramesPremultiplied[0];
-    g_wicSourcePremultiplied->AddRef();
-
-    g_animationFrameIndex = 0;
-    g_currentFrameWidth = g_imageWidth;
-    g_currentFrameHeight = g_imageHeight;
-    g_animationPlaying = g_animationFramesPremultiplied.size() > 1;
-    if (g_animationPlaying && g_hwnd)
+std::wstring FormatSettingValue(const SettingField& field)
+{
+    if (field.kind == SettingKind::FontName)
     {
-        UINT delay = GetAnimationFrameDelayMs(0);
-        SetTimer(g_hwnd, kAnimationTimerId, delay, nullptr);
+        return GetFontFamilyNameForSave(*static_cast<const std::wstring*>(field.target));
     }
-
-cleanup:
-    if (decoder) decoder->Release();
-    if (FAILED(hr))
+    double value = field.read(field.target);
+    if (field.range == SettingRange::Clamp)
     {
-        StopAnimationPlayback();
-        ClearAnimationFrames();
+        value = (std::min)((std::max)(value, field.minValue), field.maxValue);
     }
-
-    ApplyTransparencyMode();
-    return SUCCEEDED(hr);
+    if (field.kind == SettingKind::Float)
+    {
+        wchar_t buffer[32]{};
+        _snwprintf_s(buffer, _TRUNCATE, L"%g", value);
+        return buffer;
+    }
+    return std::to_wstring(static_cast<int64_t>(value));
 }
 
-bool ReadFileBytes(const wchar_t* path, std::string& bytes)
+// Resets every schema setting to its default, then applies the ini in one pass over its keys.
+// Keys the schema does not know are left alone.
+void LoadSchemaSettings()
 {
-    std::ifstream file(path, std::ios::binary);
-    if (!file)
+    for (const SettingField& field : kSettingFields)
     {
-        return false;
+        if (field.assign)
+        {
+            field.assign(field.target, field.defaultValue);
+        }
     }
-
-    bytes.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    if (bytes.size() >= 3 && static_cast<unsigned char>(bytes[0]) == 0xEF
-        && static_cast<unsigned char>(bytes[1]) == 0xBB
-        && static_cast<unsigned char>(bytes[2]) == 0xBF)
+    const SettingsStore& store = g_settingsStore;
+    for (const auto& [name, line] : store.keyLines)
     {
-        bytes.erase(0, 3);
+        const SettingField* field = FindSettingField(name, false);
+        if (field)
+        {
+            const std::wstring& text = store.lines[line];
+            ApplySettingValue(*field, TrimString(text.substr(text.find(L'=') + 1)));
+        }
     }
-    return true;
 }
 
-bool ReadFileBytesRaw(const wchar_t* path, std::string& bytes)
+void SaveSchemaSettings()
 {
-    std::ifstream file(path, std::ios::binary);
-    if (!file)
+    for (const SettingField& field : kSettingFields)
     {
-        return false;
+        std::wstring section(field.section);
+        std::wstring key(field.key);
+        if (field.loadOnly)
+        {
+            RemoveSetting(section, key);
+        }
+        else
+        {
+            SetSetting(section, key, FormatSettingValue(field));
+        }
     }
-    bytes.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    return true;
 }
 
-bool TryGetIniValueFromContent(const std::wstring& content, const std::wstring& section, const std::wstring& key, std::wstring& value)
+void LoadTextSettingsFromMarkdown(const std::filesystem::path& path)
 {
+    DocumentBuffer document;
+    if (!ReadDocumentBuffer(path.c_str(), document))
+    {
+        return;
+    }
+
+    std::wstring content;
+    if (!Utf8ToWide(document.Text(), content))
+    {
+        return;
+    }
+
     std::wstringstream stream(content);
     std::wstring line;
-    bool inSection = false;
-    std::wstring sectionHeader = L"[" + section + L"]";
     while (std::getline(stream, line))
     {
-        std::wstring trimmed = TrimString(line);
-        if (trimmed.empty())
+        std::wstring key;
+        std::wstring value;
+        if (!TryParseMarkdownLine(line, key, value))
         {
             continue;
         }
-        if (trimmed[0] == L';' || trimmed[0] == L'#')
+        const SettingField* field = FindSettingField(NormalizeSettingKey(key), true);
+        if (field)
         {
-            continue;
+            ApplyMarkdownSettingValue(*field, value);
         }
-        if (trimmed.front() == L'[' && trimmed.back() == L']')
+    }
+    g_textFontFaceName = TrimString(g_textFontName);
+}
+
+std::string InjectHtmlBaseStyles(std::string_view html)
+{
+    constexpr std::string_view style = R"(<style>
+html {
+    background: #ffffff !important;
+    margin: 0;
+    width: 100%;
+    height: 100%;
+    overflow: auto;
+    scrollbar-gutter: stable;
+}
+body {
+    background: #ffffff !important;
+    margin: 0;
+    min-height: 100%;
+    overflow: visible;
+}
+</style>)";
+    return InjectHtmlStyle(html, style);
+}
+
+// Hash of the settings that feed the page prologue; seeds the cache key of every page.
+uint64_t ComputeMarkdownStyleKey()
+{
+    uint64_t styleKey = HashBytes(g_textFontName.data(), g_textFontName.size() * sizeof(wchar_t), 0);
+    uint64_t styleValues[] = {
+        static_cast<uint64_t>(g_textColor),
+        static_cast<uint64_t>(g_textBackground),
+        g_textWrap ? 1ull : 0ull
+    };
+    return HashBytes(styleValues, sizeof(styleValues), styleKey);
+}
+
+bool RenderMarkdownToHtml(std::string_view markdown, MarkdownPage& page)
+{
+    auto toHex = [](COLORREF color)
+    {
+        std::ostringstream stream;
+        stream << '#'
+               << std::hex << std::setw(2) << std::setfill('0') << std::nouppercase
+               << static_cast<int>(GetRValue(color))
+               << std::setw(2) << static_cast<int>(GetGValue(color))
+               << std::setw(2) << static_cast<int>(GetBValue(color));
+        return stream.str();
+    };
+
+    std::string fontName = "Segoe UI";
+    if (!g_textFontName.empty())
+    {
+        std::string utf8Font;
+        if (WideToUtf8(g_textFontName, utf8Font) && !utf8Font.empty())
         {
-            inSection = (_wcsicmp(trimmed.c_str(), sectionHeader.c_str()) == 0);
-            continue;
+            fontName = utf8Font;
         }
-        if (!inSection)
-        {
-            continue;
+    }
+
+    std::string bodyBackground = toHex(g_textBackground);
+    std::string bodyColor = toHex(g_textColor);
+    const char* wrapValue = g_textWrap ? "normal" : "pre";
+
+    std::ostringstream style;
+    style << R"(
+        :root {
+            color-scheme: light dark;
         }
-        size_t eqPos = trimmed.find(L'=');
-        if (eqPos == std::wstring::npos)
-        {
-            continue;
+        html {
+            scrollbar-gutter: stable;
+            overflow: auto;
         }
-        std::wstring foundKey = TrimString(trimmed.substr(0, eqPos));
-        if (_wcsicmp(foundKey.c_str(), key.c_str()) != 0)
-        {
-            continue;
+        body {
+            margin: 0;
+            padding: 24px;
+            font-family: ")"
+          << fontName
+          << R"(", "Segoe UI", "Meiryo", sans-serif;
+            background: )"
+          << bodyBackground
+          << R"(;
+            color: )"
+          << bodyColor
+          << R"(;
+            white-space: )"
+          << wrapValue
+          << R"(;
+            overflow: visible;
         }
-        value = TrimString(trimmed.substr(eqPos + 1));
-        return true;
-    }
-    return false;
+        .markdown-body {
+            max-width: 960px;
+            margin: 0 auto;
+        }
+        pre, code {
+            font-family: "Consolas", "Courier New", monospace;
+        }
+        pre {
+            padding: 12px;
+            background: #f6f8fa;
+            border-radius: 6px;
+            overflow: auto;
+        }
+        code {
+            background: #f6f8fa;
+            border-radius: 4px;
+            padding: 0 4px;
+        }
+        .tok-kw {
+            color: #cf222e;
+        }
+        .tok-str {
+            color: #0a3069;
+        }
+        .tok-com {
+            color: #6e7781;
+            font-style: italic;
+        }
+        .tok-num {
+            color: #0550ae;
+        }
+        .tok-meta {
+            color: #8250df;
+        }
+        .tok-key {
+            color: #116329;
+        }
+        .tok-var {
+            color: #953800;
+        }
+        table {
+            border-collapse: collapse;
+        }
+        th, td {
+            border: 1px solid #d0d7de;
+            padding: 6px 10px;
+        }
+        blockquote {
+            border-left: 4px solid #d0d7de;
+            margin: 0;
+            padding-left: 16px;
+            color: #57606a;
+        }
+    )";
+
+    // md4c streams its chunks straight after the prologue; the page never exists in UTF-16.
+    std::string prologue = "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><style>";
+    prologue += style.str();
+    prologue += "</style></head><body><article class=\"markdown-body\">";
+    return RenderMarkdownPage(markdown, prologue, "</article></body></html>", page);
 }
 
-bool Utf8ToWide(const std::string& bytes, std::wstring& text)
+bool ApplyHtmlContent(std::string html, std::vector<size_t> blockBounds)
 {
-    if (bytes.empty())
+    CancelProgressiveHtml();
+    ForgetLiveMarkdownPage();
+    StopAnimationPlayback();
+    ClearAnimationFrames();
+
+    bool keepLayered = g_imageHasAlpha && g_transparencyMode == TransparencyMode::Transparent;
+    if (g_bitmap)
     {
-        text.clear();
-        return true;
+        g_bitmap->Release();
+        g_bitmap = nullptr;
+    }
+    if (g_wicSourceStraight)
+    {
+        g_wicSourceStraight->Release();
+        g_wicSourceStraight = nullptr;
+    }
+    if (g_wicSourcePremultiplied)
+    {
+        g_wicSourcePremultiplied->Release();
+        g_wicSourcePremultiplied = nullptr;
+    }
+    ReleaseLayeredSurfaceCache();
+    g_imageWidth = 0;
+    g_imageHeight = 0;
+    g_imageHasAlpha = false;
+    g_hasText = false;
+    CloseTextDocument();
+    g_fitToWindow = false;
+    g_zoom = 1.0f;
+    g_hasHtml = true;
+    g_pendingHtmlContent = std::move(html);
+    g_pendingHtmlBlockBounds = std::move(blockBounds);
+    g_webviewPendingShow = true;
+    g_keepLayeredWhileHtmlPending = keepLayered;
+    if (g_webviewController)
+    {
+        g_webviewController->put_IsVisible(FALSE);
+        SetWebViewZoomFactor(g_htmlBaseZoomFactor > 0.0 ? g_htmlBaseZoomFactor : 1.0);
+    }
+    ApplyTransparencyMode();
+    if (g_hwnd)
+    {
+        InvalidateRect(g_hwnd, nullptr, TRUE);
     }
 
-    int needed = MultiByteToWideChar(CP_UTF8, 0, bytes.data(), static_cast<int>(bytes.size()), nullptr, 0);
-    if (needed <= 0)
+    if (!EnsureWebView2(g_hwnd))
     {
+        g_hasHtml = false;
+        g_pendingHtmlContent.clear();
+        g_pendingHtmlBlockBounds.clear();
+        g_keepLayeredWhileHtmlPending = false;
         return false;
     }
 
-    text.assign(needed, L'\0');
-    MultiByteToWideChar(CP_UTF8, 0, bytes.data(), static_cast<int>(bytes.size()), text.data(), needed);
+    ApplyDocumentWindowSize(g_hwnd);
     return true;
 }
 
-bool AnsiToWide(const std::string& bytes, std::wstring& text)
+bool LoadHtmlFromFile(const wchar_t* path)
 {
-    if (bytes.empty())
+    DocumentBuffer document;
+    if (!ReadDocumentBuffer(path, document))
     {
-        text.clear();
-        return true;
+        return false;
     }
-    int needed = MultiByteToWideChar(CP_ACP, 0, bytes.data(), static_cast<int>(bytes.size()), nullptr, 0);
-    if (needed <= 0)
+
+    return ApplyHtmlContent(InjectHtmlBaseStyles(document.Text()), {});
+}
+
+bool ApplyMarkdownPage(const wchar_t* path, uint64_t styleKey, const std::shared_ptr<const MarkdownPage>& page)
+{
+    if (!ApplyHtmlContent(page->html, GetMarkdownPageBlockBounds(*page)))
     {
         return false;
     }
-    text.assign(needed, L'\0');
-    MultiByteToWideChar(CP_ACP, 0, bytes.data(), static_cast<int>(bytes.size()), text.data(), needed);
+    g_liveMarkdownPage = page;
+    g_liveMarkdownPath = path;
+    g_liveMarkdownStyleKey = styleKey;
     return true;
 }
 
-bool WideToUtf8(const std::wstring& text, std::string& bytes)
+void ForgetLiveMarkdownPage()
+{
+    g_liveMarkdownPage.reset();
+    g_liveMarkdownPath.clear();
+    g_liveMarkdownStyleKey = 0;
+}
+
+// Reloading the page on screen: the live DOM between the markers PatchMarkdownPage names is
+// replaced by script, so the scroll position and the rest of the layout survive. Returns false
+// when the page has to be navigated in full instead.
+bool PatchLiveMarkdownPage(const wchar_t* path, std::string_view markdown, uint64_t styleKey, uint64_t cacheKey)
 {
-    if (text.empty())
+    if (!g_liveMarkdownPage || g_liveMarkdownPath != path || g_liveMarkdownStyleKey != styleKey
+        || !g_hasHtml || !g_webview || g_webviewPendingShow
+        || !g_pendingHtmlContent.empty() || !g_progressiveHtml.html.empty())
+    {
+        return false;
+    }
+    MarkdownPagePatch patch;
+    if (!PatchMarkdownPage(*g_liveMarkdownPage, markdown, patch))
+    {
+        return false;
+    }
+    if (!patch.page)
     {
-        bytes.clear();
         return true;
     }
-    int needed = WideCharToMultiByte(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), nullptr, 0, nullptr, nullptr);
-    if (needed <= 0)
+    std::shared_ptr<MarkdownPage>& page = patch.page;
+
+    std::wstring fragment;
+    Utf8ToWide(std::string_view(page->html).substr(patch.fragmentStart, patch.fragmentEnd - patch.fragmentStart), fragment);
+    std::wstring script = L"(function(){var a=document.querySelector('article.markdown-body');if(!a){return false;}"
+        L"var m=[];for(var n=a.firstChild;n;n=n.nextSibling){if(n.nodeType===8&&n.data==='fvb'){m.push(n);}}";
+    script += L"if(m.length!==" + std::to_wstring(g_liveMarkdownPage->sectionStarts.size()) + L"){return false;}";
+    script += L"var s=" + std::to_wstring(patch.firstSection) + L",e=" + std::to_wstring(patch.endSection) + L";";
+    script += L"var end=e<m.length?m[e]:null;"
+        L"for(var n=s<m.length?m[s]:null;n&&n!==end;){var x=n.nextSibling;a.removeChild(n);n=x;}"
+        L"var t=document.createElement('template');t.innerHTML=";
+    AppendJsStringLiteral(script, fragment);
+    script += L";a.insertBefore(t.content,end);return true;})();";
+    std::wstring().swap(fragment);
+
+    std::shared_ptr<const MarkdownPage> patched = std::move(page);
+    std::wstring livePath = path;
+    HRESULT hr = g_webview->ExecuteScript(
+        script.c_str(),
+        Microsoft::WRL::Callback<ICoreWebView2ExecuteScriptCompletedHandler>(
+            [patched, livePath, styleKey](HRESULT errorCode, LPCWSTR resultObjectAsJson) -> HRESULT
+            {
+                bool applied = SUCCEEDED(errorCode) && resultObjectAsJson && wcscmp(resultObjectAsJson, L"true") == 0;
+                if (!applied && g_liveMarkdownPage == patched)
+                {
+                    // The DOM no longer matches the page (a link was followed, or raw HTML nested
+                    // the markers); navigate the patched page in full.
+                    ApplyMarkdownPage(livePath.c_str(), styleKey, patched);
+                }
+                return S_OK;
+            }).Get());
+    if (FAILED(hr))
     {
         return false;
     }
-    bytes.assign(static_cast<size_t>(needed), '\0');
-    WideCharToMultiByte(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), bytes.data(), needed, nullptr, nullptr);
+
+    StoreCachedMarkdownHtml(g_markdownHtmlCache, cacheKey, markdown.size(), patched);
+    g_liveMarkdownPage = patched;
     return true;
 }
 
-bool TryReadIniValueUtf8Aware(const std::filesystem::path& path, const std::wstring& section, const std::wstring& key, std::wstring& value)
+bool LoadMarkdownFromFile(const wchar_t* path)
 {
-    std::string bytes;
-    if (!ReadFileBytesRaw(path.c_str(), bytes) || bytes.empty())
+    DocumentBuffer document;
+    if (!ReadDocumentBuffer(path, document))
     {
         return false;
     }
 
-    std::wstring content;
-    if (bytes.size() >= 3
-        && static_cast<unsigned char>(bytes[0]) == 0xEF
-        && static_cast<unsigned char>(bytes[1]) == 0xBB
-        && static_cast<unsigned char>(bytes[2]) == 0xBF)
+    std::string_view markdown = document.Text();
+    uint64_t styleKey = ComputeMarkdownStyleKey();
+    uint64_t key = HashBytes(markdown.data(), markdown.size(), styleKey);
+    if (PatchLiveMarkdownPage(path, markdown, styleKey, key))
+    {
+        return true;
+    }
+
+    std::shared_ptr<const MarkdownPage> page;
+    if (const MarkdownHtmlCacheEntry* cached = FindCachedMarkdownHtml(g_markdownHtmlCache, key, markdown.size()))
+    {
+        page = cached->page;
+    }
+    else
     {
-        bytes.erase(0, 3);
-        if (!Utf8ToWide(bytes, content))
+        auto rendered = std::make_shared<MarkdownPage>();
+        if (!RenderMarkdownToHtml(markdown, *rendered))
         {
             return false;
         }
+        page = std::move(rendered);
+        StoreCachedMarkdownHtml(g_markdownHtmlCache, key, markdown.size(), page);
     }
-    else if (!Utf8ToWide(bytes, content) && !AnsiToWide(bytes, content))
-    {
-        return false;
-    }
-
-    return TryGetIniValueFromContent(content, section, key, value);
+    return ApplyMarkdownPage(path, styleKey, page);
 }
 
-bool UpdateIniValue(std::wstring& content, const std::wstring& section, const std::wstring& key, const std::wstring& value)
+bool QueryPixelFormatHasAlpha(IWICImagingFactory* factory, const WICPixelFormatGUID& format)
 {
-    std::wstringstream stream(content);
-    std::wstring line;
-    std::vector<std::wstring> lines;
-    bool inSection = false;
-    bool sectionFound = false;
-    bool keyWritten = false;
-    std::wstring sectionHeader = L"[" + section + L"]";
-    while (std::getline(stream, line))
+    if (!factory)
     {
-        if (!line.empty() && line.back() == L'\r')
-        {
-            line.pop_back();
-        }
-        std::wstring trimmed = TrimString(line);
-        if (!trimmed.empty() && trimmed.front() == L'[' && trimmed.back() == L']')
-        {
-            if (inSection && sectionFound && !keyWritten)
-            {
-                lines.push_back(key + L"=" + value);
-                keyWritten = true;
-            }
-            inSection = (_wcsicmp(trimmed.c_str(), sectionHeader.c_str()) == 0);
-            if (inSection)
-            {
-                sectionFound = true;
-            }
-            lines.push_back(line);
-            continue;
-        }
+        return false;
+    }
 
-        if (inSection)
-        {
-            size_t eqPos = line.find(L'=');
-            if (eqPos != std::wstring::npos)
-            {
-                std::wstring foundKey = TrimString(line.substr(0, eqPos));
-                if (_wcsicmp(foundKey.c_str(), key.c_str()) == 0)
-                {
-                    if (!keyWritten)
-                    {
-                        lines.push_back(key + L"=" + value);
-                        keyWritten = true;
-                    }
-                    continue;
-                }
-            }
-        }
+    IWICComponentInfo* componentInfo = nullptr;
+    IWICPixelFormatInfo2* formatInfo = nullptr;
+    bool hasAlpha = false;
 
-        lines.push_back(line);
+    HRESULT hr = factory->CreateComponentInfo(format, &componentInfo);
+    if (SUCCEEDED(hr))
+    {
+        hr = componentInfo->QueryInterface(IID_PPV_ARGS(&formatInfo));
     }
-
-    if (!sectionFound)
+    if (SUCCEEDED(hr))
     {
-        if (!lines.empty() && !lines.back().empty())
+        BOOL supportsTransparency = FALSE;
+        if (SUCCEEDED(formatInfo->SupportsTransparency(&supportsTransparency)))
         {
-            lines.push_back(L"");
+            hasAlpha = supportsTransparency == TRUE;
         }
-        lines.push_back(sectionHeader);
-        lines.push_back(key + L"=" + value);
     }
-    else if (!keyWritten)
+
+    if (formatInfo) formatInfo->Release();
+    if (componentInfo) componentInfo->Release();
+
+    return hasAlpha;
+}
+
+bool ImageHasTransparency(IWICBitmapSource* source)
+{
+    if (!source)
     {
-        lines.push_back(key + L"=" + value);
+        return false;
     }
 
-    std::wstringstream output;
-    for (size_t i = 0; i < lines.size(); ++i)
+    UINT width = 0;
+    UINT height = 0;
+    HRESULT hr = source->GetSize(&width, &height);
+    if (FAILED(hr) || width == 0 || height == 0)
     {
-        output << lines[i];
-        if (i + 1 < lines.size())
-        {
-            output << L"\r\n";
-        }
+        return false;
     }
-    content = output.str();
-    return true;
-}
 
-bool SaveUtf8IniValue(const std::filesystem::path& path, const std::wstring& section, const std::wstring& key, const std::wstring& value)
-{
-    std::string bytes;
-    std::wstring content;
-    if (ReadFileBytesRaw(path.c_str(), bytes) && !bytes.empty())
+    const UINT stride = width * 4;
+    std::vector<BYTE> row(stride);
+    WICRect rect{ 0, 0, static_cast<INT>(width), 1 };
+
+    for (UINT y = 0; y < height; ++y)
     {
-        if (bytes.size() >= 3
-            && static_cast<unsigned char>(bytes[0]) == 0xEF
-            && static_cast<unsigned char>(bytes[1]) == 0xBB
-            && static_cast<unsigned char>(bytes[2]) == 0xBF)
+        rect.Y = static_cast<INT>(y);
+        hr = source->CopyPixels(&rect, stride, stride, row.data());
+        if (FAILED(hr))
         {
-            bytes.erase(0, 3);
-            Utf8ToWide(bytes, content);
+            return false;
         }
-        else if (!Utf8ToWide(bytes, content))
+        for (UINT x = 0; x < width; ++x)
         {
-            AnsiToWide(bytes, content);
+            BYTE alpha = row[x * 4 + 3];
+            if (alpha < 255)
+            {
+                return true;
+            }
         }
     }
 
-    UpdateIniValue(content, section, key, value);
+    return false;
+}
 
-    std::string utf8Content;
-    if (!WideToUtf8(content, utf8Content))
+void ApplyTransparencyMode()
+{
+    if ((g_imageHasAlpha && g_transparencyMode == TransparencyMode::Transparent)
+        || (g_hasHtml && g_webviewPendingShow && g_keepLayeredWhileHtmlPending))
     {
-        return false;
+        UpdateLayeredStyle(true);
+    }
+    else
+    {
+        UpdateLayeredStyle(false);
     }
+    UpdateCustomColorBrush();
+}
 
-    std::ofstream file(path, std::ios::binary | std::ios::trunc);
-    if (!file)
+void HideWebView()
+{
+    if (g_webviewController)
     {
-        return false;
+        g_webviewController->put_IsVisible(FALSE);
+    }
+    if (g_webviewInputTimerActive && g_hwnd)
+    {
+        KillTimer(g_hwnd, kWebViewInputTimerId);
+        g_webviewInputTimerActive = false;
     }
-    const unsigned char bom[] = { 0xEF, 0xBB, 0xBF };
-    file.write(reinterpret_cast<const char*>(bom), sizeof(bom));
-    file.write(utf8Content.data(), static_cast<std::streamsize>(utf8Content.size()));
-    return true;
 }
 
-bool LoadTextFromFile(const wchar_t* path)
+void UpdateWebViewBounds()
 {
-    return LoadMarkdownFromFile(path);
+    if (!g_webviewController || !g_hwnd)
+    {
+        return;
+    }
+    RECT bounds{};
+    GetClientRect(g_hwnd, &bounds);
+    g_webviewController->put_Bounds(bounds);
 }
 
-std::wstring TrimString(const std::wstring& value)
+void UpdateWebViewWindowHandle()
 {
-    size_t start = 0;
-    while (start < value.size() && iswspace(value[start]))
+    if (!g_hwnd)
     {
-        ++start;
+        g_webviewWindow = nullptr;
+        return;
     }
-    size_t end = value.size();
-    while (end > start && iswspace(value[end - 1]))
+
+    HWND found = nullptr;
+    EnumChildWindows(
+        g_hwnd,
+        [](HWND child, LPARAM lParam) -> BOOL
+        {
+            wchar_t className[64] = {};
+            GetClassNameW(child, className, static_cast<int>(std::size(className)));
+            if (wcsncmp(className, L"Chrome_WidgetWin", 16) == 0)
+            {
+                *reinterpret_cast<HWND*>(lParam) = child;
+                return FALSE;
+            }
+            return TRUE;
+        },
+        reinterpret_cast<LPARAM>(&found));
+
+    if (!found)
     {
-        --end;
+        found = GetWindow(g_hwnd, GW_CHILD);
     }
-    return value.substr(start, end - start);
+    g_webviewWindow = found;
 }
 
-std::wstring NormalizeFontName(const std::wstring& value)
+void UpdateWebViewInputTimer()
 {
-    std::wstring trimmed = TrimString(value);
-    size_t commaPos = trimmed.find(L',');
-    if (commaPos != std::wstring::npos)
+    if (!g_hwnd)
     {
-        trimmed = TrimString(trimmed.substr(0, commaPos));
+        return;
     }
-    if (trimmed.size() >= 2)
+    if (g_hasHtml)
     {
-        wchar_t first = trimmed.front();
-        wchar_t last = trimmed.back();
-        if ((first == L'"' && last == L'"') || (first == L'\'' && last == L'\''))
+        if (!g_webviewInputTimerActive)
         {
-            trimmed = TrimString(trimmed.substr(1, trimmed.size() - 2));
+            SetTimer(g_hwnd, kWebViewInputTimerId, kWebViewInputTimerIntervalMs, nullptr);
+            g_webviewInputTimerActive = true;
         }
     }
-    size_t dotPos = trimmed.find_last_of(L'.');
-    if (dotPos != std::wstring::npos)
+    else if (g_webviewInputTimerActive)
     {
-        std::wstring ext = trimmed.substr(dotPos);
-        for (auto& ch : ext)
-        {
-            ch = static_cast<wchar_t>(towlower(ch));
-        }
-        if (ext == L".ttf" || ext == L".otf" || ext == L".ttc")
-        {
-            trimmed = TrimString(trimmed.substr(0, dotPos));
-        }
+        KillTimer(g_hwnd, kWebViewInputTimerId);
+        g_webviewInputTimerActive = false;
     }
-    return trimmed;
 }
 
-std::wstring NormalizeSettingKey(const std::wstring& key)
+WORD GetHtmlInputVirtualKey()
 {
-    std::wstring result;
-    result.reserve(key.size());
-    for (wchar_t ch : key)
+    switch (g_htmlInputKey)
     {
-        if (ch == L' ' || ch == L'_' || ch == L'-' || ch == L'\t')
-        {
-            continue;
-        }
-        result.push_back(static_cast<wchar_t>(towlower(ch)));
+    case HtmlInputKey::Ctrl:
+        return VK_CONTROL;
+    case HtmlInputKey::Alt:
+        return VK_MENU;
+    case HtmlInputKey::Shift:
+    default:
+        return VK_SHIFT;
     }
-    return result;
 }
 
-struct ResolvedFontInfo
-{
-    std::wstring familyName;
-    DWRITE_FONT_WEIGHT weight = DWRITE_FONT_WEIGHT_REGULAR;
-    DWRITE_FONT_STYLE style = DWRITE_FONT_STYLE_NORMAL;
-    DWRITE_FONT_STRETCH stretch = DWRITE_FONT_STRETCH_NORMAL;
-    bool matched = false;
-};
-
-ResolvedFontInfo ResolveFontInfo(IDWriteFactory* factory, const std::wstring& name);
-
-std::wstring GetFontFamilyNameForSave(const std::wstring& fontName)
+void UpdateWebViewInputState()
 {
-    if (fontName.empty())
+    if (!g_webviewWindow)
     {
-        return fontName;
+        return;
     }
-    if (!g_dwriteFactory)
+
+    LONG_PTR exStyle = GetWindowLongPtrW(g_webviewWindow, GWL_EXSTYLE);
+    WORD inputKey = GetHtmlInputVirtualKey();
+    bool keyDown = (GetKeyState(inputKey) & 0x8000) != 0;
+    if (g_hasHtml && !keyDown)
     {
-        return fontName;
+        exStyle |= WS_EX_TRANSPARENT;
+        EnableWindow(g_webviewWindow, FALSE);
+        HWND focused = GetFocus();
+        if (focused && (focused == g_webviewWindow || IsChild(g_webviewWindow, focused)) && g_hwnd)
+        {
+            SetFocus(g_hwnd);
+        }
     }
-
-    IDWriteGdiInterop* gdiInterop = nullptr;
-    HRESULT hr = g_dwriteFactory->GetGdiInterop(&gdiInterop);
-    if (FAILED(hr) || !gdiInterop)
+    else
     {
-        return fontName;
+        exStyle &= ~static_cast<LONG_PTR>(WS_EX_TRANSPARENT);
+        EnableWindow(g_webviewWindow, TRUE);
     }
+    SetWindowLongPtrW(g_webviewWindow, GWL_EXSTYLE, exStyle);
+    SetWindowPos(
+        g_webviewWindow,
+        nullptr,
+        0,
+        0,
+        0,
+        0,
+        SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED);
+}
 
-    LOGFONT lf{};
-    wcsncpy_s(lf.lfFaceName, fontName.c_str(), LF_FACESIZE - 1);
-    lf.lfHeight = -12;
-    lf.lfCharSet = DEFAULT_CHARSET;
-
-    IDWriteFont* font = nullptr;
-    hr = gdiInterop->CreateFontFromLOGFONT(&lf, &font);
-    gdiInterop->Release();
-    if (FAILED(hr) || !font)
+bool ExecuteWebViewScript(const wchar_t* script)
+{
+    if (!g_hasHtml || !g_webview || !script)
     {
-        return fontName;
+        return false;
     }
 
-    IDWriteFontFamily* family = nullptr;
-    hr = font->GetFontFamily(&family);
-    font->Release();
-    if (FAILED(hr) || !family)
+    HRESULT hr = g_webview->ExecuteScript(
+        script,
+        Microsoft::WRL::Callback<ICoreWebView2ExecuteScriptCompletedHandler>(
+            [](HRESULT, LPCWSTR) -> HRESULT
+            {
+                return S_OK;
+            }).Get());
+    return SUCCEEDED(hr);
+}
+
+bool BuildFileUrlFromPath(const std::wstring& path, std::wstring& url)
+{
+    if (path.empty())
     {
-        return fontName;
+        return false;
     }
 
-    std::wstring result = fontName;
-    IDWriteLocalizedStrings* familyNames = nullptr;
-    hr = family->GetFamilyNames(&familyNames);
-    if (SUCCEEDED(hr) && familyNames)
+    DWORD length = static_cast<DWORD>((std::max<size_t>)(512, path.size() * 3 + 16));
+    for (int attempt = 0; attempt < 4; ++attempt)
     {
-        UINT32 length = 0;
-        if (SUCCEEDED(familyNames->GetStringLength(0, &length)) && length > 0)
+        std::wstring buffer(length, L'\0');
+        DWORD written = length;
+        HRESULT hr = UrlCreateFromPathW(path.c_str(), buffer.data(), &written, 0);
+        if (SUCCEEDED(hr) && written > 0)
         {
-            std::wstring familyName(length + 1, L'\0');
-            if (SUCCEEDED(familyNames->GetString(0, familyName.data(), length + 1)))
+            if (buffer[written - 1] == L'\0')
             {
-                familyName.resize(length);
-                result = std::move(familyName);
+                --written;
             }
+            buffer.resize(written);
+            url = std::move(buffer);
+            return !url.empty();
         }
-        familyNames->Release();
+
+        if (hr == S_FALSE && written > length)
+        {
+            length = written;
+            continue;
+        }
+        break;
     }
-    family->Release();
-    return result;
+
+    return false;
 }
 
-ResolvedFontInfo ResolveFontInfo(IDWriteFactory* factory, const std::wstring& name)
+bool EnsureWebViewTempHtmlTarget()
 {
-    ResolvedFontInfo resolved;
-    if (!factory || name.empty())
+    if (!g_webviewTempHtmlPath.empty() && !g_webviewTempHtmlUrl.empty())
     {
-        resolved.familyName = name;
-        return resolved;
+        return true;
     }
-    IDWriteFontCollection* collection = nullptr;
-    if (FAILED(factory->GetSystemFontCollection(&collection, FALSE)) || !collection)
+
+    wchar_t tempDir[MAX_PATH]{};
+    DWORD dirLength = GetTempPathW(MAX_PATH, tempDir);
+    if (dirLength == 0 || dirLength >= MAX_PATH)
     {
-        resolved.familyName = name;
-        return resolved;
+        return false;
     }
 
-    UINT32 index = 0;
-    BOOL exists = FALSE;
-    if (SUCCEEDED(collection->FindFamilyName(name.c_str(), &index, &exists)) && exists)
+    wchar_t tempFile[MAX_PATH]{};
+    if (GetTempFileNameW(tempDir, L"flv", 0, tempFile) == 0)
     {
-        resolved.familyName = name;
-        resolved.matched = true;
-        collection->Release();
-        return resolved;
+        return false;
     }
 
-    UINT32 familyCount = collection->GetFontFamilyCount();
-    for (UINT32 familyIndex = 0; familyIndex < familyCount; ++familyIndex)
+    if (!DeleteFileW(tempFile))
     {
-        IDWriteFontFamily* family = nullptr;
-        if (FAILED(collection->GetFontFamily(familyIndex, &family)) || !family)
-        {
-            continue;
-        }
-        IDWriteLocalizedStrings* familyNames = nullptr;
-        if (SUCCEEDED(family->GetFamilyNames(&familyNames)) && familyNames)
-        {
-            UINT32 familyNameCount = familyNames->GetCount();
-            bool matchedFamilyName = false;
-            for (UINT32 nameIndex = 0; nameIndex < familyNameCount; ++nameIndex)
-            {
-                UINT32 length = 0;
-                if (FAILED(familyNames->GetStringLength(nameIndex, &length)) || length == 0)
-                {
-                    continue;
-                }
-                std::wstring familyName(length + 1, L'\0');
-                if (SUCCEEDED(familyNames->GetString(nameIndex, familyName.data(), length + 1)))
-                {
-                    familyName.resize(length);
-                    if (_wcsicmp(familyName.c_str(), name.c_str()) == 0)
-                    {
-                        resolved.familyName = std::move(familyName);
-                        resolved.matched = true;
-                        matchedFamilyName = true;
-                        break;
-                    }
-                }
-            }
-            familyNames->Release();
-            if (matchedFamilyName)
-            {
-                family->Release();
-                collection->Release();
-                return resolved;
-            }
-        }
-        UINT32 fontCount = family->GetFontCount();
-        bool match = false;
-        for (UINT32 fontIndex = 0; fontIndex < fontCount && !match; ++fontIndex)
-        {
-            IDWriteFont* font = nullptr;
-            if (FAILED(family->GetFont(fontIndex, &font)) || !font)
-            {
-                continue;
-            }
-            IDWriteLocalizedStrings* faceNames = nullptr;
-            if (SUCCEEDED(font->GetFaceNames(&faceNames)) && faceNames)
-            {
-                UINT32 faceCount = faceNames->GetCount();
-                for (UINT32 faceIndex = 0; faceIndex < faceCount; ++faceIndex)
-                {
-                    UINT32 length = 0;
-                    if (FAILED(faceNames->GetStringLength(faceIndex, &length)) || length == 0)
-                    {
-                        continue;
-                    }
-                    std::wstring faceName(length + 1, L'\0');
-                    if (SUCCEEDED(faceNames->GetString(faceIndex, faceName.data(), length + 1)))
-                    {
-                        faceName.resize(length);
-                        if (_wcsicmp(faceName.c_str(), name.c_str()) == 0)
-                        {
-                            match = true;
-                            resolved.weight = font->GetWeight();
-                            resolved.style = font->GetStyle();
-                            resolved.stretch = font->GetStretch();
-                            break;
-                        }
-                    }
-                }
-                faceNames->Release();
-            }
-            font->Release();
-        }
-        if (match)
-        {
-            IDWriteLocalizedStrings* familyNames = nullptr;
-            if (SUCCEEDED(family->GetFamilyNames(&familyNames)) && familyNames)
-            {
-                UINT32 length = 0;
-                if (SUCCEEDED(familyNames->GetStringLength(0, &length)) && length > 0)
-                {
-                    std::wstring familyName(length + 1, L'\0');
-                    if (SUCCEEDED(familyNames->GetString(0, familyName.data(), length + 1)))
-                    {
-                        familyName.resize(length);
-                        resolved.familyName = std::move(familyName);
-                        resolved.matched = true;
-                    }
-                }
-                familyNames->Release();
-            }
-        }
-        if (match && resolved.matched)
-        {
-            family->Release();
-            collection->Release();
-            return resolved;
-        }
-        family->Release();
+        return false;
     }
 
-    collection->Release();
-    resolved.familyName = name;
-    return resolved;
-}
+    std::wstring htmlPath = tempFile;
+    htmlPath += L".html";
 
-bool TryParseMarkdownLine(const std::wstring& line, std::wstring& key, std::wstring& value)
-{
-    std::wstring trimmed = TrimString(line);
-    if (trimmed.empty())
+    std::wstring url;
+    if (!BuildFileUrlFromPath(htmlPath, url))
     {
         return false;
     }
-    if (trimmed[0] == L'-' || trimmed[0] == L'*')
+
+    g_webviewTempHtmlPath = std::move(htmlPath);
+    g_webviewTempHtmlUrl = std::move(url);
+    return true;
+}
+
+bool WriteHtmlToTempFile(std::string_view html, std::wstring& path)
+{
+    if (!EnsureWebViewTempHtmlTarget())
     {
-        trimmed = TrimString(trimmed.substr(1));
+        return false;
     }
-    size_t pipePos = trimmed.find(L'|');
-    if (pipePos != std::wstring::npos)
+
+    std::ofstream output(g_webviewTempHtmlPath, std::ios::binary | std::ios::trunc);
+    if (!output)
     {
-        std::vector<std::wstring> columns;
-        std::wstring current;
-        for (wchar_t ch : trimmed)
-        {
-            if (ch == L'|')
-            {
-                columns.push_back(TrimString(current));
-                current.clear();
-            }
-            else
-            {
-                current.push_back(ch);
-            }
-        }
-        columns.push_back(TrimString(current));
-        std::wstring first;
-        std::wstring second;
-        for (const auto& column : columns)
-        {
-            if (column.empty())
-            {
-                continue;
-            }
-            if (first.empty())
-            {
-                first = column;
-            }
-            else
-            {
-                second = column;
-                break;
-            }
-        }
-        if (!first.empty() && !second.empty())
-        {
-            key = first;
-            value = second;
-            return true;
-        }
         return false;
     }
 
-    size_t colonPos = trimmed.find(L':');
-    if (colonPos != std::wstring::npos)
+    if (!WriteUtf8Html(output, html))
     {
-        key = TrimString(trimmed.substr(0, colonPos));
-        value = TrimString(trimmed.substr(colonPos + 1));
-        return !(key.empty() || value.empty());
+        output.close();
+        return false;
     }
-    return false;
+    output.close();
+
+    path = g_webviewTempHtmlPath;
+    return true;
 }
 
-bool TryParseBoolValue(const std::wstring& value, bool& outValue)
+bool NavigateWebViewHtml(const std::string& html)
 {
-    std::wstring lowered;
-    lowered.reserve(value.size());
-    for (wchar_t ch : value)
+    if (!g_webview)
     {
-        lowered.push_back(static_cast<wchar_t>(towlower(ch)));
+        return false;
     }
-    lowered = TrimString(lowered);
-    if (lowered == L"1" || lowered == L"true" || lowered == L"yes" || lowered == L"on")
+
+    auto navigateToString = [&html]()
+    {
+        std::wstring wide;
+        return Utf8ToWide(html, wide) && SUCCEEDED(g_webview->NavigateToString(wide.c_str()));
+    };
+
+    // NavigateToString is usually faster for small/medium documents,
+    // so prefer it for first paint and fall back to file navigation for large content.
+    // Only these pay for a UTF-16 copy of the page.
+    constexpr size_t kNavigateToStringMaxBytes = 900000;
+    if (html.size() <= kNavigateToStringMaxBytes && navigateToString())
     {
-        outValue = true;
         return true;
     }
-    if (lowered == L"0" || lowered == L"false" || lowered == L"no" || lowered == L"off")
+
+    std::wstring tempPath;
+    if (!WriteHtmlToTempFile(html, tempPath) || g_webviewTempHtmlUrl.empty())
     {
-        outValue = false;
-        return true;
+        return navigateToString();
     }
-    return false;
-}
 
-bool TryParseColorValue(const std::wstring& value, COLORREF& outColor)
-{
-    std::wstring trimmed = TrimString(value);
-    if (trimmed.empty())
+    HRESULT hr = g_webview->Navigate(g_webviewTempHtmlUrl.c_str());
+    if (FAILED(hr))
     {
-        return false;
+        return navigateToString();
     }
-    if (trimmed[0] == L'#' && trimmed.size() == 7)
+
+    return true;
+}
+
+// Large markdown pages are navigated with only their first blocks so the window shows content
+// at once; the remaining blocks are appended after NavigationCompleted, one batch per
+// ExecuteScript round trip. Content only ever grows below the viewport, so scrolling is stable.
+bool NavigatePendingHtml()
+{
+    CancelProgressiveHtml();
+    const std::string& html = g_pendingHtmlContent;
+    const std::vector<size_t>& bounds = g_pendingHtmlBlockBounds;
+    size_t firstPaintBlock = FindProgressiveFirstPaintBlock(html.size(), bounds);
+    if (firstPaintBlock == 0)
     {
-        wchar_t* endPtr = nullptr;
-        unsigned long rgb = std::wcstoul(trimmed.c_str() + 1, &endPtr, 16);
-        if (endPtr && *endPtr == L'\0')
+        if (!NavigateWebViewHtml(html))
         {
-            BYTE r = static_cast<BYTE>((rgb >> 16) & 0xFF);
-            BYTE g = static_cast<BYTE>((rgb >> 8) & 0xFF);
-            BYTE b = static_cast<BYTE>(rgb & 0xFF);
-            outColor = RGB(r, g, b);
-            return true;
+            return false;
         }
-        return false;
+        g_pendingHtmlContent.clear();
+        g_pendingHtmlBlockBounds.clear();
+        return true;
     }
-    wchar_t* endPtr = nullptr;
-    unsigned long valueNum = std::wcstoul(trimmed.c_str(), &endPtr, 0);
-    if (endPtr && *endPtr == L'\0')
+
+    std::string firstPage = MakeProgressiveFirstPage(html, bounds, firstPaintBlock);
+
+    // Set up before navigating: NavigationStarting may be raised before Navigate returns.
+    ProgressiveHtmlState& state = g_progressiveHtml;
+    state.html = std::move(g_pendingHtmlContent);
+    state.blockBounds = std::move(g_pendingHtmlBlockBounds);
+    state.nextBlock = firstPaintBlock;
+    state.awaitingNavigation = true;
+    g_pendingHtmlContent.clear();
+    g_pendingHtmlBlockBounds.clear();
+    if (!NavigateWebViewHtml(firstPage))
     {
-        outColor = static_cast<COLORREF>(valueNum);
-        return true;
+        g_pendingHtmlContent = std::move(state.html);
+        g_pendingHtmlBlockBounds = std::move(state.blockBounds);
+        CancelProgressiveHtml();
+        return false;
     }
-    return false;
+    return true;
 }
 
-void LoadTextSettingsFromMarkdown(const std::filesystem::path& path)
+void CancelProgressiveHtml()
+{
+    ++g_progressiveHtml.generation;
+    std::string().swap(g_progressiveHtml.html);
+    g_progressiveHtml.blockBounds.clear();
+    g_progressiveHtml.nextBlock = 0;
+    g_progressiveHtml.awaitingNavigation = false;
+    g_progressiveHtml.navigationStarted = false;
+    g_progressiveHtml.navigationId = 0;
+}
+
+// While the first page is pending, the latest navigation the app itself started is taken to be
+// it. A navigation the user starts (following a link) leaves the page and drops the batches.
+void HandleProgressiveHtmlNavigationStarting(ICoreWebView2NavigationStartingEventArgs* args)
 {
-    std::string bytes;
-    if (!ReadFileBytes(path.c_str(), bytes))
+    ProgressiveHtmlState& state = g_progressiveHtml;
+    if (state.html.empty())
     {
         return;
     }
+    BOOL userInitiated = TRUE;
+    UINT64 navigationId = 0;
+    if (state.awaitingNavigation
+        && SUCCEEDED(args->get_IsUserInitiated(&userInitiated)) && !userInitiated
+        && SUCCEEDED(args->get_NavigationId(&navigationId)))
+    {
+        state.navigationStarted = true;
+        state.navigationId = navigationId;
+        return;
+    }
+    CancelProgressiveHtml();
+}
 
-    std::wstring content;
-    if (!Utf8ToWide(bytes, content))
+void HandleProgressiveHtmlNavigationCompleted(ICoreWebView2NavigationCompletedEventArgs* args)
+{
+    ProgressiveHtmlState& state = g_progressiveHtml;
+    UINT64 navigationId = 0;
+    if (!state.awaitingNavigation || !state.navigationStarted
+        || FAILED(args->get_NavigationId(&navigationId)) || navigationId != state.navigationId)
+    {
+        return;
+    }
+    BOOL success = FALSE;
+    if (FAILED(args->get_IsSuccess(&success)) || !success)
     {
+        CancelProgressiveHtml();
         return;
     }
+    state.awaitingNavigation = false;
+    SendNextProgressiveHtmlBatch();
+}
 
-    std::wstringstream stream(content);
-    std::wstring line;
-    while (std::getline(stream, line))
+void AppendJsStringLiteral(std::wstring& script, const std::wstring& text)
+{
+    script.reserve(script.size() + text.size() + text.size() / 8 + 2);
+    script.push_back(L'"');
+    for (wchar_t ch : text)
     {
-        std::wstring key;
-        std::wstring value;
-        if (!TryParseMarkdownLine(line, key, value))
-        {
-            continue;
-        }
-        std::wstring normalized = NormalizeSettingKey(key);
-        if (normalized == L"font")
-        {
-            std::wstring fontName = NormalizeFontName(value);
-            if (!fontName.empty())
-            {
-                g_textFontName = std::move(fontName);
-                g_textFontFaceName = TrimString(g_textFontName);
-            }
-        }
-        else if (normalized == L"fontcolor")
+        switch (ch)
         {
-            COLORREF color = g_textColor;
-            if (TryParseColorValue(value, color))
-            {
-                g_textColor = color;
-            }
-        }
-        else if (normalized == L"background")
-        {
-            COLORREF color = g_textBackground;
-            if (TryParseColorValue(value, color))
+        case L'"':
+            script += L"\\\"";
+            break;
+        case L'\\':
+            script += L"\\\\";
+            break;
+        case L'\n':
+            script += L"\\n";
+            break;
+        case L'\r':
+            script += L"\\r";
+            break;
+        case L'\t':
+            script += L"\\t";
+            break;
+        default:
+            if (ch < 0x20 || ch == 0x2028 || ch == 0x2029)
             {
-                g_textBackground = color;
+                wchar_t escaped[8]{};
+                _snwprintf_s(escaped, _TRUNCATE, L"\\u%04x", static_cast<unsigned int>(ch));
+                script += escaped;
             }
-        }
-        else if (normalized == L"wrap")
-        {
-            bool wrapValue = g_textWrap;
-            if (TryParseBoolValue(value, wrapValue))
+            else
             {
-                g_textWrap = wrapValue;
+                script.push_back(ch);
             }
+            break;
         }
     }
+    script.push_back(L'"');
 }
 
-std::wstring InjectHtmlBaseStyles(const std::wstring& html)
+void SendNextProgressiveHtmlBatch()
 {
-    const std::wstring style = LR"(<style>
-html {
-    background: #ffffff !important;
-    margin: 0;
-    width: 100%;
-    height: 100%;
-    overflow: auto;
-    scrollbar-gutter: stable;
-}
-body {
-    background: #ffffff !important;
-    margin: 0;
-    min-height: 100%;
-    overflow: visible;
-}
-</style>)";
-    std::wstring lowered = html;
-    std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::towlower);
-    size_t headPos = lowered.find(L"<head");
-    if (headPos != std::wstring::npos)
+    ProgressiveHtmlState& state = g_progressiveHtml;
+    if (!g_webview || state.html.empty())
     {
-        size_t insertPos = lowered.find(L'>', headPos);
-        if (insertPos != std::wstring::npos)
-        {
-            std::wstring result = html;
-            result.insert(insertPos + 1, style);
-            return result;
-        }
+        return;
     }
-    return style + html;
-}
-
-bool RenderMarkdownToHtml(const std::string& markdown, std::string& html)
-{
-    std::string body;
-    auto appendChunk = [](const MD_CHAR* text, MD_SIZE size, void* userdata)
-    {
-        auto* output = static_cast<std::string*>(userdata);
-        output->append(text, size);
-    };
-
-    if (md_html(markdown.data(), static_cast<MD_SIZE>(markdown.size()), appendChunk, &body, MD_DIALECT_GITHUB, 0) != 0)
+    const std::vector<size_t>& bounds = state.blockBounds;
+    size_t last = bounds.size() - 1;
+    if (state.nextBlock >= last)
     {
-        return false;
+        CancelProgressiveHtml();
+        return;
     }
 
-    auto toHex = [](COLORREF color)
-    {
-        std::ostringstream stream;
-        stream << '#'
-               << std::hex << std::setw(2) << std::setfill('0') << std::nouppercase
-               << static_cast<int>(GetRValue(color))
-               << std::setw(2) << static_cast<int>(GetGValue(color))
-               << std::setw(2) << static_cast<int>(GetBValue(color));
-        return stream.str();
-    };
+    size_t endBlock = FindProgressiveBatchEnd(bounds, state.nextBlock);
+    std::wstring fragment;
+    Utf8ToWide(std::string_view(state.html).substr(bounds[state.nextBlock], bounds[endBlock] - bounds[state.nextBlock]), fragment);
+    state.nextBlock = endBlock;
 
-    std::string fontName = "Segoe UI";
-    if (!g_textFontName.empty())
-    {
-        std::wstring wideFont = g_textFontName;
-        int needed = WideCharToMultiByte(CP_UTF8, 0, wideFont.c_str(), -1, nullptr, 0, nullptr, nullptr);
-        if (needed > 0)
-        {
-            std::string utf8Font(static_cast<size_t>(needed), '\0');
-            WideCharToMultiByte(CP_UTF8, 0, wideFont.c_str(), -1, utf8Font.data(), needed, nullptr, nullptr);
-            if (!utf8Font.empty())
+    std::wstring script = L"(function(){var a=document.querySelector('article.markdown-body');"
+        L"if(a){a.insertAdjacentHTML('beforeend',";
+    AppendJsStringLiteral(script, fragment);
+    script += L");}})();";
+    std::wstring().swap(fragment);
+
+    uint64_t generation = state.generation;
+    HRESULT hr = g_webview->ExecuteScript(
+        script.c_str(),
+        Microsoft::WRL::Callback<ICoreWebView2ExecuteScriptCompletedHandler>(
+            [generation](HRESULT, LPCWSTR) -> HRESULT
             {
-                if (utf8Font.back() == '\0')
+                if (generation == g_progressiveHtml.generation)
                 {
-                    utf8Font.pop_back();
+                    SendNextProgressiveHtmlBatch();
                 }
-                fontName = utf8Font;
-            }
-        }
+                return S_OK;
+            }).Get());
+    if (FAILED(hr))
+    {
+        CancelProgressiveHtml();
     }
-
-    std::string bodyBackground = toHex(g_textBackground);
-    std::string bodyColor = toHex(g_textColor);
-    const char* wrapValue = g_textWrap ? "normal" : "pre";
-
-    std::ostringstream style;
-    style << R"(
-        :root {
-            color-scheme: light dark;
-        }
-        html {
-            scrollbar-gutter: stable;
-            overflow: auto;
-        }
-        body {
-            margin: 0;
-            padding: 24px;
-            font-family: ")"
-          << fontName
-          << R"(", "Segoe UI", "Meiryo", sans-serif;
-            background: )"
-          << bodyBackground
-          << R"(;
-            color: )"
-          << bodyColor
-          << R"(;
-            white-space: )"
-          << wrapValue
-          << R"(;
-            overflow: visible;
-        }
-        .markdown-body {
-            max-width: 960px;
-            margin: 0 auto;
-        }
-        pre, code {
-            font-family: "Consolas", "Courier New", monospace;
-        }
-        pre {
-            padding: 12px;
-            background: #f6f8fa;
-            border-radius: 6px;
-            overflow: auto;
-        }
-        code {
-            background: #f6f8fa;
-            border-radius: 4px;
-            padding: 0 4px;
-        }
-        table {
-            border-collapse: collapse;
-        }
-        th, td {
-            border: 1px solid #d0d7de;
-            padding: 6px 10px;
-        }
-        blockquote {
-            border-left: 4px solid #d0d7de;
-            margin: 0;
-            padding-left: 16px;
-            color: #57606a;
-        }
-    )";
-
-    html = "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><style>";
-    html += style.str();
-    html += "</style></head><body><article class=\"markdown-body\">";
-    html += body;
-    html += "</article></body></html>";
-    return true;
 }
 
-bool ApplyHtmlContent(std::wstring html)
+bool HandleHtmlOverlayKeyDown(WPARAM wParam)
 {
-    StopAnimationPlayback();
-    ClearAnimationFrames();
-
-    bool keepLayered = g_imageHasAlpha && g_transparencyMode == TransparencyMode::Transparent;
-    if (g_bitmap)
+    bool ctrlDown = (GetKeyState(VK_CONTROL) & 0x8000) != 0;
+    WORD key = static_cast<WORD>(wParam);
+    if (ctrlDown && (key == VK_UP || key == VK_DOWN))
     {
-        g_bitmap->Release();
-        g_bitmap = nullptr;
+        return JumpToAdjacentHeading(key == VK_DOWN ? 1 : -1);
     }
-    if (g_wicSourceStraight)
+    if (ctrlDown && key == 'L')
     {
-        g_wicSourceStraight->Release();
-        g_wicSourceStraight = nullptr;
+        ShowMarkdownOutlineDialog(g_hwnd);
+        return true;
     }
-    if (g_wicSourcePremultiplied)
+    if (key == g_keyScrollUp)
     {
-        g_wicSourcePremultiplied->Release();
-        g_wicSourcePremultiplied = nullptr;
+        return ExecuteWebViewScript(L"window.scrollBy(0, -60);");
     }
-    g_imageWidth = 0;
-    g_imageHeight = 0;
-    g_imageHasAlpha = false;
-    g_hasText = false;
-    g_textContent.clear();
-    g_textScroll = 0.0f;
-    g_fitToWindow = false;
-    g_zoom = 1.0f;
-    g_hasHtml = true;
-    g_pendingHtmlContent = std::move(html);
-    g_webviewPendingShow = true;
-    g_keepLayeredWhileHtmlPending = keepLayered;
-    if (g_webviewController)
+    if (key == g_keyScrollDown)
     {
-        g_webviewController->put_IsVisible(FALSE);
-        SetWebViewZoomFactor(g_htmlBaseZoomFactor > 0.0 ? g_htmlBaseZoomFactor : 1.0);
+        return ExecuteWebViewScript(L"window.scrollBy(0, 60);");
     }
-    ApplyTransparencyMode();
-    if (g_hwnd)
+    if (key == g_keyScrollLeft)
     {
-        InvalidateRect(g_hwnd, nullptr, TRUE);
+        return ExecuteWebViewScript(L"window.scrollBy(-60, 0);");
     }
-
-    if (!EnsureWebView2(g_hwnd))
+    if (key == g_keyScrollRight)
     {
-        g_hasHtml = false;
-        g_pendingHtmlContent.clear();
-        g_keepLayeredWhileHtmlPending = false;
-        return false;
+        return ExecuteWebViewScript(L"window.scrollBy(60, 0);");
     }
 
-    ApplyDocumentWindowSize(g_hwnd);
-    return true;
+    switch (wParam)
+    {
+    case VK_PRIOR:
+        return ExecuteWebViewScript(L"window.scrollBy(0, -window.innerHeight * 0.9);");
+    case VK_NEXT:
+    case VK_SPACE:
+        return ExecuteWebViewScript(L"window.scrollBy(0, window.innerHeight * 0.9);");
+    case VK_HOME:
+        return ExecuteWebViewScript(L"window.scrollTo(0, 0);");
+    case VK_END:
+        return ExecuteWebViewScript(L"window.scrollTo(0, document.body ? document.body.scrollHeight : document.documentElement.scrollHeight);");
+    case '0':
+        if (ctrlDown)
+        {
+            return SetWebViewZoomFactor(g_htmlBaseZoomFactor > 0.0 ? g_htmlBaseZoomFactor : 1.0);
+        }
+        break;
+    default:
+        break;
+    }
+    return false;
 }
 
-bool LoadHtmlFromFile(const wchar_t* path)
+// Scrolls the first heading below the top of the view, or the last one above it, to the top.
+bool JumpToAdjacentHeading(int direction)
 {
-    std::string bytes;
-    if (!ReadFileBytes(path, bytes))
-    {
-        return false;
-    }
+    const wchar_t* script = (direction > 0)
+        ? L"(function(){var h=document.querySelectorAll('h1,h2,h3,h4,h5,h6');"
+          L"for(var i=0;i<h.length;i++){if(h[i].getBoundingClientRect().top>1){h[i].scrollIntoView();return;}}})();"
+        : L"(function(){var h=document.querySelectorAll('h1,h2,h3,h4,h5,h6'),t=null;"
+          L"for(var i=0;i<h.length&&h[i].getBoundingClientRect().top<-1;i++){t=h[i];}"
+          L"if(t){t.scrollIntoView();}else{window.scrollTo(0,0);}})();";
+    return ExecuteWebViewScript(script);
+}
 
-    std::wstring html;
-    if (!Utf8ToWide(bytes, html))
+// Heading ids are unique within the page (AssignMarkdownHeadingIds), so the entry is found by id.
+bool JumpToMarkdownHeading(const MarkdownPage& page, size_t index)
+{
+    if (index >= page.headings.size())
     {
         return false;
     }
 
-    html = InjectHtmlBaseStyles(html);
-    return ApplyHtmlContent(std::move(html));
+    std::wstring wideId;
+    Utf8ToWide(page.headings[index].id, wideId);
+    std::wstring script = L"(function(){var e=document.getElementById(";
+    AppendJsStringLiteral(script, wideId);
+    script += L");if(e){e.scrollIntoView();}})();";
+    return ExecuteWebViewScript(script.c_str());
 }
 
-bool LoadMarkdownFromFile(const wchar_t* path)
+bool GetWebViewZoomFactor(double& factor)
 {
-    std::string bytes;
-    if (!ReadFileBytes(path, bytes))
+    factor = 1.0;
+    if (!g_webviewController)
     {
         return false;
     }
 
-    std::string htmlUtf8;
-    if (!RenderMarkdownToHtml(bytes, htmlUtf8))
+    double value = 1.0;
+    HRESULT hr = g_webviewController->get_ZoomFactor(&value);
+    if (FAILED(hr) || value <= 0.0)
     {
         return false;
     }
 
-    std::wstring html;
-    if (!Utf8ToWide(htmlUtf8, html))
+    factor = value;
+    return true;
+}
+
+bool SetWebViewZoomFactor(double factor)
+{
+    if (!g_webviewController || factor <= 0.0)
     {
         return false;
     }
 
-    return ApplyHtmlContent(std::move(html));
+    double clamped = (std::max)(0.1, (std::min)(factor, 5.0));
+    HRESULT hr = g_webviewController->put_ZoomFactor(clamped);
+    return SUCCEEDED(hr);
 }
 
-bool QueryPixelFormatHasAlpha(const WICPixelFormatGUID& format)
+bool HandleHtmlOverlayShortcutKeyDown(WORD key)
 {
-    if (!g_wicFactory)
+    double current = 1.0;
+    if (!GetWebViewZoomFactor(current))
     {
-        return false;
+        current = g_htmlBaseZoomFactor;
     }
 
-    IWICComponentInfo* componentInfo = nullptr;
-    IWICPixelFormatInfo2* formatInfo = nullptr;
-    bool hasAlpha = false;
-
-    HRESULT hr = g_wicFactory->CreateComponentInfo(format, &componentInfo);
-    if (SUCCEEDED(hr))
+    if (key == g_keyZoomIn)
     {
-        hr = componentInfo->QueryInterface(IID_PPV_ARGS(&formatInfo));
+        return SetWebViewZoomFactor(current * 1.1);
     }
-    if (SUCCEEDED(hr))
+    if (key == g_keyZoomOut)
     {
-        BOOL supportsTransparency = FALSE;
-        if (SUCCEEDED(formatInfo->SupportsTransparency(&supportsTransparency)))
-        {
-            hasAlpha = supportsTransparency == TRUE;
-        }
+        return SetWebViewZoomFactor(current / 1.1);
     }
-
-    if (formatInfo) formatInfo->Release();
-    if (componentInfo) componentInfo->Release();
-
-    return hasAlpha;
-}
-
-bool ImageHasTransparency(IWICBitmapSource* source)
-{
-    if (!source)
+    if (key == g_keyOriginalSize)
     {
-        return false;
+        return SetWebViewZoomFactor(g_htmlBaseZoomFactor > 0.0 ? g_htmlBaseZoomFactor : 1.0);
     }
+    return false;
+}
 
-    UINT width = 0;
-    UINT height = 0;
-    HRESULT hr = source->GetSize(&width, &height);
-    if (FAILED(hr) || width == 0 || height == 0)
+bool EnsureWebView2(HWND hwnd)
+{
+    if (!hwnd)
     {
         return false;
     }
 
-    const UINT stride = width * 4;
-    std::vector<BYTE> row(stride);
-    WICRect rect{ 0, 0, static_cast<INT>(width), 1 };
-
-    for (UINT y = 0; y < height; ++y)
+    if (g_webviewController && g_webview)
     {
-        rect.Y = static_cast<INT>(y);
-        hr = source->CopyPixels(&rect, stride, stride, row.data());
-        if (FAILED(hr))
+        if (!g_webviewPendingShow)
         {
-            return false;
+            g_webviewController->put_IsVisible(TRUE);
         }
-        for (UINT x = 0; x < width; ++x)
+        UpdateWebViewWindowHandle();
+        UpdateWebViewInputState();
+        UpdateWebViewInputTimer();
+        UpdateWebViewBounds();
+        if (!g_pendingHtmlContent.empty())
         {
-            BYTE alpha = row[x * 4 + 3];
-            if (alpha < 255)
-            {
-                return true;
-            }
+            g_webviewPendingShow = true;
+            g_webviewController->put_IsVisible(FALSE);
+            NavigatePendingHtml();
         }
+        return true;
     }
 
-    return false;
-}
-
-void ApplyTransparencyMode()
-{
-    if ((g_imageHasAlpha && g_transparencyMode == TransparencyMode::Transparent)
-        || (g_hasHtml && g_webviewPendingShow && g_keepLayeredWhileHtmlPending))
+    if (!g_webviewLoader)
     {
-        UpdateLayeredStyle(true);
+        g_webviewLoader = LoadLibraryW(L"WebView2Loader.dll");
+        if (!g_webviewLoader)
+        {
+            MessageBoxW(hwnd, L"WebView2Loader.dll not found.", L"WebView2", MB_OK | MB_ICONERROR);
+            return false;
+        }
     }
-    else
+
+    using CreateWebView2EnvironmentWithOptionsFn = HRESULT(WINAPI*)(
+        PCWSTR, PCWSTR, ICoreWebView2EnvironmentOptions*,
+        ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler*);
+    auto createEnv = reinterpret_cast<CreateWebView2EnvironmentWithOptionsFn>(
+        GetProcAddress(g_webviewLoader, "CreateCoreWebView2EnvironmentWithOptions"));
+    if (!createEnv)
     {
-        UpdateLayeredStyle(false);
+        MessageBoxW(hwnd, L"CreateCoreWebView2EnvironmentWithOptions not available.", L"WebView2", MB_OK | MB_ICONERROR);
+        return false;
     }
-    UpdateCustomColorBrush();
+
+    HRESULT hr = createEnv(
+        nullptr,
+        nullptr,
+        nullptr,
+        Microsoft::WRL::Callback<ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler>(
+            [hwnd](HRESULT result, ICoreWebView2Environment* env) -> HRESULT
+            {
+                if (FAILED(result) || !env)
+                {
+                    return result;
+                }
+                return env->CreateCoreWebView2Controller(
+                    hwnd,
+                    Microsoft::WRL::Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+                        [](HRESULT result, ICoreWebView2Controller* controller) -> HRESULT
+                        {
+                            if (FAILED(result) || !controller)
+                            {
+                                return result;
+                            }
+                            g_webviewController = controller;
+                            g_webviewController->get_CoreWebView2(&g_webview);
+                            g_webviewController.As(&g_webviewController2);
+                            g_webviewController->put_IsVisible(g_webviewPendingShow ? FALSE : TRUE);
+                            UpdateWebViewWindowHandle();
+                            UpdateWebViewInputState();
+                            UpdateWebViewInputTimer();
+                            UpdateWebViewBounds();
+                            g_webview->add_NavigationStarting(
+                                Microsoft::WRL::Callback<ICoreWebView2NavigationStartingEventHandler>(
+                                    [](ICoreWebView2*, ICoreWebView2NavigationStartingEventArgs* args) -> HRESULT
+                                    {
+                                        HandleProgressiveHtmlNavigationStarting(args);
+                                        return S_OK;
+                                    }).Get(),
+                                &g_webviewNavigationStartingToken);
+                            g_webview->add_NavigationCompleted(
+                                Microsoft::WRL::Callback<ICoreWebView2NavigationCompletedEventHandler>(
+                                    [](ICoreWebView2*, ICoreWebView2NavigationCompletedEventArgs* args) -> HRESULT
+                                    {
+                                        if (g_webviewController)
+                                        {
+                                            double zoom = 1.0;
+                                            if (SUCCEEDED(g_webviewController->get_ZoomFactor(&zoom)) && zoom > 0.0)
+                                            {
+                                                g_htmlBaseZoomFactor = zoom;
+                                            }
+                                        }
+                                        if (g_webviewController && g_webviewPendingShow)
+                                        {
+                                            g_webviewPendingShow = false;
+                                            g_keepLayeredWhileHtmlPending = false;
+                                            ApplyTransparencyMode();
+                                            g_webviewController->put_IsVisible(TRUE);
+                                        }
+                                        HandleProgressiveHtmlNavigationCompleted(args);
+                                        return S_OK;
+                                    }).Get(),
+                                &g_webviewNavigationToken);
+                            if (g_webview && !g_pendingHtmlContent.empty())
+                            {
+                                g_webviewPendingShow = true;
+                                NavigatePendingHtml();
+                            }
+                            return S_OK;
+                        }).Get());
+            }).Get());
+
+    return SUCCEEDED(hr);
 }
 
-void HideWebView()
+void CloseWebView()
 {
+    CancelProgressiveHtml();
+    ForgetLiveMarkdownPage();
+    if (!g_webviewTempHtmlPath.empty())
+    {
+        DeleteFileW(g_webviewTempHtmlPath.c_str());
+        g_webviewTempHtmlPath.clear();
+    }
+    g_webviewTempHtmlUrl.clear();
     if (g_webviewController)
     {
-        g_webviewController->put_IsVisible(FALSE);
+        g_webviewController->Close();
     }
     if (g_webviewInputTimerActive && g_hwnd)
     {
         KillTimer(g_hwnd, kWebViewInputTimerId);
         g_webviewInputTimerActive = false;
     }
+    g_webviewController.Reset();
+    g_webviewController2.Reset();
+    g_webview.Reset();
+    g_htmlBaseZoomFactor = 1.0;
+    g_webviewWindow = nullptr;
+    if (g_webviewLoader)
+    {
+        FreeLibrary(g_webviewLoader);
+        g_webviewLoader = nullptr;
+    }
 }
 
-void UpdateWebViewBounds()
+void UpdateCustomColorBrush()
 {
-    if (!g_webviewController || !g_hwnd)
+    if (!g_renderTarget)
     {
         return;
     }
-    RECT bounds{};
-    GetClientRect(g_hwnd, &bounds);
-    g_webviewController->put_Bounds(bounds);
+    if (g_customColorBrush)
+    {
+        g_customColorBrush->Release();
+        g_customColorBrush = nullptr;
+    }
+    D2D1_COLOR_F color = D2D1::ColorF(
+        GetRValue(g_customColor) / 255.0f,
+        GetGValue(g_customColor) / 255.0f,
+        GetBValue(g_customColor) / 255.0f
+    );
+    g_renderTarget->CreateSolidColorBrush(color, &g_customColorBrush);
 }
 
-void UpdateWebViewWindowHandle()
+void UpdateTextFormat()
 {
-    if (!g_hwnd)
+    if (!g_dwriteFactory)
     {
-        g_webviewWindow = nullptr;
         return;
     }
-
-    HWND found = nullptr;
-    EnumChildWindows(
-        g_hwnd,
-        [](HWND child, LPARAM lParam) -> BOOL
-        {
-            wchar_t className[64] = {};
-            GetClassNameW(child, className, static_cast<int>(std::size(className)));
-            if (wcsncmp(className, L"Chrome_WidgetWin", 16) == 0)
-            {
-                *reinterpret_cast<HWND*>(lParam) = child;
-                return FALSE;
-            }
-            return TRUE;
-        },
-        reinterpret_cast<LPARAM>(&found));
-
-    if (!found)
+    if (g_textFormat)
     {
-        found = GetWindow(g_hwnd, GW_CHILD);
+        g_textFormat->Release();
+        g_textFormat = nullptr;
     }
-    g_webviewWindow = found;
+    ResolvedFontInfo resolvedFont = ResolveFontInfo(g_dwriteFactory, g_textFontName);
+    const wchar_t* fontName = resolvedFont.familyName.empty() ? g_textFontName.c_str() : resolvedFont.familyName.c_str();
+    g_dwriteFactory->CreateTextFormat(
+        fontName,
+        nullptr,
+        resolvedFont.weight,
+        resolvedFont.style,
+        resolvedFont.stretch,
+        g_textFontSize,
+        L"ja-jp",
+        &g_textFormat
+    );
+    if (g_textFormat)
+    {
+        g_textFormat->SetWordWrapping(g_textWrap ? DWRITE_WORD_WRAPPING_WRAP : DWRITE_WORD_WRAPPING_NO_WRAP);
+    }
+    g_textLineHeights.clear();
 }
 
-void UpdateWebViewInputTimer()
+void UpdateTextBrush()
 {
-    if (!g_hwnd)
+    if (!g_renderTarget)
     {
         return;
     }
-    if (g_hasHtml)
-    {
-        if (!g_webviewInputTimerActive)
-        {
-            SetTimer(g_hwnd, kWebViewInputTimerId, kWebViewInputTimerIntervalMs, nullptr);
-            g_webviewInputTimerActive = true;
-        }
-    }
-    else if (g_webviewInputTimerActive)
+    if (g_textBrush)
     {
-        KillTimer(g_hwnd, kWebViewInputTimerId);
-        g_webviewInputTimerActive = false;
+        g_textBrush->Release();
+        g_textBrush = nullptr;
     }
+    D2D1_COLOR_F color = D2D1::ColorF(
+        GetRValue(g_textColor) / 255.0f,
+        GetGValue(g_textColor) / 255.0f,
+        GetBValue(g_textColor) / 255.0f
+    );
+    g_renderTarget->CreateSolidColorBrush(color, &g_textBrush);
 }
 
-WORD GetHtmlInputVirtualKey()
+void ResizeWindowByFactor(HWND hwnd, float factor)
 {
-    switch (g_htmlInputKey)
-    {
-    case HtmlInputKey::Ctrl:
-        return VK_CONTROL;
-    case HtmlInputKey::Alt:
-        return VK_MENU;
-    case HtmlInputKey::Shift:
-    default:
-        return VK_SHIFT;
-    }
+    RECT rc{};
+    GetClientRect(hwnd, &rc);
+    float width = static_cast<float>(rc.right - rc.left) * factor;
+    float height = static_cast<float>(rc.bottom - rc.top) * factor;
+    width = std::max(200.0f, width);
+    height = std::max(200.0f, height);
+    SetWindowPos(hwnd, nullptr, 0, 0, static_cast<int>(width), static_cast<int>(height),
+        SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE);
+    InvalidateRect(hwnd, nullptr, TRUE);
 }
 
-void UpdateWebViewInputState()
+void ScrollTextBy(float delta)
 {
-    if (!g_webviewWindow)
+    if (!g_renderTarget || !g_textFormat)
     {
         return;
     }
 
-    LONG_PTR exStyle = GetWindowLongPtrW(g_webviewWindow, GWL_EXSTYLE);
-    WORD inputKey = GetHtmlInputVirtualKey();
-    bool keyDown = (GetKeyState(inputKey) & 0x8000) != 0;
-    if (g_hasHtml && !keyDown)
-    {
-        exStyle |= WS_EX_TRANSPARENT;
-        EnableWindow(g_webviewWindow, FALSE);
-        HWND focused = GetFocus();
-        if (focused && (focused == g_webviewWindow || IsChild(g_webviewWindow, focused)) && g_hwnd)
-        {
-            SetFocus(g_hwnd);
-        }
-    }
-    else
+    D2D1_SIZE_F rtSize = g_renderTarget->GetSize();
+    if (rtSize.width <= 0.0f || rtSize.height <= 0.0f)
     {
-        exStyle &= ~static_cast<LONG_PTR>(WS_EX_TRANSPARENT);
-        EnableWindow(g_webviewWindow, TRUE);
+        return;
     }
-    SetWindowLongPtrW(g_webviewWindow, GWL_EXSTYLE, exStyle);
-    SetWindowPos(
-        g_webviewWindow,
-        nullptr,
-        0,
-        0,
-        0,
-        0,
-        SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED);
-}
 
-bool ExecuteWebViewScript(const wchar_t* script)
-{
-    if (!g_hasHtml || !g_webview || !script)
+    uint64_t lineCount = GetTextDocumentLineCount();
+    if (lineCount == 0)
     {
-        return false;
+        g_textTopLine = 0;
+        g_textTopOffset = 0.0f;
+        return;
     }
 
-    HRESULT hr = g_webview->ExecuteScript(
-        script,
-        Microsoft::WRL::Callback<ICoreWebView2ExecuteScriptCompletedHandler>(
-            [](HRESULT, LPCWSTR) -> HRESULT
-            {
-                return S_OK;
-            }).Get());
-    return SUCCEEDED(hr);
-}
-
-bool BuildFileUrlFromPath(const std::wstring& path, std::wstring& url)
-{
-    if (path.empty())
+    float width = rtSize.width - 16.0f;
+    g_textTopLine = (std::min)(g_textTopLine, lineCount - 1);
+    g_textTopOffset += delta;
+    while (g_textTopOffset < 0.0f && g_textTopLine > 0)
     {
-        return false;
+        --g_textTopLine;
+        g_textTopOffset += MeasureTextLineHeight(g_textTopLine, width);
     }
-
-    DWORD length = static_cast<DWORD>((std::max<size_t>)(512, path.size() * 3 + 16));
-    for (int attempt = 0; attempt < 4; ++attempt)
+    g_textTopOffset = std::max(0.0f, g_textTopOffset);
+    while (g_textTopLine + 1 < lineCount)
     {
-        std::wstring buffer(length, L'\0');
-        DWORD written = length;
-        HRESULT hr = UrlCreateFromPathW(path.c_str(), buffer.data(), &written, 0);
-        if (SUCCEEDED(hr) && written > 0)
+        float height = MeasureTextLineHeight(g_textTopLine, width);
+        if (g_textTopOffset < height)
         {
-            if (buffer[written - 1] == L'\0')
-            {
-                --written;
-            }
-            buffer.resize(written);
-            url = std::move(buffer);
-            return !url.empty();
+            break;
         }
+        g_textTopOffset -= height;
+        ++g_textTopLine;
+    }
 
-        if (hr == S_FALSE && written > length)
+    // Keep the last line on the bottom edge rather than scrolling past the end.
+    float viewHeight = rtSize.height - 16.0f;
+    float filled = -g_textTopOffset;
+    for (uint64_t line = g_textTopLine; line < lineCount && filled < viewHeight; ++line)
+    {
+        filled += MeasureTextLineHeight(line, width);
+    }
+    if (filled < viewHeight)
+    {
+        g_textTopOffset -= viewHeight - filled;
+        while (g_textTopOffset < 0.0f && g_textTopLine > 0)
         {
-            length = written;
-            continue;
+            --g_textTopLine;
+            g_textTopOffset += MeasureTextLineHeight(g_textTopLine, width);
         }
-        break;
+        g_textTopOffset = std::max(0.0f, g_textTopOffset);
     }
+}
 
-    return false;
+// =====================
+// テキストビューア
+// =====================
+TextFileIdentity GetTextFileIdentity(const BY_HANDLE_FILE_INFORMATION& info)
+{
+    TextFileIdentity identity;
+    identity.volume = info.dwVolumeSerialNumber;
+    identity.file = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+    return identity;
 }
 
-bool EnsureWebViewTempHtmlTarget()
+bool OpenTextDocument(const wchar_t* path)
 {
-    if (!g_webviewTempHtmlPath.empty() && !g_webviewTempHtmlUrl.empty())
-    {
-        return true;
-    }
+    CloseTextDocument();
 
-    wchar_t tempDir[MAX_PATH]{};
-    DWORD dirLength = GetTempPathW(MAX_PATH, tempDir);
-    if (dirLength == 0 || dirLength >= MAX_PATH)
+    HANDLE file = CreateFileW(
+        path,
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr
+    );
+    if (file == INVALID_HANDLE_VALUE)
     {
         return false;
     }
 
-    wchar_t tempFile[MAX_PATH]{};
-    if (GetTempFileNameW(tempDir, L"flv", 0, tempFile) == 0)
+    LARGE_INTEGER fileSize{};
+    BY_HANDLE_FILE_INFORMATION fileInfo{};
+    if (!GetFileSizeEx(file, &fileSize) || !GetFileInformationByHandle(file, &fileInfo))
     {
+        CloseHandle(file);
         return false;
     }
 
-    if (!DeleteFileW(tempFile))
+    TextDocument& doc = g_textDocument;
+    doc.path = path;
+    doc.file = file;
+    doc.size = static_cast<uint64_t>(fileSize.QuadPart);
+    doc.identity = GetTextFileIdentity(fileInfo);
+    doc.dataStart = 0;
+    if (doc.size >= 3)
     {
-        return false;
+        const char* head = MapTextRange(0, 3);
+        if (!head)
+        {
+            CloseTextDocument();
+            return false;
+        }
+        if (memcmp(head, kUtf8Bom.data(), kUtf8Bom.size()) == 0)
+        {
+            doc.dataStart = kUtf8Bom.size();
+        }
     }
 
-    std::wstring htmlPath = tempFile;
-    htmlPath += L".html";
-
-    std::wstring url;
-    if (!BuildFileUrlFromPath(htmlPath, url))
     {
-        return false;
+        std::lock_guard<std::mutex> lock(doc.indexMutex);
+        ResetTextLineIndex(doc.index, doc.dataStart);
+        doc.indexComplete = doc.size <= doc.dataStart;
+    }
+    doc.cancelIndexing = false;
+    if (doc.size > doc.dataStart)
+    {
+        doc.indexer = std::thread(IndexTextDocument, doc.dataStart, doc.size);
     }
 
-    g_webviewTempHtmlPath = std::move(htmlPath);
-    g_webviewTempHtmlUrl = std::move(url);
+    g_textTopLine = 0;
+    g_textTopOffset = 0.0f;
+    g_textLineHeights.clear();
     return true;
 }
 
-bool WriteHtmlToTempFile(const std::wstring& html, std::wstring& path)
+void CloseTextDocument()
 {
-    if (!EnsureWebViewTempHtmlTarget())
+    StopTextFileWatcher();
+    TextDocument& doc = g_textDocument;
+    doc.cancelIndexing = true;
+    if (doc.indexer.joinable())
     {
-        return false;
+        doc.indexer.join();
     }
-
-    std::ofstream output(g_webviewTempHtmlPath, std::ios::binary | std::ios::trunc);
-    if (!output)
+    ReleaseTextMapping();
+    if (doc.file != INVALID_HANDLE_VALUE)
     {
-        return false;
+        CloseHandle(doc.file);
+        doc.file = INVALID_HANDLE_VALUE;
     }
-
-    // Avoid UTF-16 -> UTF-8 conversion for large HTML writes.
-    // WebView can decode UTF-16LE content reliably via BOM.
-    static constexpr unsigned char bom[] = { 0xFF, 0xFE };
-    output.write(reinterpret_cast<const char*>(bom), sizeof(bom));
-    output.write(
-        reinterpret_cast<const char*>(html.data()),
-        static_cast<std::streamsize>(html.size() * sizeof(wchar_t)));
-    if (!output.good())
+    doc.path.clear();
+    doc.size = 0;
+    doc.dataStart = 0;
+    doc.identity = TextFileIdentity{};
     {
-        output.close();
-        return false;
+        std::lock_guard<std::mutex> lock(doc.indexMutex);
+        ResetTextLineIndex(doc.index, 0);
+        doc.indexComplete = false;
     }
-    output.close();
-
-    path = g_webviewTempHtmlPath;
-    return true;
+    g_textTopLine = 0;
+    g_textTopOffset = 0.0f;
+    g_textLineHeights.clear();
 }
 
-bool NavigateWebViewHtml(const std::wstring& html)
+// Runs on the indexer thread; the UI only sees the index through indexMutex.
+void IndexTextDocument(uint64_t begin, uint64_t end)
 {
-    if (!g_webview)
-    {
-        return false;
+    TextDocument& doc = g_textDocument;
+    std::vector<char> buffer(kTextIndexChunkBytes);
+    ULONGLONG lastPostMs = 0;
+    uint64_t offset = begin;
+    while (offset < end && !doc.cancelIndexing)
+    {
+        DWORD toRead = static_cast<DWORD>((std::min)(static_cast<uint64_t>(buffer.size()), end - offset));
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD read = 0;
+        if (!ReadFile(doc.file, buffer.data(), toRead, &read, &overlapped) || read == 0)
+        {
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(doc.indexMutex);
+            AppendTextLineIndex(doc.index, buffer.data(), read);
+        }
+        offset += read;
+
+        ULONGLONG now = GetTickCount64();
+        if (lastPostMs == 0 || now - lastPostMs >= kTextIndexProgressIntervalMs)
+        {
+            lastPostMs = now;
+            PostMessageW(g_hwnd, kMessageTextIndexProgress, 0, 0);
+        }
     }
 
-    // NavigateToString is usually faster for small/medium documents,
-    // so prefer it for first paint and fall back to file navigation for large content.
-    constexpr size_t kNavigateToStringMaxChars = 900000;
-    if (html.size() <= kNavigateToStringMaxChars)
+    if (!doc.cancelIndexing)
     {
-        if (SUCCEEDED(g_webview->NavigateToString(html.c_str())))
         {
-            return true;
+            std::lock_guard<std::mutex> lock(doc.indexMutex);
+            doc.indexComplete = true;
         }
+        PostMessageW(g_hwnd, kMessageTextIndexProgress, 0, 0);
     }
+}
 
-    std::wstring tempPath;
-    if (!WriteHtmlToTempFile(html, tempPath))
+const char* MapTextRange(uint64_t offset, size_t length)
+{
+    TextDocument& doc = g_textDocument;
+    if (doc.file == INVALID_HANDLE_VALUE || offset > doc.size || length > doc.size - offset)
     {
-        return SUCCEEDED(g_webview->NavigateToString(html.c_str()));
+        return nullptr;
+    }
+    if (!doc.mapping)
+    {
+        // Sized to what has been indexed so a growing file never shifts under the view.
+        doc.mapping = CreateFileMappingW(
+            doc.file,
+            nullptr,
+            PAGE_READONLY,
+            static_cast<DWORD>(doc.size >> 32),
+            static_cast<DWORD>(doc.size & 0xFFFFFFFF),
+            nullptr
+        );
+        if (!doc.mapping)
+        {
+            return nullptr;
+        }
+    }
+    if (doc.view && offset >= doc.viewOffset && offset + length <= doc.viewOffset + doc.viewSize)
+    {
+        return doc.view + (offset - doc.viewOffset);
     }
 
-    if (g_webviewTempHtmlUrl.empty())
+    if (doc.view)
     {
-        return SUCCEEDED(g_webview->NavigateToString(html.c_str()));
+        UnmapViewOfFile(doc.view);
+        doc.view = nullptr;
     }
 
-    HRESULT hr = g_webview->Navigate(g_webviewTempHtmlUrl.c_str());
-    if (FAILED(hr))
+    // Center a fixed-size window on the request so scrolling either way stays inside it.
+    SYSTEM_INFO systemInfo{};
+    GetSystemInfo(&systemInfo);
+    uint64_t granularity = systemInfo.dwAllocationGranularity;
+    uint64_t viewStart = offset > kTextViewWindowBytes / 2 ? offset - kTextViewWindowBytes / 2 : 0;
+    viewStart -= viewStart % granularity;
+    uint64_t viewEnd = (std::min)(doc.size, (std::max)(offset + length, viewStart + kTextViewWindowBytes));
+    void* view = MapViewOfFile(
+        doc.mapping,
+        FILE_MAP_READ,
+        static_cast<DWORD>(viewStart >> 32),
+        static_cast<DWORD>(viewStart & 0xFFFFFFFF),
+        static_cast<SIZE_T>(viewEnd - viewStart)
+    );
+    if (!view)
     {
-        return SUCCEEDED(g_webview->NavigateToString(html.c_str()));
+        return nullptr;
     }
+    doc.view = static_cast<const char*>(view);
+    doc.viewOffset = viewStart;
+    doc.viewSize = static_cast<size_t>(viewEnd - viewStart);
+    return doc.view + (offset - viewStart);
+}
 
-    return true;
+uint64_t GetTextDocumentLineCount()
+{
+    TextDocument& doc = g_textDocument;
+    std::lock_guard<std::mutex> lock(doc.indexMutex);
+    return GetTextLineCount(doc.index, doc.indexComplete);
 }
 
-bool HandleHtmlOverlayKeyDown(WPARAM wParam)
+bool ReadTextLine(uint64_t line, std::wstring& text)
 {
-    bool ctrlDown = (GetKeyState(VK_CONTROL) & 0x8000) != 0;
-    WORD key = static_cast<WORD>(wParam);
-    if (key == g_keyScrollUp)
+    TextDocument& doc = g_textDocument;
+    std::lock_guard<std::mutex> lock(doc.indexMutex);
+    return ReadTextLine(doc.index, doc.indexComplete, line, MapTextRange, text);
+}
+
+IDWriteTextLayout* CreateTextLineLayout(uint64_t line, float maxWidth)
+{
+    if (!g_dwriteFactory || !g_textFormat)
     {
-        return ExecuteWebViewScript(L"window.scrollBy(0, -60);");
+        return nullptr;
     }
-    if (key == g_keyScrollDown)
+    std::wstring text;
+    if (!ReadTextLine(line, text))
     {
-        return ExecuteWebViewScript(L"window.scrollBy(0, 60);");
+        return nullptr;
     }
-    if (key == g_keyScrollLeft)
+    IDWriteTextLayout* layout = nullptr;
+    g_dwriteFactory->CreateTextLayout(
+        text.c_str(),
+        static_cast<UINT32>(text.size()),
+        g_textFormat,
+        std::max(1.0f, maxWidth),
+        100000.0f,
+        &layout
+    );
+    return layout;
+}
+
+float RememberTextLineHeight(uint64_t line, float maxWidth, IDWriteTextLayout* layout)
+{
+    if (maxWidth != g_textLayoutWidth || g_textLineHeights.size() > 16384)
     {
-        return ExecuteWebViewScript(L"window.scrollBy(-60, 0);");
+        g_textLineHeights.clear();
+        g_textLayoutWidth = maxWidth;
     }
-    if (key == g_keyScrollRight)
+    float height = g_textFontSize;
+    DWRITE_TEXT_METRICS metrics{};
+    if (layout && SUCCEEDED(layout->GetMetrics(&metrics)) && metrics.height > 0.0f)
     {
-        return ExecuteWebViewScript(L"window.scrollBy(60, 0);");
+        height = metrics.height;
     }
+    g_textLineHeights[line] = height;
+    return height;
+}
 
-    switch (wParam)
+float MeasureTextLineHeight(uint64_t line, float maxWidth)
+{
+    if (maxWidth == g_textLayoutWidth)
     {
-    case VK_PRIOR:
-        return ExecuteWebViewScript(L"window.scrollBy(0, -window.innerHeight * 0.9);");
-    case VK_NEXT:
-    case VK_SPACE:
-        return ExecuteWebViewScript(L"window.scrollBy(0, window.innerHeight * 0.9);");
-    case VK_HOME:
-        return ExecuteWebViewScript(L"window.scrollTo(0, 0);");
-    case VK_END:
-        return ExecuteWebViewScript(L"window.scrollTo(0, document.body ? document.body.scrollHeight : document.documentElement.scrollHeight);");
-    case '0':
-        if (ctrlDown)
+        auto it = g_textLineHeights.find(line);
+        if (it != g_textLineHeights.end())
         {
-            return SetWebViewZoomFactor(g_htmlBaseZoomFactor > 0.0 ? g_htmlBaseZoomFactor : 1.0);
+            return it->second;
         }
-        break;
-    default:
-        break;
     }
-    return false;
+
+    IDWriteTextLayout* layout = CreateTextLineLayout(line, maxWidth);
+    float height = RememberTextLineHeight(line, maxWidth, layout);
+    if (layout)
+    {
+        layout->Release();
+    }
+    return height;
 }
 
-bool GetWebViewZoomFactor(double& factor)
+bool HandleTextViewKeyDown(WPARAM wParam)
 {
-    factor = 1.0;
-    if (!g_webviewController)
+    if (!g_renderTarget)
     {
         return false;
     }
-
-    double value = 1.0;
-    HRESULT hr = g_webviewController->get_ZoomFactor(&value);
-    if (FAILED(hr) || value <= 0.0)
+    float page = std::max(40.0f, g_renderTarget->GetSize().height - 16.0f - g_textFontSize);
+    WORD key = static_cast<WORD>(wParam);
+    if (key == g_keyScrollUp)
+    {
+        ScrollTextBy(-40.0f);
+    }
+    else if (key == g_keyScrollDown)
+    {
+        ScrollTextBy(40.0f);
+    }
+    else if (wParam == VK_PRIOR)
+    {
+        ScrollTextBy(-page);
+    }
+    else if (wParam == VK_NEXT)
+    {
+        ScrollTextBy(page);
+    }
+    else if (wParam == VK_HOME)
+    {
+        g_textTopLine = 0;
+        g_textTopOffset = 0.0f;
+    }
+    else if (wParam == VK_END)
+    {
+        ScrollTextToEnd();
+    }
+    else
     {
         return false;
     }
-
-    factor = value;
+    if (g_hwnd)
+    {
+        InvalidateRect(g_hwnd, nullptr, FALSE);
+    }
     return true;
 }
 
-bool SetWebViewZoomFactor(double factor)
+void ReleaseTextMapping()
 {
-    if (!g_webviewController || factor <= 0.0)
+    TextDocument& doc = g_textDocument;
+    if (doc.view)
     {
-        return false;
+        UnmapViewOfFile(doc.view);
+        doc.view = nullptr;
+    }
+    if (doc.mapping)
+    {
+        CloseHandle(doc.mapping);
+        doc.mapping = nullptr;
     }
+    doc.viewOffset = 0;
+    doc.viewSize = 0;
+}
 
-    double clamped = (std::max)(0.1, (std::min)(factor, 5.0));
-    HRESULT hr = g_webviewController->put_ZoomFactor(clamped);
-    return SUCCEEDED(hr);
+void ScrollTextToEnd()
+{
+    uint64_t lineCount = GetTextDocumentLineCount();
+    g_textTopLine = lineCount > 0 ? lineCount - 1 : 0;
+    g_textTopOffset = 0.0f;
+    ScrollTextBy(0.0f);
 }
 
-bool HandleHtmlOverlayShortcutKeyDown(WORD key)
+// Keeps following the end until the indexer has caught up with the file.
+void ApplyPendingTextScrollToEnd()
 {
-    double current = 1.0;
-    if (!GetWebViewZoomFactor(current))
+    if (!g_textScrollToEndPending)
     {
-        current = g_htmlBaseZoomFactor;
+        return;
     }
-
-    if (key == g_keyZoomIn)
+    ScrollTextToEnd();
+    TextDocument& doc = g_textDocument;
+    std::lock_guard<std::mutex> lock(doc.indexMutex);
+    if (doc.indexComplete)
     {
-        return SetWebViewZoomFactor(current * 1.1);
+        g_textScrollToEndPending = false;
     }
-    if (key == g_keyZoomOut)
+}
+
+bool IsTextViewAtBottom()
+{
+    if (!g_renderTarget)
     {
-        return SetWebViewZoomFactor(current / 1.1);
+        return true;
     }
-    if (key == g_keyOriginalSize)
+    D2D1_SIZE_F rtSize = g_renderTarget->GetSize();
+    float width = rtSize.width - 16.0f;
+    float viewHeight = rtSize.height - 16.0f;
+    uint64_t lineCount = GetTextDocumentLineCount();
+    float filled = -g_textTopOffset;
+    for (uint64_t line = g_textTopLine; line < lineCount; ++line)
     {
-        return SetWebViewZoomFactor(g_htmlBaseZoomFactor > 0.0 ? g_htmlBaseZoomFactor : 1.0);
+        filled += MeasureTextLineHeight(line, width);
+        if (filled > viewHeight + 0.5f)
+        {
+            return false;
+        }
     }
-    return false;
+    return true;
 }
 
-bool EnsureWebView2(HWND hwnd)
+// Runs on the watcher thread and only posts to the UI; the UI re-checks the file itself.
+void WatchTextFileDirectory(std::wstring directory, HANDLE stopEvent)
 {
-    if (!hwnd)
+    HANDLE change = FindFirstChangeNotificationW(
+        directory.c_str(),
+        FALSE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE
+    );
+    if (change == INVALID_HANDLE_VALUE)
     {
-        return false;
+        return;
     }
 
-    if (g_webviewController && g_webview)
+    HANDLE handles[] = { stopEvent, change };
+    while (WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
     {
-        if (!g_webviewPendingShow)
-        {
-            g_webviewController->put_IsVisible(TRUE);
-        }
-        UpdateWebViewWindowHandle();
-        UpdateWebViewInputState();
-        UpdateWebViewInputTimer();
-        UpdateWebViewBounds();
-        if (!g_pendingHtmlContent.empty())
+        if (!g_textFileWatcher.changePosted.exchange(true))
         {
-            g_webviewPendingShow = true;
-            g_webviewController->put_IsVisible(FALSE);
-            if (NavigateWebViewHtml(g_pendingHtmlContent))
-            {
-                g_pendingHtmlContent.clear();
-            }
+            PostMessageW(g_hwnd, kMessageTextFileChanged, 0, 0);
         }
-        return true;
-    }
-
-    if (!g_webviewLoader)
-    {
-        g_webviewLoader = LoadLibraryW(L"WebView2Loader.dll");
-        if (!g_webviewLoader)
+        if (!FindNextChangeNotification(change))
         {
-            MessageBoxW(hwnd, L"WebView2Loader.dll not found.", L"WebView2", MB_OK | MB_ICONERROR);
-            return false;
+            break;
         }
     }
-
-    using CreateWebView2EnvironmentWithOptionsFn = HRESULT(WINAPI*)(
-        PCWSTR, PCWSTR, ICoreWebView2EnvironmentOptions*,
-        ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler*);
-    auto createEnv = reinterpret_cast<CreateWebView2EnvironmentWithOptionsFn>(
-        GetProcAddress(g_webviewLoader, "CreateCoreWebView2EnvironmentWithOptions"));
-    if (!createEnv)
-    {
-        MessageBoxW(hwnd, L"CreateCoreWebView2EnvironmentWithOptions not available.", L"WebView2", MB_OK | MB_ICONERROR);
-        return false;
-    }
-
-    HRESULT hr = createEnv(
-        nullptr,
-        nullptr,
-        nullptr,
-        Microsoft::WRL::Callback<ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler>(
-            [hwnd](HRESULT result, ICoreWebView2Environment* env) -> HRESULT
-            {
-                if (FAILED(result) || !env)
-                {
-                    return result;
-                }
-                return env->CreateCoreWebView2Controller(
-                    hwnd,
-                    Microsoft::WRL::Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
-                        [](HRESULT result, ICoreWebView2Controller* controller) -> HRESULT
-                        {
-                            if (FAILED(result) || !controller)
-                            {
-                                return result;
-                            }
-                            g_webviewController = controller;
-                            g_webviewController->get_CoreWebView2(&g_webview);
-                            g_webviewController.As(&g_webviewController2);
-                            g_webviewController->put_IsVisible(g_webviewPendingShow ? FALSE : TRUE);
-                            UpdateWebViewWindowHandle();
-                            UpdateWebViewInputState();
-                            UpdateWebViewInputTimer();
-                            UpdateWebViewBounds();
-                            g_webview->add_NavigationCompleted(
-                                Microsoft::WRL::Callback<ICoreWebView2NavigationCompletedEventHandler>(
-                                    [](ICoreWebView2*, ICoreWebView2NavigationCompletedEventArgs*) -> HRESULT
-                                    {
-                                        if (g_webviewController)
-                                        {
-                                            double zoom = 1.0;
-                                            if (SUCCEEDED(g_webviewController->get_ZoomFactor(&zoom)) && zoom > 0.0)
-                                            {
-                                                g_htmlBaseZoomFactor = zoom;
-                                            }
-                                        }
-                                        if (g_webviewController && g_webviewPendingShow)
-                                        {
-                                            g_webviewPendingShow = false;
-                                            g_keepLayeredWhileHtmlPending = false;
-                                            ApplyTransparencyMode();
-                                            g_webviewController->put_IsVisible(TRUE);
-                                        }
-                                        return S_OK;
-                                    }).Get(),
-                                &g_webviewNavigationToken);
-                            if (g_webview && !g_pendingHtmlContent.empty())
-                            {
-                                g_webviewPendingShow = true;
-                                if (NavigateWebViewHtml(g_pendingHtmlContent))
-                                {
-                                    g_pendingHtmlContent.clear();
-                                }
-                            }
-                            return S_OK;
-                        }).Get());
-            }).Get());
-
-    return SUCCEEDED(hr);
+    FindCloseChangeNotification(change);
 }
 
-void CloseWebView()
+void StopTextFileWatcher()
 {
-    if (!g_webviewTempHtmlPath.empty())
+    TextFileWatcher& watcher = g_textFileWatcher;
+    if (watcher.stopEvent)
     {
-        DeleteFileW(g_webviewTempHtmlPath.c_str());
-        g_webviewTempHtmlPath.clear();
+        SetEvent(watcher.stopEvent);
     }
-    g_webviewTempHtmlUrl.clear();
-    if (g_webviewController)
+    if (watcher.thread.joinable())
     {
-        g_webviewController->Close();
+        watcher.thread.join();
     }
-    if (g_webviewInputTimerActive && g_hwnd)
+    if (watcher.stopEvent)
     {
-        KillTimer(g_hwnd, kWebViewInputTimerId);
-        g_webviewInputTimerActive = false;
+        CloseHandle(watcher.stopEvent);
+        watcher.stopEvent = nullptr;
     }
-    g_webviewController.Reset();
-    g_webviewController2.Reset();
-    g_webview.Reset();
-    g_htmlBaseZoomFactor = 1.0;
-    g_webviewWindow = nullptr;
-    if (g_webviewLoader)
+    watcher.directory.clear();
+    watcher.changePosted = false;
+    if (g_hwnd)
     {
-        FreeLibrary(g_webviewLoader);
-        g_webviewLoader = nullptr;
+        KillTimer(g_hwnd, kTextFollowPollTimerId);
     }
 }
 
-void UpdateCustomColorBrush()
+void UpdateTextFollowWatcher()
 {
-    if (!g_renderTarget)
+    TextDocument& doc = g_textDocument;
+    if (!g_hasText || !g_textFollow || doc.file == INVALID_HANDLE_VALUE)
     {
+        StopTextFileWatcher();
         return;
     }
-    if (g_customColorBrush)
-    {
-        g_customColorBrush->Release();
-        g_customColorBrush = nullptr;
-    }
-    D2D1_COLOR_F color = D2D1::ColorF(
-        GetRValue(g_customColor) / 255.0f,
-        GetGValue(g_customColor) / 255.0f,
-        GetBValue(g_customColor) / 255.0f
-    );
-    g_renderTarget->CreateSolidColorBrush(color, &g_customColorBrush);
-}
 
-void UpdateTextFormat()
-{
-    if (!g_dwriteFactory)
+    std::wstring directory = std::filesystem::path(doc.path).parent_path().wstring();
+    TextFileWatcher& watcher = g_textFileWatcher;
+    if (watcher.thread.joinable() && watcher.directory == directory)
     {
         return;
     }
-    if (g_textFormat)
+    StopTextFileWatcher();
+    watcher.stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!watcher.stopEvent)
     {
-        g_textFormat->Release();
-        g_textFormat = nullptr;
+        return;
     }
-    ResolvedFontInfo resolvedFont = ResolveFontInfo(g_dwriteFactory, g_textFontName);
-    const wchar_t* fontName = resolvedFont.familyName.empty() ? g_textFontName.c_str() : resolvedFont.familyName.c_str();
-    g_dwriteFactory->CreateTextFormat(
-        fontName,
-        nullptr,
-        resolvedFont.weight,
-        resolvedFont.style,
-        resolvedFont.stretch,
-        g_textFontSize,
-        L"ja-jp",
-        &g_textFormat
-    );
-    if (g_textFormat)
+    watcher.directory = directory;
+    watcher.thread = std::thread(WatchTextFileDirectory, directory, watcher.stopEvent);
+    // Directory notifications can lag for files a writer keeps open, so poll the size as well.
+    if (g_hwnd)
     {
-        g_textFormat->SetWordWrapping(g_textWrap ? DWRITE_WORD_WRAPPING_WRAP : DWRITE_WORD_WRAPPING_NO_WRAP);
+        SetTimer(g_hwnd, kTextFollowPollTimerId, kTextFollowPollIntervalMs, nullptr);
     }
 }
 
-void UpdateTextBrush()
+void RefreshFollowedTextDocument()
 {
-    if (!g_renderTarget)
+    TextDocument& doc = g_textDocument;
+    if (!g_hasText || !g_textFollow || doc.file == INVALID_HANDLE_VALUE)
     {
         return;
     }
-    if (g_textBrush)
+    bool indexComplete = false;
     {
-        g_textBrush->Release();
-        g_textBrush = nullptr;
+        std::lock_guard<std::mutex> lock(doc.indexMutex);
+        indexComplete = doc.indexComplete;
     }
-    D2D1_COLOR_F color = D2D1::ColorF(
-        GetRValue(g_textColor) / 255.0f,
-        GetGValue(g_textColor) / 255.0f,
-        GetBValue(g_textColor) / 255.0f
-    );
-    g_renderTarget->CreateSolidColorBrush(color, &g_textBrush);
-}
-
-void ResizeWindowByFactor(HWND hwnd, float factor)
-{
-    RECT rc{};
-    GetClientRect(hwnd, &rc);
-    float width = static_cast<float>(rc.right - rc.left) * factor;
-    float height = static_cast<float>(rc.bottom - rc.top) * factor;
-    width = std::max(200.0f, width);
-    height = std::max(200.0f, height);
-    SetWindowPos(hwnd, nullptr, 0, 0, static_cast<int>(width), static_cast<int>(height),
-        SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE);
-    InvalidateRect(hwnd, nullptr, TRUE);
-}
 
-void ScrollTextBy(float delta)
-{
-    if (!g_renderTarget || !g_textFormat)
+    TextFollowProbe probe;
+    HANDLE current = CreateFileW(
+        doc.path.c_str(),
+        0,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr
+    );
+    if (current != INVALID_HANDLE_VALUE)
     {
-        return;
+        probe.pathExists = true;
+        BY_HANDLE_FILE_INFORMATION info{};
+        probe.identityKnown = GetFileInformationByHandle(current, &info) != FALSE;
+        if (probe.identityKnown)
+        {
+            probe.pathIdentity = GetTextFileIdentity(info);
+        }
+        CloseHandle(current);
     }
-
-    D2D1_SIZE_F rtSize = g_renderTarget->GetSize();
-    if (rtSize.width <= 0.0f || rtSize.height <= 0.0f)
+    LARGE_INTEGER fileSize{};
+    probe.sizeKnown = GetFileSizeEx(doc.file, &fileSize) != FALSE;
+    probe.openSize = static_cast<uint64_t>(fileSize.QuadPart);
+    TextFollowAction action = GetTextFollowAction(doc.identity, doc.size, indexComplete, probe);
+    if (action == TextFollowAction::None)
     {
         return;
     }
+    uint64_t newSize = probe.openSize;
 
-    IDWriteTextLayout* layout = nullptr;
-    g_dwriteFactory->CreateTextLayout(
-        g_textContent.c_str(),
-        static_cast<UINT32>(g_textContent.size()),
-        g_textFormat,
-        rtSize.width - 16.0f,
-        10000.0f,
-        &layout
-    );
-    if (!layout)
+    bool atBottom = IsTextViewAtBottom();
+    if (action == TextFollowAction::Reopen)
     {
-        return;
+        // Rotated or truncated: start over on whatever the path names now.
+        std::wstring path = doc.path;
+        if (!OpenTextDocument(path.c_str()))
+        {
+            return;
+        }
+        g_textScrollToEndPending = atBottom;
+        UpdateTextFollowWatcher();
+    }
+    else
+    {
+        uint64_t oldSize = doc.size;
+        ReleaseTextMapping();
+        doc.size = newSize;
+        // The old last line may have been unterminated and has grown since.
+        uint64_t lineCount = GetTextDocumentLineCount();
+        if (lineCount > 0)
+        {
+            g_textLineHeights.erase(lineCount - 1);
+        }
+
+        if (action == TextFollowAction::AppendInline)
+        {
+            std::vector<char> appended(static_cast<size_t>(newSize - oldSize));
+            OVERLAPPED overlapped{};
+            overlapped.Offset = static_cast<DWORD>(oldSize & 0xFFFFFFFF);
+            overlapped.OffsetHigh = static_cast<DWORD>(oldSize >> 32);
+            DWORD read = 0;
+            if (!ReadFile(doc.file, appended.data(), static_cast<DWORD>(appended.size()), &read, &overlapped))
+            {
+                read = 0;
+            }
+            std::lock_guard<std::mutex> lock(doc.indexMutex);
+            AppendTextLineIndex(doc.index, appended.data(), read);
+            doc.size = doc.index.indexedEnd;
+        }
+        else
+        {
+            if (doc.indexer.joinable())
+            {
+                doc.indexer.join();
+            }
+            {
+                std::lock_guard<std::mutex> lock(doc.indexMutex);
+                doc.indexComplete = false;
+            }
+            doc.cancelIndexing = false;
+            doc.indexer = std::thread(IndexTextDocument, oldSize, newSize);
+        }
+        g_textScrollToEndPending = atBottom;
     }
 
-    DWRITE_TEXT_METRICS metrics{};
-    layout->GetMetrics(&metrics);
-    layout->Release();
-
-    float maxScroll = std::max(0.0f, metrics.height + 16.0f - rtSize.height);
-    g_textScroll = std::max(0.0f, std::min(g_textScroll + delta, maxScroll));
+    ApplyPendingTextScrollToEnd();
+    if (g_hwnd)
+    {
+        InvalidateRect(g_hwnd, nullptr, FALSE);
+    }
 }
 
 namespace
@@ -4701,6 +8746,7 @@ void ShowSettingsDialog(HWND hwnd)
                 cf.lpfnHook = FontChooserHookProc;
                 if (ChooseFont(&cf))
                 {
+                    EnsureDirectWrite();
                     std::wstring familyName = GetFontFamilyNameForSave(lf.lfFaceName);
                     if (familyName.empty())
                     {
@@ -4839,28 +8885,62 @@ void ShowSettingsDialog(HWND hwnd)
 }
 void NavigateImage(int delta)
 {
-    if (g_imageList.empty())
+    g_pendingFilterNavigation = 0;
+    const std::vector<ImageEntry>& entries = g_catalog.entries;
+    if (entries.empty())
     {
         return;
     }
 
-    size_t count = g_imageList.size();
-    auto currentIt = std::find_if(g_imageList.begin(), g_imageList.end(), [](const ImageEntry& entry)
+    size_t count = entries.size();
+    size_t step = (delta >= 0) ? 1 : count - 1;
+    // Entries the filters reject are stepped over; kNoCatalogEntry when none passes. Reaching a
+    // file the running indexer has not probed yet stops the search, and the step is retried
+    // from MergeCatalogMetadata once more results are in.
+    bool waitForIndexer = false;
+    auto findPassing = [&](size_t index)
     {
-        return entry.path == g_currentImagePath;
-    });
-    if (currentIt == g_imageList.end())
+        for (size_t tried = 0; tried < count; ++tried, index = (index + step) % count)
+        {
+            if (PassesCatalogFilter(entries[index]))
+            {
+                return index;
+            }
+            if (IsCatalogFilterPending(entries[index]) && g_metadataIndexer.running)
+            {
+                waitForIndexer = true;
+                return kNoCatalogEntry;
+            }
+        }
+        return kNoCatalogEntry;
+    };
+    size_t current = FindCatalogEntry(g_currentImagePath);
+    if (current == kNoCatalogEntry)
     {
-        size_t fallbackIndex = (delta >= 0) ? 0 : (count - 1);
-        if (LoadImageByIndex(fallbackIndex) && g_hwnd)
+        // The current file left the folder; its successor has moved up into g_currentIndex.
+        size_t anchor = (std::min)(g_currentIndex, count - 1);
+        size_t fallbackIndex = findPassing((delta >= 0) ? anchor : (anchor + count - 1) % count);
+        if (waitForIndexer)
+        {
+            g_pendingFilterNavigation = delta;
+        }
+        if (fallbackIndex != kNoCatalogEntry && LoadImageByIndex(fallbackIndex) && g_hwnd)
         {
             InvalidateRect(g_hwnd, nullptr, TRUE);
         }
         return;
     }
 
-    g_currentIndex = static_cast<size_t>(std::distance(g_imageList.begin(), currentIt));
-    size_t index = (g_currentIndex + count + (delta % static_cast<int>(count))) % count;
+    g_currentIndex = current;
+    size_t index = findPassing((g_currentIndex + count + (delta % static_cast<int>(count))) % count);
+    if (waitForIndexer)
+    {
+        g_pendingFilterNavigation = delta;
+    }
+    if (index == kNoCatalogEntry)
+    {
+        return;
+    }
     if (LoadImageByIndex(index) && g_hwnd)
     {
         InvalidateRect(g_hwnd, nullptr, TRUE);
@@ -4886,16 +8966,7 @@ void ReloadCurrentFile(bool reloadSettings)
         return;
     }
     RefreshImageList(g_currentImagePath);
-    bool currentInList = false;
-    for (const auto& entry : g_imageList)
-    {
-        if (entry.path == g_currentImagePath)
-        {
-            currentInList = true;
-            break;
-        }
-    }
-    if (!currentInList)
+    if (FindCatalogEntry(g_currentImagePath) == kNoCatalogEntry)
     {
         bool result = false;
         if (IsMarkdownFile(g_currentImagePath))
@@ -4939,61 +9010,75 @@ void ReloadCurrentFile(bool reloadSettings)
     }
 }
 
+// While the watcher keeps the catalog of this folder current, only the pending notifications and a
+// changed sort order are applied; another folder or filter is scanned from scratch.
 void RefreshImageList(const std::filesystem::path& imagePath)
 {
-    g_imageList.clear();
     g_currentImagePath = imagePath;
     g_currentIndex = 0;
 
+    DirectoryCatalog& catalog = g_catalog;
+    bool inPlaylist = !catalog.roots.empty() && FindCatalogEntry(imagePath) != kNoCatalogEntry;
+    if (IsArchiveCatalogPath(imagePath) || inPlaylist)
+    {
+        // An open archive or playlist is kept; only its order, or a playlist's filter, changes here.
+        if (inPlaylist && catalog.imageOnly != g_sortImageOnly)
+        {
+            // The saved index lists every supported file, so the walk has nothing to re-list.
+            StartPlaylistScan(std::vector<std::filesystem::path>(catalog.roots));
+        }
+        else if (catalog.order.sortMode != g_sortMode)
+        {
+            SortImageList();
+        }
+        size_t index = FindCatalogEntry(imagePath);
+        g_currentIndex = (index != kNoCatalogEntry) ? index : 0;
+        return;
+    }
+
     std::filesystem::path dir = imagePath.parent_path();
     if (dir.empty())
     {
         dir = std::filesystem::current_path();
     }
 
-    std::error_code ec;
-    bool filterImageOnly = g_sortImageOnly;
-
-    for (const auto& entry : std::filesystem::directory_iterator(dir, ec))
+    if (catalog.directory != dir || catalog.imageOnly != g_sortImageOnly || !g_directoryWatcher.watching)
     {
-        if (ec)
-        {
-            break;
-        }
-        if (!entry.is_regular_file(ec))
+        // Watch first so nothing that changes during the scan is missed. The opened file is
+        // listed right away; the scanner fills in the rest.
+        StartCatalogWatcher(dir);
+        StartCatalogScan(dir);
+        UpdateCatalogFile(g_currentImagePath.filename().wstring(), 0);
+    }
+    else
+    {
+        ApplyDirectoryChanges();
+        if (catalog.order.sortMode != g_sortMode)
         {
-            continue;
+            SortImageList();
         }
-        std::filesystem::path filePath = entry.path();
-        bool shouldInclude = filterImageOnly ? IsImageFile(filePath) : IsSupportedFile(filePath);
-        if (!shouldInclude)
+        if (FindCatalogEntry(g_currentImagePath) == kNoCatalogEntry)
         {
-            continue;
+            // Just created; its notification may not have arrived yet.
+            UpdateCatalogFile(g_currentImagePath.filename().wstring(), 0);
         }
-        std::filesystem::file_time_type time = entry.last_write_time(ec);
-        g_imageList.push_back({ filePath, time });
     }
 
-    SortImageList();
-
-    for (size_t i = 0; i < g_imageList.size(); ++i)
+    size_t index = FindCatalogEntry(g_currentImagePath);
+    if (index != kNoCatalogEntry)
     {
-        if (g_imageList[i].path == g_currentImagePath)
-        {
-            g_currentIndex = i;
-            break;
-        }
+        g_currentIndex = index;
     }
 }
 
 bool LoadImageByIndex(size_t index)
 {
-    if (g_imageList.empty() || index >= g_imageList.size())
+    if (index >= g_catalog.entries.size())
     {
         return false;
     }
     g_currentIndex = index;
-    g_currentImagePath = g_imageList[index].path;
+    g_currentImagePath = g_catalog.entries[index].path;
     bool result = false;
     if (IsMarkdownFile(g_currentImagePath))
     {
@@ -5009,12 +9094,12 @@ bool LoadImageByIndex(size_t index)
     }
     else
     {
-        result = LoadImageFromFile(g_currentImagePath.c_str());
+        result = g_catalog.archive ? LoadArchiveImage(index) : LoadImageFromFile(g_currentImagePath.c_str());
         if (result)
         {
             UpdateZoomToFitScreen(g_hwnd);
             if (g_hwnd && g_imageHasAlpha && g_transparencyMode == TransparencyMode::Transparent
-                && !g_animationPlaying)
+                && !g_animationPlayback.playing)
             {
                 UpdateLayeredWindowFromWic(
                     g_hwnd,
@@ -5058,7 +9143,7 @@ bool ShowOpenImageDialog(HWND hwnd)
     ofn.hwndOwner = hwnd;
     ofn.lpstrFile = filePath;
     ofn.nMaxFile = MAX_PATH;
-    ofn.lpstrFilter = L"Image/Text/HTML/Markdown Files\0*.png;*.jpg;*.jpeg;*.bmp;*.gif;*.tif;*.tiff;*.webp;*.txt;*.html;*.htm;*.md;*.markdown\0All Files\0*.*\0";
+    ofn.lpstrFilter = L"Image/Text/HTML/Markdown Files\0*.png;*.jpg;*.jpeg;*.bmp;*.gif;*.tif;*.tiff;*.webp;*.txt;*.html;*.htm;*.md;*.markdown;*.zip;*.cbz\0All Files\0*.*\0";
     ofn.nFilterIndex = 1;
     ofn.Flags = OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST;
 
@@ -5067,6 +9152,10 @@ bool ShowOpenImageDialog(HWND hwnd)
         return false;
     }
 
+    if (IsArchiveFile(filePath))
+    {
+        return OpenArchiveCatalog(filePath) && LoadImageByIndex(0);
+    }
     if (IsMarkdownFile(filePath))
     {
         if (LoadMarkdownFromFile(filePath))
@@ -5104,6 +9193,44 @@ bool ShowOpenImageDialog(HWND hwnd)
     return false;
 }
 
+// Picks one or more folders and opens them as a playlist.
+bool ShowOpenFolderDialog(HWND hwnd)
+{
+    IFileOpenDialog* dialog = nullptr;
+    if (FAILED(CoCreateInstance(CLSID_FileOpenDialog, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&dialog))))
+    {
+        return false;
+    }
+    DWORD options = 0;
+    dialog->GetOptions(&options);
+    dialog->SetOptions(options | FOS_PICKFOLDERS | FOS_ALLOWMULTISELECT | FOS_FORCEFILESYSTEM);
+
+    std::vector<std::filesystem::path> folders;
+    IShellItemArray* items = nullptr;
+    if (SUCCEEDED(dialog->Show(hwnd)) && SUCCEEDED(dialog->GetResults(&items)))
+    {
+        DWORD count = 0;
+        items->GetCount(&count);
+        for (DWORD i = 0; i < count; ++i)
+        {
+            IShellItem* item = nullptr;
+            PWSTR path = nullptr;
+            if (SUCCEEDED(items->GetItemAt(i, &item)) && SUCCEEDED(item->GetDisplayName(SIGDN_FILESYSPATH, &path)))
+            {
+                folders.emplace_back(path);
+                CoTaskMemFree(path);
+            }
+            if (item)
+            {
+                item->Release();
+            }
+        }
+        items->Release();
+    }
+    dialog->Release();
+    return !folders.empty() && OpenPlaylist(folders);
+}
+
 void UpdateWindowSizeToImage(HWND hwnd, float drawWidth, float drawHeight)
 {
     if (!hwnd || drawWidth <= 0.0f || drawHeight <= 0.0f)
@@ -5208,124 +9335,20 @@ void LoadSettings()
         return;
     }
 
-    g_textFontFaceName.clear();
-    wchar_t buffer[128]{};
-    auto readKeySetting = [&](const wchar_t* keyName, WORD defaultKey)
-    {
-        wchar_t keyBuffer[16]{};
-        _snwprintf_s(keyBuffer, _TRUNCATE, L"%u", static_cast<unsigned int>(defaultKey));
-        GetPrivateProfileStringW(L"KeyConfig", keyName, keyBuffer, buffer, 32, g_iniPath.c_str());
-        int value = _wtoi(buffer);
-        if (value <= 0 || value > 0xFE)
-        {
-            return defaultKey;
-        }
-        return static_cast<WORD>(value);
-    };
-    GetPrivateProfileStringW(L"Settings", L"SortMode", L"0", buffer, 32, g_iniPath.c_str());
-    int sortValue = _wtoi(buffer);
-    if (sortValue < 0 || sortValue > 3)
-    {
-        sortValue = 0;
-    }
-    g_sortMode = static_cast<SortMode>(sortValue);
-
-    GetPrivateProfileStringW(L"Settings", L"SortImageOnly", L"1", buffer, 32, g_iniPath.c_str());
-    g_sortImageOnly = (_wtoi(buffer) != 0);
-
-    GetPrivateProfileStringW(L"Settings", L"AlwaysOnTop", L"0", buffer, 32, g_iniPath.c_str());
-    g_alwaysOnTop = (_wtoi(buffer) != 0);
-
-    GetPrivateProfileStringW(L"Settings", L"TransparencyMode", L"0", buffer, 32, g_iniPath.c_str());
-    int modeValue = _wtoi(buffer);
-    if (modeValue < 0 || modeValue > 2)
-    {
-        modeValue = 0;
-    }
-    g_transparencyMode = static_cast<TransparencyMode>(modeValue);
-
-    GetPrivateProfileStringW(L"Settings", L"TransparencyColor", L"0", buffer, 32, g_iniPath.c_str());
-    g_customColor = static_cast<COLORREF>(_wtoi(buffer));
-
-    std::wstring windowPositionModeValue;
-    if (!TryReadIniValueUtf8Aware(g_iniPath, L"Window", L"PositionMode", windowPositionModeValue))
-    {
-        GetPrivateProfileStringW(L"Window", L"PositionMode", L"0", buffer, 32, g_iniPath.c_str());
-        windowPositionModeValue = buffer;
-    }
-    int windowPositionMode = _wtoi(windowPositionModeValue.c_str());
-    if (windowPositionMode < 0 || windowPositionMode > 2)
-    {
-        windowPositionMode = 0;
-    }
-    g_windowPositionMode = static_cast<WindowPositionMode>(windowPositionMode);
-
-    std::wstring customXValue;
-    if (!TryReadIniValueUtf8Aware(g_iniPath, L"Window", L"CustomX", customXValue))
-    {
-        GetPrivateProfileStringW(L"Window", L"CustomX", L"0", buffer, 32, g_iniPath.c_str());
-        customXValue = buffer;
-    }
-    g_customWindowPos.x = _wtoi(customXValue.c_str());
+    LoadSettingsStore(g_iniPath);
+    ApplyStoredSettings();
+}
 
-    std::wstring customYValue;
-    if (!TryReadIniValueUtf8Aware(g_iniPath, L"Window", L"CustomY", customYValue))
+// Applies the settings store, as LoadSettingsStore read it, and the markdown settings file.
+void ApplyStoredSettings()
+{
+    if (g_iniPath.empty())
     {
-        GetPrivateProfileStringW(L"Window", L"CustomY", L"0", buffer, 32, g_iniPath.c_str());
-        customYValue = buffer;
+        return;
     }
-    g_customWindowPos.y = _wtoi(customYValue.c_str());
 
-    std::wstring normalizedFontName;
-    bool loadedUtf8FontName = false;
-    std::string iniBytes;
-    if (ReadFileBytesRaw(g_iniPath.c_str(), iniBytes) && !iniBytes.empty())
-    {
-        std::string utf8Bytes = iniBytes;
-        if (utf8Bytes.size() >= 3
-            && static_cast<unsigned char>(utf8Bytes[0]) == 0xEF
-            && static_cast<unsigned char>(utf8Bytes[1]) == 0xBB
-            && static_cast<unsigned char>(utf8Bytes[2]) == 0xBF)
-        {
-            utf8Bytes.erase(0, 3);
-        }
-        std::wstring content;
-        if (Utf8ToWide(utf8Bytes, content))
-        {
-            std::wstring value;
-            if (TryGetIniValueFromContent(content, L"Text", L"FontName", value))
-            {
-                normalizedFontName = NormalizeFontName(value);
-                loadedUtf8FontName = !normalizedFontName.empty();
-            }
-        }
-    }
-    if (!loadedUtf8FontName)
-    {
-        GetPrivateProfileStringW(L"Text", L"FontName", g_textFontName.c_str(), buffer, static_cast<DWORD>(std::size(buffer)), g_iniPath.c_str());
-        normalizedFontName = NormalizeFontName(buffer);
-    }
-    if (!normalizedFontName.empty())
-    {
-        g_textFontName = std::move(normalizedFontName);
-    }
+    LoadSchemaSettings();
     g_textFontFaceName = TrimString(g_textFontName);
-    GetPrivateProfileStringW(L"Text", L"FontSize", L"18", buffer, 32, g_iniPath.c_str());
-    g_textFontSize = static_cast<float>(_wtof(buffer));
-    if (g_textFontSize < 8.0f)
-    {
-        g_textFontSize = 8.0f;
-    }
-    GetPrivateProfileStringW(L"Text", L"FontColor", L"15790320", buffer, 32, g_iniPath.c_str());
-    g_textColor = static_cast<COLORREF>(_wtoi(buffer));
-    GetPrivateProfileStringW(L"Text", L"BackgroundColor", L"1315860", buffer, 32, g_iniPath.c_str());
-    g_textBackground = static_cast<COLORREF>(_wtoi(buffer));
-    GetPrivateProfileStringW(L"Text", L"Wrap", L"1", buffer, 32, g_iniPath.c_str());
-    g_textWrap = (_wtoi(buffer) != 0);
-    GetPrivateProfileStringW(L"Text", L"Width", L"800", buffer, 32, g_iniPath.c_str());
-    g_textWindowWidth = static_cast<UINT>((std::max)(200, _wtoi(buffer)));
-    GetPrivateProfileStringW(L"Text", L"Height", L"600", buffer, 32, g_iniPath.c_str());
-    g_textWindowHeight = static_cast<UINT>((std::max)(200, _wtoi(buffer)));
 
     std::filesystem::path markdownPath(g_iniPath);
     markdownPath.replace_extension(L".md");
@@ -5342,20 +9365,6 @@ void LoadSettings()
             LoadTextSettingsFromMarkdown(markdownPath);
         }
     }
-    g_keyNextFile = readKeySetting(L"NextFile", 'J');
-    g_keyPrevFile = readKeySetting(L"PrevFile", 'K');
-    g_keyZoomIn = readKeySetting(L"ZoomIn", VK_OEM_PLUS);
-    g_keyZoomOut = readKeySetting(L"ZoomOut", VK_OEM_MINUS);
-    g_keyOriginalSize = readKeySetting(L"OriginalSize", '0');
-    g_keyOpenFile = readKeySetting(L"OpenFile", 'O');
-    g_keyExit = readKeySetting(L"Exit", VK_ESCAPE);
-    g_keyAlwaysOnTop = readKeySetting(L"AlwaysOnTop", 'P');
-    g_keyMinimize = readKeySetting(L"Minimize", 'M');
-    g_keyReload = readKeySetting(L"Reload", 'R');
-    g_keyScrollUp = readKeySetting(L"ScrollUp", VK_UP);
-    g_keyScrollDown = readKeySetting(L"ScrollDown", VK_DOWN);
-    g_keyScrollLeft = readKeySetting(L"ScrollLeft", VK_LEFT);
-    g_keyScrollRight = readKeySetting(L"ScrollRight", VK_RIGHT);
 }
 
 void SaveSettings()
@@ -5365,73 +9374,8 @@ void SaveSettings()
         return;
     }
 
-    wchar_t buffer[32]{};
-    _snwprintf_s(buffer, _TRUNCATE, L"%d", static_cast<int>(g_sortMode));
-    WritePrivateProfileStringW(L"Settings", L"SortMode", buffer, g_iniPath.c_str());
-
-    _snwprintf_s(buffer, _TRUNCATE, L"%d", g_sortImageOnly ? 1 : 0);
-    WritePrivateProfileStringW(L"Settings", L"SortImageOnly", buffer, g_iniPath.c_str());
-
-    _snwprintf_s(buffer, _TRUNCATE, L"%d", g_alwaysOnTop ? 1 : 0);
-    WritePrivateProfileStringW(L"Settings", L"AlwaysOnTop", buffer, g_iniPath.c_str());
-
-    _snwprintf_s(buffer, _TRUNCATE, L"%d", static_cast<int>(g_transparencyMode));
-    WritePrivateProfileStringW(L"Settings", L"TransparencyMode", buffer, g_iniPath.c_str());
-
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_customColor));
-    WritePrivateProfileStringW(L"Settings", L"TransparencyColor", buffer, g_iniPath.c_str());
-
-    _snwprintf_s(buffer, _TRUNCATE, L"%d", static_cast<int>(g_windowPositionMode));
-    SaveUtf8IniValue(g_iniPath, L"Window", L"PositionMode", buffer);
-    _snwprintf_s(buffer, _TRUNCATE, L"%d", g_customWindowPos.x);
-    SaveUtf8IniValue(g_iniPath, L"Window", L"CustomX", buffer);
-    _snwprintf_s(buffer, _TRUNCATE, L"%d", g_customWindowPos.y);
-    SaveUtf8IniValue(g_iniPath, L"Window", L"CustomY", buffer);
-
-    std::wstring fontNameToSave = GetFontFamilyNameForSave(g_textFontName);
-    WritePrivateProfileStringW(L"Text", L"FontName", fontNameToSave.c_str(), g_iniPath.c_str());
-    WritePrivateProfileStringW(L"Text", L"FontSize", nullptr, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_textColor));
-    WritePrivateProfileStringW(L"Text", L"FontColor", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_textBackground));
-    WritePrivateProfileStringW(L"Text", L"BackgroundColor", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%d", g_textWrap ? 1 : 0);
-    WritePrivateProfileStringW(L"Text", L"Wrap", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", (std::max)(200u, g_textWindowWidth));
-    WritePrivateProfileStringW(L"Text", L"Width", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", (std::max)(200u, g_textWindowHeight));
-    WritePrivateProfileStringW(L"Text", L"Height", buffer, g_iniPath.c_str());
-
-    SaveUtf8IniValue(g_iniPath, L"Text", L"FontName", fontNameToSave);
-
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyNextFile));
-    WritePrivateProfileStringW(L"KeyConfig", L"NextFile", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyPrevFile));
-    WritePrivateProfileStringW(L"KeyConfig", L"PrevFile", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyZoomIn));
-    WritePrivateProfileStringW(L"KeyConfig", L"ZoomIn", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyZoomOut));
-    WritePrivateProfileStringW(L"KeyConfig", L"ZoomOut", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyOriginalSize));
-    WritePrivateProfileStringW(L"KeyConfig", L"OriginalSize", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyOpenFile));
-    WritePrivateProfileStringW(L"KeyConfig", L"OpenFile", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyExit));
-    WritePrivateProfileStringW(L"KeyConfig", L"Exit", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyAlwaysOnTop));
-    WritePrivateProfileStringW(L"KeyConfig", L"AlwaysOnTop", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyMinimize));
-    WritePrivateProfileStringW(L"KeyConfig", L"Minimize", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyReload));
-    WritePrivateProfileStringW(L"KeyConfig", L"Reload", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyScrollUp));
-    WritePrivateProfileStringW(L"KeyConfig", L"ScrollUp", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyScrollDown));
-    WritePrivateProfileStringW(L"KeyConfig", L"ScrollDown", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyScrollLeft));
-    WritePrivateProfileStringW(L"KeyConfig", L"ScrollLeft", buffer, g_iniPath.c_str());
-    _snwprintf_s(buffer, _TRUNCATE, L"%u", static_cast<unsigned int>(g_keyScrollRight));
-    WritePrivateProfileStringW(L"KeyConfig", L"ScrollRight", buffer, g_iniPath.c_str());
+    SaveSchemaSettings();
+    FlushSettingsStore();
 }
 
 void ApplyAlwaysOnTop()
@@ -5525,26 +9469,14 @@ void LoadWindowPlacement()
     }
 
     std::wstring xValue;
-    if (!TryReadIniValueUtf8Aware(g_iniPath, L"Window", L"X", xValue))
-    {
-        wchar_t buffer[32]{};
-        GetPrivateProfileStringW(L"Window", L"X", L"", buffer, 32, g_iniPath.c_str());
-        xValue = buffer;
-    }
-    if (!xValue.empty())
+    if (TryGetSetting(L"Window", L"X", xValue) && !xValue.empty())
     {
         g_windowPos.x = _wtoi(xValue.c_str());
         g_hasSavedWindowPos = true;
     }
 
     std::wstring yValue;
-    if (!TryReadIniValueUtf8Aware(g_iniPath, L"Window", L"Y", yValue))
-    {
-        wchar_t buffer[32]{};
-        GetPrivateProfileStringW(L"Window", L"Y", L"", buffer, 32, g_iniPath.c_str());
-        yValue = buffer;
-    }
-    if (!yValue.empty())
+    if (TryGetSetting(L"Window", L"Y", yValue) && !yValue.empty())
     {
         g_windowPos.y = _wtoi(yValue.c_str());
         g_hasSavedWindowPos = true;
@@ -5564,14 +9496,9 @@ void SaveWindowPlacement()
         return;
     }
 
-    int saveX = static_cast<int>(rect.left);
-    int saveY = static_cast<int>(rect.top);
-
-    wchar_t buffer[32]{};
-    _snwprintf_s(buffer, _TRUNCATE, L"%d", saveX);
-    SaveUtf8IniValue(g_iniPath, L"Window", L"X", buffer);
-    _snwprintf_s(buffer, _TRUNCATE, L"%d", saveY);
-    SaveUtf8IniValue(g_iniPath, L"Window", L"Y", buffer);
+    SetSettingInt(L"Window", L"X", static_cast<int>(rect.left));
+    SetSettingInt(L"Window", L"Y", static_cast<int>(rect.top));
+    FlushSettingsStore();
 }
 
 void UpdateLayeredStyle(bool enable)
@@ -5589,81 +9516,106 @@ void UpdateLayeredStyle(bool enable)
     else
     {
         exStyle &= ~WS_EX_LAYERED;
+        ReleaseLayeredSurfaceCache();
     }
     SetWindowLongPtr(g_hwnd, GWL_EXSTYLE, exStyle);
 }
 
-bool UpdateLayeredWindowFromWic(HWND hwnd, float drawWidth, float drawHeight)
+void ReleaseLayeredSurfaceCache()
 {
-    if (!g_wicSourcePremultiplied || drawWidth <= 0.0f || drawHeight <= 0.0f)
+    if (g_layeredSurface.memDc)
     {
-        return false;
+        SelectObject(g_layeredSurface.memDc, g_layeredSurface.oldBitmap);
+        DeleteDC(g_layeredSurface.memDc);
     }
-
-    UINT width = static_cast<UINT>(std::max(1.0f, static_cast<float>(std::lround(drawWidth))));
-    UINT height = static_cast<UINT>(std::max(1.0f, static_cast<float>(std::lround(drawHeight))));
-
-    IWICBitmapScaler* scaler = nullptr;
-    HRESULT hr = g_wicFactory->CreateBitmapScaler(&scaler);
-    if (FAILED(hr))
+    if (g_layeredSurface.dib)
     {
-        return false;
+        DeleteObject(g_layeredSurface.dib);
     }
+    g_layeredSurface = LayeredSurfaceCache{};
+}
 
-    hr = scaler->Initialize(g_wicSourcePremultiplied, width, height, WICBitmapInterpolationModeFant);
-    if (FAILED(hr))
+bool UpdateLayeredWindowFromWic(HWND hwnd, float drawWidth, float drawHeight)
+{
+    if (!g_wicSourcePremultiplied || drawWidth <= 0.0f || drawHeight <= 0.0f)
     {
-        scaler->Release();
         return false;
     }
 
-    BITMAPINFO bmi{};
-    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-    bmi.bmiHeader.biWidth = static_cast<LONG>(width);
-    bmi.bmiHeader.biHeight = -static_cast<LONG>(height);
-    bmi.bmiHeader.biPlanes = 1;
-    bmi.bmiHeader.biBitCount = 32;
-    bmi.bmiHeader.biCompression = BI_RGB;
+    LayeredSurfaceKey key = MakeLayeredSurfaceKey(reinterpret_cast<uintptr_t>(g_wicSourcePremultiplied), drawWidth, drawHeight);
+    UINT width = key.width;
+    UINT height = key.height;
 
-    void* bits = nullptr;
     HDC screenDc = GetDC(nullptr);
     if (screenDc == nullptr)
     {
-        scaler->Release();
         return false;
     }
 
-    HBITMAP dib = CreateDIBSection(screenDc, &bmi, DIB_RGB_COLORS, &bits, nullptr, 0);
-    HDC memDc = CreateCompatibleDC(screenDc);
-    if (dib == nullptr || memDc == nullptr)
+    if (!g_layeredSurface.memDc || !IsLayeredSurfaceCached(g_layeredSurface.state, key))
     {
-        if (memDc != nullptr)
+        ReleaseLayeredSurfaceCache();
+
+        IWICBitmapScaler* scaler = nullptr;
+        HRESULT hr = g_wicFactory->CreateBitmapScaler(&scaler);
+        if (FAILED(hr))
         {
-            DeleteDC(memDc);
+            ReleaseDC(nullptr, screenDc);
+            return false;
         }
-        if (dib != nullptr)
+
+        hr = scaler->Initialize(g_wicSourcePremultiplied, width, height, WICBitmapInterpolationModeFant);
+        if (FAILED(hr))
         {
-            DeleteObject(dib);
+            scaler->Release();
+            ReleaseDC(nullptr, screenDc);
+            return false;
         }
-        ReleaseDC(nullptr, screenDc);
-        scaler->Release();
-        return false;
-    }
 
-    HGDIOBJ oldBmp = SelectObject(memDc, dib);
-    if (oldBmp == nullptr)
-    {
-        DeleteDC(memDc);
-        DeleteObject(dib);
-        ReleaseDC(nullptr, screenDc);
+        BITMAPINFO bmi{};
+        bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bmi.bmiHeader.biWidth = static_cast<LONG>(width);
+        bmi.bmiHeader.biHeight = -static_cast<LONG>(height);
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+
+        void* bits = nullptr;
+        HBITMAP dib = CreateDIBSection(screenDc, &bmi, DIB_RGB_COLORS, &bits, nullptr, 0);
+        HDC memDc = CreateCompatibleDC(screenDc);
+        HGDIOBJ oldBmp = (dib != nullptr && memDc != nullptr) ? SelectObject(memDc, dib) : nullptr;
+        if (oldBmp == nullptr)
+        {
+            if (memDc != nullptr)
+            {
+                DeleteDC(memDc);
+            }
+            if (dib != nullptr)
+            {
+                DeleteObject(dib);
+            }
+            ReleaseDC(nullptr, screenDc);
+            scaler->Release();
+            return false;
+        }
+
+        WICRect rect{ 0, 0, static_cast<INT>(width), static_cast<INT>(height) };
+        UINT stride = width * 4;
+        UINT bufferSize = stride * height;
+        hr = scaler->CopyPixels(&rect, stride, bufferSize, static_cast<BYTE*>(bits));
         scaler->Release();
-        return false;
-    }
 
-    WICRect rect{ 0, 0, static_cast<INT>(width), static_cast<INT>(height) };
-    UINT stride = width * 4;
-    UINT bufferSize = stride * height;
-    hr = scaler->CopyPixels(&rect, stride, bufferSize, static_cast<BYTE*>(bits));
+        g_layeredSurface.memDc = memDc;
+        g_layeredSurface.dib = dib;
+        g_layeredSurface.oldBitmap = oldBmp;
+        if (FAILED(hr))
+        {
+            ReleaseLayeredSurfaceCache();
+            ReleaseDC(nullptr, screenDc);
+            return false;
+        }
+        MarkLayeredSurfaceBuilt(g_layeredSurface.state, key);
+    }
 
     POINT ptSrc{ 0, 0 };
     SIZE sizeWindow{ static_cast<LONG>(width), static_cast<LONG>(height) };
@@ -5675,27 +9627,19 @@ bool UpdateLayeredWindowFromWic(HWND hwnd, float drawWidth, float drawHeight)
     blend.SourceConstantAlpha = 255;
     blend.AlphaFormat = AC_SRC_ALPHA;
 
-    bool updated = false;
-    if (SUCCEEDED(hr))
-    {
-        updated = UpdateLayeredWindow(
-            hwnd,
-            screenDc,
-            &ptDst,
-            &sizeWindow,
-            memDc,
-            &ptSrc,
-            0,
-            &blend,
-            ULW_ALPHA
-        ) == TRUE;
-    }
+    bool updated = UpdateLayeredWindow(
+        hwnd,
+        screenDc,
+        &ptDst,
+        &sizeWindow,
+        g_layeredSurface.memDc,
+        &ptSrc,
+        0,
+        &blend,
+        ULW_ALPHA
+    ) == TRUE;
 
-    SelectObject(memDc, oldBmp);
-    DeleteDC(memDc);
-    DeleteObject(dib);
     ReleaseDC(nullptr, screenDc);
-    scaler->Release();
 
     return updated;
 }
@@ -5744,22 +9688,23 @@ void Render(HWND hwnd)
             g_renderTarget->Clear(bgColor);
             if (g_textFormat && g_textBrush)
             {
-                IDWriteTextLayout* layout = nullptr;
-                g_dwriteFactory->CreateTextLayout(
-                    g_textContent.c_str(),
-                    static_cast<UINT32>(g_textContent.size()),
-                    g_textFormat,
-                    rtSize.width - 16.0f,
-                    10000.0f,
-                    &layout
-                );
-                if (layout)
+                // Only the lines intersecting the viewport are read, shaped and drawn.
+                float width = rtSize.width - 16.0f;
+                uint64_t lineCount = GetTextDocumentLineCount();
+                float y = 8.0f - g_textTopOffset;
+                for (uint64_t line = g_textTopLine; line < lineCount && y < rtSize.height; ++line)
                 {
+                    IDWriteTextLayout* layout = CreateTextLineLayout(line, width);
+                    if (!layout)
+                    {
+                        break;
+                    }
                     g_renderTarget->DrawTextLayout(
-                        D2D1::Point2F(8.0f, 8.0f - g_textScroll),
+                        D2D1::Point2F(8.0f, y),
                         layout,
                         g_textBrush
                     );
+                    y += RememberTextLineHeight(line, width, layout);
                     layout->Release();
                 }
             }
@@ -5786,7 +9731,7 @@ void Render(HWND hwnd)
 
         UpdateWindowSizeToImage(hwnd, canvasDrawWidth, canvasDrawHeight);
 
-        if (g_imageHasAlpha && g_transparencyMode == TransparencyMode::Transparent && !g_animationPlaying)
+        if (g_imageHasAlpha && g_transparencyMode == TransparencyMode::Transparent && !g_animationPlayback.playing)
         {
             UpdateLayeredWindowFromWic(hwnd, canvasDrawWidth, canvasDrawHeight);
             return;
@@ -5808,21 +9753,12 @@ void Render(HWND hwnd)
 
         g_renderTarget->Clear(D2D1::ColorF(D2D1::ColorF::Black));
         if (g_imageHasAlpha && g_transparencyMode == TransparencyMode::Checkerboard
-            && g_checkerBrushA && g_checkerBrushB)
+            && EnsureCheckerPatternBrush())
         {
-            const float cellSize = 16.0f;
-            for (float y = 0.0f; y < canvasDrawHeight; y += cellSize)
-            {
-                for (float x = 0.0f; x < canvasDrawWidth; x += cellSize)
-                {
-                    bool evenCell = (static_cast<int>(x / cellSize) + static_cast<int>(y / cellSize)) % 2 == 0;
-                    ID2D1SolidColorBrush* brush = evenCell ? g_checkerBrushA : g_checkerBrushB;
-                    g_renderTarget->FillRectangle(
-                        D2D1::RectF(x, y, x + cellSize, y + cellSize),
-                        brush
-                    );
-                }
-            }
+            g_renderTarget->FillRectangle(
+                D2D1::RectF(0.0f, 0.0f, canvasDrawWidth, canvasDrawHeight),
+                g_checkerPatternBrush
+            );
         }
         else if (g_imageHasAlpha && g_transparencyMode == TransparencyMode::SolidColor && g_customColorBrush)
         {
@@ -5864,6 +9800,10 @@ void Render(HWND hwnd)
             rtSize.height
         );
 
+        if (!g_placeholderFormat && !g_startupContentPending)
+        {
+            EnsureDirectWrite();
+        }
         if (g_placeholderBrush && g_placeholderFormat)
         {
             g_renderTarget->DrawTextW(
@@ -5883,6 +9823,88 @@ void Render(HWND hwnd)
     }
 }
 
+// =====================
+// 起動トレース
+// =====================
+void BeginStartupTrace()
+{
+    BeginStartupTrace(g_startupTrace, std::chrono::steady_clock::now());
+}
+
+// Records that the named step has just finished. Callable from any thread.
+void MarkStartupPhase(const wchar_t* name)
+{
+    MarkStartupPhase(g_startupTrace, name, std::chrono::steady_clock::now());
+}
+
+// Called after every paint; once startup has finished, the first paint closes the trace. The
+// report goes to the debugger, and to a .startup.log file beside the ini when the
+// FLOATVISION_STARTUP_TRACE environment variable is set.
+void ReportStartupTrace()
+{
+    StartupTrace& trace = g_startupTrace;
+    if (!trace.finished || trace.reported)
+    {
+        return;
+    }
+    MarkStartupPhase(L"First paint");
+    std::wstring report = FormatStartupReport(trace);
+    OutputDebugStringW(report.c_str());
+
+    if (GetEnvironmentVariableW(L"FLOATVISION_STARTUP_TRACE", nullptr, 0) > 0)
+    {
+        std::filesystem::path logPath = GetSettingsSidePath(L".startup.log");
+        std::string bytes;
+        if (!logPath.empty() && WideToUtf8(report, bytes))
+        {
+            WriteFileAtomically(logPath, bytes.data(), bytes.size());
+        }
+    }
+}
+
+// Runs as a startup task while the window and Direct2D are set up. Reads the image named on
+// the command line into the system cache and opens a WIC decoder on it, so the codec is already
+// loaded when the UI thread decodes the image.
+void WarmUpStartupImage(std::filesystem::path path)
+{
+    HANDLE file = CreateFileW(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN,
+        nullptr
+    );
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        std::vector<BYTE> chunk(kStartupReadAheadChunkBytes);
+        uint64_t remaining = kStartupReadAheadMaxBytes;
+        DWORD read = 0;
+        while (remaining > 0 && ReadFile(file, chunk.data(), static_cast<DWORD>(chunk.size()), &read, nullptr) && read > 0)
+        {
+            remaining -= (std::min)(remaining, static_cast<uint64_t>(read));
+        }
+        CloseHandle(file);
+    }
+
+    bool comInitialized = SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+    IWICImagingFactory* factory = nullptr;
+    if (SUCCEEDED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory))))
+    {
+        IWICBitmapDecoder* decoder = nullptr;
+        if (SUCCEEDED(factory->CreateDecoderFromFilename(path.c_str(), nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder)))
+        {
+            decoder->Release();
+        }
+        factory->Release();
+    }
+    if (comInitialized)
+    {
+        CoUninitialize();
+    }
+}
+
 // =====================
 // エントリポイント
 // =====================
@@ -5893,6 +9915,7 @@ int WINAPI wWinMain(
     _In_ int nCmdShow
 )
 {
+    BeginStartupTrace();
     SetProcessDPIAware();
     HRESULT coInitResult = CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED);
     if (FAILED(coInitResult) && coInitResult != RPC_E_CHANGED_MODE)
@@ -5900,11 +9923,46 @@ int WINAPI wWinMain(
         return 0;
     }
     bool shouldCoUninitialize = (coInitResult != RPC_E_CHANGED_MODE);
+    MarkStartupPhase(L"COM");
+
+    {
+        wchar_t modulePath[MAX_PATH]{};
+        if (GetModuleFileNameW(nullptr, modulePath, MAX_PATH) > 0)
+        {
+            std::filesystem::path iniPath(modulePath);
+            iniPath.replace_extension(L".ini");
+            g_iniPath = iniPath.wstring();
+        }
+    }
+    int argc = 0;
+    wchar_t** argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+
+    // Reading the ini and the image to open only touch files, so they run while the window and
+    // Direct2D are set up.
+    StartupTasks startupTasks;
+    size_t settingsTask = kNoStartupTask;
+    if (!g_iniPath.empty())
+    {
+        settingsTask = RunStartupTask(startupTasks, g_startupTrace, L"Settings read", [path = std::filesystem::path(g_iniPath)]()
+        {
+            LoadSettingsStore(path);
+        });
+    }
+    size_t imageTask = kNoStartupTask;
+    if (argv && argc > 1 && IsImageFile(argv[1]))
+    {
+        imageTask = RunStartupTask(startupTasks, g_startupTrace, L"Image read-ahead", [path = std::filesystem::path(argv[1])]()
+        {
+            WarmUpStartupImage(path);
+        });
+    }
+
     INITCOMMONCONTROLSEX icc{};
     icc.dwSize = sizeof(icc);
     icc.dwICC = ICC_WIN95_CLASSES;
     InitCommonControlsEx(&icc);
     InitializeThemeMode();
+    MarkStartupPhase(L"Common controls and theme");
 
     const wchar_t CLASS_NAME[] = L"FloatVisionWindow";
 
@@ -5931,22 +9989,13 @@ int WINAPI wWinMain(
         nullptr
     );
     g_hwnd = hwnd;
-    if (g_hwnd)
-    {
-        wchar_t modulePath[MAX_PATH]{};
-        if (GetModuleFileNameW(nullptr, modulePath, MAX_PATH) > 0)
-        {
-            std::filesystem::path iniPath(modulePath);
-            iniPath.replace_extension(L".ini");
-            g_iniPath = iniPath.wstring();
-        }
-    }
 
     if (!hwnd)
     {
         MessageBox(nullptr, L"CreateWindowEx failed", L"Error", MB_OK);
         return 0;
     }
+    MarkStartupPhase(L"Window created");
 
     DragAcceptFiles(hwnd, TRUE);
 
@@ -5955,25 +10004,23 @@ int WINAPI wWinMain(
         MessageBox(nullptr, L"WIC init failed", L"Error", MB_OK);
         return 0;
     }
+    MarkStartupPhase(L"WIC");
 
-    if (!InitDirectWrite())
-    {
-        MessageBox(nullptr, L"DirectWrite init failed", L"Error", MB_OK);
-        return 0;
-    }
-
+    // DirectWrite is left to EnsureDirectWrite, once there is text to draw.
     if (!InitDirect2D(hwnd))
     {
         MessageBox(hwnd, L"Direct2D init failed", L"Error", MB_OK);
         return 0;
     }
+    MarkStartupPhase(L"Direct2D");
 
-    LoadSettings();
+    WaitStartupTask(startupTasks, settingsTask);
+    ApplyStoredSettings();
     LoadWindowPlacement();
     ApplyAlwaysOnTop();
     ApplyTransparencyMode();
-    UpdateTextFormat();
     UpdateTextBrush();
+    MarkStartupPhase(L"Settings applied");
     POINT startupPos{ CW_USEDEFAULT, CW_USEDEFAULT };
     bool shouldApplyWindowPos = false;
     if (g_windowPositionMode == WindowPositionMode::Previous)
@@ -6007,15 +10054,34 @@ int WINAPI wWinMain(
         );
     }
 
+    g_startupContentPending = argv && argc > 1;
     ShowWindow(hwnd, nCmdShow);
     UpdateWindow(hwnd);
+    MarkStartupPhase(L"Window shown");
 
-    int argc = 0;
-    wchar_t** argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    WaitStartupTask(startupTasks, imageTask);
     bool loadedImage = false;
     if (argv && argc > 1)
     {
-        if (IsMarkdownFile(argv[1]))
+        std::vector<std::filesystem::path> folders;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::error_code ec;
+            if (std::filesystem::is_directory(argv[i], ec))
+            {
+                folders.emplace_back(argv[i]);
+            }
+        }
+        if (!folders.empty())
+        {
+            // Until the walk finds a file the placeholder is shown; the first one found is loaded.
+            loadedImage = OpenPlaylist(folders) && !g_currentImagePath.empty();
+        }
+        else if (IsArchiveFile(argv[1]))
+        {
+            loadedImage = OpenArchiveCatalog(argv[1]) && LoadImageByIndex(0);
+        }
+        else if (IsMarkdownFile(argv[1]))
         {
             loadedImage = LoadMarkdownFromFile(argv[1]);
             if (loadedImage)
@@ -6053,6 +10119,7 @@ int WINAPI wWinMain(
     {
         LocalFree(argv);
     }
+    g_startupContentPending = false;
     if (!loadedImage)
     {
         bool loadedSkin = false;
@@ -6089,8 +10156,10 @@ int WINAPI wWinMain(
     }
 
     ApplyWindowPositionModeAfterContentLoad(hwnd);
+    MarkStartupPhase(L"Content loaded");
 
     InvalidateRect(hwnd, nullptr, TRUE);
+    g_startupTrace.finished = true;
 
     MSG msg{};
     while (GetMessage(&msg, nullptr, 0, 0))
@@ -0,0 +1,3690 @@
+﻿#include "FloatVisionCore.h"
+#include "md4c-html.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cwctype>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// =====================
+// 並べ替えキー
+// =====================
+
+// Case-folded name in which every run of ASCII digits becomes '0', its significant digit count,
+// the significant digits and its leading zero count. Comparing keys ordinally then puts "img2"
+// before "img10" the way Explorer does.
+std::wstring MakeNaturalSortKey(std::wstring_view name)
+{
+    std::wstring folded(name);
+    FoldCaseText(folded);
+    std::wstring key;
+    key.reserve(folded.size() + 8);
+    for (size_t i = 0; i < folded.size();)
+    {
+        if (folded[i] < L'0' || folded[i] > L'9')
+        {
+            key.push_back(folded[i++]);
+            continue;
+        }
+        size_t runStart = i;
+        while (i < folded.size() && folded[i] == L'0')
+        {
+            ++i;
+        }
+        size_t digitsStart = i;
+        while (i < folded.size() && folded[i] >= L'0' && folded[i] <= L'9')
+        {
+            ++i;
+        }
+        key.push_back(L'0');
+        key.push_back(static_cast<wchar_t>((std::min)(i - digitsStart, static_cast<size_t>(0xFFFF))));
+        key.append(folded, digitsStart, i - digitsStart);
+        key.push_back(static_cast<wchar_t>((std::min)(digitsStart - runStart, static_cast<size_t>(0xFFFF))));
+    }
+    return key;
+}
+
+bool IsDescendingSortMode(SortMode mode)
+{
+    return mode == SortMode::NameDesc || mode == SortMode::TimeDesc;
+}
+
+bool IsMetadataSortMode(SortMode mode)
+{
+    return mode == SortMode::DimensionsAsc || mode == SortMode::DateTakenAsc;
+}
+
+bool CatalogKeyPrecedes(SortMode mode, uint64_t primaryA, const std::wstring& nameA, uint64_t primaryB, const std::wstring& nameB)
+{
+    if (IsDescendingSortMode(mode))
+    {
+        std::swap(primaryA, primaryB);
+        return primaryA != primaryB ? primaryA < primaryB : nameB < nameA;
+    }
+    return primaryA != primaryB ? primaryA < primaryB : nameA < nameB;
+}
+
+size_t GetCatalogChunkCount(size_t count, size_t minChunk)
+{
+    size_t workerCount = (std::max)(1u, std::thread::hardware_concurrency());
+    return (std::max)(static_cast<size_t>(1), (std::min)(workerCount, count / minChunk));
+}
+
+void ClearCatalogOrder(CatalogOrder& order)
+{
+    order.ids.clear();
+    order.sortPrimary.clear();
+    order.sortNames.clear();
+    order.idByName.clear();
+    order.positionById.assign(1, kNoCatalogEntry);
+}
+
+bool CatalogPositionPrecedes(const CatalogOrder& order, size_t a, size_t b)
+{
+    return CatalogKeyPrecedes(order.sortMode, order.sortPrimary[a], order.sortNames[a], order.sortPrimary[b], order.sortNames[b]);
+}
+
+// Stable-sorts permutation[first, last) by the key columns; large ranges are sorted in chunks on
+// all cores and the sorted runs merged pairwise, which keeps equal keys in permutation order.
+void SortCatalogPermutation(const CatalogOrder& order, std::vector<uint32_t>& permutation, size_t first, size_t last)
+{
+    auto precedes = [&](uint32_t a, uint32_t b)
+    {
+        return CatalogPositionPrecedes(order, a, b);
+    };
+    size_t count = last - first;
+    size_t chunkCount = GetCatalogChunkCount(count, kCatalogSortChunkEntries);
+    auto chunkStart = [&](size_t chunk)
+    {
+        return permutation.begin() + first + count * chunk / chunkCount;
+    };
+    RunCatalogChunks(chunkCount, [&](size_t chunk)
+    {
+        std::stable_sort(chunkStart(chunk), chunkStart(chunk + 1), precedes);
+    });
+    for (size_t width = 1; width < chunkCount; width *= 2)
+    {
+        size_t pairs = (chunkCount + 2 * width - 1) / (2 * width);
+        RunCatalogChunks(pairs, [&](size_t pair)
+        {
+            size_t begin = pair * 2 * width;
+            size_t middle = (std::min)(begin + width, chunkCount);
+            size_t end = (std::min)(begin + 2 * width, chunkCount);
+            std::inplace_merge(chunkStart(begin), chunkStart(middle), chunkStart(end), precedes);
+        });
+    }
+}
+
+// The positions in display order when the first sortedCount are already in order and the rest
+// were appended: the appended run is sorted on its own and merged in. Equal keys keep their
+// position order, so entries already listed stay in front of equal newcomers.
+std::vector<uint32_t> MakeCatalogPermutation(const CatalogOrder& order, size_t sortedCount)
+{
+    size_t count = order.ids.size();
+    std::vector<uint32_t> permutation(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        permutation[i] = static_cast<uint32_t>(i);
+    }
+    SortCatalogPermutation(order, permutation, sortedCount, count);
+    std::inplace_merge(permutation.begin(), permutation.begin() + sortedCount, permutation.end(), [&](uint32_t a, uint32_t b)
+    {
+        return CatalogPositionPrecedes(order, a, b);
+    });
+    return permutation;
+}
+
+// Moves ids and keys into the given order at once; the host moves its entries the same way.
+void PermuteCatalogOrder(CatalogOrder& order, const std::vector<uint32_t>& permutation)
+{
+    std::vector<uint32_t> ids;
+    std::vector<uint64_t> sortPrimary;
+    std::vector<std::wstring> sortNames;
+    ids.reserve(permutation.size());
+    sortPrimary.reserve(permutation.size());
+    sortNames.reserve(permutation.size());
+    for (uint32_t index : permutation)
+    {
+        ids.push_back(order.ids[index]);
+        sortPrimary.push_back(order.sortPrimary[index]);
+        sortNames.push_back(std::move(order.sortNames[index]));
+    }
+    order.ids.swap(ids);
+    order.sortPrimary.swap(sortPrimary);
+    order.sortNames.swap(sortNames);
+    RenumberCatalogOrder(order, 0);
+}
+
+// Positions shift on every insert and erase; ids do not, so only the position table is rewritten.
+void RenumberCatalogOrder(CatalogOrder& order, size_t first)
+{
+    for (size_t i = first; i < order.ids.size(); ++i)
+    {
+        order.positionById[order.ids[i]] = i;
+    }
+}
+
+size_t FindCatalogPosition(const CatalogOrder& order, const std::wstring& foldedName)
+{
+    auto it = order.idByName.find(foldedName);
+    if (it == order.idByName.end())
+    {
+        return kNoCatalogEntry;
+    }
+    return order.positionById[it->second];
+}
+
+// Where an entry with this key goes: after every entry that does not sort after it, so an entry
+// added later lands behind equal ones.
+size_t FindCatalogInsertPosition(const CatalogOrder& order, uint64_t primary, const std::wstring& sortName)
+{
+    size_t low = 0;
+    size_t high = order.ids.size();
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (CatalogKeyPrecedes(order.sortMode, primary, sortName, order.sortPrimary[middle], order.sortNames[middle]))
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+// id must already have a slot in positionById.
+void InsertCatalogPosition(CatalogOrder& order, size_t position, uint32_t id, std::wstring foldedName, uint64_t primary, std::wstring sortName)
+{
+    order.ids.insert(order.ids.begin() + position, id);
+    order.sortPrimary.insert(order.sortPrimary.begin() + position, primary);
+    order.sortNames.insert(order.sortNames.begin() + position, std::move(sortName));
+    order.idByName[std::move(foldedName)] = id;
+    RenumberCatalogOrder(order, position);
+}
+
+// Removes the entry named foldedName and returns the position it held, which the host erases
+// from its entries as well, and its id; kNoCatalogEntry and an id of 0 when it is not listed.
+size_t RemoveCatalogPosition(CatalogOrder& order, const std::wstring& foldedName, uint32_t& id)
+{
+    id = 0;
+    auto it = order.idByName.find(foldedName);
+    if (it == order.idByName.end())
+    {
+        return kNoCatalogEntry;
+    }
+    id = it->second;
+    size_t position = order.positionById[id];
+    order.idByName.erase(it);
+    order.positionById[id] = kNoCatalogEntry;
+    order.ids.erase(order.ids.begin() + position);
+    order.sortPrimary.erase(order.sortPrimary.begin() + position);
+    order.sortNames.erase(order.sortNames.begin() + position);
+    RenumberCatalogOrder(order, position);
+    return position;
+}
+
+// Whether the key at position, rewritten in place, still sorts between its neighbours.
+bool IsCatalogPositionInOrder(const CatalogOrder& order, size_t position)
+{
+    return (position == 0 || !CatalogPositionPrecedes(order, position, position - 1))
+        && (position + 1 == order.ids.size() || !CatalogPositionPrecedes(order, position + 1, position));
+}
+
+// =====================
+// アーカイブ (ZIP/CBZ)
+// =====================
+uint16_t ReadLe16(const uint8_t* data)
+{
+    return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t ReadLe32(const uint8_t* data)
+{
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8)
+        | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+uint64_t ReadLe64(const uint8_t* data)
+{
+    return static_cast<uint64_t>(ReadLe32(data)) | (static_cast<uint64_t>(ReadLe32(data + 4)) << 32);
+}
+
+constexpr std::array<uint32_t, 256> kCrc32Table = []()
+{
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+uint32_t ComputeCrc32(const uint8_t* data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = kCrc32Table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Canonical Huffman code for one DEFLATE alphabet. fast is indexed by the next kInflateFastBits
+// input bits and holds symbol << 4 | length, or 0 when the code is longer and has to be walked
+// bit by bit through counts and symbols.
+struct InflateHuffman
+{
+    uint16_t counts[16];
+    uint16_t symbols[288];
+    uint16_t fast[1 << kInflateFastBits];
+};
+
+bool BuildInflateHuffman(InflateHuffman& huffman, const uint8_t* lengths, int count)
+{
+    std::fill(std::begin(huffman.counts), std::end(huffman.counts), static_cast<uint16_t>(0));
+    for (int symbol = 0; symbol < count; ++symbol)
+    {
+        ++huffman.counts[lengths[symbol]];
+    }
+    huffman.counts[0] = 0;
+    int left = 1;
+    for (int length = 1; length < 16; ++length)
+    {
+        left = (left << 1) - huffman.counts[length];
+        if (left < 0)
+        {
+            return false;
+        }
+    }
+
+    uint16_t offsets[16]{};
+    for (int length = 1; length < 15; ++length)
+    {
+        offsets[length + 1] = static_cast<uint16_t>(offsets[length] + huffman.counts[length]);
+    }
+    for (int symbol = 0; symbol < count; ++symbol)
+    {
+        if (lengths[symbol] != 0)
+        {
+            huffman.symbols[offsets[lengths[symbol]]++] = static_cast<uint16_t>(symbol);
+        }
+    }
+
+    std::fill(std::begin(huffman.fast), std::end(huffman.fast), static_cast<uint16_t>(0));
+    uint32_t code = 0;
+    int index = 0;
+    for (int length = 1; length <= kInflateFastBits; ++length)
+    {
+        for (int i = 0; i < huffman.counts[length]; ++i, ++code)
+        {
+            // DEFLATE sends codes most significant bit first; the bit buffer is read LSB first.
+            uint32_t reversed = 0;
+            for (int bit = 0; bit < length; ++bit)
+            {
+                reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+            }
+            uint16_t entry = static_cast<uint16_t>((huffman.symbols[index++] << 4) | length);
+            for (uint32_t fill = reversed; fill < (1u << kInflateFastBits); fill += 1u << length)
+            {
+                huffman.fast[fill] = entry;
+            }
+        }
+        code <<= 1;
+    }
+    return true;
+}
+
+// Raw DEFLATE (RFC 1951) into a buffer of the exact size the ZIP directory recorded. Past the
+// end of the input the bit buffer is fed zeros and the overrun is caught when a block ends.
+struct InflateState
+{
+    const uint8_t* input = nullptr;
+    size_t inputSize = 0;
+    size_t inputPos = 0;
+    uint64_t bitBuffer = 0;
+    int bitCount = 0;
+    uint8_t* output = nullptr;
+    size_t outputSize = 0;
+    size_t outputPos = 0;
+};
+
+void RefillInflateBits(InflateState& state)
+{
+    while (state.bitCount <= 56)
+    {
+        uint64_t byte = state.inputPos < state.inputSize ? state.input[state.inputPos] : 0;
+        ++state.inputPos;
+        state.bitBuffer |= byte << state.bitCount;
+        state.bitCount += 8;
+    }
+}
+
+uint32_t TakeInflateBits(InflateState& state, int count)
+{
+    if (state.bitCount < count)
+    {
+        RefillInflateBits(state);
+    }
+    uint32_t value = static_cast<uint32_t>(state.bitBuffer & ((1ull << count) - 1));
+    state.bitBuffer >>= count;
+    state.bitCount -= count;
+    return value;
+}
+
+bool InflateOverran(const InflateState& state)
+{
+    return (state.inputPos * 8 - state.bitCount) > state.inputSize * 8;
+}
+
+int DecodeInflateSymbol(InflateState& state, const InflateHuffman& huffman)
+{
+    if (state.bitCount < 15)
+    {
+        RefillInflateBits(state);
+    }
+    uint16_t entry = huffman.fast[state.bitBuffer & ((1u << kInflateFastBits) - 1)];
+    if (entry != 0)
+    {
+        state.bitBuffer >>= entry & 15;
+        state.bitCount -= entry & 15;
+        return entry >> 4;
+    }
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int length = 1; length < 16; ++length)
+    {
+        code |= static_cast<int>(TakeInflateBits(state, 1));
+        int count = huffman.counts[length];
+        if (code - count < first)
+        {
+            return huffman.symbols[index + (code - first)];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+bool InflateCodes(InflateState& state, const InflateHuffman& literals, const InflateHuffman& distances)
+{
+    static constexpr uint16_t kLengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static constexpr uint8_t kLengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static constexpr uint16_t kDistanceBase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+        4097, 6145, 8193, 12289, 16385, 24577 };
+    static constexpr uint8_t kDistanceExtra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    for (;;)
+    {
+        int symbol = DecodeInflateSymbol(state, literals);
+        if (symbol < 0)
+        {
+            return false;
+        }
+        if (symbol < 256)
+        {
+            if (state.outputPos >= state.outputSize)
+            {
+                return false;
+            }
+            state.output[state.outputPos++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+        if (symbol == 256)
+        {
+            return !InflateOverran(state);
+        }
+
+        symbol -= 257;
+        if (symbol >= 29)
+        {
+            return false;
+        }
+        size_t length = kLengthBase[symbol] + TakeInflateBits(state, kLengthExtra[symbol]);
+        int distanceSymbol = DecodeInflateSymbol(state, distances);
+        if (distanceSymbol < 0 || distanceSymbol >= 30)
+        {
+            return false;
+        }
+        size_t distance = kDistanceBase[distanceSymbol] + TakeInflateBits(state, kDistanceExtra[distanceSymbol]);
+        if (distance > state.outputPos || length > state.outputSize - state.outputPos)
+        {
+            return false;
+        }
+        uint8_t* to = state.output + state.outputPos;
+        const uint8_t* from = to - distance;
+        if (distance >= length)
+        {
+            memcpy(to, from, length);
+        }
+        else
+        {
+            // Overlapping copy repeats the last distance bytes.
+            for (size_t i = 0; i < length; ++i)
+            {
+                to[i] = from[i];
+            }
+        }
+        state.outputPos += length;
+    }
+}
+
+bool InflateRaw(const uint8_t* input, size_t inputSize, uint8_t* output, size_t outputSize)
+{
+    InflateState state;
+    state.input = input;
+    state.inputSize = inputSize;
+    state.output = output;
+    state.outputSize = outputSize;
+    auto literals = std::make_unique<InflateHuffman>();
+    auto distances = std::make_unique<InflateHuffman>();
+
+    bool last = false;
+    while (!last)
+    {
+        last = TakeInflateBits(state, 1) != 0;
+        uint32_t type = TakeInflateBits(state, 2);
+        if (type == 0)
+        {
+            // Stored block: drop to the byte boundary, then LEN and its complement.
+            TakeInflateBits(state, state.bitCount & 7);
+            uint32_t length = TakeInflateBits(state, 16);
+            uint32_t complement = TakeInflateBits(state, 16);
+            if (length != (~complement & 0xFFFF) || InflateOverran(state))
+            {
+                return false;
+            }
+            // Whole bytes still in the bit buffer come first.
+            while (length > 0 && state.bitCount >= 8)
+            {
+                if (state.outputPos >= state.outputSize)
+                {
+                    return false;
+                }
+                state.output[state.outputPos++] = static_cast<uint8_t>(TakeInflateBits(state, 8));
+                --length;
+            }
+            size_t bytePos = state.inputPos - state.bitCount / 8;
+            if (length > state.inputSize - (std::min)(bytePos, state.inputSize)
+                || length > state.outputSize - state.outputPos)
+            {
+                return false;
+            }
+            memcpy(state.output + state.outputPos, state.input + bytePos, length);
+            state.outputPos += length;
+            state.inputPos = bytePos + length;
+            state.bitBuffer = 0;
+            state.bitCount = 0;
+            continue;
+        }
+
+        uint8_t lengths[320]{};
+        if (type == 1)
+        {
+            for (int i = 0; i < 288; ++i)
+            {
+                lengths[i] = static_cast<uint8_t>(i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+            }
+            std::fill(lengths + 288, lengths + 288 + 30, static_cast<uint8_t>(5));
+            if (!BuildInflateHuffman(*literals, lengths, 288) || !BuildInflateHuffman(*distances, lengths + 288, 30))
+            {
+                return false;
+            }
+        }
+        else if (type == 2)
+        {
+            static constexpr uint8_t kCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+            int literalCount = static_cast<int>(TakeInflateBits(state, 5)) + 257;
+            int distanceCount = static_cast<int>(TakeInflateBits(state, 5)) + 1;
+            int codeLengthCount = static_cast<int>(TakeInflateBits(state, 4)) + 4;
+            if (literalCount > 286 || distanceCount > 30)
+            {
+                return false;
+            }
+            uint8_t codeLengths[19]{};
+            for (int i = 0; i < codeLengthCount; ++i)
+            {
+                codeLengths[kCodeLengthOrder[i]] = static_cast<uint8_t>(TakeInflateBits(state, 3));
+            }
+            if (!BuildInflateHuffman(*literals, codeLengths, 19))
+            {
+                return false;
+            }
+            int total = literalCount + distanceCount;
+            for (int i = 0; i < total;)
+            {
+                int symbol = DecodeInflateSymbol(state, *literals);
+                if (symbol < 0)
+                {
+                    return false;
+                }
+                if (symbol < 16)
+                {
+                    lengths[i++] = static_cast<uint8_t>(symbol);
+                    continue;
+                }
+                uint8_t value = 0;
+                int repeat = 0;
+                if (symbol == 16)
+                {
+                    if (i == 0)
+                    {
+                        return false;
+                    }
+                    value = lengths[i - 1];
+                    repeat = 3 + static_cast<int>(TakeInflateBits(state, 2));
+                }
+                else if (symbol == 17)
+                {
+                    repeat = 3 + static_cast<int>(TakeInflateBits(state, 3));
+                }
+                else
+                {
+                    repeat = 11 + static_cast<int>(TakeInflateBits(state, 7));
+                }
+                if (i + repeat > total)
+                {
+                    return false;
+                }
+                std::fill(lengths + i, lengths + i + repeat, value);
+                i += repeat;
+            }
+            if (lengths[256] == 0
+                || !BuildInflateHuffman(*literals, lengths, literalCount)
+                || !BuildInflateHuffman(*distances, lengths + literalCount, distanceCount))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+        if (!InflateCodes(state, *literals, *distances))
+        {
+            return false;
+        }
+    }
+    return state.outputPos == state.outputSize && !InflateOverran(state);
+}
+
+
+// Finds the end of central directory record in the last kZipEndSearchBytes of the archive,
+// scanning back past a trailing comment, and notes a ZIP64 locator in front of it.
+bool FindZipDirectory(const uint8_t* tail, size_t tailSize, ZipDirectoryRange& range)
+{
+    if (tailSize < kZipEndRecordSize)
+    {
+        return false;
+    }
+    const uint8_t* end = nullptr;
+    for (size_t pos = tailSize - kZipEndRecordSize + 1; pos-- > 0;)
+    {
+        if (ReadLe32(tail + pos) == 0x06054B50
+            && pos + kZipEndRecordSize + ReadLe16(tail + pos + 20) <= tailSize)
+        {
+            end = tail + pos;
+            break;
+        }
+    }
+    if (!end)
+    {
+        return false;
+    }
+    range.entryCount = ReadLe16(end + 10);
+    range.size = ReadLe32(end + 12);
+    range.offset = ReadLe32(end + 16);
+    size_t endPos = static_cast<size_t>(end - tail);
+    range.zip64 = endPos >= 20 && ReadLe32(end - 20) == 0x07064B50;
+    range.zip64EndOffset = range.zip64 ? ReadLe64(end - 20 + 8) : 0;
+    return true;
+}
+
+// Takes the directory's place from the ZIP64 end record; a record without its signature is
+// ignored and the end record's values stand.
+void ReadZip64EndRecord(const uint8_t* record, size_t size, ZipDirectoryRange& range)
+{
+    if (size < kZip64EndRecordSize || ReadLe32(record) != 0x06064B50)
+    {
+        return;
+    }
+    range.entryCount = ReadLe64(record + 32);
+    range.size = ReadLe64(record + 40);
+    range.offset = ReadLe64(record + 48);
+}
+
+// Indexes the central directory (ZIP64 aware). Only stored and deflated, unencrypted files are
+// listed; names are made relative with '\' separators, and a name with a "." or ".." component
+// is dropped, so they can never leave the archive path.
+void ParseZipCentralDirectory(const uint8_t* data, size_t size, uint64_t entryCount, std::vector<ZipMember>& members)
+{
+    members.reserve(static_cast<size_t>((std::min)(entryCount, static_cast<uint64_t>(size / kZipCentralHeaderSize))));
+    size_t pos = 0;
+    while (pos + kZipCentralHeaderSize <= size && ReadLe32(data + pos) == 0x02014B50)
+    {
+        const uint8_t* header = data + pos;
+        uint16_t flags = ReadLe16(header + 8);
+        uint16_t method = ReadLe16(header + 10);
+        size_t nameLength = ReadLe16(header + 28);
+        size_t extraLength = ReadLe16(header + 30);
+        size_t commentLength = ReadLe16(header + 32);
+        size_t recordLength = kZipCentralHeaderSize + nameLength + extraLength + commentLength;
+        if (pos + recordLength > size)
+        {
+            break;
+        }
+        pos += recordLength;
+
+        ZipMember member;
+        member.method = method;
+        member.crc = ReadLe32(header + 16);
+        member.compressedSize = ReadLe32(header + 20);
+        member.size = ReadLe32(header + 24);
+        member.localHeaderOffset = ReadLe32(header + 42);
+        member.dosTime = ReadLe16(header + 12);
+        member.dosDate = ReadLe16(header + 14);
+
+        const uint8_t* extra = header + kZipCentralHeaderSize + nameLength;
+        for (size_t field = 0; field + 4 <= extraLength;)
+        {
+            uint16_t id = ReadLe16(extra + field);
+            size_t fieldLength = ReadLe16(extra + field + 2);
+            if (field + 4 + fieldLength > extraLength)
+            {
+                break;
+            }
+            if (id == 0x0001)
+            {
+                // ZIP64 values appear in this order, only for the fields that overflowed.
+                const uint8_t* value = extra + field + 4;
+                const uint8_t* valueEnd = value + fieldLength;
+                uint64_t* targets[] = { &member.size, &member.compressedSize, &member.localHeaderOffset };
+                for (uint64_t* target : targets)
+                {
+                    if (*target == 0xFFFFFFFFu && value + 8 <= valueEnd)
+                    {
+                        *target = ReadLe64(value);
+                        value += 8;
+                    }
+                }
+            }
+            field += 4 + fieldLength;
+        }
+
+        if ((flags & 1) != 0 || (method != 0 && method != 8) || nameLength == 0)
+        {
+            continue;
+        }
+        std::string_view rawName(reinterpret_cast<const char*>(header + kZipCentralHeaderSize), nameLength);
+        std::wstring name;
+        if (!DecodeZipName(rawName, (flags & 0x0800) != 0, name))
+        {
+            continue;
+        }
+        std::replace(name.begin(), name.end(), L'/', L'\\');
+        size_t nameStart = name.find_first_not_of(L'\\');
+        if (nameStart == std::wstring::npos || name.back() == L'\\' || name.find(L':') != std::wstring::npos)
+        {
+            continue;
+        }
+        member.name = name.substr(nameStart);
+        bool dotComponent = false;
+        for (size_t start = 0; start <= member.name.size() && !dotComponent;)
+        {
+            size_t end = (std::min)(member.name.find(L'\\', start), member.name.size());
+            std::wstring_view component(member.name.data() + start, end - start);
+            dotComponent = component == L"." || component == L"..";
+            start = end + 1;
+        }
+        if (dotComponent)
+        {
+            continue;
+        }
+        members.push_back(std::move(member));
+    }
+}
+
+// Where the member's data starts: past its local header, whose name and extra field may differ
+// from the directory's. False when there is no local header at the member's offset.
+bool ReadZipLocalHeader(const uint8_t* header, size_t size, const ZipMember& member, uint64_t& dataOffset)
+{
+    if (size < kZipLocalHeaderSize || ReadLe32(header) != 0x04034B50)
+    {
+        return false;
+    }
+    dataOffset = member.localHeaderOffset + kZipLocalHeaderSize + ReadLe16(header + 26) + ReadLe16(header + 28);
+    return true;
+}
+
+// Checks the recorded sizes before anything is allocated for them: a stored member is as large as
+// its data, a deflated one within DEFLATE's expansion limit, and neither past kZipMaxMemberBytes.
+bool IsZipMemberSizeValid(const ZipMember& member)
+{
+    if (member.size > kZipMaxMemberBytes)
+    {
+        return false;
+    }
+    if (member.method == 0)
+    {
+        return member.size == member.compressedSize;
+    }
+    return member.size <= member.compressedSize * kInflateMaxExpansion + kInflateMaxExpansion;
+}
+
+// =====================
+// プレイリスト索引
+// =====================
+// Front coding: the length shared with the previous string, then only the rest of it.
+void AppendPlaylistString(std::vector<uint8_t>& out, const std::wstring& previous, const std::wstring& value)
+{
+    size_t limit = (std::min)({ previous.size(), value.size(), static_cast<size_t>(0xFFFF) });
+    size_t shared = 0;
+    while (shared < limit && previous[shared] == value[shared])
+    {
+        ++shared;
+    }
+    size_t suffix = (std::min)(value.size() - shared, static_cast<size_t>(0xFFFF));
+    AppendIndexValue(out, static_cast<uint16_t>(shared));
+    AppendIndexValue(out, static_cast<uint16_t>(suffix));
+    for (size_t i = 0; i < suffix; ++i)
+    {
+        AppendIndexValue(out, static_cast<uint16_t>(value[shared + i]));
+    }
+}
+
+bool ReadIndexValue(const uint8_t*& pos, const uint8_t* end, size_t bytes, uint64_t& value)
+{
+    if (static_cast<size_t>(end - pos) < bytes)
+    {
+        return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        value |= static_cast<uint64_t>(pos[i]) << (8 * i);
+    }
+    pos += bytes;
+    return true;
+}
+
+// value holds the previous string on entry and the decoded one on return.
+bool ReadPlaylistString(const uint8_t*& pos, const uint8_t* end, std::wstring& value)
+{
+    uint64_t shared = 0;
+    uint64_t suffix = 0;
+    if (!ReadIndexValue(pos, end, 2, shared) || !ReadIndexValue(pos, end, 2, suffix)
+        || shared > value.size() || static_cast<size_t>(end - pos) < suffix * 2)
+    {
+        return false;
+    }
+    value.resize(static_cast<size_t>(shared));
+    for (uint64_t i = 0; i < suffix; ++i)
+    {
+        value.push_back(static_cast<wchar_t>(ReadLe16(pos)));
+        pos += 2;
+    }
+    return true;
+}
+
+// Layout: magic, version, the roots, then each folder in path order with its time, its files
+// (name, time, size) and its subfolder names. Paths and names are front-coded against the one
+// before, so a deep tree stores each shared prefix once.
+void EncodePlaylistIndex(const PlaylistIndex& index, std::vector<uint8_t>& out)
+{
+    AppendIndexValue(out, kPlaylistIndexMagic);
+    AppendIndexValue(out, kPlaylistIndexVersion);
+    AppendIndexValue(out, static_cast<uint32_t>(index.roots.size()));
+    std::wstring previous;
+    for (const std::wstring& root : index.roots)
+    {
+        AppendPlaylistString(out, previous, root);
+        previous = root;
+    }
+    AppendIndexValue(out, static_cast<uint32_t>(index.directories.size()));
+    previous.clear();
+    for (const PlaylistDirectory& directory : index.directories)
+    {
+        AppendPlaylistString(out, previous, directory.path);
+        previous = directory.path;
+        AppendIndexValue(out, directory.writeTime);
+        AppendIndexValue(out, static_cast<uint32_t>(directory.files.size()));
+        const std::wstring empty;
+        const std::wstring* previousName = &empty;
+        for (const PlaylistFile& file : directory.files)
+        {
+            AppendPlaylistString(out, *previousName, file.name);
+            previousName = &file.name;
+            AppendIndexValue(out, file.writeTime);
+            AppendIndexValue(out, file.size);
+        }
+        AppendIndexValue(out, static_cast<uint32_t>(directory.subdirectories.size()));
+        previousName = &empty;
+        for (const std::wstring& name : directory.subdirectories)
+        {
+            AppendPlaylistString(out, *previousName, name);
+            previousName = &name;
+        }
+    }
+}
+
+// Reads what EncodePlaylistIndex wrote. Every count is checked against the bytes left, so a
+// damaged or foreign file is refused instead of read past its end.
+bool DecodePlaylistIndex(const uint8_t* data, size_t size, PlaylistIndex& index)
+{
+    index = PlaylistIndex{};
+    const uint8_t* pos = data;
+    const uint8_t* end = data + size;
+    uint64_t magic = 0;
+    uint64_t version = 0;
+    uint64_t count = 0;
+    if (!ReadIndexValue(pos, end, 4, magic) || magic != kPlaylistIndexMagic
+        || !ReadIndexValue(pos, end, 4, version) || version != kPlaylistIndexVersion
+        || !ReadIndexValue(pos, end, 4, count))
+    {
+        return false;
+    }
+    std::wstring previous;
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        if (!ReadPlaylistString(pos, end, previous))
+        {
+            return false;
+        }
+        index.roots.push_back(previous);
+    }
+    // Counts are checked against the bytes left so a damaged file cannot ask for a huge reserve.
+    if (!ReadIndexValue(pos, end, 4, count) || count > static_cast<uint64_t>(end - pos) / 20)
+    {
+        return false;
+    }
+    index.directories.resize(static_cast<size_t>(count));
+    previous.clear();
+    for (PlaylistDirectory& directory : index.directories)
+    {
+        if (!ReadPlaylistString(pos, end, previous) || !ReadIndexValue(pos, end, 8, directory.writeTime)
+            || !ReadIndexValue(pos, end, 4, count) || count > static_cast<uint64_t>(end - pos) / 20)
+        {
+            return false;
+        }
+        directory.path = previous;
+        directory.files.resize(static_cast<size_t>(count));
+        std::wstring name;
+        for (PlaylistFile& file : directory.files)
+        {
+            if (!ReadPlaylistString(pos, end, name) || !ReadIndexValue(pos, end, 8, file.writeTime)
+                || !ReadIndexValue(pos, end, 8, file.size))
+            {
+                return false;
+            }
+            file.name = name;
+        }
+        if (!ReadIndexValue(pos, end, 4, count) || count > static_cast<uint64_t>(end - pos) / 4)
+        {
+            return false;
+        }
+        directory.subdirectories.resize(static_cast<size_t>(count));
+        name.clear();
+        for (std::wstring& subdirectory : directory.subdirectories)
+        {
+            if (!ReadPlaylistString(pos, end, name))
+            {
+                return false;
+            }
+            subdirectory = name;
+        }
+    }
+    return true;
+}
+
+// =====================
+// メタデータキャッシュ
+// =====================
+
+// Layout: magic, version, count, then per file the path hash, time, size, width, height, frame
+// count, flags and date taken.
+void EncodeMetadataCache(const std::unordered_map<uint64_t, MetadataCacheRecord>& records, std::vector<uint8_t>& out)
+{
+    out.reserve(out.size() + 12 + records.size() * kMetadataCacheRecordBytes);
+    AppendIndexValue(out, kMetadataCacheMagic);
+    AppendIndexValue(out, kMetadataCacheVersion);
+    AppendIndexValue(out, static_cast<uint32_t>(records.size()));
+    for (const auto& [key, record] : records)
+    {
+        AppendIndexValue(out, key);
+        AppendIndexValue(out, record.writeTime);
+        AppendIndexValue(out, record.size);
+        AppendIndexValue(out, record.metadata.width);
+        AppendIndexValue(out, record.metadata.height);
+        AppendIndexValue(out, record.metadata.frameCount);
+        AppendIndexValue(out, static_cast<uint8_t>(record.metadata.hasAlpha ? kMetadataHasAlpha : 0));
+        AppendIndexValue(out, record.metadata.dateTaken);
+    }
+}
+
+// Adds the records EncodeMetadataCache wrote. The count is checked against the bytes left before
+// anything is read, so a file of another version or a truncated one adds nothing.
+bool DecodeMetadataCache(const uint8_t* data, size_t size, std::unordered_map<uint64_t, MetadataCacheRecord>& records)
+{
+    const uint8_t* pos = data;
+    const uint8_t* end = data + size;
+    uint64_t magic = 0;
+    uint64_t version = 0;
+    uint64_t count = 0;
+    if (!ReadIndexValue(pos, end, 4, magic) || magic != kMetadataCacheMagic
+        || !ReadIndexValue(pos, end, 4, version) || version != kMetadataCacheVersion
+        || !ReadIndexValue(pos, end, 4, count) || count > static_cast<uint64_t>(end - pos) / kMetadataCacheRecordBytes)
+    {
+        return false;
+    }
+    records.reserve(records.size() + static_cast<size_t>(count));
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        uint64_t key = 0;
+        uint64_t width = 0;
+        uint64_t height = 0;
+        uint64_t frameCount = 0;
+        uint64_t flags = 0;
+        MetadataCacheRecord record;
+        ReadIndexValue(pos, end, 8, key);
+        ReadIndexValue(pos, end, 8, record.writeTime);
+        ReadIndexValue(pos, end, 8, record.size);
+        ReadIndexValue(pos, end, 4, width);
+        ReadIndexValue(pos, end, 4, height);
+        ReadIndexValue(pos, end, 4, frameCount);
+        ReadIndexValue(pos, end, 1, flags);
+        ReadIndexValue(pos, end, 8, record.metadata.dateTaken);
+        record.metadata.width = static_cast<uint32_t>(width);
+        record.metadata.height = static_cast<uint32_t>(height);
+        record.metadata.frameCount = static_cast<uint32_t>(frameCount);
+        record.metadata.hasAlpha = (flags & kMetadataHasAlpha) != 0;
+        records[key] = record;
+    }
+    return true;
+}
+
+// =====================
+// アニメーション
+// =====================
+
+// A missing or zero delay plays at kDefaultAnimationFrameDelayMs, as browsers do.
+uint32_t GetAnimationFrameDelayMs(const std::vector<uint32_t>& frameDelaysMs, size_t frameIndex)
+{
+    if (frameIndex >= frameDelaysMs.size() || frameDelaysMs[frameIndex] == 0)
+    {
+        return kDefaultAnimationFrameDelayMs;
+    }
+    return frameDelaysMs[frameIndex];
+}
+
+size_t AdvanceAnimationTimeline(const std::vector<uint32_t>& frameDelaysMs, size_t frameIndex, uint64_t& frameStartMs,
+    uint64_t nowMs, size_t& advancedFrames)
+{
+    advancedFrames = 0;
+    size_t frameCount = frameDelaysMs.size();
+    if (frameCount < 2 || nowMs <= frameStartMs)
+    {
+        return frameIndex;
+    }
+
+    // Skip whole loops arithmetically so a long suspension does not walk every frame.
+    uint64_t loopMs = 0;
+    for (size_t i = 0; i < frameCount; ++i)
+    {
+        loopMs += GetAnimationFrameDelayMs(frameDelaysMs, i);
+    }
+    uint64_t elapsed = nowMs - frameStartMs;
+    if (loopMs > 0 && elapsed >= loopMs)
+    {
+        uint64_t loops = elapsed / loopMs;
+        frameStartMs += loops * loopMs;
+        advancedFrames += static_cast<size_t>(loops * frameCount);
+    }
+
+    while (nowMs - frameStartMs >= GetAnimationFrameDelayMs(frameDelaysMs, frameIndex))
+    {
+        frameStartMs += GetAnimationFrameDelayMs(frameDelaysMs, frameIndex);
+        frameIndex = (frameIndex + 1) % frameCount;
+        ++advancedFrames;
+    }
+    return frameIndex;
+}
+
+void StartAnimationTimeline(AnimationPlayback& playback, size_t frameIndex, uint64_t nowMs)
+{
+    playback.frameIndex = frameIndex;
+    playback.frameStartMs = nowMs;
+    playback.occlusionChecked = false;
+    playback.uncovered = true;
+    playback.playing = playback.frameDelaysMs.size() > 1;
+    playback.suspended = false;
+    playback.skippedFrames = 0;
+}
+
+// Decides what a timer tick shows and when the next one comes: the due frame and the time left
+// on it, or, when the window cannot be seen, a suspension polled every kAnimationVisibilityPollMs.
+AnimationTick TickAnimationTimeline(AnimationPlayback& playback, uint64_t nowMs, const AnimationVisibility& visibility)
+{
+    AnimationTick tick;
+    tick.frame = playback.frameIndex;
+    bool shown = visibility.isShown();
+    if (shown && (playback.suspended || !playback.occlusionChecked || nowMs - playback.occlusionCheckedMs >= kAnimationOcclusionCheckMs))
+    {
+        playback.uncovered = visibility.isUncovered();
+        playback.occlusionCheckedMs = nowMs;
+        playback.occlusionChecked = true;
+    }
+    if (!shown || !playback.uncovered)
+    {
+        playback.suspended = true;
+        tick.suspended = true;
+        tick.waitMs = kAnimationVisibilityPollMs;
+        return tick;
+    }
+
+    playback.suspended = false;
+    size_t advancedFrames = 0;
+    playback.frameIndex = AdvanceAnimationTimeline(playback.frameDelaysMs, playback.frameIndex, playback.frameStartMs, nowMs, advancedFrames);
+    if (advancedFrames > 1)
+    {
+        playback.skippedFrames += advancedFrames - 1;
+    }
+    tick.frame = playback.frameIndex;
+    uint64_t shownMs = nowMs > playback.frameStartMs ? nowMs - playback.frameStartMs : 0;
+    uint32_t delay = GetAnimationFrameDelayMs(playback.frameDelaysMs, playback.frameIndex);
+    tick.waitMs = shownMs < delay ? static_cast<uint32_t>(delay - shownMs) : 0;
+    return tick;
+}
+
+bool IsCanvasRectEmpty(const CanvasRect& rect)
+{
+    return rect.right <= rect.left || rect.bottom <= rect.top;
+}
+
+// The bounding box of the pixels that differ between two canvases of width x height 32bpp pixels.
+CanvasRect ComputeCanvasDirtyRect(const std::vector<uint8_t>& before, const std::vector<uint8_t>& after, uint32_t width, uint32_t height)
+{
+    CanvasRect rect;
+    size_t stride = static_cast<size_t>(width) * 4;
+    if (width == 0 || height == 0 || before.size() < stride * height || after.size() < stride * height)
+    {
+        return rect;
+    }
+
+    auto rowDiffers = [&](uint32_t y)
+    {
+        return memcmp(before.data() + y * stride, after.data() + y * stride, stride) != 0;
+    };
+
+    uint32_t top = 0;
+    while (top < height && !rowDiffers(top))
+    {
+        ++top;
+    }
+    if (top == height)
+    {
+        return rect;
+    }
+    uint32_t bottom = height;
+    while (bottom > top + 1 && !rowDiffers(bottom - 1))
+    {
+        --bottom;
+    }
+
+    uint32_t left = width;
+    uint32_t right = 0;
+    for (uint32_t y = top; y < bottom; ++y)
+    {
+        const uint8_t* beforeRow = before.data() + y * stride;
+        const uint8_t* afterRow = after.data() + y * stride;
+        for (uint32_t x = 0; x < left; ++x)
+        {
+            if (memcmp(beforeRow + x * 4, afterRow + x * 4, 4) != 0)
+            {
+                left = x;
+                break;
+            }
+        }
+        for (uint32_t x = width; x > right && x > left; --x)
+        {
+            if (memcmp(beforeRow + (x - 1) * 4, afterRow + (x - 1) * 4, 4) != 0)
+            {
+                right = x;
+                break;
+            }
+        }
+    }
+
+    if (left < right)
+    {
+        rect = CanvasRect{ left, top, right, bottom };
+    }
+    return rect;
+}
+
+void UnionDirtyRect(CanvasRect& target, const CanvasRect& rect)
+{
+    if (IsCanvasRectEmpty(rect))
+    {
+        return;
+    }
+    if (IsCanvasRectEmpty(target))
+    {
+        target = rect;
+        return;
+    }
+    target.left = (std::min)(target.left, rect.left);
+    target.top = (std::min)(target.top, rect.top);
+    target.right = (std::max)(target.right, rect.right);
+    target.bottom = (std::max)(target.bottom, rect.bottom);
+}
+
+// frameDirtyRects[i] is what changes going into frame i from the one before it, frame 0 coming
+// after the last. Going forward from one frame to another uploads the union of the steps between;
+// anything the steps cannot account for uploads the whole canvas.
+CanvasRect GetAnimationUploadRect(const std::vector<CanvasRect>& frameDirtyRects, size_t fromFrame, size_t toFrame,
+    uint32_t width, uint32_t height)
+{
+    CanvasRect full{ 0, 0, width, height };
+    size_t frameCount = frameDirtyRects.size();
+    if (fromFrame >= frameCount || toFrame >= frameCount)
+    {
+        return full;
+    }
+    CanvasRect dirty;
+    size_t step = fromFrame;
+    while (step != toFrame)
+    {
+        step = (step + 1) % frameCount;
+        UnionDirtyRect(dirty, frameDirtyRects[step]);
+    }
+    dirty.right = (std::min)(dirty.right, width);
+    dirty.bottom = (std::min)(dirty.bottom, height);
+    return dirty;
+}
+
+// Brings the surface to frameIndex. A surface of the right size is updated in place with only
+// the changed rectangle, through one upload buffer reused across frames; otherwise it is created
+// anew from the frame.
+bool PresentAnimationFrame(AnimationSurface& surface, const std::vector<CanvasRect>& frameDirtyRects, size_t frameIndex,
+    uint32_t width, uint32_t height, const AnimationSurfaceBackend& backend)
+{
+    if (!surface.valid || surface.width != width || surface.height != height || frameDirtyRects.empty())
+    {
+        surface.valid = false;
+        if (!backend.create(frameIndex))
+        {
+            return false;
+        }
+        surface.width = width;
+        surface.height = height;
+        surface.frameIndex = frameIndex;
+        surface.valid = true;
+        ++surface.createdSurfaces;
+        surface.uploadedBytes += static_cast<uint64_t>(width) * height * 4;
+        return true;
+    }
+
+    CanvasRect dirty = GetAnimationUploadRect(frameDirtyRects, surface.frameIndex, frameIndex, width, height);
+    if (!IsCanvasRectEmpty(dirty))
+    {
+        uint32_t stride = (dirty.right - dirty.left) * 4;
+        size_t bufferSize = static_cast<size_t>(stride) * (dirty.bottom - dirty.top);
+        if (surface.uploadBuffer.size() < bufferSize)
+        {
+            surface.uploadBuffer.resize(bufferSize);
+        }
+        if (!backend.read(frameIndex, dirty, stride, surface.uploadBuffer.data())
+            || !backend.upload(dirty, surface.uploadBuffer.data(), stride))
+        {
+            // The surface may hold half a frame now.
+            surface.valid = false;
+            return false;
+        }
+        surface.uploadedBytes += bufferSize;
+    }
+    surface.frameIndex = frameIndex;
+    return true;
+}
+
+// =====================
+// 背景キャッシュ
+// =====================
+
+// 2x2 opaque BGRA cells, tiled by a wrapping brush instead of one FillRectangle per cell.
+std::array<uint32_t, kCheckerTileSize * kCheckerTileSize> MakeCheckerTile()
+{
+    std::array<uint32_t, kCheckerTileSize * kCheckerTileSize> pixels{};
+    for (uint32_t y = 0; y < kCheckerTileSize; ++y)
+    {
+        for (uint32_t x = 0; x < kCheckerTileSize; ++x)
+        {
+            bool evenCell = ((x / kCheckerCellSize) + (y / kCheckerCellSize)) % 2 == 0;
+            uint32_t level = evenCell ? kCheckerLightLevel : kCheckerDarkLevel;
+            pixels[y * kCheckerTileSize + x] = 0xFF000000u | (level << 16) | (level << 8) | level;
+        }
+    }
+    return pixels;
+}
+
+// The surface is the draw size rounded to whole pixels, at least 1x1.
+LayeredSurfaceKey MakeLayeredSurfaceKey(uintptr_t source, float drawWidth, float drawHeight)
+{
+    LayeredSurfaceKey key;
+    key.source = source;
+    key.width = static_cast<uint32_t>((std::max)(1.0f, static_cast<float>(std::lround(drawWidth))));
+    key.height = static_cast<uint32_t>((std::max)(1.0f, static_cast<float>(std::lround(drawHeight))));
+    return key;
+}
+
+// The cached pixels serve every paint until the image or the rounded size changes, or the host
+// drops them (a new frame, a new file, leaving the layered style).
+bool IsLayeredSurfaceCached(const LayeredSurfaceState& state, const LayeredSurfaceKey& key)
+{
+    return state.valid && key.source != 0 && state.key.source == key.source
+        && state.key.width == key.width && state.key.height == key.height;
+}
+
+void MarkLayeredSurfaceBuilt(LayeredSurfaceState& state, const LayeredSurfaceKey& key)
+{
+    state.key = key;
+    state.valid = key.source != 0;
+    ++state.builds;
+}
+
+// =====================
+// 文字コード
+// =====================
+
+// size is what the file held when it was opened; a file that shrank since ends the buffer early.
+bool FillDocumentBuffer(size_t size, const DocumentReader& read, DocumentBuffer& document)
+{
+    document = DocumentBuffer{};
+    // Left uninitialized: every byte that is kept is overwritten by read.
+    std::unique_ptr<char[]> data(new char[size > 0 ? size : 1]);
+    size_t total = 0;
+    while (total < size)
+    {
+        size_t got = 0;
+        if (!read(data.get() + total, (std::min)(size - total, kDocumentReadChunkBytes), got))
+        {
+            return false;
+        }
+        if (got == 0)
+        {
+            break;
+        }
+        total += got;
+    }
+
+    document.data = std::move(data);
+    document.size = total;
+    document.textStart = std::string_view(document.data.get(), total).starts_with(kUtf8Bom) ? kUtf8Bom.size() : 0;
+    return true;
+}
+
+// Validates and converts in one pass. Invalid sequences become U+FFFD (one per maximal
+// subpart), or fail the call when strict. The text is UTF-16 whatever the width of wchar_t,
+// so supplementary characters always take a surrogate pair.
+bool DecodeUtf8(const char* data, size_t size, std::wstring& text, bool strict)
+{
+    // A UTF-16 string never has more code units than its UTF-8 source has bytes.
+    text.resize(size);
+    wchar_t* out = text.data();
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    while (p < end)
+    {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        while (end - p >= 16)
+        {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            if (_mm_movemask_epi8(chunk) != 0)
+            {
+                break;
+            }
+            __m128i low = _mm_unpacklo_epi8(chunk, zero);
+            __m128i high = _mm_unpackhi_epi8(chunk, zero);
+            if constexpr (sizeof(wchar_t) == 2)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), low);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), high);
+            }
+            else
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(low, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_unpackhi_epi16(low, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpacklo_epi16(high, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm_unpackhi_epi16(high, zero));
+            }
+            p += 16;
+            out += 16;
+        }
+#else
+        while (end - p >= 8)
+        {
+            uint64_t chunk = 0;
+            memcpy(&chunk, p, sizeof(chunk));
+            if ((chunk & 0x8080808080808080ull) != 0)
+            {
+                break;
+            }
+            for (int i = 0; i < 8; ++i)
+            {
+                out[i] = static_cast<wchar_t>(p[i]);
+            }
+            p += 8;
+            out += 8;
+        }
+#endif
+        while (p < end && *p < 0x80)
+        {
+            *out++ = static_cast<wchar_t>(*p++);
+        }
+        if (p >= end || *p < 0x80)
+        {
+            continue;
+        }
+
+        unsigned int lead = *p;
+        int trail = 0;
+        unsigned int codePoint = 0;
+        unsigned char low = 0x80;
+        unsigned char high = 0xBF;
+        if (lead >= 0xC2 && lead <= 0xDF)
+        {
+            trail = 1;
+            codePoint = lead & 0x1F;
+        }
+        else if (lead >= 0xE0 && lead <= 0xEF)
+        {
+            trail = 2;
+            codePoint = lead & 0x0F;
+            low = (lead == 0xE0) ? 0xA0 : 0x80;
+            high = (lead == 0xED) ? 0x9F : 0xBF;
+        }
+        else if (lead >= 0xF0 && lead <= 0xF4)
+        {
+            trail = 3;
+            codePoint = lead & 0x07;
+            low = (lead == 0xF0) ? 0x90 : 0x80;
+            high = (lead == 0xF4) ? 0x8F : 0xBF;
+        }
+
+        const unsigned char* q = p + 1;
+        int consumed = 0;
+        while (consumed < trail && q < end && *q >= low && *q <= high)
+        {
+            codePoint = (codePoint << 6) | (*q & 0x3F);
+            low = 0x80;
+            high = 0xBF;
+            ++q;
+            ++consumed;
+        }
+
+        if (trail == 0 || consumed < trail)
+        {
+            if (strict)
+            {
+                text.clear();
+                return false;
+            }
+            *out++ = 0xFFFD;
+            p = q;
+            continue;
+        }
+
+        if (codePoint >= 0x10000)
+        {
+            codePoint -= 0x10000;
+            *out++ = static_cast<wchar_t>(0xD800 + (codePoint >> 10));
+            *out++ = static_cast<wchar_t>(0xDC00 + (codePoint & 0x3FF));
+        }
+        else
+        {
+            *out++ = static_cast<wchar_t>(codePoint);
+        }
+        p = q;
+    }
+
+    text.resize(static_cast<size_t>(out - text.data()));
+    return true;
+}
+
+bool Utf8ToWide(const char* data, size_t size, std::wstring& text)
+{
+    return DecodeUtf8(data, size, text, false);
+}
+
+bool Utf8ToWide(std::string_view bytes, std::wstring& text)
+{
+    return DecodeUtf8(bytes.data(), bytes.size(), text, false);
+}
+
+bool Utf8ToWideStrict(std::string_view bytes, std::wstring& text)
+{
+    return DecodeUtf8(bytes.data(), bytes.size(), text, true);
+}
+
+// Encodes in fixed-size chunks so the output grows by what was written rather than
+// by the three-bytes-per-unit worst case. Lone surrogates become U+FFFD, as do units past
+// U+10FFFF where wchar_t is wide enough to hold them.
+bool WideToUtf8(const wchar_t* data, size_t size, std::string& bytes)
+{
+    constexpr size_t kChunkUnits = 16384;
+    char buffer[kChunkUnits * 3 + 4];
+    bytes.clear();
+    bytes.reserve(size);
+
+    size_t index = 0;
+    while (index < size)
+    {
+        char* out = buffer;
+        size_t chunkEnd = (std::min)(size, index + kChunkUnits);
+        while (index < chunkEnd)
+        {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+            const __m128i zero = _mm_setzero_si128();
+            while (chunkEnd - index >= 16)
+            {
+                const __m128i* units = reinterpret_cast<const __m128i*>(data + index);
+                __m128i packed;
+                if constexpr (sizeof(wchar_t) == 2)
+                {
+                    const __m128i nonAscii = _mm_set1_epi16(static_cast<short>(0xFF80));
+                    __m128i first = _mm_loadu_si128(units);
+                    __m128i second = _mm_loadu_si128(units + 1);
+                    __m128i high = _mm_and_si128(_mm_or_si128(first, second), nonAscii);
+                    if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF)
+                    {
+                        break;
+                    }
+                    packed = _mm_packus_epi16(first, second);
+                }
+                else
+                {
+                    const __m128i nonAscii = _mm_set1_epi32(static_cast<int>(0xFFFFFF80u));
+                    __m128i first = _mm_loadu_si128(units);
+                    __m128i second = _mm_loadu_si128(units + 1);
+                    __m128i third = _mm_loadu_si128(units + 2);
+                    __m128i fourth = _mm_loadu_si128(units + 3);
+                    __m128i high = _mm_and_si128(_mm_or_si128(_mm_or_si128(first, second), _mm_or_si128(third, fourth)), nonAscii);
+                    if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)) != 0xFFFF)
+                    {
+                        break;
+                    }
+                    packed = _mm_packus_epi16(_mm_packs_epi32(first, second), _mm_packs_epi32(third, fourth));
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), packed);
+                index += 16;
+                out += 16;
+            }
+            if (index >= chunkEnd)
+            {
+                break;
+            }
+#endif
+            unsigned int unit = static_cast<unsigned int>(data[index++]);
+            if (unit < 0x80)
+            {
+                *out++ = static_cast<char>(unit);
+                continue;
+            }
+            if (unit < 0x800)
+            {
+                *out++ = static_cast<char>(0xC0 | (unit >> 6));
+                *out++ = static_cast<char>(0x80 | (unit & 0x3F));
+                continue;
+            }
+            unsigned int codePoint = unit;
+            if (unit >= 0xD800 && unit <= 0xDBFF && index < size
+                && static_cast<unsigned int>(data[index]) >= 0xDC00 && static_cast<unsigned int>(data[index]) <= 0xDFFF)
+            {
+                // A pair may straddle the chunk boundary; the buffer has room for it.
+                codePoint = 0x10000 + ((unit - 0xD800) << 10) + (static_cast<unsigned int>(data[index]) - 0xDC00);
+                ++index;
+            }
+            else if ((unit >= 0xD800 && unit <= 0xDFFF) || unit > 0x10FFFF)
+            {
+                codePoint = 0xFFFD;
+            }
+            if (codePoint >= 0x10000)
+            {
+                *out++ = static_cast<char>(0xF0 | (codePoint >> 18));
+                *out++ = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+            }
+            else
+            {
+                *out++ = static_cast<char>(0xE0 | (codePoint >> 12));
+            }
+            *out++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            *out++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        bytes.append(buffer, static_cast<size_t>(out - buffer));
+    }
+    return true;
+}
+
+bool WideToUtf8(const std::wstring& text, std::string& bytes)
+{
+    return WideToUtf8(text.data(), text.size(), bytes);
+}
+
+// =====================
+// テキスト行索引
+// =====================
+
+void ResetTextLineIndex(TextLineIndex& index, uint64_t dataStart)
+{
+    index.checkpoints.assign(1, dataStart);
+    index.longLines.clear();
+    index.lineCount = 0;
+    index.lastLineStart = dataStart;
+    index.indexedEnd = dataStart;
+}
+
+// data must start at index.indexedEnd.
+void AppendTextLineIndex(TextLineIndex& index, const char* data, size_t size)
+{
+    const char* cursor = data;
+    const char* end = data + size;
+    while (cursor < end)
+    {
+        const char* newline = static_cast<const char*>(memchr(cursor, '\n', static_cast<size_t>(end - cursor)));
+        if (!newline)
+        {
+            break;
+        }
+        uint64_t newlineOffset = index.indexedEnd + static_cast<uint64_t>(newline - data);
+        if (newlineOffset - index.lastLineStart > kTextMaxLineBytes)
+        {
+            index.longLines.push_back(TextLongLine{ index.lineCount, index.lastLineStart, newlineOffset });
+        }
+        ++index.lineCount;
+        index.lastLineStart = newlineOffset + 1;
+        if (index.lineCount % kTextLineCheckpointStride == 0)
+        {
+            index.checkpoints.push_back(index.lastLineStart);
+        }
+        cursor = newline + 1;
+    }
+    index.indexedEnd += size;
+}
+
+uint64_t GetTextLineCount(const TextLineIndex& index, bool complete)
+{
+    // An unterminated last line only counts once the scan has reached the end of the file.
+    bool trailingLine = complete && index.indexedEnd > index.lastLineStart;
+    return index.lineCount + (trailingLine ? 1 : 0);
+}
+
+// Finds the bytes of a line, without its '\n'. The walk starts at the nearest checkpoint and
+// jumps over long lines, so it reads at most one stride of lines of kTextMaxLineBytes each.
+bool FindTextLineRange(const TextLineIndex& index, bool complete, uint64_t line, const TextRangeMapper& map,
+    uint64_t& start, uint64_t& end)
+{
+    if (line >= GetTextLineCount(index, complete))
+    {
+        return false;
+    }
+    if (line == index.lineCount)
+    {
+        start = index.lastLineStart;
+        end = index.indexedEnd;
+        return true;
+    }
+    auto longLine = std::lower_bound(index.longLines.begin(), index.longLines.end(), line / kTextLineCheckpointStride * kTextLineCheckpointStride,
+        [](const TextLongLine& entry, uint64_t value) { return entry.line < value; });
+
+    // A line that is not long ends within kTextMaxLineBytes + 1 bytes of its start.
+    auto findNewline = [&](uint64_t from, uint64_t& newline)
+    {
+        size_t window = static_cast<size_t>((std::min)(static_cast<uint64_t>(kTextMaxLineBytes + 1), index.indexedEnd - from));
+        const char* data = map(from, window);
+        if (!data)
+        {
+            return false;
+        }
+        const char* found = static_cast<const char*>(memchr(data, '\n', window));
+        if (!found)
+        {
+            return false;
+        }
+        newline = from + static_cast<uint64_t>(found - data);
+        return true;
+    };
+
+    uint64_t current = line / kTextLineCheckpointStride * kTextLineCheckpointStride;
+    uint64_t cursor = index.checkpoints[static_cast<size_t>(line / kTextLineCheckpointStride)];
+    while (true)
+    {
+        if (longLine != index.longLines.end() && longLine->line == current)
+        {
+            if (current == line)
+            {
+                start = longLine->start;
+                end = longLine->end;
+                return true;
+            }
+            cursor = longLine->end + 1;
+            ++longLine;
+        }
+        else
+        {
+            uint64_t newline = 0;
+            if (!findNewline(cursor, newline))
+            {
+                return false;
+            }
+            if (current == line)
+            {
+                start = cursor;
+                end = newline;
+                return true;
+            }
+            cursor = newline + 1;
+        }
+        ++current;
+    }
+}
+
+// A line as shown: without its '\r', clipped to kTextMaxLineBytes on a UTF-8 sequence boundary.
+bool ReadTextLine(const TextLineIndex& index, bool complete, uint64_t line, const TextRangeMapper& map, std::wstring& text)
+{
+    text.clear();
+    uint64_t start = 0;
+    uint64_t end = 0;
+    if (!FindTextLineRange(index, complete, line, map, start, end))
+    {
+        return false;
+    }
+    bool clipped = end - start > kTextMaxLineBytes;
+    if (clipped)
+    {
+        end = start + kTextMaxLineBytes;
+    }
+    if (end <= start)
+    {
+        return true;
+    }
+
+    const char* data = map(start, static_cast<size_t>(end - start));
+    if (!data)
+    {
+        return false;
+    }
+    size_t length = static_cast<size_t>(end - start);
+    if (!clipped && data[length - 1] == '\r')
+    {
+        --length;
+    }
+    if (clipped)
+    {
+        // Drop a UTF-8 sequence the clip cut short.
+        size_t lead = length;
+        while (lead > 0 && length - lead < 3 && (static_cast<unsigned char>(data[lead - 1]) & 0xC0) == 0x80)
+        {
+            --lead;
+        }
+        if (lead > 0)
+        {
+            unsigned char first = static_cast<unsigned char>(data[lead - 1]);
+            size_t sequence = first >= 0xF0 ? 4 : first >= 0xE0 ? 3 : first >= 0xC0 ? 2 : 1;
+            if (length - (lead - 1) < sequence)
+            {
+                length = lead - 1;
+            }
+        }
+    }
+    return Utf8ToWide(data, length, text);
+}
+
+// Decides what a change notification or poll does to a followed file of size bytes. A path that
+// names another file was rotated and a smaller file was truncated: both are opened again from the
+// start. A file that grew has only the new bytes indexed; that includes the last writes to a file
+// renamed away, while its successor has yet to appear.
+TextFollowAction GetTextFollowAction(const TextFileIdentity& open, uint64_t size, bool indexComplete, const TextFollowProbe& probe)
+{
+    if (!indexComplete)
+    {
+        // A running scan has a fixed end; the next notification or poll looks again.
+        return TextFollowAction::None;
+    }
+    if (probe.pathExists && probe.identityKnown
+        && (probe.pathIdentity.volume != open.volume || probe.pathIdentity.file != open.file))
+    {
+        return TextFollowAction::Reopen;
+    }
+    if (!probe.sizeKnown || probe.openSize == size)
+    {
+        return TextFollowAction::None;
+    }
+    if (probe.openSize < size)
+    {
+        return TextFollowAction::Reopen;
+    }
+    return probe.openSize - size <= kTextIndexChunkBytes ? TextFollowAction::AppendInline : TextFollowAction::AppendInBackground;
+}
+
+// =====================
+// 設定ストア
+// =====================
+std::wstring TrimString(const std::wstring& value)
+{
+    size_t start = 0;
+    while (start < value.size() && iswspace(value[start]))
+    {
+        ++start;
+    }
+    size_t end = value.size();
+    while (end > start && iswspace(value[end - 1]))
+    {
+        --end;
+    }
+    return value.substr(start, end - start);
+}
+
+// Lines as the ini holds them, without their CR LF or LF endings. A final line break does not
+// start another line.
+void SplitSettingsLines(std::wstring_view content, std::vector<std::wstring>& lines)
+{
+    size_t start = 0;
+    while (start < content.size())
+    {
+        size_t end = content.find(L'\n', start);
+        if (end == std::wstring_view::npos)
+        {
+            end = content.size();
+        }
+        size_t lineEnd = (end > start && content[end - 1] == L'\r') ? end - 1 : end;
+        lines.emplace_back(content.substr(start, lineEnd - start));
+        start = end + 1;
+    }
+}
+
+// The key a value is indexed under: section and key case-folded, as ini lookups ignore case.
+std::wstring MakeSettingsKey(const std::wstring& section, const std::wstring& key)
+{
+    std::wstring folded = section + L'\n' + key;
+    FoldCaseText(folded);
+    return folded;
+}
+
+void IndexSettingsLines(SettingsStore& store)
+{
+    store.keyLines.clear();
+    store.sectionEnds.clear();
+    std::wstring section;
+    for (size_t i = 0; i < store.lines.size(); ++i)
+    {
+        std::wstring trimmed = TrimString(store.lines[i]);
+        if (trimmed.empty() || trimmed[0] == L';' || trimmed[0] == L'#')
+        {
+            continue;
+        }
+        if (trimmed.front() == L'[' && trimmed.back() == L']')
+        {
+            section = trimmed.substr(1, trimmed.size() - 2);
+            FoldCaseText(section);
+            store.sectionEnds[section] = i;
+            continue;
+        }
+        if (section.empty())
+        {
+            continue;
+        }
+        store.sectionEnds[section] = i;
+        size_t eqPos = trimmed.find(L'=');
+        if (eqPos != std::wstring::npos)
+        {
+            // The first occurrence wins, as with GetPrivateProfileString.
+            store.keyLines.try_emplace(MakeSettingsKey(section, TrimString(trimmed.substr(0, eqPos))), i);
+        }
+    }
+}
+
+// Edits the lines for one change and reports whether anything was modified. A rewritten value
+// keeps the key and spacing as they were written; a new key goes at the end of its section.
+bool ApplySettingsChange(SettingsStore& store, const SettingsChange& change)
+{
+    std::wstring name = MakeSettingsKey(change.section, change.key);
+    auto it = store.keyLines.find(name);
+    if (change.remove)
+    {
+        if (it == store.keyLines.end())
+        {
+            return false;
+        }
+        // Every occurrence goes; otherwise the next one would surface as the key's value.
+        do
+        {
+            store.lines.erase(store.lines.begin() + it->second);
+            IndexSettingsLines(store);
+            it = store.keyLines.find(name);
+        } while (it != store.keyLines.end());
+        return true;
+    }
+    if (it != store.keyLines.end())
+    {
+        std::wstring& line = store.lines[it->second];
+        size_t eqPos = line.find(L'=');
+        if (TrimString(line.substr(eqPos + 1)) == change.value)
+        {
+            return false;
+        }
+        size_t valueStart = (std::min)(line.find_first_not_of(L" \t", eqPos + 1), line.size());
+        line = line.substr(0, valueStart) + change.value;
+        return true;
+    }
+
+    std::wstring section = change.section;
+    FoldCaseText(section);
+    auto sectionIt = store.sectionEnds.find(section);
+    if (sectionIt != store.sectionEnds.end())
+    {
+        store.lines.insert(store.lines.begin() + sectionIt->second + 1, change.key + L"=" + change.value);
+    }
+    else
+    {
+        if (!store.lines.empty() && !TrimString(store.lines.back()).empty())
+        {
+            store.lines.push_back(L"");
+        }
+        store.lines.push_back(L"[" + change.section + L"]");
+        store.lines.push_back(change.key + L"=" + change.value);
+    }
+    IndexSettingsLines(store);
+    return true;
+}
+
+// name is already case-folded; the schema spells its names with capitals.
+bool EqualsSettingName(std::wstring_view name, std::wstring_view schemaName)
+{
+    return name.size() == schemaName.size()
+        && std::equal(name.begin(), name.end(), schemaName.begin(), [](wchar_t a, wchar_t b)
+        {
+            return a == ((b >= L'A' && b <= L'Z') ? static_cast<wchar_t>(b - L'A' + L'a') : b);
+        });
+}
+
+// =====================
+// フォントカタログ
+// =====================
+
+// Case-folds a font name for the catalog's maps. Only case is folded, as DirectWrite does when
+// it matches family names.
+std::wstring FoldFontName(std::wstring_view name)
+{
+    std::wstring folded(name);
+    for (wchar_t& ch : folded)
+    {
+        ch = static_cast<wchar_t>(towlower(ch));
+    }
+    return folded;
+}
+
+void AddFontCatalogFamily(FontCatalogIndex& index, const std::vector<std::wstring>& familyNames)
+{
+    // Any localized family name creates the family, so each resolves to itself.
+    for (const std::wstring& familyName : familyNames)
+    {
+        FontCatalogEntry entry;
+        entry.familyName = familyName;
+        index.families.try_emplace(FoldFontName(familyName), std::move(entry));
+    }
+}
+
+void AddFontCatalogFace(FontCatalogIndex& index, const FontCatalogEntry& face, const std::vector<std::wstring>& faceNames,
+    const std::vector<std::wstring>& gdiFamilyNames)
+{
+    for (const std::wstring& faceName : faceNames)
+    {
+        index.faces.try_emplace(FoldFontName(faceName), face);
+    }
+    for (const std::wstring& gdiName : gdiFamilyNames)
+    {
+        index.gdiFamilies.try_emplace(FoldFontName(gdiName), face.familyName);
+    }
+}
+
+// Family names are tried before face names, whichever family they belong to.
+bool FindFontCatalogEntry(const FontCatalogIndex& index, std::wstring_view name, FontCatalogEntry& entry)
+{
+    std::wstring folded = FoldFontName(name);
+    auto family = index.families.find(folded);
+    if (family != index.families.end())
+    {
+        entry = family->second;
+        return true;
+    }
+    auto face = index.faces.find(folded);
+    if (face != index.faces.end())
+    {
+        entry = face->second;
+        return true;
+    }
+    return false;
+}
+
+bool FindFontCatalogGdiFamily(const FontCatalogIndex& index, std::wstring_view name, std::wstring& familyName)
+{
+    auto it = index.gdiFamilies.find(FoldFontName(name));
+    if (it == index.gdiFamilies.end())
+    {
+        return false;
+    }
+    familyName = it->second;
+    return true;
+}
+
+// =====================
+// Markdown 分割
+// =====================
+
+bool EqualsAsciiNoCase(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size()
+        && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+        {
+            auto lower = [](char ch)
+            {
+                return (ch >= 'A' && ch <= 'Z') ? static_cast<char>(ch - 'A' + 'a') : ch;
+            };
+            return lower(x) == lower(y);
+        });
+}
+
+// Cuts the document into sections of top-level blocks that md4c renders exactly as it would
+// inside the whole document. A cut is only made before a line that starts in column 0 with a
+// letter, '#' or a non-ASCII byte, follows a blank line, and is outside fenced code and HTML
+// blocks of types 1-5 (the only blocks that survive a blank line at column 0). Such a line
+// cannot continue a paragraph, list, quote, table or indented code. With a target of 0 every
+// such line starts a section, so the cuts depend only on the nearby text. Link reference
+// definitions are global, so they are collected and prepended to every section. Returns false
+// when the document has a construct the scan cannot place with certainty; the caller then
+// renders serially.
+bool SplitMarkdownIntoSections(
+    std::string_view markdown,
+    size_t targetSectionBytes,
+    std::vector<std::string_view>& sections,
+    std::string& definitions)
+{
+    sections.clear();
+    definitions.clear();
+    if (markdown.find('\r') != std::string_view::npos && markdown.find("\r\n") == std::string_view::npos)
+    {
+        // Bare CR line endings; keep the line scan simple.
+        return false;
+    }
+
+    auto isSpace = [](char ch)
+    {
+        return ch == ' ' || ch == '\t';
+    };
+    auto startsWithNoCase = [](std::string_view text, size_t pos, std::string_view token)
+    {
+        return text.size() - pos >= token.size() && EqualsAsciiNoCase(text.substr(pos, token.size()), token);
+    };
+    auto containsNoCase = [](std::string_view text, size_t pos, std::string_view token)
+    {
+        for (; pos + token.size() <= text.size(); ++pos)
+        {
+            if (EqualsAsciiNoCase(text.substr(pos, token.size()), token))
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+    // HTML block types 1-5 per CommonMark; 0 when the line does not open one at pos.
+    auto htmlBlockKind = [&](std::string_view line, size_t pos)
+    {
+        if (pos >= line.size() || line[pos] != '<')
+        {
+            return 0;
+        }
+        for (std::string_view tag : { std::string_view("<script"), std::string_view("<pre"), std::string_view("<style"), std::string_view("<textarea") })
+        {
+            size_t end = pos + tag.size();
+            if (startsWithNoCase(line, pos, tag) && (end == line.size() || isSpace(line[end]) || line[end] == '>'))
+            {
+                return 1;
+            }
+        }
+        if (startsWithNoCase(line, pos, "<!--"))
+        {
+            return 2;
+        }
+        if (startsWithNoCase(line, pos, "<?"))
+        {
+            return 3;
+        }
+        if (startsWithNoCase(line, pos, "<![CDATA["))
+        {
+            return 5;
+        }
+        if (startsWithNoCase(line, pos, "<!") && pos + 2 < line.size()
+            && ((line[pos + 2] >= 'A' && line[pos + 2] <= 'Z') || (line[pos + 2] >= 'a' && line[pos + 2] <= 'z')))
+        {
+            return 4;
+        }
+        return 0;
+    };
+    auto htmlBlockEnds = [&](std::string_view line, size_t pos, int kind)
+    {
+        switch (kind)
+        {
+        case 1:
+            return containsNoCase(line, pos, "</script>") || containsNoCase(line, pos, "</pre>")
+                || containsNoCase(line, pos, "</style>") || containsNoCase(line, pos, "</textarea>");
+        case 2:
+            return line.find("-->", pos) != std::string_view::npos;
+        case 3:
+            return line.find("?>", pos) != std::string_view::npos;
+        case 4:
+            return line.find('>', pos) != std::string_view::npos;
+        default:
+            return line.find("]]>", pos) != std::string_view::npos;
+        }
+    };
+    // Single-line "[label]: destination" with an optional title and no escapes.
+    auto isSimpleDefinition = [&](std::string_view text)
+    {
+        size_t close = text.find(']');
+        if (close == std::string_view::npos || close < 2 || close > 999
+            || text.substr(1, close - 1).find_first_of("[\\") != std::string_view::npos
+            || close + 1 >= text.size() || text[close + 1] != ':')
+        {
+            return false;
+        }
+        size_t pos = close + 2;
+        while (pos < text.size() && isSpace(text[pos]))
+        {
+            ++pos;
+        }
+        if (pos >= text.size() || text[pos] == '<')
+        {
+            return false;
+        }
+        size_t destEnd = pos;
+        while (destEnd < text.size() && !isSpace(text[destEnd]))
+        {
+            char ch = text[destEnd];
+            if (ch == '(' || ch == ')' || ch == '\\' || static_cast<unsigned char>(ch) < 0x20)
+            {
+                return false;
+            }
+            ++destEnd;
+        }
+        pos = destEnd;
+        while (pos < text.size() && isSpace(text[pos]))
+        {
+            ++pos;
+        }
+        if (pos >= text.size())
+        {
+            return true;
+        }
+        if (pos == destEnd)
+        {
+            return false;
+        }
+        char opener = text[pos];
+        char closer = (opener == '(') ? ')' : opener;
+        if (opener != '"' && opener != '\'' && opener != '(')
+        {
+            return false;
+        }
+        size_t titleEnd = text.find(closer, pos + 1);
+        if (titleEnd == std::string_view::npos
+            || text.substr(pos + 1, titleEnd - pos - 1).find_first_of("\\\"'()") != std::string_view::npos)
+        {
+            return false;
+        }
+        for (pos = titleEnd + 1; pos < text.size(); ++pos)
+        {
+            if (!isSpace(text[pos]))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    // Skips leading block quote markers and list item markers.
+    auto skipContainerPrefixes = [&](std::string_view line)
+    {
+        size_t pos = 0;
+        while (true)
+        {
+            size_t start = pos;
+            while (pos < line.size() && line[pos] == ' ' && pos - start < 3)
+            {
+                ++pos;
+            }
+            if (pos < line.size() && line[pos] == '>')
+            {
+                ++pos;
+                continue;
+            }
+            if (pos + 1 < line.size() && (line[pos] == '-' || line[pos] == '+' || line[pos] == '*') && isSpace(line[pos + 1]))
+            {
+                pos += 2;
+                continue;
+            }
+            size_t digits = pos;
+            while (digits < line.size() && digits - pos < 9 && line[digits] >= '0' && line[digits] <= '9')
+            {
+                ++digits;
+            }
+            if (digits > pos && digits + 1 < line.size() && (line[digits] == '.' || line[digits] == ')') && isSpace(line[digits + 1]))
+            {
+                pos = digits + 2;
+                continue;
+            }
+            return start;
+        }
+    };
+
+    size_t sectionStart = 0;
+    size_t lineStart = 0;
+    bool previousBlank = true;
+    bool previousDefinition = false;
+    char fenceChar = 0;
+    size_t fenceLength = 0;
+    int htmlKind = 0;
+    bool htmlUntilBlank = false;
+    bool inTable = false;
+    while (lineStart < markdown.size())
+    {
+        size_t lineEnd = markdown.find('\n', lineStart);
+        size_t nextLine = (lineEnd == std::string_view::npos) ? markdown.size() : lineEnd + 1;
+        if (lineEnd == std::string_view::npos)
+        {
+            lineEnd = markdown.size();
+        }
+        std::string_view line = markdown.substr(lineStart, lineEnd - lineStart);
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+
+        size_t indent = 0;
+        bool tabIndent = false;
+        while (indent < line.size() && isSpace(line[indent]))
+        {
+            tabIndent = tabIndent || line[indent] == '\t';
+            ++indent;
+        }
+        bool blank = (indent == line.size());
+        if (tabIndent)
+        {
+            indent = (std::max)(indent, static_cast<size_t>(4));
+        }
+        size_t runLength = 0;
+        while (indent + runLength < line.size() && (line[indent + runLength] == '`' || line[indent + runLength] == '~')
+            && line[indent + runLength] == line[indent])
+        {
+            ++runLength;
+        }
+        bool fenceLike = runLength >= 3 && indent < 4
+            && !(line[indent] == '`' && line.find('`', indent + runLength) != std::string_view::npos);
+
+        if (fenceChar)
+        {
+            if (fenceLike && line[indent] == fenceChar && runLength >= fenceLength
+                && line.find_first_not_of(" \t", indent + runLength) == std::string_view::npos)
+            {
+                fenceChar = 0;
+            }
+            previousBlank = false;
+            previousDefinition = false;
+            lineStart = nextLine;
+            continue;
+        }
+
+        size_t content = skipContainerPrefixes(line);
+        if (content > 0 || indent >= 4)
+        {
+            size_t marker = line.find_first_not_of(" \t", content);
+            if (marker != std::string_view::npos && (line[marker] == '`' || line[marker] == '~')
+                && line.compare(marker, 3, std::string(3, line[marker])) == 0)
+            {
+                // A fence inside a quote or list item, or indented as deep as list item content;
+                // md4c decides where it closes by the containers, which this scan does not track.
+                return false;
+            }
+        }
+        size_t bracket = content;
+        while (bracket < line.size() && isSpace(line[bracket]))
+        {
+            ++bracket;
+        }
+        std::string_view bracketText = line.substr(bracket);
+        bool definitionLike = !bracketText.empty() && bracketText[0] == '['
+            && (bracketText.find("]:") != std::string_view::npos || bracketText.find(']') == std::string_view::npos);
+        if (previousDefinition && !blank && !definitionLike)
+        {
+            // The line could still turn the definition into a table header or setext heading.
+            return false;
+        }
+
+        if (htmlKind)
+        {
+            // Where the block really ends depends on containers this scan does not track.
+            if (fenceLike || definitionLike)
+            {
+                return false;
+            }
+            if (indent < 4)
+            {
+                int kind = htmlBlockKind(line, indent);
+                if (kind && kind != htmlKind)
+                {
+                    return false;
+                }
+            }
+            if (htmlBlockEnds(line, 0, htmlKind))
+            {
+                htmlKind = 0;
+            }
+            previousBlank = blank;
+            previousDefinition = false;
+            lineStart = nextLine;
+            continue;
+        }
+
+        if (blank)
+        {
+            previousBlank = true;
+            previousDefinition = false;
+            htmlUntilBlank = false;
+            inTable = false;
+            lineStart = nextLine;
+            continue;
+        }
+        if (htmlUntilBlank && (fenceLike || definitionLike))
+        {
+            // Inside an HTML block that only a blank line closes, or a paragraph; cannot tell which.
+            return false;
+        }
+        if (inTable && fenceLike)
+        {
+            // md4c keeps such a line as a table row instead of opening a fence.
+            return false;
+        }
+
+        unsigned char first = static_cast<unsigned char>(line[0]);
+        bool safeStart = (first >= 'A' && first <= 'Z') || (first >= 'a' && first <= 'z') || first == '#' || first >= 0x80;
+        if (previousBlank && safeStart && lineStart > sectionStart && lineStart - sectionStart >= targetSectionBytes)
+        {
+            sections.push_back(markdown.substr(sectionStart, lineStart - sectionStart));
+            sectionStart = lineStart;
+        }
+
+        if (fenceLike)
+        {
+            if (indent != 0)
+            {
+                // Could belong to a list item or to the top level; only a full parse can tell.
+                return false;
+            }
+            fenceChar = line[0];
+            fenceLength = runLength;
+            previousBlank = false;
+            previousDefinition = false;
+            lineStart = nextLine;
+            continue;
+        }
+
+        if (indent < 4 && line[indent] == '<')
+        {
+            int kind = htmlBlockKind(line, indent);
+            if (kind == 0)
+            {
+                htmlUntilBlank = true;
+            }
+            else if (!htmlBlockEnds(line, indent + 2, kind))
+            {
+                htmlKind = kind;
+            }
+        }
+
+        bool definition = false;
+        if (definitionLike)
+        {
+            if (htmlKind || htmlUntilBlank || bracket - content > 3 || !(previousBlank || previousDefinition)
+                || !isSimpleDefinition(bracketText))
+            {
+                return false;
+            }
+            definitions.append(bracketText);
+            definitions.push_back('\n');
+            definition = true;
+        }
+
+        if (!previousBlank && line.find('|') != std::string_view::npos && line.find('-') != std::string_view::npos
+            && line.find_first_not_of("|-: \t") == std::string_view::npos)
+        {
+            inTable = true;
+        }
+        previousBlank = false;
+        previousDefinition = definition;
+        lineStart = nextLine;
+    }
+
+    sections.push_back(markdown.substr(sectionStart));
+    if (!definitions.empty())
+    {
+        definitions.push_back('\n');
+    }
+    return true;
+}
+
+// Every safe cut, unless the definitions repeated in front of each section would outweigh the
+// document; then sections are made at least as long as the definitions.
+bool SplitMarkdownPageSections(std::string_view markdown, std::vector<std::string_view>& sections, std::string& definitions)
+{
+    if (!SplitMarkdownIntoSections(markdown, 0, sections, definitions))
+    {
+        return false;
+    }
+    if (!definitions.empty() && definitions.size() * sections.size() > markdown.size())
+    {
+        return SplitMarkdownIntoSections(markdown, definitions.size(), sections, definitions);
+    }
+    return true;
+}
+
+// =====================
+// コードハイライト
+// =====================
+
+// Token classes emitted by the fenced code highlighter; indexes kCodeTokenClasses.
+enum class CodeToken : unsigned char
+{
+    Plain,
+    Keyword,
+    String,
+    Comment,
+    Number,
+    Meta,
+    Key,
+    Variable
+};
+
+constexpr const char* kCodeTokenClasses[] = { "", "tok-kw", "tok-str", "tok-com", "tok-num", "tok-meta", "tok-key", "tok-var" };
+
+constexpr unsigned char kCodeIdentStart = 1;
+constexpr unsigned char kCodeIdentPart = 2;
+constexpr unsigned char kCodeDigit = 4;
+constexpr auto kCodeCharClass = []()
+{
+    std::array<unsigned char, 256> table{};
+    for (int ch = 0; ch < 256; ++ch)
+    {
+        bool alpha = (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || ch == '_' || ch >= 0x80;
+        bool digit = ch >= '0' && ch <= '9';
+        table[ch] = static_cast<unsigned char>((alpha ? kCodeIdentStart | kCodeIdentPart : 0) | (digit ? kCodeIdentPart | kCodeDigit : 0));
+    }
+    return table;
+}();
+
+// Keyword tables are kept in byte order for binary search.
+constexpr std::string_view kCppKeywords[] = {
+    "alignas", "alignof", "auto", "bool", "break", "case", "catch", "char", "class", "const", "const_cast",
+    "constexpr", "continue", "decltype", "default", "delete", "do", "double", "dynamic_cast", "else", "enum",
+    "explicit", "extern", "false", "final", "float", "for", "friend", "goto", "if", "inline", "int", "long",
+    "mutable", "namespace", "new", "noexcept", "nullptr", "operator", "override", "private", "protected",
+    "public", "register", "reinterpret_cast", "return", "short", "signed", "sizeof", "static", "static_assert",
+    "static_cast", "struct", "switch", "template", "this", "throw", "true", "try", "typedef", "typename",
+    "union", "unsigned", "using", "virtual", "void", "volatile", "while"
+};
+constexpr std::string_view kPythonKeywords[] = {
+    "False", "None", "True", "and", "as", "assert", "async", "await", "break", "class", "continue", "def",
+    "del", "elif", "else", "except", "finally", "for", "from", "global", "if", "import", "in", "is", "lambda",
+    "nonlocal", "not", "or", "pass", "raise", "return", "self", "try", "while", "with", "yield"
+};
+constexpr std::string_view kJsonKeywords[] = { "false", "null", "true" };
+constexpr std::string_view kShellKeywords[] = {
+    "case", "do", "done", "elif", "else", "esac", "exit", "export", "fi", "for", "function", "if", "in",
+    "local", "readonly", "return", "shift", "then", "until", "while"
+};
+constexpr std::string_view kYamlKeywords[] = { "False", "Null", "True", "false", "no", "null", "off", "on", "true", "yes" };
+
+// Fence info strings are matched case-insensitively against the space separated names.
+constexpr CodeLanguage kCodeLanguages[] = {
+    {
+        .names = "c cpp c++ cc cxx h hpp hxx cu",
+        .keywords = kCppKeywords,
+        .keywordCount = std::size(kCppKeywords),
+        .lineComment = "//",
+        .blockComments = true,
+        .preprocessor = true,
+        .singleQuoteStrings = true
+    },
+    {
+        .names = "python py python3 py3",
+        .keywords = kPythonKeywords,
+        .keywordCount = std::size(kPythonKeywords),
+        .lineComment = "#",
+        .decorators = true,
+        .tripleQuotes = true,
+        .stringPrefixes = true,
+        .singleQuoteStrings = true
+    },
+    {
+        .names = "json jsonc json5",
+        .keywords = kJsonKeywords,
+        .keywordCount = std::size(kJsonKeywords),
+        .lineComment = "//",
+        .blockComments = true,
+        .jsonKeys = true
+    },
+    {
+        .names = "sh bash shell zsh ksh console",
+        .keywords = kShellKeywords,
+        .keywordCount = std::size(kShellKeywords),
+        .lineComment = "#",
+        .singleQuoteStrings = true,
+        .shellSyntax = true
+    },
+    {
+        .names = "yaml yml",
+        .keywords = kYamlKeywords,
+        .keywordCount = std::size(kYamlKeywords),
+        .lineComment = "#",
+        .singleQuoteStrings = true,
+        .yamlKeys = true
+    }
+};
+
+const CodeLanguage* FindCodeLanguage(std::string_view info)
+{
+    if (info.empty())
+    {
+        return nullptr;
+    }
+    for (const CodeLanguage& language : kCodeLanguages)
+    {
+        std::string_view names = language.names;
+        while (!names.empty())
+        {
+            size_t space = names.find(' ');
+            std::string_view name = names.substr(0, space);
+            if (EqualsAsciiNoCase(name, info))
+            {
+                return &language;
+            }
+            names = (space == std::string_view::npos) ? std::string_view() : names.substr(space + 1);
+        }
+    }
+    return nullptr;
+}
+
+// Appends the raw code HTML-escaped, with the tokens of the language wrapped in span classes.
+// One forward scan; the only allocations are the growth of html itself.
+void HighlightCode(const CodeLanguage& language, std::string_view code, std::string& html)
+{
+    constexpr size_t npos = std::string_view::npos;
+    const size_t size = code.size();
+    auto charClass = [](char ch)
+    {
+        return kCodeCharClass[static_cast<unsigned char>(ch)];
+    };
+    auto appendEscaped = [&](size_t begin, size_t end)
+    {
+        size_t run = begin;
+        for (size_t index = begin; index < end; ++index)
+        {
+            const char* entity = nullptr;
+            switch (code[index])
+            {
+            case '&':
+                entity = "&amp;";
+                break;
+            case '<':
+                entity = "&lt;";
+                break;
+            case '>':
+                entity = "&gt;";
+                break;
+            case '"':
+                entity = "&quot;";
+                break;
+            default:
+                continue;
+            }
+            html.append(code.data() + run, index - run);
+            html += entity;
+            run = index + 1;
+        }
+        html.append(code.data() + run, end - run);
+    };
+    auto lineEnd = [&](size_t pos)
+    {
+        size_t end = code.find('\n', pos);
+        return (end == npos) ? size : end;
+    };
+    // Returns the offset just past the closing quote. Single-quote-character strings stop at the
+    // line end except in shell, where quoting spans lines and '...' has no escapes.
+    auto stringEnd = [&](size_t pos, std::string_view quote)
+    {
+        bool escapes = !(language.shellSyntax && quote == "'");
+        size_t index = pos + quote.size();
+        while (index < size)
+        {
+            char ch = code[index];
+            if (ch == '\\' && escapes)
+            {
+                index += 2;
+                continue;
+            }
+            if (code.compare(index, quote.size(), quote) == 0)
+            {
+                return index + quote.size();
+            }
+            if (ch == '\n' && quote.size() == 1 && !language.shellSyntax)
+            {
+                return index;
+            }
+            ++index;
+        }
+        return size;
+    };
+    auto openingQuote = [&](size_t pos)
+    {
+        std::string_view rest = code.substr(pos);
+        if (language.tripleQuotes && (rest.starts_with("\"\"\"") || rest.starts_with("'''")))
+        {
+            return rest.substr(0, 3);
+        }
+        return rest.substr(0, 1);
+    };
+
+    size_t plainStart = 0;
+    size_t pos = 0;
+    bool lineStart = true;
+    auto emit = [&](CodeToken kind, size_t begin, size_t end)
+    {
+        appendEscaped(plainStart, begin);
+        html += "<span class=\"";
+        html += kCodeTokenClasses[static_cast<size_t>(kind)];
+        html += "\">";
+        appendEscaped(begin, end);
+        html += "</span>";
+        plainStart = end;
+        pos = end;
+    };
+
+    while (pos < size)
+    {
+        char ch = code[pos];
+        if (ch == '\n')
+        {
+            lineStart = true;
+            ++pos;
+            continue;
+        }
+        if (ch == ' ' || ch == '\t' || ch == '\r')
+        {
+            ++pos;
+            continue;
+        }
+        bool atLineStart = lineStart;
+        lineStart = false;
+        std::string_view rest = code.substr(pos);
+
+        if (!language.lineComment.empty() && rest.starts_with(language.lineComment)
+            && (!(language.shellSyntax || language.yamlKeys) || pos == 0 || code[pos - 1] == ' ' || code[pos - 1] == '\t' || code[pos - 1] == '\n'))
+        {
+            emit(CodeToken::Comment, pos, lineEnd(pos));
+            continue;
+        }
+        if (language.blockComments && rest.starts_with("/*"))
+        {
+            size_t close = code.find("*/", pos + 2);
+            emit(CodeToken::Comment, pos, (close == npos) ? size : close + 2);
+            continue;
+        }
+        if (language.preprocessor && atLineStart && ch == '#')
+        {
+            size_t end = lineEnd(pos);
+            while (end < size && code[end - 1] == '\\')
+            {
+                end = lineEnd(end + 1);
+            }
+            emit(CodeToken::Meta, pos, end);
+            continue;
+        }
+        if (language.decorators && atLineStart && ch == '@')
+        {
+            size_t end = pos + 1;
+            while (end < size && ((charClass(code[end]) & kCodeIdentPart) || code[end] == '.'))
+            {
+                ++end;
+            }
+            emit(CodeToken::Meta, pos, end);
+            continue;
+        }
+        if (language.yamlKeys && atLineStart)
+        {
+            size_t keyStart = pos;
+            if (ch == '-' && pos + 1 < size && code[pos + 1] == ' ')
+            {
+                keyStart = code.find_first_not_of(' ', pos + 1);
+                keyStart = (keyStart == npos) ? size : keyStart;
+            }
+            size_t keyEnd = keyStart;
+            while (keyEnd < size && ((charClass(code[keyEnd]) & kCodeIdentPart) || code[keyEnd] == '-' || code[keyEnd] == '.' || code[keyEnd] == '/'))
+            {
+                ++keyEnd;
+            }
+            if (keyEnd > keyStart && keyEnd < size && code[keyEnd] == ':'
+                && (keyEnd + 1 == size || code[keyEnd + 1] == ' ' || code[keyEnd + 1] == '\n' || code[keyEnd + 1] == '\r'))
+            {
+                emit(CodeToken::Key, keyStart, keyEnd);
+                continue;
+            }
+        }
+        if (ch == '"' || (ch == '\'' && language.singleQuoteStrings))
+        {
+            size_t end = stringEnd(pos, openingQuote(pos));
+            CodeToken kind = CodeToken::String;
+            if (language.jsonKeys)
+            {
+                size_t next = code.find_first_not_of(" \t\r\n", end);
+                if (next != npos && code[next] == ':')
+                {
+                    kind = CodeToken::Key;
+                }
+            }
+            emit(kind, pos, end);
+            continue;
+        }
+        if (language.shellSyntax && ch == '$')
+        {
+            size_t end = pos + 1;
+            if (end < size && code[end] == '{')
+            {
+                size_t close = code.find('}', end);
+                end = (close == npos || close > lineEnd(pos)) ? end : close + 1;
+            }
+            else if (end < size && (charClass(code[end]) & kCodeIdentPart))
+            {
+                while (end < size && (charClass(code[end]) & kCodeIdentPart))
+                {
+                    ++end;
+                }
+            }
+            else if (end < size && std::string_view("@*#?$!-").find(code[end]) != npos)
+            {
+                ++end;
+            }
+            if (end > pos + 1)
+            {
+                emit(CodeToken::Variable, pos, end);
+            }
+            else
+            {
+                ++pos;
+            }
+            continue;
+        }
+        unsigned char cls = charClass(ch);
+        if ((cls & kCodeDigit) || (ch == '.' && pos + 1 < size && (charClass(code[pos + 1]) & kCodeDigit)))
+        {
+            size_t end = pos + 1;
+            while (end < size && ((charClass(code[end]) & kCodeIdentPart) || code[end] == '.'))
+            {
+                ++end;
+            }
+            if (language.shellSyntax)
+            {
+                pos = end;
+            }
+            else
+            {
+                emit(CodeToken::Number, pos, end);
+            }
+            continue;
+        }
+        if (cls & kCodeIdentStart)
+        {
+            size_t end = pos + 1;
+            while (end < size && (charClass(code[end]) & kCodeIdentPart))
+            {
+                ++end;
+            }
+            std::string_view word = code.substr(pos, end - pos);
+            if (language.stringPrefixes && word.size() <= 2 && end < size && (code[end] == '"' || code[end] == '\'')
+                && word.find_first_not_of("rbfuRBFU") == npos)
+            {
+                emit(CodeToken::String, pos, stringEnd(end, openingQuote(end)));
+                continue;
+            }
+            if (std::binary_search(language.keywords, language.keywords + language.keywordCount, word))
+            {
+                emit(CodeToken::Keyword, pos, end);
+                continue;
+            }
+            pos = end;
+            continue;
+        }
+        ++pos;
+    }
+    appendEscaped(plainStart, size);
+}
+
+// Decodes the four escapes md4c emits in text ("&amp;", "&lt;", "&gt;", "&quot;").
+void AppendHtmlUnescaped(std::string_view escaped, std::string& text)
+{
+    size_t run = 0;
+    for (size_t amp = escaped.find('&'); amp != std::string_view::npos; amp = escaped.find('&', run))
+    {
+        text.append(escaped.data() + run, amp - run);
+        std::string_view entity = escaped.substr(amp);
+        if (entity.starts_with("&amp;"))
+        {
+            text.push_back('&');
+            run = amp + 5;
+        }
+        else if (entity.starts_with("&lt;"))
+        {
+            text.push_back('<');
+            run = amp + 4;
+        }
+        else if (entity.starts_with("&gt;"))
+        {
+            text.push_back('>');
+            run = amp + 4;
+        }
+        else if (entity.starts_with("&quot;"))
+        {
+            text.push_back('"');
+            run = amp + 6;
+        }
+        else
+        {
+            text.push_back('&');
+            run = amp + 1;
+        }
+    }
+    text.append(escaped.data() + run, escaped.size() - run);
+}
+
+// =====================
+// Markdown 出力
+// =====================
+
+void HighlightClosedCodeBlock(MarkdownHtmlWriter& writer)
+{
+    std::string& output = *writer.output;
+    std::string& code = writer.code;
+    code.clear();
+    code.reserve(output.size() - writer.codeStart);
+    AppendHtmlUnescaped(std::string_view(output).substr(writer.codeStart), code);
+
+    output.resize(writer.codeStart);
+    HighlightCode(*writer.language, code, output);
+}
+
+// GitHub style anchor: ASCII letters lowercased, spaces to '-', other ASCII punctuation dropped,
+// UTF-8 sequences kept. Repeated slugs are numbered afterwards by AssignMarkdownHeadingIds.
+void MakeHeadingId(std::string_view text, std::string& id)
+{
+    id.clear();
+    for (char ch : text)
+    {
+        unsigned char byte = static_cast<unsigned char>(ch);
+        if (byte >= 'A' && byte <= 'Z')
+        {
+            id.push_back(static_cast<char>(byte - 'A' + 'a'));
+        }
+        else if ((byte >= 'a' && byte <= 'z') || (byte >= '0' && byte <= '9') || byte == '-' || byte == '_' || byte >= 0x80)
+        {
+            id.push_back(ch);
+        }
+        else if (byte == ' ')
+        {
+            id.push_back('-');
+        }
+    }
+    if (id.empty())
+    {
+        id = "section";
+    }
+}
+
+// Called with the heading content complete and its closing tag not yet written: records the
+// outline entry and gives the opening tag an id.
+void FinishMarkdownHeading(MarkdownHtmlWriter& writer)
+{
+    std::string& output = *writer.output;
+    std::string_view inner = std::string_view(output).substr(writer.headingStart + 4);
+    MarkdownHeading heading;
+    heading.level = writer.headingLevel;
+    heading.offset = writer.headingStart;
+
+    std::string& text = writer.code;
+    text.clear();
+    size_t tagEnd = 0;
+    for (size_t tag = inner.find('<'); tag != std::string_view::npos; tag = inner.find('<', tagEnd))
+    {
+        AppendHtmlUnescaped(inner.substr(tagEnd, tag - tagEnd), text);
+        size_t close = inner.find('>', tag);
+        tagEnd = (close == std::string_view::npos) ? inner.size() : close + 1;
+    }
+    AppendHtmlUnescaped(inner.substr(tagEnd), text);
+    for (char ch : text)
+    {
+        bool space = ch == ' ' || ch == '\n' || ch == '\t';
+        if (space && (heading.text.empty() || heading.text.back() == ' '))
+        {
+            continue;
+        }
+        heading.text.push_back(space ? ' ' : ch);
+    }
+    if (!heading.text.empty() && heading.text.back() == ' ')
+    {
+        heading.text.pop_back();
+    }
+
+    MakeHeadingId(heading.text, heading.slug);
+    heading.id = heading.slug;
+    std::string attribute = " id=\"";
+    attribute += heading.id;
+    attribute += '"';
+    output.insert(writer.headingStart + 3, attribute);
+    writer.headings->push_back(std::move(heading));
+}
+
+// Numbers repeated slugs the way GitHub does: the second "usage" becomes usage-1, the third
+// usage-2, skipping any id an earlier heading already spells out. Sections are rendered apart,
+// so this runs over the whole page; the id attributes in html are rewritten and the offsets
+// behind each edit move with it.
+void AssignMarkdownHeadingIds(std::string& html, std::vector<MarkdownHeading>& headings, std::vector<size_t>& sectionStarts)
+{
+    std::unordered_map<std::string, size_t> occurrences;
+    std::vector<std::string> ids(headings.size());
+    bool changed = false;
+    for (size_t index = 0; index < headings.size(); ++index)
+    {
+        const std::string& slug = headings[index].slug;
+        std::string& id = ids[index];
+        id = slug;
+        while (occurrences.contains(id))
+        {
+            id = slug + '-' + std::to_string(++occurrences[slug]);
+        }
+        occurrences[id] = 0;
+        changed = changed || id != headings[index].id;
+    }
+    if (!changed)
+    {
+        return;
+    }
+
+    // Each heading opens as <hN id="..."; the value starts 8 bytes past the offset.
+    std::string rewritten;
+    rewritten.reserve(html.size() + html.size() / 64);
+    size_t copied = 0;
+    size_t section = 0;
+    for (size_t index = 0; index < headings.size(); ++index)
+    {
+        MarkdownHeading& heading = headings[index];
+        size_t value = heading.offset + 8;
+        for (; section < sectionStarts.size() && sectionStarts[section] < value; ++section)
+        {
+            sectionStarts[section] = sectionStarts[section] - copied + rewritten.size();
+        }
+        heading.offset = heading.offset - copied + rewritten.size();
+        rewritten.append(html, copied, value - copied);
+        rewritten += ids[index];
+        copied = value + heading.id.size();
+        heading.id = std::move(ids[index]);
+    }
+    for (; section < sectionStarts.size(); ++section)
+    {
+        sectionStarts[section] = sectionStarts[section] - copied + rewritten.size();
+    }
+    rewritten.append(html, copied, std::string::npos);
+    html.swap(rewritten);
+}
+
+void WriteMarkdownHtml(const MD_CHAR* text, MD_SIZE size, void* userdata)
+{
+    auto* writer = static_cast<MarkdownHtmlWriter*>(userdata);
+    std::string& output = *writer->output;
+    std::string_view chunk(text, size);
+    switch (writer->state)
+    {
+    case CodeBlockState::None:
+        if (chunk == "<pre><code")
+        {
+            writer->state = CodeBlockState::AfterPre;
+        }
+        else if (writer->headings && chunk.size() == 4 && chunk.starts_with("<h") && chunk[2] >= '1' && chunk[2] <= '6' && chunk[3] == '>')
+        {
+            writer->headingLevel = chunk[2] - '0';
+            writer->headingStart = output.size();
+        }
+        else if (writer->headingLevel && chunk.size() == 6 && chunk.starts_with("</h") && chunk[3] == '0' + writer->headingLevel
+            && chunk.ends_with(">\n"))
+        {
+            FinishMarkdownHeading(*writer);
+            writer->headingLevel = 0;
+        }
+        break;
+    case CodeBlockState::AfterPre:
+        writer->state = (chunk == " class=\"language-") ? CodeBlockState::Language : CodeBlockState::None;
+        writer->languageStart = output.size() + size;
+        break;
+    case CodeBlockState::Language:
+        if (chunk == "\"")
+        {
+            writer->language = FindCodeLanguage(std::string_view(output).substr(writer->languageStart));
+            writer->state = writer->language ? CodeBlockState::AfterLanguage : CodeBlockState::None;
+        }
+        break;
+    case CodeBlockState::AfterLanguage:
+        writer->state = (chunk == ">") ? CodeBlockState::Code : CodeBlockState::None;
+        writer->codeStart = output.size() + size;
+        break;
+    case CodeBlockState::Code:
+        if (chunk == "</code></pre>\n")
+        {
+            HighlightClosedCodeBlock(*writer);
+            writer->state = CodeBlockState::None;
+        }
+        break;
+    }
+    output.append(text, size);
+}
+
+// One md_html pass in the GitHub dialect through writer, which may be reused between passes.
+bool RenderMarkdownHtml(std::string_view markdown, MarkdownHtmlWriter& writer)
+{
+    writer.state = CodeBlockState::None;
+    writer.headingLevel = 0;
+    return md_html(markdown.data(), static_cast<MD_SIZE>(markdown.size()), WriteMarkdownHtml, &writer, MD_DIALECT_GITHUB, 0) == 0;
+}
+
+// =====================
+// Markdown キャッシュ
+// =====================
+
+// 64-bit multiply/rotate hash over 8-byte words; only used to key the in-memory caches.
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+{
+    constexpr uint64_t kMultiplier = 0x9E3779B97F4A7C15ull;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed ^ (size * kMultiplier);
+    size_t index = 0;
+    for (; index + 8 <= size; index += 8)
+    {
+        uint64_t word = 0;
+        memcpy(&word, bytes + index, sizeof(word));
+        word *= 0xBF58476D1CE4E5B9ull;
+        word ^= word >> 31;
+        hash = (hash ^ word) * kMultiplier;
+        hash = (hash << 27) | (hash >> 37);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + index, size - index);
+    hash ^= tail * 0x94D049BB133111EBull;
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBull;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+const MarkdownHtmlCacheEntry* FindCachedMarkdownHtml(MarkdownHtmlCache& cache, uint64_t key, size_t markdownSize)
+{
+    for (auto& entry : cache.entries)
+    {
+        if (entry.key == key && entry.markdownSize == markdownSize)
+        {
+            entry.lastUse = ++cache.clock;
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void StoreCachedMarkdownHtml(MarkdownHtmlCache& cache, uint64_t key, size_t markdownSize, const std::shared_ptr<const MarkdownPage>& page)
+{
+    // A page that would take most of the budget would only evict everything else.
+    size_t pageBytes = page->html.size();
+    if (pageBytes > cache.budgetBytes / 2)
+    {
+        return;
+    }
+    for (auto it = cache.entries.begin(); it != cache.entries.end(); ++it)
+    {
+        if (it->key == key && it->markdownSize == markdownSize)
+        {
+            cache.bytes -= it->page->html.size();
+            cache.entries.erase(it);
+            break;
+        }
+    }
+    while (!cache.entries.empty() && cache.bytes + pageBytes > cache.budgetBytes)
+    {
+        auto oldest = std::min_element(
+            cache.entries.begin(),
+            cache.entries.end(),
+            [](const MarkdownHtmlCacheEntry& left, const MarkdownHtmlCacheEntry& right)
+            {
+                return left.lastUse < right.lastUse;
+            });
+        cache.bytes -= oldest->page->html.size();
+        cache.entries.erase(oldest);
+    }
+
+    MarkdownHtmlCacheEntry entry;
+    entry.key = key;
+    entry.markdownSize = markdownSize;
+    entry.lastUse = ++cache.clock;
+    entry.page = page;
+    cache.bytes += pageBytes;
+    cache.entries.push_back(std::move(entry));
+}
+
+void ClearMarkdownHtmlCache(MarkdownHtmlCache& cache)
+{
+    cache.entries.clear();
+    cache.entries.shrink_to_fit();
+    cache.bytes = 0;
+}
+
+// =====================
+// Markdown ページ
+// =====================
+
+// Renders sections [first, last) each behind a section marker and appends them to html, recording
+// where every marker starts. Large runs are spread over all cores in groups of about
+// kMarkdownParallelChunkBytes; the output does not depend on the number of workers.
+bool RenderMarkdownSections(
+    const std::vector<std::string_view>& sections,
+    size_t first,
+    size_t last,
+    const std::string& definitions,
+    std::string& html,
+    std::vector<size_t>& sectionStarts,
+    std::vector<MarkdownHeading>& headings)
+{
+    std::vector<size_t> groupStarts;
+    size_t groupBytes = 0;
+    size_t totalBytes = 0;
+    for (size_t index = first; index < last; ++index)
+    {
+        if (index == first || groupBytes >= kMarkdownParallelChunkBytes)
+        {
+            groupStarts.push_back(index);
+            groupBytes = 0;
+        }
+        groupBytes += sections[index].size();
+        totalBytes += sections[index].size();
+    }
+    groupStarts.push_back(last);
+    size_t groupCount = groupStarts.size() - 1;
+
+    struct GroupOutput
+    {
+        std::string html;
+        std::vector<size_t> sectionStarts;
+        std::vector<MarkdownHeading> headings;
+    };
+    std::vector<GroupOutput> outputs(groupCount);
+    std::atomic<size_t> nextGroup{ 0 };
+    std::atomic<bool> failed{ false };
+    auto renderGroups = [&]()
+    {
+        std::string input;
+        MarkdownHtmlWriter writer;
+        for (size_t group = nextGroup++; group < groupCount && !failed; group = nextGroup++)
+        {
+            GroupOutput& output = outputs[group];
+            writer.output = &output.html;
+            writer.headings = &output.headings;
+            for (size_t index = groupStarts[group]; index < groupStarts[group + 1]; ++index)
+            {
+                std::string_view section = sections[index];
+                if (!definitions.empty())
+                {
+                    input.assign(definitions);
+                    input.append(section);
+                    section = input;
+                }
+                output.sectionStarts.push_back(output.html.size());
+                output.html += kMarkdownSectionMarker;
+                if (!RenderMarkdownHtml(section, writer))
+                {
+                    failed = true;
+                    break;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    if (totalBytes >= kMarkdownParallelMinBytes)
+    {
+        unsigned int workerCount = (std::max)(1u, std::thread::hardware_concurrency());
+        size_t extraWorkers = (std::min)(static_cast<size_t>(workerCount), groupCount) - 1;
+        for (size_t i = 0; i < extraWorkers; ++i)
+        {
+            workers.emplace_back(renderGroups);
+        }
+    }
+    renderGroups();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    if (failed)
+    {
+        return false;
+    }
+
+    for (auto& output : outputs)
+    {
+        size_t base = html.size();
+        for (size_t start : output.sectionStarts)
+        {
+            sectionStarts.push_back(base + start);
+        }
+        for (MarkdownHeading& heading : output.headings)
+        {
+            heading.offset += base;
+            headings.push_back(std::move(heading));
+        }
+        html.append(output.html);
+        std::string().swap(output.html);
+    }
+    return true;
+}
+
+// Renders the page body section by section; the sections are hashed so a reload can tell which
+// ones changed. Documents the splitter cannot place are rendered in one md_html pass.
+bool RenderMarkdownBody(std::string_view markdown, MarkdownPage& page)
+{
+    page.sectionStarts.clear();
+    page.sectionHashes.clear();
+    page.headings.clear();
+    std::vector<std::string_view> sections;
+    std::string definitions;
+    if (!SplitMarkdownPageSections(markdown, sections, definitions))
+    {
+        MarkdownHtmlWriter writer;
+        writer.output = &page.html;
+        writer.headings = &page.headings;
+        if (!RenderMarkdownHtml(markdown, writer))
+        {
+            return false;
+        }
+        AssignMarkdownHeadingIds(page.html, page.headings, page.sectionStarts);
+        return true;
+    }
+
+    page.definitionsHash = HashBytes(definitions.data(), definitions.size(), 0);
+    page.sectionHashes.reserve(sections.size());
+    for (std::string_view section : sections)
+    {
+        page.sectionHashes.push_back(HashBytes(section.data(), section.size(), 0));
+    }
+    page.sectionStarts.reserve(sections.size());
+    if (!RenderMarkdownSections(sections, 0, sections.size(), definitions, page.html, page.sectionStarts, page.headings))
+    {
+        page.sectionStarts.clear();
+        page.sectionHashes.clear();
+        page.headings.clear();
+        return false;
+    }
+    AssignMarkdownHeadingIds(page.html, page.headings, page.sectionStarts);
+    return true;
+}
+
+// Renders markdown between the page prologue and epilogue; bodyEnd is where the epilogue starts.
+bool RenderMarkdownPage(std::string_view markdown, std::string_view prologue, std::string_view epilogue, MarkdownPage& page)
+{
+    std::string& html = page.html;
+    html.reserve(prologue.size() + markdown.size() + markdown.size() / 4 + epilogue.size());
+    html.assign(prologue);
+    if (!RenderMarkdownBody(markdown, page))
+    {
+        page = MarkdownPage();
+        return false;
+    }
+    page.bodyEnd = html.size();
+    html += epilogue;
+    return true;
+}
+
+// Sections are compared by hash and only the run between the common prefix and suffix is
+// re-rendered; the new page is the previous one with that run's HTML replaced. Returns false when
+// the page has to be rendered in full instead, and true with no page when nothing changed.
+bool PatchMarkdownPage(const MarkdownPage& previous, std::string_view markdown, MarkdownPagePatch& patch)
+{
+    patch = MarkdownPagePatch();
+    if (previous.sectionStarts.empty())
+    {
+        return false;
+    }
+
+    std::vector<std::string_view> sections;
+    std::string definitions;
+    if (!SplitMarkdownPageSections(markdown, sections, definitions)
+        || HashBytes(definitions.data(), definitions.size(), 0) != previous.definitionsHash)
+    {
+        return false;
+    }
+    std::vector<uint64_t> hashes;
+    hashes.reserve(sections.size());
+    for (std::string_view section : sections)
+    {
+        hashes.push_back(HashBytes(section.data(), section.size(), 0));
+    }
+
+    size_t previousCount = previous.sectionHashes.size();
+    size_t limit = (std::min)(previousCount, hashes.size());
+    size_t prefix = 0;
+    while (prefix < limit && previous.sectionHashes[prefix] == hashes[prefix])
+    {
+        ++prefix;
+    }
+    size_t suffix = 0;
+    while (suffix < limit - prefix
+        && previous.sectionHashes[previousCount - 1 - suffix] == hashes[hashes.size() - 1 - suffix])
+    {
+        ++suffix;
+    }
+    if (prefix == previousCount && prefix == hashes.size())
+    {
+        return true;
+    }
+
+    auto previousStart = [&](size_t index)
+    {
+        return index < previousCount ? previous.sectionStarts[index] : previous.bodyEnd;
+    };
+    size_t removedEnd = previousCount - suffix;
+    patch.page = std::make_shared<MarkdownPage>();
+    MarkdownPage* page = patch.page.get();
+    page->html.reserve(previous.html.size() + markdown.size() / 8);
+    page->html.append(previous.html, 0, previousStart(prefix));
+    page->sectionStarts.assign(previous.sectionStarts.begin(), previous.sectionStarts.begin() + prefix);
+    size_t fragmentStart = page->html.size();
+    for (const MarkdownHeading& heading : previous.headings)
+    {
+        if (heading.offset >= fragmentStart)
+        {
+            break;
+        }
+        page->headings.push_back(heading);
+    }
+    if (!RenderMarkdownSections(sections, prefix, sections.size() - suffix, definitions, page->html, page->sectionStarts, page->headings))
+    {
+        patch.page.reset();
+        return false;
+    }
+    size_t fragmentEnd = page->html.size();
+    size_t tailStart = previousStart(removedEnd);
+    page->html.append(previous.html, tailStart, std::string::npos);
+    for (size_t index = removedEnd; index < previousCount; ++index)
+    {
+        page->sectionStarts.push_back(previous.sectionStarts[index] - tailStart + fragmentEnd);
+    }
+    size_t tailHeading = page->headings.size();
+    size_t previousTailHeading = previous.headings.size();
+    for (size_t index = 0; index < previous.headings.size(); ++index)
+    {
+        const MarkdownHeading& heading = previous.headings[index];
+        if (heading.offset >= tailStart)
+        {
+            previousTailHeading = (std::min)(previousTailHeading, index);
+            page->headings.push_back(heading);
+            page->headings.back().offset = heading.offset - tailStart + fragmentEnd;
+        }
+    }
+
+    // The prefix keeps its numbering; the script only replaces the fragment, so a tail heading
+    // that would be renumbered sends the page through a full navigation.
+    AssignMarkdownHeadingIds(page->html, page->headings, page->sectionStarts);
+    for (size_t index = tailHeading; index < page->headings.size(); ++index)
+    {
+        if (page->headings[index].id != previous.headings[previousTailHeading + index - tailHeading].id)
+        {
+            patch.page.reset();
+            return false;
+        }
+    }
+    fragmentEnd = page->html.size() - (previous.html.size() - tailStart);
+    page->bodyEnd = previous.bodyEnd - tailStart + fragmentEnd;
+    page->sectionHashes = std::move(hashes);
+    page->definitionsHash = previous.definitionsHash;
+    patch.firstSection = prefix;
+    patch.endSection = removedEnd;
+    patch.fragmentStart = fragmentStart;
+    patch.fragmentEnd = fragmentEnd;
+    return true;
+}
+
+// Progressive delivery batches: section starts at least kMarkdownParallelChunkBytes apart.
+std::vector<size_t> GetMarkdownPageBlockBounds(const MarkdownPage& page)
+{
+    std::vector<size_t> blockBounds;
+    if (page.sectionStarts.empty())
+    {
+        return blockBounds;
+    }
+    blockBounds.push_back(page.sectionStarts.front());
+    for (size_t start : page.sectionStarts)
+    {
+        if (start - blockBounds.back() >= kMarkdownParallelChunkBytes)
+        {
+            blockBounds.push_back(start);
+        }
+    }
+    blockBounds.push_back(page.bodyEnd);
+    return blockBounds;
+}
+
+// The block the first page ends at, or 0 when the page is small enough (or has too few blocks)
+// to be navigated whole.
+size_t FindProgressiveFirstPaintBlock(size_t htmlBytes, const std::vector<size_t>& blockBounds)
+{
+    size_t firstPaintBlock = 1;
+    while (firstPaintBlock < blockBounds.size() && blockBounds[firstPaintBlock] - blockBounds[0] < kProgressiveFirstPaintBytes)
+    {
+        ++firstPaintBlock;
+    }
+    if (htmlBytes < kProgressiveHtmlMinBytes || blockBounds.size() < 2 || firstPaintBlock + 1 >= blockBounds.size())
+    {
+        return 0;
+    }
+    return firstPaintBlock;
+}
+
+// The blocks before firstPaintBlock followed by the page's closing tags.
+std::string MakeProgressiveFirstPage(std::string_view html, const std::vector<size_t>& blockBounds, size_t firstPaintBlock)
+{
+    std::string firstPage;
+    firstPage.reserve(blockBounds[firstPaintBlock] + (html.size() - blockBounds.back()));
+    firstPage.append(html.substr(0, blockBounds[firstPaintBlock]));
+    firstPage.append(html.substr(blockBounds.back()));
+    return firstPage;
+}
+
+// The block the batch starting at nextBlock ends at: at least one block, then whole blocks up to
+// kProgressiveBatchBytes.
+size_t FindProgressiveBatchEnd(const std::vector<size_t>& blockBounds, size_t nextBlock)
+{
+    size_t last = blockBounds.size() - 1;
+    size_t endBlock = nextBlock + 1;
+    while (endBlock < last && blockBounds[endBlock] - blockBounds[nextBlock] < kProgressiveBatchBytes)
+    {
+        ++endBlock;
+    }
+    return endBlock;
+}
+
+// =====================
+// HTML 挿入位置
+// =====================
+
+// Walks the document prologue (BOM, comments, doctype, processing instructions and the
+// <html> tag) and returns the offset just inside <head>. When the document has no explicit
+// head, the offset is where the implied one would start, so the style never lands ahead of
+// the doctype and switch the page to quirks mode. The scan covers kMaxPrologueBytes past the
+// last comment, however long that is; when something is left open the offset falls back to
+// just past the doctype or <html> tag.
+size_t FindHtmlHeadInsertPosition(std::string_view html)
+{
+    constexpr size_t kMaxPrologueBytes = 64 * 1024;
+    size_t limit = (std::min)(html.size(), kMaxPrologueBytes);
+    std::string_view prologue = html.substr(0, limit);
+
+    auto startsWithNoCase = [&html](size_t pos, std::string_view token)
+    {
+        return EqualsAsciiNoCase(html.substr(pos, token.size()), token);
+    };
+    auto isTagNameEnd = [&html](size_t pos)
+    {
+        return pos >= html.size() || html[pos] == '>' || html[pos] == '/'
+            || html[pos] == ' ' || html[pos] == '\t' || html[pos] == '\r' || html[pos] == '\n' || html[pos] == '\f';
+    };
+    // Returns the offset past the '>' that closes the tag at pos, skipping quoted attribute values.
+    auto skipTag = [&prologue](size_t pos)
+    {
+        char quote = 0;
+        for (; pos < prologue.size(); ++pos)
+        {
+            char ch = prologue[pos];
+            if (quote)
+            {
+                if (ch == quote)
+                {
+                    quote = 0;
+                }
+            }
+            else if (ch == '"' || ch == '\'')
+            {
+                quote = ch;
+            }
+            else if (ch == '>')
+            {
+                return pos + 1;
+            }
+        }
+        return std::string_view::npos;
+    };
+
+    size_t pos = html.starts_with(kUtf8Bom) ? kUtf8Bom.size() : 0;
+    // Past the doctype or <html> tag: always a valid place for the style.
+    size_t afterRoot = std::string_view::npos;
+    while (pos < limit)
+    {
+        char ch = html[pos];
+        if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n' || ch == '\f')
+        {
+            ++pos;
+            continue;
+        }
+        if (ch != '<')
+        {
+            break;
+        }
+
+        size_t next = std::string_view::npos;
+        bool root = false;
+        bool comment = false;
+        if (startsWithNoCase(pos, "<!--"))
+        {
+            size_t close = html.find("-->", pos + 4);
+            comment = true;
+            next = (close == std::string_view::npos) ? close : close + 3;
+        }
+        else if (startsWithNoCase(pos, "<!") || startsWithNoCase(pos, "<?"))
+        {
+            size_t close = prologue.find('>', pos + 2);
+            next = (close == std::string_view::npos) ? close : close + 1;
+            root = startsWithNoCase(pos, "<!doctype");
+        }
+        else if (startsWithNoCase(pos, "<html") && isTagNameEnd(pos + 5))
+        {
+            next = skipTag(pos + 5);
+            root = true;
+        }
+        else if (startsWithNoCase(pos, "<head") && isTagNameEnd(pos + 5))
+        {
+            size_t end = skipTag(pos + 5);
+            if (end != std::string_view::npos)
+            {
+                return end;
+            }
+            return (afterRoot == std::string_view::npos) ? pos : afterRoot;
+        }
+        else
+        {
+            // Any other tag opens the implied head or body.
+            break;
+        }
+
+        if (next == std::string_view::npos)
+        {
+            // Left open: a comment running to the end of the file hides everything after it,
+            // so in front of it nothing can follow the style.
+            if (afterRoot != std::string_view::npos)
+            {
+                return afterRoot;
+            }
+            break;
+        }
+        pos = next;
+        if (root)
+        {
+            afterRoot = pos;
+        }
+        else if (comment)
+        {
+            limit = (std::max)(limit, (std::min)(html.size(), pos + kMaxPrologueBytes));
+            prologue = html.substr(0, limit);
+        }
+    }
+    return (std::min)(pos, html.size());
+}
+
+// One copy of html with style at its head insert position.
+std::string InjectHtmlStyle(std::string_view html, std::string_view style)
+{
+    size_t insertPos = FindHtmlHeadInsertPosition(html);
+    std::string result;
+    result.reserve(html.size() + style.size());
+    result.append(html.substr(0, insertPos));
+    result.append(style);
+    result.append(html.substr(insertPos));
+    return result;
+}
+
+// The page goes out as the UTF-8 it was rendered in, behind a single BOM that makes WebView
+// decode it as such regardless of any meta charset.
+bool WriteUtf8Html(std::ostream& output, std::string_view html)
+{
+    if (!html.starts_with(kUtf8Bom))
+    {
+        output.write(kUtf8Bom.data(), static_cast<std::streamsize>(kUtf8Bom.size()));
+    }
+    output.write(html.data(), static_cast<std::streamsize>(html.size()));
+    return output.good();
+}
+
+// =====================
+// 起動トレース
+// =====================
+
+void BeginStartupTrace(StartupTrace& trace, std::chrono::steady_clock::time_point start)
+{
+    trace.start = start;
+    trace.uiThread = std::this_thread::get_id();
+}
+
+// Records that the named step finished at now. Callable from any thread; a step that finishes
+// after the report has gone out is dropped.
+void MarkStartupPhase(StartupTrace& trace, const wchar_t* name, std::chrono::steady_clock::time_point now)
+{
+    StartupPhase phase{ name, now - trace.start, std::this_thread::get_id() != trace.uiThread };
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    if (!trace.reported)
+    {
+        trace.phases.push_back(phase);
+    }
+}
+
+// Closes the trace and returns the report: each step's time since start, and for UI thread steps
+// the time since the previous one, which is what that step cost the first paint.
+std::wstring FormatStartupReport(StartupTrace& trace)
+{
+    std::wstring report = L"FloatVision startup (ms since start, ms since previous step):\n";
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    trace.reported = true;
+    double previous = 0.0;
+    for (const StartupPhase& phase : trace.phases)
+    {
+        double elapsed = std::chrono::duration<double, std::milli>(phase.elapsed).count();
+        wchar_t line[160]{};
+        if (phase.background)
+        {
+            std::swprintf(line, std::size(line), L"%9.2f            [task] %ls\n", elapsed, phase.name);
+        }
+        else
+        {
+            std::swprintf(line, std::size(line), L"%9.2f  %+9.2f  %ls\n", elapsed, elapsed - previous, phase.name);
+            previous = elapsed;
+        }
+        report += line;
+    }
+    return report;
+}
+
+// Starts work on its own thread once the tasks in dependencies have finished, and returns the
+// handle WaitStartupTask and later tasks take. The finish is recorded in trace under name.
+size_t RunStartupTask(StartupTasks& tasks, StartupTrace& trace, const wchar_t* name, std::function<void()> work,
+    const std::vector<size_t>& dependencies)
+{
+    std::vector<std::shared_future<void>> inputs;
+    for (size_t dependency : dependencies)
+    {
+        if (dependency < tasks.done.size())
+        {
+            inputs.push_back(tasks.done[dependency]);
+        }
+    }
+    std::promise<void> finished;
+    tasks.done.push_back(finished.get_future().share());
+    tasks.threads.emplace_back([&trace, name, work = std::move(work), inputs = std::move(inputs), finished = std::move(finished)]() mutable
+    {
+        for (const std::shared_future<void>& input : inputs)
+        {
+            input.wait();
+        }
+        work();
+        MarkStartupPhase(trace, name, std::chrono::steady_clock::now());
+        finished.set_value();
+    });
+    return tasks.done.size() - 1;
+}
+
+void WaitStartupTask(const StartupTasks& tasks, size_t task)
+{
+    if (task < tasks.done.size())
+    {
+        tasks.done[task].wait();
+    }
+}
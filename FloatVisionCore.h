@@ -0,0 +1,749 @@
+#pragma once
+
+// The parts of FloatVision that only work on memory: sort keys, archive and cache formats, the
+// settings lookup tables and markdown rendering on top of md4c. FloatVision.cpp does the Win32
+// side around them, and tests/ builds them on their own.
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+constexpr size_t kZipEndRecordSize = 22;
+constexpr uint64_t kZipEndSearchBytes = kZipEndRecordSize + 0xFFFF + 20;
+constexpr size_t kZip64EndRecordSize = 56;
+constexpr size_t kZipCentralHeaderSize = 46;
+constexpr size_t kZipLocalHeaderSize = 30;
+constexpr int kInflateFastBits = 10;
+// DEFLATE cannot expand past 1032:1, so a larger recorded size is a corrupt directory.
+constexpr uint64_t kInflateMaxExpansion = 1032;
+constexpr uint64_t kZipMaxMemberBytes = 1ull << 30;
+constexpr uint32_t kPlaylistIndexMagic = 0x4C505646;
+constexpr uint32_t kPlaylistIndexVersion = 1;
+constexpr uint8_t kMetadataProbed = 1;
+constexpr uint8_t kMetadataHasAlpha = 2;
+constexpr uint32_t kMetadataCacheMagic = 0x444D5646;
+constexpr uint32_t kMetadataCacheVersion = 1;
+constexpr size_t kMetadataCacheRecordBytes = 45;
+constexpr size_t kMarkdownHtmlCacheBudgetBytes = 96 * 1024 * 1024;
+constexpr size_t kMarkdownParallelMinBytes = 2 * 1024 * 1024;
+constexpr size_t kMarkdownParallelChunkBytes = 256 * 1024;
+constexpr char kMarkdownSectionMarker[] = "<!--fvb-->";
+constexpr size_t kProgressiveHtmlMinBytes = 1024 * 1024;
+constexpr size_t kProgressiveFirstPaintBytes = 192 * 1024;
+constexpr size_t kProgressiveBatchBytes = 512 * 1024;
+
+enum class SortMode
+{
+    NameAsc,
+    NameDesc,
+    TimeAsc,
+    TimeDesc,
+    NaturalAsc,
+    SizeAsc,
+    DimensionsAsc,
+    DateTakenAsc
+};
+
+// Lowercases text in place. Supplied by the host: the app folds with CharLowerBuffW, as Explorer
+// and the profile functions do.
+void FoldCaseText(std::wstring& text);
+
+std::wstring MakeNaturalSortKey(std::wstring_view name);
+bool IsDescendingSortMode(SortMode mode);
+bool IsMetadataSortMode(SortMode mode);
+bool CatalogKeyPrecedes(SortMode mode, uint64_t primaryA, const std::wstring& nameA, uint64_t primaryB, const std::wstring& nameB);
+
+constexpr size_t kNoCatalogEntry = static_cast<size_t>(-1);
+constexpr size_t kCatalogSortChunkEntries = 16384;
+constexpr uint64_t kCatalogSortKeyPending = ~0ull;
+
+// A catalog's display order, position for position with the host's entries: each entry's id and
+// precomputed sort key. idByName is keyed by the case-folded name and positionById gives where
+// each id currently sits; slot 0 stays unused so an id of 0 can mean "none".
+struct CatalogOrder
+{
+    SortMode sortMode = SortMode::NameAsc;
+    std::vector<uint32_t> ids;
+    std::vector<uint64_t> sortPrimary;
+    std::vector<std::wstring> sortNames;
+    std::unordered_map<std::wstring, uint32_t> idByName;
+    std::vector<size_t> positionById{ kNoCatalogEntry };
+};
+
+// Runs job(0) .. job(jobs - 1), all but the first on their own thread.
+template <typename Job>
+void RunCatalogChunks(size_t jobs, Job&& job)
+{
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < jobs; ++i)
+    {
+        workers.emplace_back(job, i);
+    }
+    job(0);
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+size_t GetCatalogChunkCount(size_t count, size_t minChunk);
+void ClearCatalogOrder(CatalogOrder& order);
+bool CatalogPositionPrecedes(const CatalogOrder& order, size_t a, size_t b);
+void SortCatalogPermutation(const CatalogOrder& order, std::vector<uint32_t>& permutation, size_t first, size_t last);
+std::vector<uint32_t> MakeCatalogPermutation(const CatalogOrder& order, size_t sortedCount);
+void PermuteCatalogOrder(CatalogOrder& order, const std::vector<uint32_t>& permutation);
+void RenumberCatalogOrder(CatalogOrder& order, size_t first);
+size_t FindCatalogPosition(const CatalogOrder& order, const std::wstring& foldedName);
+size_t FindCatalogInsertPosition(const CatalogOrder& order, uint64_t primary, const std::wstring& sortName);
+void InsertCatalogPosition(CatalogOrder& order, size_t position, uint32_t id, std::wstring foldedName, uint64_t primary, std::wstring sortName);
+size_t RemoveCatalogPosition(CatalogOrder& order, const std::wstring& foldedName, uint32_t& id);
+bool IsCatalogPositionInOrder(const CatalogOrder& order, size_t position);
+
+struct ZipMember
+{
+    std::wstring name;
+    uint64_t localHeaderOffset = 0;
+    uint64_t compressedSize = 0;
+    uint64_t size = 0;
+    uint32_t crc = 0;
+    uint16_t method = 0;
+    uint16_t dosTime = 0;
+    uint16_t dosDate = 0;
+};
+
+// Where the central directory lies, as the end record gives it. When zip64 is set the end record
+// was preceded by a ZIP64 locator, and the record at zip64EndOffset holds the real values.
+struct ZipDirectoryRange
+{
+    uint64_t entryCount = 0;
+    uint64_t size = 0;
+    uint64_t offset = 0;
+    uint64_t zip64EndOffset = 0;
+    bool zip64 = false;
+};
+
+// Converts a member name to UTF-16, from UTF-8 when flagged and code page 437 otherwise. Supplied
+// by the host: the app converts with MultiByteToWideChar.
+bool DecodeZipName(std::string_view raw, bool utf8, std::wstring& name);
+
+uint16_t ReadLe16(const uint8_t* data);
+uint32_t ReadLe32(const uint8_t* data);
+uint64_t ReadLe64(const uint8_t* data);
+uint32_t ComputeCrc32(const uint8_t* data, size_t size);
+bool InflateRaw(const uint8_t* input, size_t inputSize, uint8_t* output, size_t outputSize);
+bool FindZipDirectory(const uint8_t* tail, size_t tailSize, ZipDirectoryRange& range);
+void ReadZip64EndRecord(const uint8_t* record, size_t size, ZipDirectoryRange& range);
+void ParseZipCentralDirectory(const uint8_t* data, size_t size, uint64_t entryCount, std::vector<ZipMember>& members);
+bool ReadZipLocalHeader(const uint8_t* header, size_t size, const ZipMember& member, uint64_t& dataOffset);
+bool IsZipMemberSizeValid(const ZipMember& member);
+
+struct PlaylistFile
+{
+    std::wstring name;
+    uint64_t writeTime = 0;
+    uint64_t size = 0;
+};
+
+// One folder of a playlist as last listed. writeTime is the folder's own FILETIME; while it is
+// unchanged, no file has been added, removed or renamed in it.
+struct PlaylistDirectory
+{
+    std::wstring path;
+    uint64_t writeTime = 0;
+    std::vector<PlaylistFile> files;
+    std::vector<std::wstring> subdirectories;
+};
+
+struct PlaylistIndex
+{
+    std::vector<std::wstring> roots;
+    std::vector<PlaylistDirectory> directories;
+};
+
+template <typename T>
+void AppendIndexValue(std::vector<uint8_t>& out, T value)
+{
+    for (size_t i = 0; i < sizeof(T); ++i)
+    {
+        out.push_back(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i)));
+    }
+}
+
+bool ReadIndexValue(const uint8_t*& pos, const uint8_t* end, size_t bytes, uint64_t& value);
+void AppendPlaylistString(std::vector<uint8_t>& out, const std::wstring& previous, const std::wstring& value);
+bool ReadPlaylistString(const uint8_t*& pos, const uint8_t* end, std::wstring& value);
+void EncodePlaylistIndex(const PlaylistIndex& index, std::vector<uint8_t>& out);
+bool DecodePlaylistIndex(const uint8_t* data, size_t size, PlaylistIndex& index);
+
+// Header facts about an image, read without decoding any pixels. dateTaken is the EXIF
+// DateTimeOriginal in UTC FILETIME ticks, 0 when the image carries none.
+struct ImageMetadata
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t frameCount = 0;
+    uint64_t dateTaken = 0;
+    bool hasAlpha = false;
+};
+
+struct MetadataCacheRecord
+{
+    uint64_t writeTime = 0;
+    uint64_t size = 0;
+    ImageMetadata metadata;
+};
+
+void EncodeMetadataCache(const std::unordered_map<uint64_t, MetadataCacheRecord>& records, std::vector<uint8_t>& out);
+bool DecodeMetadataCache(const uint8_t* data, size_t size, std::unordered_map<uint64_t, MetadataCacheRecord>& records);
+
+constexpr uint32_t kDefaultAnimationFrameDelayMs = 100;
+constexpr uint32_t kAnimationVisibilityPollMs = 250;
+constexpr uint64_t kAnimationOcclusionCheckMs = 1000;
+
+// What playback asks the host about its window on a tick. isShown (visible, not minimized, not
+// cloaked) is cheap and asked every tick; isUncovered walks the windows above and is asked at
+// most every kAnimationOcclusionCheckMs while playing, and on every poll while suspended.
+struct AnimationVisibility
+{
+    std::function<bool()> isShown;
+    std::function<bool()> isUncovered;
+};
+
+// An animated image's playback as timer ticks drive it, in milliseconds of any steady clock.
+// While the window cannot be seen nothing is decoded; the next visible tick lands on the frame
+// wall time says is due, and the frames passed over are added to skippedFrames.
+struct AnimationPlayback
+{
+    std::vector<uint32_t> frameDelaysMs;
+    size_t frameIndex = 0;
+    // When the current frame became due.
+    uint64_t frameStartMs = 0;
+    uint64_t occlusionCheckedMs = 0;
+    bool occlusionChecked = false;
+    bool uncovered = true;
+    bool playing = false;
+    bool suspended = false;
+    size_t skippedFrames = 0;
+};
+
+struct AnimationTick
+{
+    size_t frame = 0;
+    uint32_t waitMs = 0;
+    bool suspended = false;
+};
+
+uint32_t GetAnimationFrameDelayMs(const std::vector<uint32_t>& frameDelaysMs, size_t frameIndex);
+size_t AdvanceAnimationTimeline(const std::vector<uint32_t>& frameDelaysMs, size_t frameIndex, uint64_t& frameStartMs,
+    uint64_t nowMs, size_t& advancedFrames);
+void StartAnimationTimeline(AnimationPlayback& playback, size_t frameIndex, uint64_t nowMs);
+AnimationTick TickAnimationTimeline(AnimationPlayback& playback, uint64_t nowMs, const AnimationVisibility& visibility);
+
+// A pixel rectangle in a canvas, right and bottom exclusive; empty when either span is.
+struct CanvasRect
+{
+    uint32_t left = 0;
+    uint32_t top = 0;
+    uint32_t right = 0;
+    uint32_t bottom = 0;
+};
+
+// Where a host keeps the surface an animation is presented from. create makes a new surface
+// holding the whole of a frame; read copies a rectangle of a composited frame (32bpp) into
+// pixels; upload writes such a buffer into the existing surface in place.
+struct AnimationSurfaceBackend
+{
+    std::function<bool(size_t frame)> create;
+    std::function<bool(size_t frame, const CanvasRect& rect, uint32_t stride, uint8_t* pixels)> read;
+    std::function<bool(const CanvasRect& rect, const uint8_t* pixels, uint32_t stride)> upload;
+};
+
+// The one canvas-sized surface of an animation and the frame it holds. valid is cleared whenever
+// the host drops the surface, so the next frame creates it again.
+struct AnimationSurface
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    size_t frameIndex = 0;
+    bool valid = false;
+    std::vector<uint8_t> uploadBuffer;
+    size_t createdSurfaces = 0;
+    uint64_t uploadedBytes = 0;
+};
+
+bool IsCanvasRectEmpty(const CanvasRect& rect);
+CanvasRect ComputeCanvasDirtyRect(const std::vector<uint8_t>& before, const std::vector<uint8_t>& after, uint32_t width, uint32_t height);
+void UnionDirtyRect(CanvasRect& target, const CanvasRect& rect);
+CanvasRect GetAnimationUploadRect(const std::vector<CanvasRect>& frameDirtyRects, size_t fromFrame, size_t toFrame,
+    uint32_t width, uint32_t height);
+bool PresentAnimationFrame(AnimationSurface& surface, const std::vector<CanvasRect>& frameDirtyRects, size_t frameIndex,
+    uint32_t width, uint32_t height, const AnimationSurfaceBackend& backend);
+
+constexpr uint32_t kCheckerCellSize = 16;
+constexpr uint32_t kCheckerTileSize = kCheckerCellSize * 2;
+constexpr uint32_t kCheckerLightLevel = 217;
+constexpr uint32_t kCheckerDarkLevel = 179;
+
+// What the scaled pixels handed to UpdateLayeredWindow were made from. source is the host's
+// identity for the image shown (its bitmap source); 0 is no image and never matches.
+struct LayeredSurfaceKey
+{
+    uintptr_t source = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+};
+
+struct LayeredSurfaceState
+{
+    LayeredSurfaceKey key;
+    bool valid = false;
+    size_t builds = 0;
+};
+
+std::array<uint32_t, kCheckerTileSize * kCheckerTileSize> MakeCheckerTile();
+LayeredSurfaceKey MakeLayeredSurfaceKey(uintptr_t source, float drawWidth, float drawHeight);
+bool IsLayeredSurfaceCached(const LayeredSurfaceState& state, const LayeredSurfaceKey& key);
+void MarkLayeredSurfaceBuilt(LayeredSurfaceState& state, const LayeredSurfaceKey& key);
+
+constexpr std::string_view kUtf8Bom = "\xEF\xBB\xBF";
+// The most one read call is asked for, so the count fits a DWORD.
+constexpr size_t kDocumentReadChunkBytes = 1u << 30;
+
+// Whole-file contents read once into a buffer of known size. Text() skips a UTF-8 BOM
+// without moving any bytes.
+struct DocumentBuffer
+{
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+    size_t textStart = 0;
+
+    bool HasUtf8Bom() const
+    {
+        return textStart == kUtf8Bom.size();
+    }
+
+    std::string_view Text() const
+    {
+        return std::string_view(data.get() + textStart, size - textStart);
+    }
+};
+
+// Stores up to size bytes at data and sets read, which is 0 at the end of the file; false on an
+// error.
+using DocumentReader = std::function<bool(char* data, size_t size, size_t& read)>;
+
+bool FillDocumentBuffer(size_t size, const DocumentReader& read, DocumentBuffer& document);
+
+bool DecodeUtf8(const char* data, size_t size, std::wstring& text, bool strict);
+bool Utf8ToWide(const char* data, size_t size, std::wstring& text);
+bool Utf8ToWide(std::string_view bytes, std::wstring& text);
+bool Utf8ToWideStrict(std::string_view bytes, std::wstring& text);
+bool WideToUtf8(const wchar_t* data, size_t size, std::string& bytes);
+bool WideToUtf8(const std::wstring& text, std::string& bytes);
+
+constexpr uint64_t kTextLineCheckpointStride = 256;
+// Longer lines are shown clipped, and are remembered by the index so lookups never rescan them.
+constexpr size_t kTextMaxLineBytes = 16 * 1024;
+
+struct TextLongLine
+{
+    uint64_t line = 0;
+    uint64_t start = 0;
+    // The offset of the line's '\n'.
+    uint64_t end = 0;
+};
+
+// checkpoints[k] is the byte offset of line k * kTextLineCheckpointStride. longLines holds, in
+// line order, every terminated line longer than kTextMaxLineBytes.
+struct TextLineIndex
+{
+    std::vector<uint64_t> checkpoints;
+    std::vector<TextLongLine> longLines;
+    uint64_t lineCount = 0;
+    uint64_t lastLineStart = 0;
+    uint64_t indexedEnd = 0;
+};
+
+// Returns length bytes of the indexed file at offset, or nullptr.
+using TextRangeMapper = std::function<const char*(uint64_t offset, size_t length)>;
+
+void ResetTextLineIndex(TextLineIndex& index, uint64_t dataStart);
+void AppendTextLineIndex(TextLineIndex& index, const char* data, size_t size);
+uint64_t GetTextLineCount(const TextLineIndex& index, bool complete);
+bool FindTextLineRange(const TextLineIndex& index, bool complete, uint64_t line, const TextRangeMapper& map,
+    uint64_t& start, uint64_t& end);
+bool ReadTextLine(const TextLineIndex& index, bool complete, uint64_t line, const TextRangeMapper& map, std::wstring& text);
+
+// Follow mode reads up to this much appended text inline; more goes to the indexer thread.
+constexpr size_t kTextIndexChunkBytes = 4 * 1024 * 1024;
+
+// Which file a path named: volume serial and file index on Windows, device and inode elsewhere.
+struct TextFileIdentity
+{
+    uint64_t volume = 0;
+    uint64_t file = 0;
+};
+
+// What a follow-mode check found: the file the path names now, when it could be opened and
+// identified, and the size of the file held open, which is asked even when the path is missing.
+struct TextFollowProbe
+{
+    bool pathExists = false;
+    bool identityKnown = false;
+    TextFileIdentity pathIdentity;
+    bool sizeKnown = false;
+    uint64_t openSize = 0;
+};
+
+enum class TextFollowAction
+{
+    None,
+    AppendInline,
+    AppendInBackground,
+    Reopen
+};
+
+TextFollowAction GetTextFollowAction(const TextFileIdentity& open, uint64_t size, bool indexComplete, const TextFollowProbe& probe);
+
+struct SettingsChange
+{
+    std::wstring section;
+    std::wstring key;
+    std::wstring value;
+    bool remove = false;
+};
+
+// The ini file parsed once into its lines. Reads are served from keyLines; changes edit the lines
+// in memory and are written back together, so comments, unknown keys and ordering survive.
+// changes lists what was edited since the last write, for replaying onto a file edited meanwhile.
+struct SettingsStore
+{
+    std::filesystem::path path;
+    std::vector<std::wstring> lines;
+    // Case-folded "section\nkey" -> the line holding the key's first occurrence.
+    std::unordered_map<std::wstring, size_t> keyLines;
+    // Case-folded section -> the last line that belongs to it.
+    std::unordered_map<std::wstring, size_t> sectionEnds;
+    std::vector<SettingsChange> changes;
+    uint64_t writeTime = 0;
+    uint64_t size = 0;
+    bool loaded = false;
+};
+
+std::wstring TrimString(const std::wstring& value);
+void SplitSettingsLines(std::wstring_view content, std::vector<std::wstring>& lines);
+std::wstring MakeSettingsKey(const std::wstring& section, const std::wstring& key);
+void IndexSettingsLines(SettingsStore& store);
+bool ApplySettingsChange(SettingsStore& store, const SettingsChange& change);
+
+constexpr uint64_t kSettingNameHashBasis = 0xCBF29CE484222325ull;
+constexpr uint8_t kSettingSlotEmpty = 0xFF;
+
+// FNV-1a over ASCII-case-folded code units, so "Settings" and "settings" hash alike.
+constexpr uint64_t HashSettingName(uint64_t hash, std::wstring_view text)
+{
+    for (wchar_t ch : text)
+    {
+        if (ch >= L'A' && ch <= L'Z')
+        {
+            ch = static_cast<wchar_t>(ch - L'A' + L'a');
+        }
+        hash = (hash ^ static_cast<uint64_t>(ch)) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// The name a field is looked up by: "section\nkey" for the ini, the markdown name otherwise.
+template <typename Field>
+constexpr uint64_t HashSettingField(const Field& field, bool markdown)
+{
+    if (markdown)
+    {
+        return HashSettingName(kSettingNameHashBasis, field.markdownName);
+    }
+    return HashSettingName(HashSettingName(HashSettingName(kSettingNameHashBasis, field.section), L"\n"), field.key);
+}
+
+constexpr size_t GetSettingSlot(uint64_t nameHash, uint64_t seed, size_t slotCount)
+{
+    uint64_t mixed = nameHash ^ (seed * 0x9E3779B97F4A7C15ull);
+    mixed = (mixed ^ (mixed >> 31)) * 0xBF58476D1CE4E5B9ull;
+    mixed ^= mixed >> 29;
+    return static_cast<size_t>(mixed & (slotCount - 1));
+}
+
+// A collision-free slot table over the field names, found at compile time by trying seeds
+// until every name lands in its own slot. A lookup is then one hash and one comparison. Field is
+// anything with section, key and markdownName views; fields without a markdown name are left out
+// of the markdown table.
+template <size_t SlotCount>
+struct SettingHashTable
+{
+    uint64_t seed = 0;
+    std::array<uint8_t, SlotCount> slots{};
+};
+
+template <size_t SlotCount, typename Field, size_t FieldCount>
+constexpr SettingHashTable<SlotCount> BuildSettingHashTable(const std::array<Field, FieldCount>& fields, bool markdown)
+{
+    static_assert(FieldCount < kSettingSlotEmpty);
+    SettingHashTable<SlotCount> table;
+    for (uint64_t seed = 1; seed < 0x10000; ++seed)
+    {
+        table.slots.fill(kSettingSlotEmpty);
+        bool collided = false;
+        for (size_t i = 0; i < fields.size() && !collided; ++i)
+        {
+            if (markdown && fields[i].markdownName.empty())
+            {
+                continue;
+            }
+            uint8_t& slot = table.slots[GetSettingSlot(HashSettingField(fields[i], markdown), seed, SlotCount)];
+            collided = slot != kSettingSlotEmpty;
+            slot = static_cast<uint8_t>(i);
+        }
+        if (!collided)
+        {
+            table.seed = seed;
+            return table;
+        }
+    }
+    return SettingHashTable<SlotCount>{};
+}
+
+// The index of the only field name could be, or kSettingSlotEmpty; MatchesSettingField confirms it.
+template <size_t SlotCount>
+constexpr uint8_t FindSettingSlot(const SettingHashTable<SlotCount>& table, std::wstring_view name)
+{
+    return table.slots[GetSettingSlot(HashSettingName(kSettingNameHashBasis, name), table.seed, SlotCount)];
+}
+
+bool EqualsSettingName(std::wstring_view name, std::wstring_view schemaName);
+
+// name is a case-folded "section\nkey" for the ini, a normalized key for the markdown file.
+template <typename Field>
+bool MatchesSettingField(const Field& field, std::wstring_view name, bool markdown)
+{
+    if (markdown)
+    {
+        return EqualsSettingName(name, field.markdownName);
+    }
+    size_t split = field.section.size();
+    return name.size() > split && name[split] == L'\n'
+        && EqualsSettingName(name.substr(0, split), field.section)
+        && EqualsSettingName(name.substr(split + 1), field.key);
+}
+
+std::wstring FoldFontName(std::wstring_view name);
+
+// What a font name resolves to. weight, style and stretch hold DWRITE_FONT_WEIGHT, _STYLE and
+// _STRETCH values; a family name resolves to its regular face.
+struct FontCatalogEntry
+{
+    std::wstring familyName;
+    uint32_t weight = 400;
+    uint32_t style = 0;
+    uint32_t stretch = 5;
+};
+
+// Folded family, face and GDI family names of the system fonts. gdiFamilies maps the name GDI
+// and the font dialog use to the DirectWrite family name. When two fonts share a name, the first
+// one added keeps it.
+struct FontCatalogIndex
+{
+    std::unordered_map<std::wstring, FontCatalogEntry> families;
+    std::unordered_map<std::wstring, FontCatalogEntry> faces;
+    std::unordered_map<std::wstring, std::wstring> gdiFamilies;
+};
+
+// familyNames are every localized name of one family. A face names its family by the first of them.
+void AddFontCatalogFamily(FontCatalogIndex& index, const std::vector<std::wstring>& familyNames);
+void AddFontCatalogFace(FontCatalogIndex& index, const FontCatalogEntry& face, const std::vector<std::wstring>& faceNames,
+    const std::vector<std::wstring>& gdiFamilyNames);
+bool FindFontCatalogEntry(const FontCatalogIndex& index, std::wstring_view name, FontCatalogEntry& entry);
+bool FindFontCatalogGdiFamily(const FontCatalogIndex& index, std::wstring_view name, std::wstring& familyName);
+
+bool EqualsAsciiNoCase(std::string_view a, std::string_view b);
+bool SplitMarkdownIntoSections(
+    std::string_view markdown,
+    size_t targetSectionBytes,
+    std::vector<std::string_view>& sections,
+    std::string& definitions);
+bool SplitMarkdownPageSections(std::string_view markdown, std::vector<std::string_view>& sections, std::string& definitions);
+
+struct CodeLanguage
+{
+    std::string_view names;
+    const std::string_view* keywords = nullptr;
+    size_t keywordCount = 0;
+    std::string_view lineComment;
+    bool blockComments = false;
+    bool preprocessor = false;
+    bool decorators = false;
+    bool tripleQuotes = false;
+    bool stringPrefixes = false;
+    bool singleQuoteStrings = false;
+    bool shellSyntax = false;
+    bool jsonKeys = false;
+    bool yamlKeys = false;
+};
+
+const CodeLanguage* FindCodeLanguage(std::string_view info);
+void HighlightCode(const CodeLanguage& language, std::string_view code, std::string& html);
+void AppendHtmlUnescaped(std::string_view escaped, std::string& text);
+
+// Outline entry collected while the page is rendered; offset is where the heading starts in the
+// page HTML and id is the anchor written into its opening tag.
+struct MarkdownHeading
+{
+    int level = 0;
+    size_t offset = 0;
+    std::string slug;
+    std::string id;
+    std::string text;
+};
+
+enum class CodeBlockState
+{
+    None,
+    AfterPre,
+    Language,
+    AfterLanguage,
+    Code
+};
+
+// md_html output sink. md4c opens a fenced block with the chunks "<pre><code",
+// " class=\"language-", the escaped info word, "\"" and ">", and closes it with
+// "</code></pre>\n"; blocks in a known language are re-emitted highlighted when they close.
+// Headings arrive as "<hN>" ... "</hN>\n" and are collected into the outline.
+struct MarkdownHtmlWriter
+{
+    std::string* output = nullptr;
+    CodeBlockState state = CodeBlockState::None;
+    size_t languageStart = 0;
+    size_t codeStart = 0;
+    const CodeLanguage* language = nullptr;
+    std::string code;
+    std::vector<MarkdownHeading>* headings = nullptr;
+    size_t headingStart = 0;
+    int headingLevel = 0;
+};
+
+void MakeHeadingId(std::string_view text, std::string& id);
+void AssignMarkdownHeadingIds(std::string& html, std::vector<MarkdownHeading>& headings, std::vector<size_t>& sectionStarts);
+bool RenderMarkdownHtml(std::string_view markdown, MarkdownHtmlWriter& writer);
+
+// A rendered markdown page. Each top-level section of the source is rendered on its own behind
+// a <!--fvb--> marker, so a reload only has to re-render and patch the sections that changed.
+// sectionStarts is empty when the document could not be split and was rendered in one pass.
+struct MarkdownPage
+{
+    std::string html;
+    std::vector<size_t> sectionStarts;
+    std::vector<uint64_t> sectionHashes;
+    size_t bodyEnd = 0;
+    uint64_t definitionsHash = 0;
+    std::vector<MarkdownHeading> headings;
+};
+
+// Rendered markdown pages keyed by a hash of the source bytes and the style inputs.
+struct MarkdownHtmlCacheEntry
+{
+    uint64_t key = 0;
+    size_t markdownSize = 0;
+    uint64_t lastUse = 0;
+    std::shared_ptr<const MarkdownPage> page;
+};
+
+// Least recently used pages are evicted once their HTML would pass budgetBytes.
+struct MarkdownHtmlCache
+{
+    std::vector<MarkdownHtmlCacheEntry> entries;
+    size_t bytes = 0;
+    uint64_t clock = 0;
+    size_t budgetBytes = kMarkdownHtmlCacheBudgetBytes;
+};
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed);
+const MarkdownHtmlCacheEntry* FindCachedMarkdownHtml(MarkdownHtmlCache& cache, uint64_t key, size_t markdownSize);
+void StoreCachedMarkdownHtml(MarkdownHtmlCache& cache, uint64_t key, size_t markdownSize, const std::shared_ptr<const MarkdownPage>& page);
+void ClearMarkdownHtmlCache(MarkdownHtmlCache& cache);
+
+// A reload expressed against the previous page: its sections [firstSection, endSection) give way
+// to page->html[fragmentStart, fragmentEnd).
+struct MarkdownPagePatch
+{
+    std::shared_ptr<MarkdownPage> page;
+    size_t firstSection = 0;
+    size_t endSection = 0;
+    size_t fragmentStart = 0;
+    size_t fragmentEnd = 0;
+};
+
+bool RenderMarkdownSections(
+    const std::vector<std::string_view>& sections,
+    size_t first,
+    size_t last,
+    const std::string& definitions,
+    std::string& html,
+    std::vector<size_t>& sectionStarts,
+    std::vector<MarkdownHeading>& headings);
+bool RenderMarkdownBody(std::string_view markdown, MarkdownPage& page);
+bool RenderMarkdownPage(std::string_view markdown, std::string_view prologue, std::string_view epilogue, MarkdownPage& page);
+bool PatchMarkdownPage(const MarkdownPage& previous, std::string_view markdown, MarkdownPagePatch& patch);
+std::vector<size_t> GetMarkdownPageBlockBounds(const MarkdownPage& page);
+size_t FindProgressiveFirstPaintBlock(size_t htmlBytes, const std::vector<size_t>& blockBounds);
+std::string MakeProgressiveFirstPage(std::string_view html, const std::vector<size_t>& blockBounds, size_t firstPaintBlock);
+size_t FindProgressiveBatchEnd(const std::vector<size_t>& blockBounds, size_t nextBlock);
+size_t FindHtmlHeadInsertPosition(std::string_view html);
+std::string InjectHtmlStyle(std::string_view html, std::string_view style);
+bool WriteUtf8Html(std::ostream& output, std::string_view html);
+
+// One step of startup, timed from process start. background marks steps that finished on a
+// startup task rather than the UI thread.
+struct StartupPhase
+{
+    const wchar_t* name = nullptr;
+    std::chrono::steady_clock::duration elapsed{};
+    bool background = false;
+};
+
+struct StartupTrace
+{
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point start;
+    std::thread::id uiThread;
+    std::vector<StartupPhase> phases;
+    bool finished = false;
+    bool reported = false;
+};
+
+// Startup work that needs neither the window nor the UI thread, as a graph: a task starts once
+// the ones it depends on have finished, and the UI thread waits for each just before the step
+// that needs it. Tasks nobody waited for are joined when this goes away.
+struct StartupTasks
+{
+    std::vector<std::shared_future<void>> done;
+    std::vector<std::jthread> threads;
+};
+
+constexpr size_t kNoStartupTask = static_cast<size_t>(-1);
+
+void BeginStartupTrace(StartupTrace& trace, std::chrono::steady_clock::time_point start);
+void MarkStartupPhase(StartupTrace& trace, const wchar_t* name, std::chrono::steady_clock::time_point now);
+std::wstring FormatStartupReport(StartupTrace& trace);
+size_t RunStartupTask(StartupTasks& tasks, StartupTrace& trace, const wchar_t* name, std::function<void()> work,
+    const std::vector<size_t>& dependencies = {});
+void WaitStartupTask(const StartupTasks& tasks, size_t task);
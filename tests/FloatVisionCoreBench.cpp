@@ -0,0 +1,1004 @@
+﻿#include "FloatVisionCore.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Throughput of the FloatVisionCore.cpp hot paths on generated input. A full run takes a few
+// seconds per benchmark; --quick runs each once on a small input.
+
+namespace
+{
+bool g_quick = false;
+const char* g_filter = nullptr;
+// Results are folded in here so the compiler cannot drop the work.
+size_t g_sink = 0;
+
+size_t BenchSize(size_t full)
+{
+    return g_quick ? (std::max)(full / 256, static_cast<size_t>(1)) : full;
+}
+
+// Repeats body for about a second and prints the rate at bytesPerRun bytes per call.
+template <typename Body>
+void RunBenchmark(const char* name, size_t bytesPerRun, Body&& body)
+{
+    if (g_filter && !std::strstr(name, g_filter))
+    {
+        return;
+    }
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+    std::chrono::duration<double> elapsed{};
+    size_t runs = 0;
+    do
+    {
+        body();
+        ++runs;
+        elapsed = Clock::now() - start;
+    } while (!g_quick && elapsed.count() < 1.0);
+    double seconds = elapsed.count();
+    std::printf("%-44s %10.1f MB/s %12.3f ms/run\n", name, static_cast<double>(bytesPerRun) * runs / seconds / 1e6, seconds * 1e3 / runs);
+}
+
+// Copies of sample until the text reaches size bytes.
+std::string RepeatText(std::string_view sample, size_t size)
+{
+    std::string text;
+    text.reserve(size + sample.size());
+    while (text.size() < size)
+    {
+        text.append(sample);
+    }
+    return text;
+}
+
+// =====================
+// 並べ替えキー
+// =====================
+
+// A camera folder of BenchSize(200k) files sorted by name. Opening merges the scanner's batches
+// (256 entries, doubling) into the catalog, navigating looks each file up by name, and a refresh
+// applies a burst of watcher notifications: 1000 files renamed away and back. Every edit shifts
+// the columns behind it, so a refresh costs in proportion to the folder, not to the burst alone.
+void BenchCatalogOrder()
+{
+    size_t fileCount = BenchSize(200000);
+    std::vector<std::wstring> names;
+    names.reserve(fileCount);
+    for (size_t i = 0; i < fileCount; ++i)
+    {
+        // Listed in hash order, as a large folder comes back from the file system.
+        names.push_back(L"dsc" + std::to_wstring((i * 2654435761u) % 1000000) + L".jpg");
+    }
+    size_t nameBytes = 0;
+    for (const std::wstring& name : names)
+    {
+        nameBytes += name.size() * sizeof(wchar_t);
+    }
+
+    CatalogOrder order;
+    auto open = [&]()
+    {
+        ClearCatalogOrder(order);
+        uint32_t nextId = 1;
+        size_t next = 0;
+        for (size_t batch = 256; next < names.size(); batch *= 2)
+        {
+            size_t previousCount = order.ids.size();
+            for (size_t end = (std::min)(names.size(), next + batch); next < end; ++next)
+            {
+                if (!order.idByName.try_emplace(names[next], nextId).second)
+                {
+                    continue;
+                }
+                order.positionById.push_back(kNoCatalogEntry);
+                order.ids.push_back(nextId++);
+                order.sortPrimary.push_back(0);
+                order.sortNames.push_back(names[next]);
+            }
+            PermuteCatalogOrder(order, MakeCatalogPermutation(order, previousCount));
+        }
+    };
+    RunBenchmark("Open 200k files in scanner batches", nameBytes, [&]()
+        {
+            open();
+            g_sink += order.ids.size();
+        });
+    open();
+
+    RunBenchmark("Navigate 200k files by name", nameBytes, [&]()
+        {
+            for (const std::wstring& name : names)
+            {
+                g_sink += FindCatalogPosition(order, name);
+            }
+        });
+
+    auto rename = [&](const std::wstring& from, const std::wstring& to)
+    {
+        uint32_t id = 0;
+        RemoveCatalogPosition(order, from, id);
+        size_t position = FindCatalogInsertPosition(order, 0, to);
+        InsertCatalogPosition(order, position, id, to, 0, to);
+    };
+    size_t stride = (std::max)(names.size() / 1000, static_cast<size_t>(1));
+    size_t changeBytes = 0;
+    for (size_t i = 0; i < names.size(); i += stride)
+    {
+        changeBytes += 2 * names[i].size() * sizeof(wchar_t);
+    }
+    RunBenchmark("Refresh 200k files, 1000 renames", changeBytes, [&]()
+        {
+            for (size_t i = 0; i < names.size(); i += stride)
+            {
+                std::wstring renamed = L"~" + names[i];
+                rename(names[i], renamed);
+                rename(renamed, names[i]);
+            }
+            g_sink += order.ids.size();
+        });
+}
+
+// =====================
+// アーカイブ (ZIP/CBZ)
+// =====================
+
+struct DeflateBitWriter
+{
+    std::vector<uint8_t>& out;
+    uint64_t bits = 0;
+    int count = 0;
+
+    void Put(uint32_t value, int length)
+    {
+        bits |= static_cast<uint64_t>(value) << count;
+        count += length;
+        while (count >= 8)
+        {
+            out.push_back(static_cast<uint8_t>(bits));
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    // Huffman codes go most significant bit first.
+    void PutCode(uint32_t code, int length)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; ++i)
+        {
+            reversed |= ((code >> i) & 1u) << (length - 1 - i);
+        }
+        Put(reversed, length);
+    }
+
+    void PutLiteralOrLength(uint32_t symbol)
+    {
+        if (symbol < 144)
+        {
+            PutCode(0x30 + symbol, 8);
+        }
+        else if (symbol < 256)
+        {
+            PutCode(0x190 + symbol - 144, 9);
+        }
+        else if (symbol < 280)
+        {
+            PutCode(symbol - 256, 7);
+        }
+        else
+        {
+            PutCode(0xC0 + symbol - 280, 8);
+        }
+    }
+};
+
+// One fixed-Huffman block with a greedy, single-candidate match search. The ratio is well short
+// of zlib's, but the literal, length and distance paths of InflateRaw all run.
+std::vector<uint8_t> DeflateFixed(const uint8_t* data, size_t size)
+{
+    static constexpr uint16_t kLengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static constexpr uint8_t kLengthExtra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static constexpr uint16_t kDistanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static constexpr uint8_t kDistanceExtra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    constexpr size_t kWindow = 32768;
+
+    std::vector<uint8_t> out;
+    out.reserve(size / 2 + 64);
+    DeflateBitWriter writer{ out };
+    writer.Put(1, 1);
+    writer.Put(1, 2);
+    std::vector<size_t> lastSeen(1 << 15, SIZE_MAX);
+    for (size_t pos = 0; pos < size;)
+    {
+        size_t matchLength = 0;
+        size_t distance = 0;
+        if (pos + 3 <= size)
+        {
+            uint32_t hash = ((data[pos] << 10) ^ (data[pos + 1] << 5) ^ data[pos + 2]) & 0x7FFF;
+            size_t candidate = lastSeen[hash];
+            lastSeen[hash] = pos;
+            if (candidate != SIZE_MAX && pos - candidate <= kWindow)
+            {
+                size_t limit = (std::min)(static_cast<size_t>(258), size - pos);
+                while (matchLength < limit && data[candidate + matchLength] == data[pos + matchLength])
+                {
+                    ++matchLength;
+                }
+                distance = pos - candidate;
+            }
+        }
+        if (matchLength < 3)
+        {
+            writer.PutLiteralOrLength(data[pos]);
+            ++pos;
+            continue;
+        }
+        size_t lengthCode = std::upper_bound(std::begin(kLengthBase), std::end(kLengthBase), matchLength) - std::begin(kLengthBase) - 1;
+        writer.PutLiteralOrLength(static_cast<uint32_t>(257 + lengthCode));
+        writer.Put(static_cast<uint32_t>(matchLength - kLengthBase[lengthCode]), kLengthExtra[lengthCode]);
+        size_t distanceCode = std::upper_bound(std::begin(kDistanceBase), std::end(kDistanceBase), distance) - std::begin(kDistanceBase) - 1;
+        writer.PutCode(static_cast<uint32_t>(distanceCode), 5);
+        writer.Put(static_cast<uint32_t>(distance - kDistanceBase[distanceCode]), kDistanceExtra[distanceCode]);
+        pos += matchLength;
+    }
+    writer.PutLiteralOrLength(256);
+    writer.Put(0, 7);
+    return out;
+}
+
+void AppendLe(std::vector<uint8_t>& out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+// A central directory record; sizes and the offset go to a ZIP64 extra field when they overflow.
+void AppendCentralRecord(std::vector<uint8_t>& out, const std::string& name, uint16_t method, uint32_t crc,
+    uint64_t compressedSize, uint64_t size, uint64_t offset)
+{
+    bool zip64 = size >= 0xFFFFFFFFu || compressedSize >= 0xFFFFFFFFu || offset >= 0xFFFFFFFFu;
+    AppendLe(out, 0x02014B50, 4);
+    AppendLe(out, 45, 2);
+    AppendLe(out, 45, 2);
+    AppendLe(out, 0, 2);
+    AppendLe(out, method, 2);
+    AppendLe(out, 0x6000, 2);
+    AppendLe(out, 0x5821, 2);
+    AppendLe(out, crc, 4);
+    AppendLe(out, zip64 ? 0xFFFFFFFFu : compressedSize, 4);
+    AppendLe(out, zip64 ? 0xFFFFFFFFu : size, 4);
+    AppendLe(out, name.size(), 2);
+    AppendLe(out, zip64 ? 28 : 0, 2);
+    AppendLe(out, 0, 2);
+    AppendLe(out, 0, 2);
+    AppendLe(out, 0, 2);
+    AppendLe(out, 0, 4);
+    AppendLe(out, zip64 ? 0xFFFFFFFFu : offset, 4);
+    out.insert(out.end(), name.begin(), name.end());
+    if (zip64)
+    {
+        AppendLe(out, 0x0001, 2);
+        AppendLe(out, 24, 2);
+        AppendLe(out, size, 8);
+        AppendLe(out, compressedSize, 8);
+        AppendLe(out, offset, 8);
+    }
+}
+
+// 8-bit "scanlines": a gradient with a little noise, about as compressible as raw bitmap data.
+std::vector<uint8_t> MakeBitmapBytes(size_t size, uint32_t seed)
+{
+    std::vector<uint8_t> bytes(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        seed = seed * 1103515245u + 12345u;
+        bytes[i] = static_cast<uint8_t>((i % 3072) / 12 + ((seed >> 16) & 3));
+    }
+    return bytes;
+}
+
+// Indexing a comic archive of several gigabytes: 40 KB pages at offsets past 4 GB, which only a
+// ZIP64 extra field can hold. The directory is all that is read when an archive is opened.
+void BenchZipDirectory()
+{
+    size_t memberCount = BenchSize(200000);
+    std::vector<uint8_t> directory;
+    uint64_t offset = 0;
+    for (size_t i = 0; i < memberCount; ++i)
+    {
+        std::string name = "volume" + std::to_string(i / 1000) + "/page" + std::to_string(i) + ".jpg";
+        AppendCentralRecord(directory, name, 0, 0, 40 * 1024, 40 * 1024, offset);
+        offset += kZipLocalHeaderSize + name.size() + 40 * 1024;
+    }
+    char title[64];
+    std::snprintf(title, sizeof(title), "ParseZipCentralDirectory %.1f GB archive", static_cast<double>(offset) / (1 << 30));
+    RunBenchmark(title, directory.size(), [&]()
+        {
+            std::vector<ZipMember> members;
+            ParseZipCentralDirectory(directory.data(), directory.size(), memberCount, members);
+            g_sink += members.size() + static_cast<size_t>(members.back().localHeaderOffset);
+        });
+}
+
+// Reading every page of an archive held in memory, as ReadZipMember does from the mapping:
+// local header, size check, then inflate and CRC for deflated pages. Stored pages are views
+// into the mapping and cost nothing here.
+void BenchZipMembers()
+{
+    constexpr size_t kPageBytes = 1 << 20;
+    size_t pageCount = (std::max)(BenchSize(256 << 20) / kPageBytes, static_cast<size_t>(2));
+    std::vector<uint8_t> archive;
+    std::vector<ZipMember> members;
+    for (size_t i = 0; i < pageCount; ++i)
+    {
+        std::vector<uint8_t> page = MakeBitmapBytes(kPageBytes, static_cast<uint32_t>(i));
+        std::vector<uint8_t> compressed = DeflateFixed(page.data(), page.size());
+        ZipMember member;
+        member.method = 8;
+        member.localHeaderOffset = archive.size();
+        member.compressedSize = compressed.size();
+        member.size = page.size();
+        member.crc = ComputeCrc32(page.data(), page.size());
+        AppendLe(archive, 0x04034B50, 4);
+        archive.resize(archive.size() + 22, 0);
+        AppendLe(archive, 0, 2);
+        AppendLe(archive, 0, 2);
+        archive.insert(archive.end(), compressed.begin(), compressed.end());
+        members.push_back(member);
+    }
+    std::vector<uint8_t> output(kPageBytes);
+    RunBenchmark("ReadZipMember deflated 1 MB pages", pageCount * kPageBytes, [&]()
+        {
+            for (const ZipMember& member : members)
+            {
+                uint64_t dataOffset = 0;
+                if (!ReadZipLocalHeader(archive.data() + member.localHeaderOffset, kZipLocalHeaderSize, member, dataOffset)
+                    || !IsZipMemberSizeValid(member)
+                    || !InflateRaw(archive.data() + dataOffset, static_cast<size_t>(member.compressedSize), output.data(), output.size())
+                    || ComputeCrc32(output.data(), output.size()) != member.crc)
+                {
+                    std::printf("damaged page at %llu\n", static_cast<unsigned long long>(member.localHeaderOffset));
+                    return;
+                }
+                g_sink += output[member.size / 2];
+            }
+        });
+}
+
+// =====================
+// プレイリスト索引
+// =====================
+
+// A reference library of BenchSize(1M) files: 100 photos in each album folder, two levels under
+// the root, named the way cameras name them.
+PlaylistIndex MakeLibraryPlaylist(size_t fileCount)
+{
+    PlaylistIndex index;
+    index.roots.push_back(L"D:\\Library");
+    size_t folders = (std::max)(fileCount / 100, static_cast<size_t>(1));
+    index.directories.reserve(folders);
+    for (size_t folder = 0; folder < folders; ++folder)
+    {
+        wchar_t path[64];
+        std::swprintf(path, 64, L"D:\\Library\\Artist %04zu\\Album %02zu", folder / 20, folder % 20);
+        PlaylistDirectory directory;
+        directory.path = path;
+        directory.writeTime = 0x01DA000000000000ull + folder;
+        directory.files.reserve(100);
+        for (size_t file = 0; file < 100; ++file)
+        {
+            wchar_t name[32];
+            std::swprintf(name, 32, L"IMG_%06zu.jpg", folder * 100 + file);
+            directory.files.push_back(PlaylistFile{ name, 0x01DA000000000000ull + file, 2000000 + file * 37 });
+        }
+        index.directories.push_back(std::move(directory));
+    }
+    return index;
+}
+
+// Saving the index at exit and loading it at the next launch, before any folder is revalidated.
+void BenchPlaylistIndex()
+{
+    PlaylistIndex index = MakeLibraryPlaylist(BenchSize(1000000));
+    std::vector<uint8_t> bytes;
+    EncodePlaylistIndex(index, bytes);
+    RunBenchmark("EncodePlaylistIndex 1M files", bytes.size(), [&]()
+        {
+            bytes.clear();
+            EncodePlaylistIndex(index, bytes);
+            g_sink += bytes.size();
+        });
+    PlaylistIndex decoded;
+    RunBenchmark("DecodePlaylistIndex 1M files", bytes.size(), [&]()
+        {
+            g_sink += DecodePlaylistIndex(bytes.data(), bytes.size(), decoded) ? decoded.directories.size() : 0;
+        });
+}
+
+// =====================
+// メタデータキャッシュ
+// =====================
+
+// Cached header facts for a folder of BenchSize(1M) images, then the sort the dimensions mode
+// runs over them: pixel count first, name second, on columns rather than whole entries.
+void BenchMetadataCache()
+{
+    size_t count = BenchSize(1000000);
+    std::unordered_map<uint64_t, MetadataCacheRecord> records;
+    records.reserve(count);
+    std::vector<uint64_t> primary(count);
+    std::vector<std::wstring> names(count);
+    uint64_t state = 46;
+    for (size_t i = 0; i < count; ++i)
+    {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        MetadataCacheRecord record;
+        record.writeTime = 0x01DA000000000000ull + i;
+        record.size = 1000000 + (state >> 44);
+        record.metadata = { 640u + static_cast<uint32_t>(state >> 58) * 320u, 480u + static_cast<uint32_t>(state >> 60) * 240u,
+            (state & 15) == 0 ? 24u : 1u, 0x01D9000000000000ull + (state >> 30), (state & 7) == 0 };
+        records[state] = record;
+        primary[i] = static_cast<uint64_t>(record.metadata.width) * record.metadata.height;
+        wchar_t name[32];
+        std::swprintf(name, 32, L"img_%07zu.png", (i * 7919) % count);
+        names[i] = name;
+    }
+
+    std::vector<uint8_t> bytes;
+    EncodeMetadataCache(records, bytes);
+    RunBenchmark("EncodeMetadataCache 1M images", bytes.size(), [&]()
+        {
+            bytes.clear();
+            EncodeMetadataCache(records, bytes);
+            g_sink += bytes.size();
+        });
+    std::unordered_map<uint64_t, MetadataCacheRecord> decoded;
+    RunBenchmark("DecodeMetadataCache 1M images", bytes.size(), [&]()
+        {
+            decoded.clear();
+            g_sink += DecodeMetadataCache(bytes.data(), bytes.size(), decoded) ? decoded.size() : 0;
+        });
+
+    std::vector<size_t> order(count);
+    RunBenchmark("Sort 1M images by dimensions", count * sizeof(uint64_t), [&]()
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                order[i] = i;
+            }
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                {
+                    return CatalogKeyPrecedes(SortMode::DimensionsAsc, primary[a], names[a], primary[b], names[b]);
+                });
+            g_sink += order[0];
+        });
+}
+
+// =====================
+// 文字コード
+// =====================
+
+// Reading a whole document from disk, as ReadFileBytes did (istreambuf_iterator, then erasing
+// the BOM) and as ReadDocumentBuffer does (one sized buffer, the BOM skipped in place). The files
+// are small enough to stay in the page cache, so this is the copying rather than the disk.
+void BenchDocumentRead()
+{
+    struct Size
+    {
+        const char* label;
+        size_t bytes;
+    };
+    static constexpr Size kSizes[] = {
+        { "1 KB", 1024 },
+        { "1 MB", 1 << 20 },
+        { "64 MB", 64 << 20 },
+        { "500 MB", 500 << 20 },
+    };
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "FloatVisionCoreBench.md";
+    for (const Size& size : kSizes)
+    {
+        std::string bytes(kUtf8Bom);
+        bytes += RepeatText("# Notes\n\nSome *markdown* with `code` and a [link](https://example.com).\n", BenchSize(size.bytes));
+        std::FILE* file = std::fopen(path.string().c_str(), "wb");
+        if (!file)
+        {
+            return;
+        }
+        std::fwrite(bytes.data(), 1, bytes.size(), file);
+        std::fclose(file);
+        std::string().swap(bytes);
+        size_t fileBytes = static_cast<size_t>(std::filesystem::file_size(path));
+
+        std::string name = std::string("istreambuf_iterator read ") + size.label;
+        RunBenchmark(name.c_str(), fileBytes, [&]()
+            {
+                std::ifstream input(path, std::ios::binary);
+                std::string text((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+                if (text.starts_with(kUtf8Bom))
+                {
+                    text.erase(0, kUtf8Bom.size());
+                }
+                g_sink += text.size();
+            });
+        name = std::string("FillDocumentBuffer read ") + size.label;
+        RunBenchmark(name.c_str(), fileBytes, [&]()
+            {
+                std::FILE* input = std::fopen(path.string().c_str(), "rb");
+                if (!input)
+                {
+                    return;
+                }
+                DocumentBuffer document;
+                FillDocumentBuffer(fileBytes, [input](char* data, size_t size, size_t& read)
+                    {
+                        read = std::fread(data, 1, size, input);
+                        return read == size || !std::ferror(input);
+                    }, document);
+                std::fclose(input);
+                g_sink += document.Text().size();
+            });
+    }
+    std::filesystem::remove(path);
+}
+
+// Documents of each kind the viewer opens: English source, Japanese prose, and Markdown that
+// mixes the two a few words at a time.
+void BenchUtf8()
+{
+    struct Sample
+    {
+        const char* decodeName;
+        const char* encodeName;
+        std::string_view text;
+    };
+    static constexpr Sample kSamples[] = {
+        { "DecodeUtf8 ASCII", "WideToUtf8 ASCII", "int main(int argc, char** argv) { return argc > 1 ? run(argv[1]) : 0; }\n" },
+        { "DecodeUtf8 CJK", "WideToUtf8 CJK",
+          "\xE7\x94\xBB\xE5\x83\x8F\xE3\x82\x92\xE8\xA1\xA8\xE7\xA4\xBA\xE3\x81\x97\xE3\x81\xBE\xE3\x81\x99\xE3\x80\x82"
+          "\xE6\x96\x87\xE6\x9B\xB8\xE3\x82\x82\xE9\x96\x8B\xE3\x81\x91\xE3\x81\xBE\xE3\x81\x99\xE3\x80\x82\n" },
+        { "DecodeUtf8 mixed", "WideToUtf8 mixed",
+          "## \xE8\xA8\xAD\xE5\xAE\x9A (settings)\n\n`FloatVision.ini` \xE3\x81\xAB\xE4\xBF\x9D\xE5\xAD\x98\xE3\x81\x95\xE3\x82\x8C\xE3\x81\xBE\xE3\x81\x99 \xE2\x80\x94 see [README](README.md).\n" },
+    };
+    for (const Sample& sample : kSamples)
+    {
+        std::string bytes = RepeatText(sample.text, BenchSize(32 << 20));
+        std::wstring text;
+        RunBenchmark(sample.decodeName, bytes.size(), [&]()
+            {
+                Utf8ToWide(bytes, text);
+                g_sink += text.size();
+            });
+        std::string encoded;
+        RunBenchmark(sample.encodeName, bytes.size(), [&]()
+            {
+                WideToUtf8(text, encoded);
+                g_sink += encoded.size();
+            });
+    }
+}
+
+// =====================
+// テキスト行索引
+// =====================
+
+// A log of BenchSize(1 GB) made of one 4 MB block repeated, so it never has to be held whole.
+void BenchTextLineIndex()
+{
+    std::string block;
+    size_t lineNumber = 0;
+    while (block.size() < (4 << 20))
+    {
+        char line[160];
+        int length = std::snprintf(line, sizeof(line), "2026-10-19T12:%02zu:%02zu.%03zuZ INFO  worker-%zu request %zu finished in %zu ms\n",
+            lineNumber / 60 % 60, lineNumber % 60, lineNumber % 1000, lineNumber % 16, lineNumber, lineNumber * 7 % 500);
+        block.append(line, static_cast<size_t>(length));
+        ++lineNumber;
+    }
+    // Whole lines only, so every copy starts on a line.
+    block.resize(block.rfind('\n') + 1);
+    size_t blockLines = static_cast<size_t>(std::count(block.begin(), block.end(), '\n'));
+    size_t blocks = (std::max)(BenchSize(size_t(1) << 30) / block.size(), static_cast<size_t>(1));
+    if (g_quick)
+    {
+        block.resize(block.find('\n', BenchSize(block.size())) + 1);
+        blockLines = static_cast<size_t>(std::count(block.begin(), block.end(), '\n'));
+    }
+
+    TextLineIndex index;
+    RunBenchmark("AppendTextLineIndex 1 GB log", block.size() * blocks, [&]()
+        {
+            ResetTextLineIndex(index, 0);
+            for (size_t i = 0; i < blocks; ++i)
+            {
+                AppendTextLineIndex(index, block.data(), block.size());
+            }
+            g_sink += static_cast<size_t>(index.lineCount);
+        });
+
+    // Two copies back to back, so any window that fits in one copy maps without a seam.
+    std::string twice = block + block;
+    TextRangeMapper map = [&](uint64_t offset, size_t length) -> const char*
+    {
+        size_t at = static_cast<size_t>(offset % block.size());
+        return length <= block.size() ? twice.data() + at : nullptr;
+    };
+    uint64_t lineCount = GetTextLineCount(index, true);
+    std::wstring text;
+    size_t lookups = 4096;
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    size_t bytesRead = 0;
+    RunBenchmark("ReadTextLine random lines", 100 * lookups, [&]()
+        {
+            for (size_t i = 0; i < lookups; ++i)
+            {
+                state = state * 6364136223846793005ull + 1442695040888963407ull;
+                ReadTextLine(index, true, (state >> 11) % lineCount, map, text);
+                bytesRead += text.size();
+            }
+            g_sink += bytesRead;
+        });
+    g_sink += blockLines;
+}
+
+// =====================
+// 設定ストア
+// =====================
+
+// An ini the size a well-used FloatVision.ini reaches: eight sections of 20 keys with comments.
+// Loading is split, index and one lookup per key, as LoadSettings does; saving is a change to
+// every fifth key then the text FlushSettingsStore writes.
+void BenchSettingsStore()
+{
+    std::wstring content = L"; FloatVision settings\r\n";
+    std::vector<std::pair<std::wstring, std::wstring>> keys;
+    for (int section = 0; section < 8; ++section)
+    {
+        std::wstring name = L"Section" + std::to_wstring(section);
+        content += L"\r\n[" + name + L"]\r\n; keys of " + name + L"\r\n";
+        for (int key = 0; key < 20; ++key)
+        {
+            std::wstring keyName = L"Key" + std::to_wstring(key);
+            content += keyName + L" = " + std::to_wstring(section * 1000 + key) + L"\r\n";
+            keys.emplace_back(name, keyName);
+        }
+    }
+    std::string bytes;
+    WideToUtf8(content, bytes);
+
+    RunBenchmark("SettingsStore load 160 keys", bytes.size(), [&]()
+        {
+            std::wstring text;
+            Utf8ToWide(bytes, text);
+            SettingsStore store;
+            SplitSettingsLines(text, store.lines);
+            IndexSettingsLines(store);
+            for (const auto& [section, key] : keys)
+            {
+                g_sink += store.keyLines.count(MakeSettingsKey(section, key));
+            }
+        });
+
+    SettingsStore loaded;
+    SplitSettingsLines(content, loaded.lines);
+    IndexSettingsLines(loaded);
+    RunBenchmark("SettingsStore save 32 changes", bytes.size(), [&]()
+        {
+            SettingsStore store = loaded;
+            for (size_t i = 0; i < keys.size(); i += 5)
+            {
+                ApplySettingsChange(store, { keys[i].first, keys[i].second, std::to_wstring(i), false });
+            }
+            std::wstring text;
+            for (const std::wstring& line : store.lines)
+            {
+                text += line;
+                text += L"\r\n";
+            }
+            std::string out;
+            WideToUtf8(text, out);
+            g_sink += out.size();
+        });
+}
+
+// The app's 32 ini settings, looked up by name as a settings file is read: the compile-time hash
+// table against the comparison chain it replaced.
+struct BenchSettingField
+{
+    std::wstring_view section;
+    std::wstring_view key;
+    std::wstring_view markdownName;
+};
+
+constexpr std::array kBenchSettingFields{
+    BenchSettingField{ L"Settings", L"SortMode", L"" }, BenchSettingField{ L"Settings", L"SortImageOnly", L"" },
+    BenchSettingField{ L"Settings", L"FilterAnimatedOnly", L"" }, BenchSettingField{ L"Settings", L"FilterAlphaOnly", L"" },
+    BenchSettingField{ L"Settings", L"AlwaysOnTop", L"" }, BenchSettingField{ L"Settings", L"TransparencyMode", L"" },
+    BenchSettingField{ L"Settings", L"TransparencyColor", L"" }, BenchSettingField{ L"Window", L"PositionMode", L"" },
+    BenchSettingField{ L"Window", L"CustomX", L"" }, BenchSettingField{ L"Window", L"CustomY", L"" },
+    BenchSettingField{ L"Text", L"FontName", L"font" }, BenchSettingField{ L"Text", L"FontSize", L"fontsize" },
+    BenchSettingField{ L"Text", L"FontColor", L"fontcolor" }, BenchSettingField{ L"Text", L"BackgroundColor", L"background" },
+    BenchSettingField{ L"Text", L"Wrap", L"wrap" }, BenchSettingField{ L"Text", L"Follow", L"" },
+    BenchSettingField{ L"Text", L"Width", L"width" }, BenchSettingField{ L"Text", L"Height", L"height" },
+    BenchSettingField{ L"KeyConfig", L"NextFile", L"" }, BenchSettingField{ L"KeyConfig", L"PrevFile", L"" },
+    BenchSettingField{ L"KeyConfig", L"ZoomIn", L"" }, BenchSettingField{ L"KeyConfig", L"ZoomOut", L"" },
+    BenchSettingField{ L"KeyConfig", L"OriginalSize", L"" }, BenchSettingField{ L"KeyConfig", L"OpenFile", L"" },
+    BenchSettingField{ L"KeyConfig", L"Exit", L"" }, BenchSettingField{ L"KeyConfig", L"AlwaysOnTop", L"" },
+    BenchSettingField{ L"KeyConfig", L"Minimize", L"" }, BenchSettingField{ L"KeyConfig", L"Reload", L"" },
+    BenchSettingField{ L"KeyConfig", L"ScrollUp", L"" }, BenchSettingField{ L"KeyConfig", L"ScrollDown", L"" },
+    BenchSettingField{ L"KeyConfig", L"ScrollLeft", L"" }, BenchSettingField{ L"KeyConfig", L"ScrollRight", L"" },
+};
+constexpr auto kBenchSettingTable = BuildSettingHashTable<std::bit_ceil(kBenchSettingFields.size() * 4)>(kBenchSettingFields, false);
+static_assert(kBenchSettingTable.seed != 0);
+
+void BenchSettingLookup()
+{
+    // Every name once, and as many that match nothing: other tools' keys in a shared file.
+    std::vector<std::wstring> names;
+    for (const BenchSettingField& field : kBenchSettingFields)
+    {
+        std::wstring name = std::wstring(field.section) + L'\n' + std::wstring(field.key);
+        FoldCaseText(name);
+        names.push_back(name);
+        names.push_back(name + L"2");
+    }
+    size_t nameBytes = 0;
+    for (const std::wstring& name : names)
+    {
+        nameBytes += name.size() * sizeof(wchar_t);
+    }
+    size_t rounds = BenchSize(1 << 16);
+    RunBenchmark("Setting lookup, hash table", nameBytes * rounds, [&]()
+        {
+            for (size_t round = 0; round < rounds; ++round)
+            {
+                for (const std::wstring& name : names)
+                {
+                    uint8_t index = FindSettingSlot(kBenchSettingTable, name);
+                    g_sink += index != kSettingSlotEmpty && MatchesSettingField(kBenchSettingFields[index], name, false);
+                }
+            }
+        });
+    RunBenchmark("Setting lookup, comparison chain", nameBytes * rounds, [&]()
+        {
+            for (size_t round = 0; round < rounds; ++round)
+            {
+                for (const std::wstring& name : names)
+                {
+                    for (const BenchSettingField& field : kBenchSettingFields)
+                    {
+                        if (MatchesSettingField(field, name, false))
+                        {
+                            ++g_sink;
+                            break;
+                        }
+                    }
+                }
+            }
+        });
+}
+
+// =====================
+// フォントカタログ
+// =====================
+
+// A synthetic system collection of BenchSize(4096) families: eight faces each, and a Japanese
+// name for every eighth family, as a Japanese install lists them. Building is what the catalog
+// thread does once; lookups are what UpdateTextFormat and the settings dialogs ask.
+void BenchFontCatalog()
+{
+    static constexpr const wchar_t* kStyles[] = { L"Regular", L"Bold", L"Italic", L"Bold Italic", L"Light", L"Semibold", L"Black", L"Condensed" };
+    struct Family
+    {
+        std::vector<std::wstring> names;
+        std::vector<std::vector<std::wstring>> faceNames;
+    };
+    size_t familyCount = BenchSize(4096);
+    std::vector<Family> families(familyCount);
+    size_t nameBytes = 0;
+    for (size_t i = 0; i < familyCount; ++i)
+    {
+        Family& family = families[i];
+        family.names.push_back(L"Font Family " + std::to_wstring(i));
+        if (i % 8 == 0)
+        {
+            family.names.push_back(L"フォント " + std::to_wstring(i));
+        }
+        for (const wchar_t* style : kStyles)
+        {
+            family.faceNames.push_back({ family.names.front() + L" " + style });
+            nameBytes += family.faceNames.back().front().size() * sizeof(wchar_t);
+        }
+    }
+
+    FontCatalogIndex index;
+    RunBenchmark("Build font catalog 4096 families", nameBytes, [&]()
+        {
+            index = FontCatalogIndex{};
+            for (const Family& family : families)
+            {
+                AddFontCatalogFamily(index, family.names);
+                uint32_t weight = 400;
+                for (const std::vector<std::wstring>& faceNames : family.faceNames)
+                {
+                    FontCatalogEntry face;
+                    face.familyName = family.names.front();
+                    face.weight = weight;
+                    weight = weight % 900 + 100;
+                    AddFontCatalogFace(index, face, faceNames, { family.names.front() });
+                }
+            }
+            g_sink += index.faces.size();
+        });
+
+    // Family names, face names, GDI names and misses, mixed.
+    std::vector<std::wstring> queries;
+    for (size_t i = 0; i < familyCount; i += 3)
+    {
+        queries.push_back(families[i].names.back());
+        queries.push_back(families[i].faceNames[i % 8].front());
+        queries.push_back(L"font family " + std::to_wstring(i) + L" ui");
+    }
+    size_t queryBytes = 0;
+    for (const std::wstring& query : queries)
+    {
+        queryBytes += query.size() * sizeof(wchar_t);
+    }
+    RunBenchmark("Resolve font names", queryBytes, [&]()
+        {
+            FontCatalogEntry entry;
+            std::wstring familyName;
+            for (const std::wstring& query : queries)
+            {
+                g_sink += FindFontCatalogEntry(index, query, entry) ? entry.weight : 0;
+                g_sink += FindFontCatalogGdiFamily(index, query, familyName) ? familyName.size() : 0;
+            }
+        });
+}
+
+// =====================
+// コードハイライト
+// =====================
+
+void BenchHighlightCode()
+{
+    struct Sample
+    {
+        const char* name;
+        const char* info;
+        std::string_view code;
+    };
+    static constexpr Sample kSamples[] = {
+        { "HighlightCode cpp", "cpp",
+            "#include <vector>\n// Sums the values.\nstatic int Sum(const std::vector<int>& values)\n{\n"
+            "    int total = 0x10; /* start */\n    for (int value : values) { total += value * 3; }\n"
+            "    return total > 42 ? total : -1; // \"done\"\n}\n" },
+        { "HighlightCode python", "python",
+            "@cache\ndef load(path, mode='r'):\n    \"\"\"Reads the file.\"\"\"\n    with open(path, mode) as f:  # text\n"
+            "        return [line.strip() for line in f if len(line) > 0x20]\n" },
+        { "HighlightCode json", "json",
+            "{\"name\": \"FloatVision\", \"size\": 12345, \"ratio\": 1.5e3, \"tags\": [\"a\", \"b\"], \"ok\": true, \"none\": null},\n" },
+        { "HighlightCode sh", "sh",
+            "for f in \"$@\"; do\n    if [ -f \"${f}\" ]; then echo '$f' >> out.log; fi # copy\ndone\nexport PATH=$HOME/bin:$PATH\n" },
+        { "HighlightCode yaml", "yaml",
+            "name: build\non: push\njobs:\n  - run: make -j8 # all\n    env: { CC: clang, OPT: 'yes' }\n    retries: 3\n" },
+    };
+    std::string html;
+    for (const Sample& sample : kSamples)
+    {
+        const CodeLanguage* language = FindCodeLanguage(sample.info);
+        std::string code = RepeatText(sample.code, BenchSize(8 << 20));
+        RunBenchmark(sample.name, code.size(), [&]()
+            {
+                html.clear();
+                HighlightCode(*language, code, html);
+                g_sink += html.size();
+            });
+    }
+}
+
+// =====================
+// Markdown キャッシュ
+// =====================
+
+void BenchHashBytes()
+{
+    std::string text = RepeatText("# Heading\n\nSome *markdown* text with `code` and a [link](https://example.com/).\n", BenchSize(64 << 20));
+    RunBenchmark("HashBytes 64 MB", text.size(), [&]()
+        {
+            g_sink += static_cast<size_t>(HashBytes(text.data(), text.size(), 0));
+        });
+    // Section hashes: many short inputs, where the setup and tail dominate.
+    std::vector<std::string_view> sections;
+    for (size_t pos = 0; pos + 300 <= text.size(); pos += 300)
+    {
+        sections.push_back(std::string_view(text).substr(pos, 120 + pos % 180));
+    }
+    size_t sectionBytes = 0;
+    for (std::string_view section : sections)
+    {
+        sectionBytes += section.size();
+    }
+    RunBenchmark("HashBytes 120-300 byte sections", sectionBytes, [&]()
+        {
+            for (std::string_view section : sections)
+            {
+                g_sink += static_cast<size_t>(HashBytes(section.data(), section.size(), 0));
+            }
+        });
+}
+
+// =====================
+// Markdown ページ
+// =====================
+
+// A BenchSize(50 MB) markdown file taken to the temp HTML file WebView navigates to: rendered
+// straight into the page buffer, then written out as the same UTF-8 bytes behind a BOM. The old
+// path widened the page to UTF-16 and wrote that, twice the bytes on disk.
+void BenchMarkdownDelivery()
+{
+    std::string markdown = RepeatText(
+        "## Section\n\nSome *markdown* with `code`, a [link](https://example.com/) and "
+        "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E.\n\n- one\n- two\n\n```cpp\nint x = 1;\n```\n\n", BenchSize(50 << 20));
+    constexpr std::string_view prologue = "<!DOCTYPE html><html><head></head><body><article>";
+    constexpr std::string_view epilogue = "</article></body></html>";
+    MarkdownPage page;
+    RenderMarkdownPage(markdown, prologue, epilogue, page);
+    RunBenchmark("RenderMarkdownPage 50 MB", markdown.size(), [&]()
+        {
+            RenderMarkdownPage(markdown, prologue, epilogue, page);
+            g_sink += page.html.size();
+        });
+
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "FloatVisionCoreBench.html";
+    RunBenchmark("WriteUtf8Html 50 MB page", page.html.size(), [&]()
+        {
+            std::ofstream output(path, std::ios::binary | std::ios::trunc);
+            g_sink += WriteUtf8Html(output, page.html) ? 1 : 0;
+        });
+    std::filesystem::remove(path);
+}
+}
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--quick") == 0)
+        {
+            g_quick = true;
+        }
+        else
+        {
+            g_filter = argv[i];
+        }
+    }
+    BenchCatalogOrder();
+    BenchZipDirectory();
+    BenchZipMembers();
+    BenchPlaylistIndex();
+    BenchMetadataCache();
+    BenchDocumentRead();
+    BenchUtf8();
+    BenchTextLineIndex();
+    BenchSettingsStore();
+    BenchSettingLookup();
+    BenchFontCatalog();
+    BenchHighlightCode();
+    BenchHashBytes();
+    BenchMarkdownDelivery();
+    return g_sink == 0;
+}
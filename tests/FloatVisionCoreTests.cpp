@@ -0,0 +1,2953 @@
+﻿#include "FloatVisionCore.h"
+#include "md4c-html.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+int g_failures = 0;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ++g_failures; \
+        } \
+    } while (false)
+
+// Deterministic generator for the generated-input tests.
+struct TestRandom
+{
+    uint32_t seed = 1;
+
+    uint32_t Next(uint32_t range)
+    {
+        seed = (seed * 1103515245u + 12345u) & 0x7FFFFFFFu;
+        return (seed >> 8) % range;
+    }
+};
+
+// =====================
+// 並べ替えキー
+// =====================
+
+bool NaturalPrecedes(std::wstring_view a, std::wstring_view b)
+{
+    return CatalogKeyPrecedes(SortMode::NaturalAsc, 0, MakeNaturalSortKey(a), 0, MakeNaturalSortKey(b));
+}
+
+void TestNaturalSortKey()
+{
+    CHECK(NaturalPrecedes(L"img2.png", L"img10.png"));
+    CHECK(!NaturalPrecedes(L"img10.png", L"img2.png"));
+    CHECK(NaturalPrecedes(L"img9", L"img10"));
+    CHECK(NaturalPrecedes(L"page", L"page1"));
+    CHECK(NaturalPrecedes(L"a1b2", L"a1b10"));
+    CHECK(NaturalPrecedes(L"v1.9", L"v1.10"));
+    // Equal values: fewer leading zeros first, and both before the next value.
+    CHECK(NaturalPrecedes(L"a1", L"a01"));
+    CHECK(NaturalPrecedes(L"a01", L"a2"));
+    CHECK(NaturalPrecedes(L"a0", L"a1"));
+    CHECK(MakeNaturalSortKey(L"IMG2.PNG") == MakeNaturalSortKey(L"img2.png"));
+    CHECK(MakeNaturalSortKey(L"a007") != MakeNaturalSortKey(L"a7"));
+    // Runs longer than a 64-bit number still compare by length, then digit by digit.
+    CHECK(NaturalPrecedes(L"x99999999999999999999", L"x100000000000000000000"));
+    CHECK(NaturalPrecedes(L"x100000000000000000000", L"x100000000000000000001"));
+    CHECK(MakeNaturalSortKey(L"").empty());
+}
+
+void TestCatalogKeyPrecedes()
+{
+    const std::wstring a = L"a";
+    const std::wstring b = L"b";
+    CHECK(CatalogKeyPrecedes(SortMode::SizeAsc, 1, b, 2, a));
+    CHECK(CatalogKeyPrecedes(SortMode::SizeAsc, 5, a, 5, b));
+    CHECK(!CatalogKeyPrecedes(SortMode::SizeAsc, 5, a, 5, a));
+    // A descending order reverses both the number and the name.
+    CHECK(CatalogKeyPrecedes(SortMode::TimeDesc, 2, a, 1, b));
+    CHECK(CatalogKeyPrecedes(SortMode::NameDesc, 0, b, 0, a));
+    CHECK(!CatalogKeyPrecedes(SortMode::NameDesc, 0, a, 0, a));
+    // Entries still waiting for the indexer carry the largest key and sort last.
+    CHECK(CatalogKeyPrecedes(SortMode::DimensionsAsc, 1ull << 40, b, ~0ull, a));
+    CHECK(IsDescendingSortMode(SortMode::TimeDesc) && !IsDescendingSortMode(SortMode::NaturalAsc));
+    CHECK(IsMetadataSortMode(SortMode::DateTakenAsc) && !IsMetadataSortMode(SortMode::SizeAsc));
+}
+
+// The columns against each other: keys in order, and every listed id where positionById and
+// idByName say it is.
+bool IsCatalogOrderConsistent(const CatalogOrder& order)
+{
+    size_t count = order.ids.size();
+    if (order.sortPrimary.size() != count || order.sortNames.size() != count || order.idByName.size() != count)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (order.ids[i] >= order.positionById.size() || order.positionById[order.ids[i]] != i
+            || (i > 0 && CatalogPositionPrecedes(order, i, i - 1)))
+        {
+            return false;
+        }
+    }
+    for (const auto& [name, id] : order.idByName)
+    {
+        if (id >= order.positionById.size() || order.positionById[id] == kNoCatalogEntry)
+        {
+            return false;
+        }
+    }
+    return std::count(order.positionById.begin(), order.positionById.end(), kNoCatalogEntry)
+        == static_cast<std::ptrdiff_t>(order.positionById.size() - count);
+}
+
+struct CatalogKeyModel
+{
+    uint32_t id = 0;
+    uint64_t primary = 0;
+    std::wstring sortName;
+};
+
+// Watcher notifications applied one at a time, as UpdateCatalogFile and RemoveCatalogEntry do:
+// adds, removes, rewrites that may move an entry, and renames that keep its id. Sort names come
+// from a small set so equal keys are common.
+void TestCatalogOrderEdits()
+{
+    for (SortMode mode : { SortMode::TimeAsc, SortMode::NameDesc })
+    {
+        CatalogOrder order;
+        order.sortMode = mode;
+        std::unordered_map<std::wstring, CatalogKeyModel> model;
+        TestRandom random{ 43 };
+        uint32_t nextId = 1;
+        bool consistent = true;
+        bool landsLast = true;
+        bool matches = true;
+        auto insert = [&](const std::wstring& name, uint32_t id)
+        {
+            CatalogKeyModel key{ id, random.Next(8), L"n" + std::to_wstring(random.Next(20)) };
+            size_t position = FindCatalogInsertPosition(order, key.primary, key.sortName);
+            InsertCatalogPosition(order, position, id, name, key.primary, key.sortName);
+            // Behind every equal key, in front of every greater one.
+            landsLast = landsLast && (position + 1 == order.ids.size() || CatalogPositionPrecedes(order, position, position + 1));
+            model[name] = std::move(key);
+        };
+        auto pickName = [&]()
+        {
+            auto it = model.begin();
+            std::advance(it, random.Next(static_cast<uint32_t>(model.size())));
+            return it->first;
+        };
+        for (int step = 0; step < 3000; ++step)
+        {
+            // Adds outnumber the rest so the catalog grows.
+            uint32_t roll = model.empty() ? 0 : random.Next(6);
+            uint32_t action = roll < 3 ? 0 : roll - 2;
+            if (action == 0)
+            {
+                std::wstring name = L"img" + std::to_wstring(random.Next(100000)) + L".jpg";
+                if (model.contains(name))
+                {
+                    continue;
+                }
+                order.positionById.push_back(kNoCatalogEntry);
+                insert(name, nextId++);
+            }
+            else if (action == 1)
+            {
+                std::wstring name = pickName();
+                uint32_t id = 0;
+                size_t position = RemoveCatalogPosition(order, name, id);
+                matches = matches && position != kNoCatalogEntry && id == model[name].id;
+                model.erase(name);
+            }
+            else if (action == 2)
+            {
+                std::wstring name = pickName();
+                size_t position = FindCatalogPosition(order, name);
+                CatalogKeyModel& key = model[name];
+                key.primary = random.Next(8);
+                order.sortPrimary[position] = key.primary;
+                if (!IsCatalogPositionInOrder(order, position))
+                {
+                    uint32_t id = 0;
+                    RemoveCatalogPosition(order, name, id);
+                    insert(name, id);
+                    key.primary = order.sortPrimary[order.positionById[id]];
+                }
+            }
+            else
+            {
+                std::wstring oldName = pickName();
+                std::wstring newName = L"renamed" + std::to_wstring(step) + L".png";
+                uint32_t id = 0;
+                RemoveCatalogPosition(order, oldName, id);
+                matches = matches && id == model[oldName].id;
+                model.erase(oldName);
+                insert(newName, id);
+            }
+            consistent = consistent && IsCatalogOrderConsistent(order);
+        }
+        for (const auto& [name, key] : model)
+        {
+            size_t position = FindCatalogPosition(order, name);
+            matches = matches && position != kNoCatalogEntry && order.ids[position] == key.id
+                && order.sortPrimary[position] == key.primary && order.sortNames[position] == key.sortName;
+        }
+        CHECK(consistent);
+        CHECK(landsLast);
+        CHECK(matches);
+        CHECK(model.size() == order.ids.size() && model.size() > 100);
+        CHECK(FindCatalogPosition(order, L"missing.jpg") == kNoCatalogEntry);
+        uint32_t missingId = 7;
+        CHECK(RemoveCatalogPosition(order, L"missing.jpg", missingId) == kNoCatalogEntry && missingId == 0);
+    }
+}
+
+// Scanner batches merged as MergeCatalogBatch does, 256 entries doubling past the parallel sort
+// threshold: names already listed are skipped, and after every merge the catalog is the stable
+// sort of everything in arrival order, so equal keys never trade places.
+void TestCatalogBatchMerge()
+{
+    CatalogOrder order;
+    order.sortMode = SortMode::SizeAsc;
+    std::vector<CatalogKeyModel> arrived;
+    // The host's own column, moved by the same permutations.
+    std::vector<uint32_t> hostIds;
+    TestRandom random{ 47 };
+    uint32_t nextId = 1;
+    size_t skipped = 0;
+    auto expectedIds = [&](SortMode mode)
+    {
+        std::vector<CatalogKeyModel> sorted = arrived;
+        std::stable_sort(sorted.begin(), sorted.end(), [mode](const CatalogKeyModel& a, const CatalogKeyModel& b)
+        {
+            return CatalogKeyPrecedes(mode, a.primary, a.sortName, b.primary, b.sortName);
+        });
+        std::vector<uint32_t> ids;
+        for (const CatalogKeyModel& key : sorted)
+        {
+            ids.push_back(key.id);
+        }
+        return ids;
+    };
+    bool matches = true;
+    for (size_t batchSize = 256; batchSize <= 32768 && matches; batchSize *= 2)
+    {
+        size_t previousCount = order.ids.size();
+        for (size_t i = 0; i < batchSize; ++i)
+        {
+            std::wstring name = L"DSC" + std::to_wstring(random.Next(200000)) + L".jpg";
+            auto [it, inserted] = order.idByName.try_emplace(name, nextId);
+            if (!inserted)
+            {
+                ++skipped;
+                continue;
+            }
+            CatalogKeyModel key{ nextId++, random.Next(16), L"n" + std::to_wstring(random.Next(64)) };
+            order.positionById.push_back(kNoCatalogEntry);
+            order.ids.push_back(key.id);
+            order.sortPrimary.push_back(key.primary);
+            order.sortNames.push_back(key.sortName);
+            hostIds.push_back(key.id);
+            arrived.push_back(std::move(key));
+        }
+        std::vector<uint32_t> permutation = MakeCatalogPermutation(order, previousCount);
+        std::vector<uint32_t> moved;
+        for (uint32_t index : permutation)
+        {
+            moved.push_back(hostIds[index]);
+        }
+        hostIds.swap(moved);
+        PermuteCatalogOrder(order, permutation);
+        matches = IsCatalogOrderConsistent(order) && order.ids == expectedIds(order.sortMode) && hostIds == order.ids;
+    }
+    CHECK(matches);
+    CHECK(skipped > 0 && order.ids.size() > 2 * kCatalogSortChunkEntries);
+
+    // A new sort mode re-sorts everything; equal keys keep the order they had.
+    order.sortMode = SortMode::TimeDesc;
+    std::vector<CatalogKeyModel> listed(nextId);
+    for (CatalogKeyModel& key : arrived)
+    {
+        listed[key.id] = std::move(key);
+    }
+    arrived.clear();
+    for (uint32_t id : order.ids)
+    {
+        arrived.push_back(listed[id]);
+    }
+    PermuteCatalogOrder(order, MakeCatalogPermutation(order, 0));
+    CHECK(IsCatalogOrderConsistent(order) && order.ids == expectedIds(SortMode::TimeDesc));
+
+    // An empty batch leaves the order as it was.
+    std::vector<uint32_t> before = order.ids;
+    PermuteCatalogOrder(order, MakeCatalogPermutation(order, order.ids.size()));
+    CHECK(order.ids == before);
+
+    ClearCatalogOrder(order);
+    CHECK(order.ids.empty() && order.idByName.empty() && order.positionById.size() == 1);
+}
+
+// =====================
+// アーカイブ (ZIP/CBZ)
+// =====================
+
+void AppendLe(std::vector<uint8_t>& out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+void AppendBytes(std::vector<uint8_t>& out, std::string_view bytes)
+{
+    out.insert(out.end(), bytes.begin(), bytes.end());
+}
+
+void AppendCentralHeader(std::vector<uint8_t>& out, std::string_view name, uint16_t flags, uint16_t method,
+    uint32_t compressedSize, uint32_t size, uint32_t offset, const std::vector<uint8_t>& extra = {})
+{
+    AppendLe(out, 0x02014B50, 4);
+    AppendLe(out, 20, 2);
+    AppendLe(out, 20, 2);
+    AppendLe(out, flags, 2);
+    AppendLe(out, method, 2);
+    AppendLe(out, 0x6000, 2);
+    AppendLe(out, 0x5821, 2);
+    AppendLe(out, 0x12345678, 4);
+    AppendLe(out, compressedSize, 4);
+    AppendLe(out, size, 4);
+    AppendLe(out, name.size(), 2);
+    AppendLe(out, extra.size(), 2);
+    AppendLe(out, 0, 2);
+    AppendLe(out, 0, 2);
+    AppendLe(out, 0, 2);
+    AppendLe(out, 0, 4);
+    AppendLe(out, offset, 4);
+    AppendBytes(out, name);
+    out.insert(out.end(), extra.begin(), extra.end());
+}
+
+void AppendEndRecord(std::vector<uint8_t>& out, uint16_t entryCount, uint32_t directorySize, uint32_t directoryOffset, std::string_view comment)
+{
+    AppendLe(out, 0x06054B50, 4);
+    AppendLe(out, 0, 2);
+    AppendLe(out, 0, 2);
+    AppendLe(out, entryCount, 2);
+    AppendLe(out, entryCount, 2);
+    AppendLe(out, directorySize, 4);
+    AppendLe(out, directoryOffset, 4);
+    AppendLe(out, comment.size(), 2);
+    AppendBytes(out, comment);
+}
+
+bool Inflates(const std::vector<uint8_t>& input, std::string_view expected)
+{
+    std::vector<uint8_t> output(expected.size());
+    return InflateRaw(input.data(), input.size(), output.data(), output.size())
+        && std::string_view(reinterpret_cast<const char*>(output.data()), output.size()) == expected;
+}
+
+void TestCrc32()
+{
+    const std::string_view check = "123456789";
+    CHECK(ComputeCrc32(reinterpret_cast<const uint8_t*>(check.data()), check.size()) == 0xCBF43926u);
+    CHECK(ComputeCrc32(nullptr, 0) == 0);
+}
+
+void TestInflateStored()
+{
+    const std::string_view text = "stored block";
+    std::vector<uint8_t> input{ 0x01 };
+    AppendLe(input, text.size(), 2);
+    AppendLe(input, ~text.size() & 0xFFFF, 2);
+    AppendBytes(input, text);
+    CHECK(Inflates(input, text));
+
+    // The member must fill the recorded size exactly, in both directions.
+    std::vector<uint8_t> output(text.size() + 1);
+    CHECK(!InflateRaw(input.data(), input.size(), output.data(), output.size()));
+    CHECK(!InflateRaw(input.data(), input.size(), output.data(), text.size() - 1));
+
+    std::vector<uint8_t> badComplement = input;
+    badComplement[3] ^= 1;
+    CHECK(!Inflates(badComplement, text));
+    std::vector<uint8_t> truncated(input.begin(), input.end() - 1);
+    CHECK(!Inflates(truncated, text));
+}
+
+void TestInflateFixed()
+{
+    // "abcabcabcabcabcabc": three literals, then a length 15 copy from distance 3 that overlaps itself.
+    const std::vector<uint8_t> input{ 0x4B, 0x4C, 0x4A, 0x4E, 0x44, 0x45, 0x00 };
+    CHECK(Inflates(input, "abcabcabcabcabcabc"));
+    CHECK(!Inflates(std::vector<uint8_t>(input.begin(), input.end() - 2), "abcabcabcabcabcabc"));
+    // "a", then a copy from distance 2, reaching back before the start of the output.
+    const std::vector<uint8_t> farBack{ 0x4B, 0x04, 0x42, 0x00 };
+    CHECK(!Inflates(farBack, "aaaa"));
+}
+
+void TestInflateDynamic()
+{
+    // 256 bytes drawn from a skewed alphabet, compressed by zlib at level 9 into one dynamic block.
+    static constexpr std::string_view kAlphabet = "eeeeeeeeetttttaaaoinsh r";
+    std::string text;
+    uint32_t seed = 1;
+    for (int i = 0; i < 256; ++i)
+    {
+        seed = (seed * 1103515245u + 12345u) & 0x7FFFFFFFu;
+        text.push_back(kAlphabet[(seed >> 16) % kAlphabet.size()]);
+    }
+    const std::vector<uint8_t> input{
+        0x1D, 0x8F, 0xC1, 0x0D, 0x00, 0x20, 0x08, 0x03, 0x57, 0x61, 0x35, 0x1E, 0x4D, 0xF0, 0x23, 0x09,
+        0x74, 0xFF, 0xD8, 0xAA, 0x11, 0xA5, 0xC0, 0x21, 0x19, 0xBC, 0x97, 0x07, 0x04, 0x87, 0xEC, 0x61,
+        0x12, 0xC9, 0xC9, 0x44, 0x36, 0xB1, 0x8D, 0xA0, 0x17, 0x76, 0x4B, 0x52, 0x11, 0x87, 0x00, 0x4F,
+        0x00, 0x0D, 0xAF, 0xB0, 0x61, 0x84, 0x8E, 0x1F, 0x18, 0xD9, 0xBC, 0x3F, 0x04, 0xF2, 0xD2, 0xF7,
+        0xC1, 0xA9, 0x1F, 0x88, 0x8B, 0xA6, 0x12, 0xD5, 0x64, 0x05, 0x13, 0x41, 0xAA, 0x3B, 0x3A, 0x2D,
+        0x17, 0xF7, 0x53, 0x5A, 0x7B, 0xC0, 0x4E, 0x96, 0x10, 0x28, 0xC1, 0x33, 0x3E, 0x86, 0x06, 0x0F,
+        0x3F, 0x5A, 0x95, 0x23, 0x25, 0x55, 0xA8, 0x88, 0xFE, 0xAB, 0x41, 0xEC, 0x39, 0x66, 0x2F, 0xB1,
+        0x51, 0x14, 0xD4, 0x4D, 0xD6, 0x23, 0xA8, 0x4B, 0xD6, 0xA8, 0x5C, 0x18, 0xB9, 0x94, 0xD8, 0xF1, 0x00 };
+    CHECK(Inflates(input, text));
+    CHECK(ComputeCrc32(reinterpret_cast<const uint8_t*>(text.data()), text.size()) == 0xCFE29EFDu);
+
+    // Damage is refused or caught by the CRC check ReadZipMember makes; it never writes past the
+    // end. The last byte is only padding after the end-of-block code.
+    for (size_t i = 0; i + 1 < input.size(); ++i)
+    {
+        std::vector<uint8_t> damaged = input;
+        damaged[i] ^= 0x5A;
+        std::vector<uint8_t> output(text.size());
+        bool inflated = InflateRaw(damaged.data(), damaged.size(), output.data(), output.size());
+        CHECK(!inflated || ComputeCrc32(output.data(), output.size()) != 0xCFE29EFDu);
+    }
+    CHECK(!Inflates(std::vector<uint8_t>(input.begin(), input.begin() + input.size() / 2), text));
+}
+
+void TestZipDirectory()
+{
+    std::vector<uint8_t> zip64Extra;
+    AppendLe(zip64Extra, 0x0001, 2);
+    AppendLe(zip64Extra, 16, 2);
+    AppendLe(zip64Extra, 5ull << 30, 8);
+    AppendLe(zip64Extra, 3ull << 30, 8);
+
+    std::vector<uint8_t> directory;
+    AppendCentralHeader(directory, "a.png", 0, 0, 10, 10, 0);
+    AppendCentralHeader(directory, "dir/b.jpg", 0x0800, 8, 20, 40, 100);
+    AppendCentralHeader(directory, "/abs/c.png", 0, 8, 1, 2, 200);
+    AppendCentralHeader(directory, "locked.png", 1, 8, 1, 2, 300);
+    AppendCentralHeader(directory, "folder/", 0, 0, 0, 0, 400);
+    AppendCentralHeader(directory, "c:/evil.png", 0, 0, 1, 1, 500);
+    AppendCentralHeader(directory, "bzip2.png", 0, 12, 1, 2, 600);
+    AppendCentralHeader(directory, "\xFFname.png", 0, 0, 1, 1, 700);
+    AppendCentralHeader(directory, "huge.tif", 0, 8, 0xFFFFFFFFu, 0xFFFFFFFFu, 800, zip64Extra);
+    // "." and ".." components are refused wherever they are; dots inside a name are not.
+    AppendCentralHeader(directory, "../x.png", 0, 0, 1, 1, 900);
+    AppendCentralHeader(directory, "x/../a.png", 0, 0, 1, 1, 1000);
+    AppendCentralHeader(directory, "./a.png", 0, 0, 1, 1, 1100);
+    AppendCentralHeader(directory, "a/./b.png", 0, 0, 1, 1, 1200);
+    AppendCentralHeader(directory, "x\\..\\..\\y.png", 0, 0, 1, 1, 1300);
+    AppendCentralHeader(directory, "dir/..", 0, 0, 1, 1, 1400);
+    AppendCentralHeader(directory, "..b.png", 0, 0, 1, 1, 1500);
+    AppendCentralHeader(directory, ".hidden/...png", 0, 0, 1, 1, 1600);
+
+    std::vector<ZipMember> members;
+    ParseZipCentralDirectory(directory.data(), directory.size(), 17, members);
+    CHECK(members.size() == 6);
+    if (members.size() == 6)
+    {
+        CHECK(members[0].name == L"a.png" && members[0].method == 0 && members[0].size == 10);
+        CHECK(members[0].crc == 0x12345678u && members[0].dosTime == 0x6000 && members[0].dosDate == 0x5821);
+        CHECK(members[1].name == L"dir\\b.jpg" && members[1].method == 8 && members[1].compressedSize == 20
+            && members[1].size == 40 && members[1].localHeaderOffset == 100);
+        CHECK(members[2].name == L"abs\\c.png");
+        CHECK(members[3].name == L"huge.tif" && members[3].size == (5ull << 30)
+            && members[3].compressedSize == (3ull << 30) && members[3].localHeaderOffset == 800);
+        CHECK(members[4].name == L"..b.png" && members[5].name == L".hidden\\...png");
+    }
+
+    // A record running past the directory ends the listing; the ones before it stay.
+    members.clear();
+    ParseZipCentralDirectory(directory.data(), directory.size() - 1, 17, members);
+    CHECK(members.size() == 5);
+    members.clear();
+    ParseZipCentralDirectory(directory.data(), kZipCentralHeaderSize - 1, 17, members);
+    CHECK(members.empty());
+
+    std::vector<uint8_t> archive(64, 0);
+    archive.insert(archive.end(), directory.begin(), directory.end());
+    AppendEndRecord(archive, 17, static_cast<uint32_t>(directory.size()), 64, "comment");
+    ZipDirectoryRange range;
+    CHECK(FindZipDirectory(archive.data(), archive.size(), range));
+    CHECK(range.entryCount == 17 && range.size == directory.size() && range.offset == 64 && !range.zip64);
+
+    // The comment length has to fit in what is left of the file.
+    std::vector<uint8_t> cut(archive.begin(), archive.end() - 1);
+    CHECK(!FindZipDirectory(cut.data(), cut.size(), range));
+    CHECK(!FindZipDirectory(archive.data(), kZipEndRecordSize - 1, range));
+}
+
+void TestZip64EndRecord()
+{
+    std::vector<uint8_t> tail;
+    AppendLe(tail, 0x07064B50, 4);
+    AppendLe(tail, 0, 4);
+    AppendLe(tail, 0x123456789ull, 8);
+    AppendLe(tail, 1, 4);
+    AppendEndRecord(tail, 0xFFFF, 0xFFFFFFFFu, 0xFFFFFFFFu, "");
+    ZipDirectoryRange range;
+    CHECK(FindZipDirectory(tail.data(), tail.size(), range));
+    CHECK(range.zip64 && range.zip64EndOffset == 0x123456789ull);
+
+    std::vector<uint8_t> record;
+    AppendLe(record, 0x06064B50, 4);
+    AppendLe(record, 44, 8);
+    AppendLe(record, 45, 2);
+    AppendLe(record, 45, 2);
+    AppendLe(record, 0, 4);
+    AppendLe(record, 0, 4);
+    AppendLe(record, 70000, 8);
+    AppendLe(record, 70000, 8);
+    AppendLe(record, 0x200000000ull, 8);
+    AppendLe(record, 0x300000000ull, 8);
+    CHECK(record.size() == kZip64EndRecordSize);
+    ReadZip64EndRecord(record.data(), record.size(), range);
+    CHECK(range.entryCount == 70000 && range.size == 0x200000000ull && range.offset == 0x300000000ull);
+
+    ZipDirectoryRange unchanged;
+    unchanged.offset = 7;
+    record[0] = 0;
+    ReadZip64EndRecord(record.data(), record.size(), unchanged);
+    CHECK(unchanged.offset == 7);
+}
+
+void TestZipMemberSize()
+{
+    ZipMember member;
+    member.method = 0;
+    member.compressedSize = 100;
+    member.size = 100;
+    CHECK(IsZipMemberSizeValid(member));
+    member.size = 101;
+    CHECK(!IsZipMemberSizeValid(member));
+
+    member.method = 8;
+    member.compressedSize = 10;
+    member.size = 10 * kInflateMaxExpansion + kInflateMaxExpansion;
+    CHECK(IsZipMemberSizeValid(member));
+    member.size += 1;
+    CHECK(!IsZipMemberSizeValid(member));
+    member.compressedSize = kZipMaxMemberBytes;
+    member.size = kZipMaxMemberBytes + 1;
+    CHECK(!IsZipMemberSizeValid(member));
+}
+
+void TestZipLocalHeader()
+{
+    std::vector<uint8_t> header;
+    AppendLe(header, 0x04034B50, 4);
+    header.resize(26, 0);
+    AppendLe(header, 7, 2);
+    AppendLe(header, 5, 2);
+    ZipMember member;
+    member.localHeaderOffset = 6ull << 30;
+    uint64_t dataOffset = 0;
+    CHECK(ReadZipLocalHeader(header.data(), header.size(), member, dataOffset));
+    CHECK(dataOffset == (6ull << 30) + kZipLocalHeaderSize + 12);
+    CHECK(!ReadZipLocalHeader(header.data(), header.size() - 1, member, dataOffset));
+    header[0] = 0;
+    CHECK(!ReadZipLocalHeader(header.data(), header.size(), member, dataOffset));
+}
+
+// =====================
+// プレイリスト索引
+// =====================
+
+PlaylistIndex MakeSamplePlaylist()
+{
+    PlaylistIndex index;
+    index.roots = { L"D:\\Photos", L"D:\\Photos 2024" };
+    PlaylistDirectory root;
+    root.path = L"D:\\Photos";
+    root.writeTime = 0x01DA000000000001ull;
+    root.files = { { L"img001.jpg", 11, 1000 }, { L"img002.jpg", 12, 2000 }, { L"\u5199\u771F.png", 13, 3000 } };
+    root.subdirectories = { L"Trip", L"Trip 2" };
+    PlaylistDirectory trip;
+    trip.path = L"D:\\Photos\\Trip";
+    trip.writeTime = 42;
+    trip.files = { { L"a.gif", 1, 1ull << 40 } };
+    PlaylistDirectory empty;
+    empty.path = L"D:\\Photos\\Trip 2";
+    index.directories = { root, trip, empty };
+    return index;
+}
+
+bool SamePlaylist(const PlaylistIndex& a, const PlaylistIndex& b)
+{
+    if (a.roots != b.roots || a.directories.size() != b.directories.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.directories.size(); ++i)
+    {
+        const PlaylistDirectory& x = a.directories[i];
+        const PlaylistDirectory& y = b.directories[i];
+        if (x.path != y.path || x.writeTime != y.writeTime || x.subdirectories != y.subdirectories
+            || x.files.size() != y.files.size())
+        {
+            return false;
+        }
+        for (size_t f = 0; f < x.files.size(); ++f)
+        {
+            if (x.files[f].name != y.files[f].name || x.files[f].writeTime != y.files[f].writeTime
+                || x.files[f].size != y.files[f].size)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void TestPlaylistIndexRoundTrip()
+{
+    PlaylistIndex index = MakeSamplePlaylist();
+    std::vector<uint8_t> bytes;
+    EncodePlaylistIndex(index, bytes);
+    PlaylistIndex decoded;
+    CHECK(DecodePlaylistIndex(bytes.data(), bytes.size(), decoded));
+    CHECK(SamePlaylist(index, decoded));
+
+    std::vector<uint8_t> emptyBytes;
+    EncodePlaylistIndex(PlaylistIndex{}, emptyBytes);
+    CHECK(emptyBytes.size() == 16);
+    CHECK(DecodePlaylistIndex(emptyBytes.data(), emptyBytes.size(), decoded));
+    CHECK(decoded.roots.empty() && decoded.directories.empty());
+}
+
+void TestPlaylistFrontCoding()
+{
+    std::vector<uint8_t> bytes;
+    AppendPlaylistString(bytes, L"D:\\Photos\\Trip", L"D:\\Photos\\Trip 2");
+    // Shared length, suffix length, then only " 2".
+    CHECK(bytes.size() == 8 && ReadLe16(bytes.data()) == 14 && ReadLe16(bytes.data() + 2) == 2);
+
+    std::wstring value = L"D:\\Photos\\Trip";
+    const uint8_t* pos = bytes.data();
+    CHECK(ReadPlaylistString(pos, bytes.data() + bytes.size(), value));
+    CHECK(value == L"D:\\Photos\\Trip 2" && pos == bytes.data() + bytes.size());
+
+    // The shared part cannot be longer than the string before it.
+    std::wstring shorter = L"D:";
+    pos = bytes.data();
+    CHECK(!ReadPlaylistString(pos, bytes.data() + bytes.size(), shorter));
+}
+
+void TestPlaylistIndexDamage()
+{
+    std::vector<uint8_t> bytes;
+    EncodePlaylistIndex(MakeSamplePlaylist(), bytes);
+    PlaylistIndex decoded;
+    for (size_t size = 0; size < bytes.size(); ++size)
+    {
+        CHECK(!DecodePlaylistIndex(bytes.data(), size, decoded));
+    }
+
+    std::vector<uint8_t> wrongMagic = bytes;
+    wrongMagic[0] ^= 1;
+    CHECK(!DecodePlaylistIndex(wrongMagic.data(), wrongMagic.size(), decoded));
+    std::vector<uint8_t> wrongVersion = bytes;
+    wrongVersion[4] = static_cast<uint8_t>(kPlaylistIndexVersion + 1);
+    CHECK(!DecodePlaylistIndex(wrongVersion.data(), wrongVersion.size(), decoded));
+
+    // A folder count far beyond the file's size is refused before anything is reserved for it.
+    std::vector<uint8_t> hugeCount;
+    AppendIndexValue(hugeCount, kPlaylistIndexMagic);
+    AppendIndexValue(hugeCount, kPlaylistIndexVersion);
+    AppendIndexValue(hugeCount, uint32_t{ 0 });
+    AppendIndexValue(hugeCount, uint32_t{ 0xFFFFFFFFu });
+    CHECK(!DecodePlaylistIndex(hugeCount.data(), hugeCount.size(), decoded));
+}
+
+// =====================
+// メタデータキャッシュ
+// =====================
+
+void TestMetadataCacheRoundTrip()
+{
+    std::unordered_map<uint64_t, MetadataCacheRecord> records;
+    MetadataCacheRecord photo;
+    photo.writeTime = 0x01DA123456789ABCull;
+    photo.size = 5ull << 30;
+    photo.metadata = { 6000, 4000, 1, 0x01D9000000000000ull, false };
+    MetadataCacheRecord sticker;
+    sticker.writeTime = 7;
+    sticker.size = 1234;
+    sticker.metadata = { 512, 512, 48, 0, true };
+    records[0x1111] = photo;
+    records[~0ull] = sticker;
+
+    std::vector<uint8_t> bytes;
+    EncodeMetadataCache(records, bytes);
+    CHECK(bytes.size() == 12 + 2 * kMetadataCacheRecordBytes);
+
+    std::unordered_map<uint64_t, MetadataCacheRecord> decoded;
+    CHECK(DecodeMetadataCache(bytes.data(), bytes.size(), decoded));
+    CHECK(decoded.size() == 2);
+    auto same = [](const MetadataCacheRecord& a, const MetadataCacheRecord& b)
+    {
+        return a.writeTime == b.writeTime && a.size == b.size && a.metadata.width == b.metadata.width
+            && a.metadata.height == b.metadata.height && a.metadata.frameCount == b.metadata.frameCount
+            && a.metadata.dateTaken == b.metadata.dateTaken && a.metadata.hasAlpha == b.metadata.hasAlpha;
+    };
+    CHECK(decoded.count(0x1111) == 1 && same(decoded[0x1111], photo));
+    CHECK(decoded.count(~0ull) == 1 && same(decoded[~0ull], sticker));
+}
+
+void TestMetadataCacheDamage()
+{
+    std::unordered_map<uint64_t, MetadataCacheRecord> records;
+    for (uint64_t key = 1; key <= 3; ++key)
+    {
+        records[key].metadata.width = static_cast<uint32_t>(key);
+    }
+    std::vector<uint8_t> bytes;
+    EncodeMetadataCache(records, bytes);
+
+    std::unordered_map<uint64_t, MetadataCacheRecord> decoded;
+    for (size_t size = 0; size < bytes.size(); ++size)
+    {
+        CHECK(!DecodeMetadataCache(bytes.data(), size, decoded));
+    }
+    CHECK(decoded.empty());
+
+    std::vector<uint8_t> wrongVersion = bytes;
+    wrongVersion[4] = static_cast<uint8_t>(kMetadataCacheVersion + 1);
+    CHECK(!DecodeMetadataCache(wrongVersion.data(), wrongVersion.size(), decoded));
+    std::vector<uint8_t> wrongMagic = bytes;
+    wrongMagic[3] ^= 0x80;
+    CHECK(!DecodeMetadataCache(wrongMagic.data(), wrongMagic.size(), decoded));
+    CHECK(decoded.empty());
+}
+
+// =====================
+// アニメーション
+// =====================
+
+void TestAdvanceAnimationTimeline()
+{
+    // 100 ms, 50 ms and a zero delay, which plays at the default: a 250 ms loop.
+    const std::vector<uint32_t> delays = { 100, 50, 0 };
+    CHECK(GetAnimationFrameDelayMs(delays, 2) == kDefaultAnimationFrameDelayMs && GetAnimationFrameDelayMs(delays, 9) == kDefaultAnimationFrameDelayMs);
+    uint64_t frameStart = 1000;
+    size_t advanced = 0;
+    CHECK(AdvanceAnimationTimeline(delays, 0, frameStart, 1099, advanced) == 0 && advanced == 0 && frameStart == 1000);
+    CHECK(AdvanceAnimationTimeline(delays, 0, frameStart, 1100, advanced) == 1 && advanced == 1 && frameStart == 1100);
+    CHECK(AdvanceAnimationTimeline(delays, 1, frameStart, 1240, advanced) == 2 && advanced == 1 && frameStart == 1150);
+    // An hour later: whole loops are skipped in one step and the frame is the one wall time gives.
+    CHECK(AdvanceAnimationTimeline(delays, 2, frameStart, 1150 + 3600000 + 120, advanced) == 0
+        && advanced == 3600000 / 250 * 3 + 1 && frameStart == 1150 + 3600000 + 100);
+    // A clock that steps back and a single frame leave the timeline alone.
+    CHECK(AdvanceAnimationTimeline(delays, 0, frameStart, 10, advanced) == 0 && advanced == 0);
+    CHECK(AdvanceAnimationTimeline({ 100 }, 0, frameStart, frameStart + 5000, advanced) == 0 && advanced == 0);
+}
+
+// A window the test moves about: shown or minimized, uncovered or covered, with call counts.
+struct FakeAnimationWindow
+{
+    bool shown = true;
+    bool uncovered = true;
+    int shownChecks = 0;
+    int occlusionChecks = 0;
+
+    AnimationVisibility Visibility()
+    {
+        return AnimationVisibility{
+            [this]() { ++shownChecks; return shown; },
+            [this]() { ++occlusionChecks; return uncovered; }
+        };
+    }
+};
+
+void TestAnimationPlayback()
+{
+    FakeAnimationWindow window;
+    AnimationVisibility visibility = window.Visibility();
+    AnimationPlayback playback;
+    playback.frameDelaysMs = { 100, 50, 0 };
+    StartAnimationTimeline(playback, 0, 1000);
+    CHECK(playback.playing);
+
+    AnimationTick tick = TickAnimationTimeline(playback, 1000, visibility);
+    CHECK(!tick.suspended && tick.frame == 0 && tick.waitMs == 100 && window.occlusionChecks == 1);
+    tick = TickAnimationTimeline(playback, 1100, visibility);
+    CHECK(!tick.suspended && tick.frame == 1 && tick.waitMs == 50);
+
+    // Playing ticks check the window state every time, the z-order only every
+    // kAnimationOcclusionCheckMs.
+    uint64_t now = 1100;
+    for (int i = 0; i < 200; ++i)
+    {
+        now += 10;
+        tick = TickAnimationTimeline(playback, now, visibility);
+    }
+    CHECK(window.shownChecks == 202);
+    CHECK(window.occlusionChecks == 1 + static_cast<int>((now - 1000) / kAnimationOcclusionCheckMs));
+    CHECK(playback.skippedFrames == 0 && tick.frame == ((now - 1000) % 250 < 100 ? 0u : (now - 1000) % 250 < 150 ? 1u : 2u));
+
+    // Minimized: suspended at once, polled without walking the z-order.
+    window.shown = false;
+    int occlusionChecks = window.occlusionChecks;
+    tick = TickAnimationTimeline(playback, now + 5, visibility);
+    CHECK(tick.suspended && tick.waitMs == kAnimationVisibilityPollMs && playback.suspended);
+    size_t frameBefore = playback.frameIndex;
+    for (int i = 0; i < 40; ++i)
+    {
+        tick = TickAnimationTimeline(playback, now + 5 + (i + 1) * kAnimationVisibilityPollMs, visibility);
+    }
+    CHECK(tick.suspended && window.occlusionChecks == occlusionChecks && playback.frameIndex == frameBefore);
+
+    // Restored: the z-order is checked at once and playback lands on the frame wall time gives,
+    // counting the ones it passed over.
+    window.shown = true;
+    uint64_t restored = 1000 + 250 * 100 + 130;
+    tick = TickAnimationTimeline(playback, restored, visibility);
+    CHECK(!tick.suspended && tick.frame == 1 && tick.waitMs == 20 && window.occlusionChecks == occlusionChecks + 1);
+    // 301 frame changes had come due by then and 25 had been shown before the window went away.
+    CHECK(playback.skippedFrames == 301 - 25 - 1);
+
+    // Covered: noticed at the next occlusion check, and every poll looks again.
+    window.uncovered = false;
+    tick = TickAnimationTimeline(playback, restored + 20, visibility);
+    CHECK(!tick.suspended);
+    tick = TickAnimationTimeline(playback, restored + kAnimationOcclusionCheckMs, visibility);
+    CHECK(tick.suspended);
+    occlusionChecks = window.occlusionChecks;
+    tick = TickAnimationTimeline(playback, restored + kAnimationOcclusionCheckMs + kAnimationVisibilityPollMs, visibility);
+    CHECK(tick.suspended && window.occlusionChecks == occlusionChecks + 1);
+    window.uncovered = true;
+    tick = TickAnimationTimeline(playback, restored + kAnimationOcclusionCheckMs + 2 * kAnimationVisibilityPollMs, visibility);
+    CHECK(!tick.suspended && !playback.suspended);
+
+    // Restarting clears the count; a still image never plays.
+    StartAnimationTimeline(playback, 0, 0);
+    CHECK(playback.skippedFrames == 0 && !playback.suspended);
+    AnimationPlayback still;
+    still.frameDelaysMs = { 100 };
+    StartAnimationTimeline(still, 0, 0);
+    CHECK(!still.playing);
+}
+
+// The dirty rectangle by brute force: every pixel compared.
+CanvasRect ReferenceDirtyRect(const std::vector<uint8_t>& before, const std::vector<uint8_t>& after, uint32_t width, uint32_t height)
+{
+    CanvasRect rect;
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            size_t offset = (static_cast<size_t>(y) * width + x) * 4;
+            if (memcmp(before.data() + offset, after.data() + offset, 4) != 0)
+            {
+                UnionDirtyRect(rect, CanvasRect{ x, y, x + 1, y + 1 });
+            }
+        }
+    }
+    return rect;
+}
+
+bool SameRect(const CanvasRect& a, const CanvasRect& b)
+{
+    if (IsCanvasRectEmpty(a) || IsCanvasRectEmpty(b))
+    {
+        return IsCanvasRectEmpty(a) && IsCanvasRectEmpty(b);
+    }
+    return a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom;
+}
+
+void TestCanvasDirtyRect()
+{
+    std::vector<uint8_t> before(8 * 4 * 4, 0);
+    std::vector<uint8_t> after = before;
+    CHECK(IsCanvasRectEmpty(ComputeCanvasDirtyRect(before, after, 8, 4)));
+    after[(2 * 8 + 5) * 4 + 3] = 0xFF;
+    after[(1 * 8 + 3) * 4] = 1;
+    CHECK(SameRect(ComputeCanvasDirtyRect(before, after, 8, 4), CanvasRect{ 3, 1, 6, 3 }));
+    // Short buffers and empty canvases are never dirty.
+    CHECK(IsCanvasRectEmpty(ComputeCanvasDirtyRect(before, std::vector<uint8_t>(10), 8, 4)));
+    CHECK(IsCanvasRectEmpty(ComputeCanvasDirtyRect(before, after, 0, 4)));
+
+    CanvasRect target;
+    UnionDirtyRect(target, CanvasRect{ 4, 4, 4, 9 });
+    CHECK(IsCanvasRectEmpty(target));
+    UnionDirtyRect(target, CanvasRect{ 4, 4, 6, 9 });
+    UnionDirtyRect(target, CanvasRect{ 1, 7, 2, 12 });
+    CHECK(SameRect(target, CanvasRect{ 1, 4, 6, 12 }));
+
+    TestRandom random{ 28 };
+    for (int round = 0; round < 2000; ++round)
+    {
+        uint32_t width = 1 + random.Next(40);
+        uint32_t height = 1 + random.Next(40);
+        std::vector<uint8_t> a(static_cast<size_t>(width) * height * 4);
+        for (uint8_t& byte : a)
+        {
+            byte = static_cast<uint8_t>(random.Next(4));
+        }
+        std::vector<uint8_t> b = a;
+        uint32_t changes = random.Next(5);
+        for (uint32_t i = 0; i < changes; ++i)
+        {
+            b[random.Next(static_cast<uint32_t>(b.size()))] ^= static_cast<uint8_t>(1 + random.Next(255));
+        }
+        CHECK(SameRect(ComputeCanvasDirtyRect(a, b, width, height), ReferenceDirtyRect(a, b, width, height)));
+    }
+}
+
+// A surface backend over plain memory: it keeps the pixels it was given and counts what each
+// present creates and uploads.
+struct MockAnimationSurface
+{
+    const std::vector<std::vector<uint8_t>>* frames = nullptr;
+    uint32_t width = 0;
+    std::vector<uint8_t> pixels;
+    int creates = 0;
+    uint64_t uploadedBytes = 0;
+    bool failUpload = false;
+
+    AnimationSurfaceBackend Backend()
+    {
+        return AnimationSurfaceBackend{
+            [this](size_t frame)
+            {
+                ++creates;
+                pixels = (*frames)[frame];
+                uploadedBytes += pixels.size();
+                return true;
+            },
+            [this](size_t frame, const CanvasRect& rect, uint32_t stride, uint8_t* out)
+            {
+                for (uint32_t y = rect.top; y < rect.bottom; ++y)
+                {
+                    memcpy(out + (y - rect.top) * stride, (*frames)[frame].data() + (static_cast<size_t>(y) * width + rect.left) * 4, stride);
+                }
+                return true;
+            },
+            [this](const CanvasRect& rect, const uint8_t* in, uint32_t stride)
+            {
+                if (failUpload)
+                {
+                    return false;
+                }
+                for (uint32_t y = rect.top; y < rect.bottom; ++y)
+                {
+                    memcpy(pixels.data() + (static_cast<size_t>(y) * width + rect.left) * 4, in + (y - rect.top) * stride, stride);
+                }
+                uploadedBytes += static_cast<uint64_t>(stride) * (rect.bottom - rect.top);
+                return true;
+            }
+        };
+    }
+};
+
+void TestAnimationSurface()
+{
+    // A 64x48 animation of 12 frames where a 6x6 sprite moves and the rest stays still.
+    const uint32_t width = 64;
+    const uint32_t height = 48;
+    std::vector<std::vector<uint8_t>> frames;
+    for (uint32_t i = 0; i < 12; ++i)
+    {
+        std::vector<uint8_t> canvas(static_cast<size_t>(width) * height * 4, 0x40);
+        for (uint32_t y = 10; y < 16; ++y)
+        {
+            for (uint32_t x = 4 * i; x < 4 * i + 6; ++x)
+            {
+                memset(canvas.data() + (static_cast<size_t>(y) * width + x) * 4, 0xC0, 4);
+            }
+        }
+        frames.push_back(std::move(canvas));
+    }
+    std::vector<CanvasRect> dirtyRects(frames.size());
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        dirtyRects[i] = ComputeCanvasDirtyRect(frames[(i + frames.size() - 1) % frames.size()], frames[i], width, height);
+    }
+    CHECK(SameRect(dirtyRects[1], CanvasRect{ 0, 10, 10, 16 }));
+    CHECK(SameRect(dirtyRects[0], CanvasRect{ 0, 10, 50, 16 }));
+    CHECK(SameRect(GetAnimationUploadRect(dirtyRects, 2, 4, width, height), CanvasRect{ 8, 10, 22, 16 }));
+    CHECK(IsCanvasRectEmpty(GetAnimationUploadRect(dirtyRects, 5, 5, width, height)));
+    CHECK(SameRect(GetAnimationUploadRect(dirtyRects, 0, 40, width, height), CanvasRect{ 0, 0, width, height }));
+
+    MockAnimationSurface mock;
+    mock.frames = &frames;
+    mock.width = width;
+    AnimationSurfaceBackend backend = mock.Backend();
+    AnimationSurface surface;
+    CHECK(PresentAnimationFrame(surface, dirtyRects, 0, width, height, backend));
+    CHECK(mock.creates == 1 && mock.uploadedBytes == frames[0].size() && surface.uploadedBytes == mock.uploadedBytes);
+
+    // Each following frame uploads only the sprite's old and new place, 10x6 pixels, and the
+    // surface ends up holding the frame exactly.
+    uint64_t uploaded = mock.uploadedBytes;
+    for (size_t i = 1; i < frames.size(); ++i)
+    {
+        CHECK(PresentAnimationFrame(surface, dirtyRects, i, width, height, backend));
+        CHECK(mock.uploadedBytes - uploaded == 10 * 6 * 4);
+        CHECK(mock.pixels == frames[i]);
+        uploaded = mock.uploadedBytes;
+    }
+    CHECK(mock.creates == 1 && surface.uploadBuffer.size() == 10 * 6 * 4);
+
+    // A skipped-over stretch uploads the union of its steps; the same frame uploads nothing.
+    CHECK(PresentAnimationFrame(surface, dirtyRects, 2, width, height, backend));
+    CHECK(mock.pixels == frames[2] && mock.uploadedBytes - uploaded == 50 * 6 * 4);
+    uploaded = mock.uploadedBytes;
+    CHECK(PresentAnimationFrame(surface, dirtyRects, 2, width, height, backend));
+    CHECK(mock.uploadedBytes == uploaded && mock.creates == 1);
+
+    // A failed upload drops the surface, and the next frame creates it again; so does a resize
+    // or a host that lost the surface.
+    mock.failUpload = true;
+    CHECK(!PresentAnimationFrame(surface, dirtyRects, 3, width, height, backend));
+    CHECK(!surface.valid);
+    mock.failUpload = false;
+    CHECK(PresentAnimationFrame(surface, dirtyRects, 3, width, height, backend));
+    CHECK(mock.creates == 2 && mock.pixels == frames[3]);
+    surface.valid = false;
+    CHECK(PresentAnimationFrame(surface, dirtyRects, 4, width, height, backend));
+    CHECK(mock.creates == 3 && mock.pixels == frames[4] && surface.createdSurfaces == 3);
+}
+
+// =====================
+// 背景キャッシュ
+// =====================
+
+void TestCheckerTile()
+{
+    std::array<uint32_t, kCheckerTileSize * kCheckerTileSize> tile = MakeCheckerTile();
+    auto at = [&](uint32_t x, uint32_t y) { return tile[y * kCheckerTileSize + x]; };
+    const uint32_t light = 0xFF000000u | kCheckerLightLevel * 0x010101u;
+    const uint32_t dark = 0xFF000000u | kCheckerDarkLevel * 0x010101u;
+    CHECK(at(0, 0) == light && at(kCheckerCellSize - 1, kCheckerCellSize - 1) == light);
+    CHECK(at(kCheckerCellSize, 0) == dark && at(0, kCheckerCellSize) == dark);
+    CHECK(at(kCheckerTileSize - 1, kCheckerTileSize - 1) == light);
+    // Tiled with wrapping, the tile continues the pattern across its edges: every cell is
+    // kCheckerCellSize wide and neighbours differ.
+    for (uint32_t y = 0; y < kCheckerTileSize * 3; ++y)
+    {
+        for (uint32_t x = 0; x < kCheckerTileSize * 3; ++x)
+        {
+            bool even = ((x / kCheckerCellSize) + (y / kCheckerCellSize)) % 2 == 0;
+            CHECK(at(x % kCheckerTileSize, y % kCheckerTileSize) == (even ? light : dark));
+        }
+    }
+}
+
+void TestLayeredSurfaceCache()
+{
+    // Paints at one size reuse the surface; the key rounds the draw size the way the surface is made.
+    LayeredSurfaceState state;
+    LayeredSurfaceKey key = MakeLayeredSurfaceKey(0x1000, 639.6f, 480.4f);
+    CHECK(key.width == 640 && key.height == 480);
+    CHECK(!IsLayeredSurfaceCached(state, key));
+    MarkLayeredSurfaceBuilt(state, key);
+    for (int paint = 0; paint < 100; ++paint)
+    {
+        CHECK(IsLayeredSurfaceCached(state, MakeLayeredSurfaceKey(0x1000, 640.2f, 479.5f)));
+    }
+    CHECK(state.builds == 1);
+
+    // A new size, a new image or a dropped surface each need a build.
+    CHECK(!IsLayeredSurfaceCached(state, MakeLayeredSurfaceKey(0x1000, 641.0f, 480.0f)));
+    CHECK(!IsLayeredSurfaceCached(state, MakeLayeredSurfaceKey(0x1000, 640.0f, 481.0f)));
+    CHECK(!IsLayeredSurfaceCached(state, MakeLayeredSurfaceKey(0x2000, 640.0f, 480.0f)));
+    CHECK(!IsLayeredSurfaceCached(LayeredSurfaceState{}, key));
+
+    // A tiny or empty draw still makes a 1x1 surface; no image is never cached.
+    LayeredSurfaceKey tiny = MakeLayeredSurfaceKey(0x1000, 0.2f, -3.0f);
+    CHECK(tiny.width == 1 && tiny.height == 1);
+    LayeredSurfaceKey none = MakeLayeredSurfaceKey(0, 640.0f, 480.0f);
+    MarkLayeredSurfaceBuilt(state, none);
+    CHECK(!state.valid && !IsLayeredSurfaceCached(state, none) && state.builds == 2);
+
+    // An animation drops the surface on every frame and a resize drag changes the size on every
+    // paint: one build per frame or per size, none for repeated paints in between.
+    LayeredSurfaceState animated;
+    for (uintptr_t frame = 1; frame <= 10; ++frame)
+    {
+        for (int paint = 0; paint < 3; ++paint)
+        {
+            LayeredSurfaceKey frameKey = MakeLayeredSurfaceKey(frame * 0x100, 320.0f + paint % 2, 240.0f);
+            if (!IsLayeredSurfaceCached(animated, frameKey))
+            {
+                MarkLayeredSurfaceBuilt(animated, frameKey);
+            }
+        }
+    }
+    CHECK(animated.builds == 30);
+    LayeredSurfaceState still;
+    for (int paint = 0; paint < 30; ++paint)
+    {
+        LayeredSurfaceKey stillKey = MakeLayeredSurfaceKey(0x100, 320.0f + paint / 10, 240.0f);
+        if (!IsLayeredSurfaceCached(still, stillKey))
+        {
+            MarkLayeredSurfaceBuilt(still, stillKey);
+        }
+    }
+    CHECK(still.builds == 3);
+}
+
+// =====================
+// 文字コード
+// =====================
+
+// A file of bytes that hands out at most chunk bytes per read and may shrink after it is sized.
+struct ChunkedDocument
+{
+    std::string bytes;
+    size_t chunk = 0;
+    size_t pos = 0;
+    size_t calls = 0;
+    size_t failAt = SIZE_MAX;
+
+    DocumentReader Reader()
+    {
+        return [this](char* data, size_t size, size_t& read)
+        {
+            if (calls++ == failAt)
+            {
+                return false;
+            }
+            read = (std::min)({ size, chunk, bytes.size() - pos });
+            memcpy(data, bytes.data() + pos, read);
+            pos += read;
+            return true;
+        };
+    }
+};
+
+bool ReadChunkedDocument(std::string_view bytes, size_t chunk, DocumentBuffer& document)
+{
+    ChunkedDocument file{ std::string(bytes), chunk };
+    return FillDocumentBuffer(bytes.size(), file.Reader(), document);
+}
+
+void TestDocumentBuffer()
+{
+    DocumentBuffer document;
+    CHECK(ReadChunkedDocument("", 16, document) && document.size == 0 && document.Text().empty() && !document.HasUtf8Bom());
+    CHECK(ReadChunkedDocument("\xEF\xBB\xBF", 16, document) && document.HasUtf8Bom() && document.Text().empty());
+    CHECK(ReadChunkedDocument("\xEF\xBB\xBF# title\n", 16, document) && document.HasUtf8Bom() && document.Text() == "# title\n");
+    CHECK(ReadChunkedDocument("\xEF\xBB# title\n", 16, document) && !document.HasUtf8Bom() && document.Text() == "\xEF\xBB# title\n");
+    CHECK(ReadChunkedDocument("# \xEF\xBB\xBF\n", 16, document) && !document.HasUtf8Bom() && document.Text() == "# \xEF\xBB\xBF\n");
+
+    // The BOM is skipped in place: Text() points into the buffer that was read.
+    CHECK(ReadChunkedDocument("\xEF\xBB\xBFkey=value\r\n", 16, document));
+    CHECK(document.Text().data() == document.data.get() + 3 && document.size == 14);
+
+    // Short reads, including a BOM split across them, add up to the whole file.
+    TestRandom random{ 41 };
+    bool matches = true;
+    for (int i = 0; i < 500 && matches; ++i)
+    {
+        std::string bytes = random.Next(2) ? std::string(kUtf8Bom) : std::string();
+        for (uint32_t count = random.Next(2000); bytes.size() < count;)
+        {
+            bytes.push_back(static_cast<char>(random.Next(256)));
+        }
+        std::string_view text = std::string_view(bytes).substr(bytes.starts_with(kUtf8Bom) ? 3 : 0);
+        matches = ReadChunkedDocument(bytes, 1 + random.Next(64), document) && document.Text() == text;
+    }
+    CHECK(matches);
+
+    // A file that shrank after it was sized ends the buffer at the bytes it still had; a failed
+    // read leaves no document.
+    ChunkedDocument shrunk{ "\xEF\xBB\xBFshort", 4 };
+    CHECK(FillDocumentBuffer(4096, shrunk.Reader(), document) && document.size == 8 && document.Text() == "short");
+    ChunkedDocument failing{ std::string(100, 'x'), 10 };
+    failing.failAt = 3;
+    CHECK(!FillDocumentBuffer(100, failing.Reader(), document) && document.size == 0 && !document.data);
+}
+
+void AppendUtf16(std::wstring& text, uint32_t codePoint)
+{
+    if (codePoint >= 0x10000)
+    {
+        text.push_back(static_cast<wchar_t>(0xD800 + ((codePoint - 0x10000) >> 10)));
+        text.push_back(static_cast<wchar_t>(0xDC00 + ((codePoint - 0x10000) & 0x3FF)));
+    }
+    else
+    {
+        text.push_back(static_cast<wchar_t>(codePoint));
+    }
+}
+
+// The WHATWG decoder, a byte at a time: the reference for one U+FFFD per maximal subpart.
+std::wstring DecodeUtf8Reference(std::string_view bytes, bool& valid)
+{
+    std::wstring text;
+    valid = true;
+    uint32_t codePoint = 0;
+    int needed = 0;
+    int seen = 0;
+    unsigned int lower = 0x80;
+    unsigned int upper = 0xBF;
+    for (size_t i = 0; i < bytes.size(); ++i)
+    {
+        unsigned int byte = static_cast<unsigned char>(bytes[i]);
+        if (needed == 0)
+        {
+            if (byte < 0x80)
+            {
+                text.push_back(static_cast<wchar_t>(byte));
+            }
+            else if (byte >= 0xC2 && byte <= 0xDF)
+            {
+                needed = 1;
+                codePoint = byte & 0x1F;
+            }
+            else if (byte >= 0xE0 && byte <= 0xEF)
+            {
+                lower = (byte == 0xE0) ? 0xA0 : 0x80;
+                upper = (byte == 0xED) ? 0x9F : 0xBF;
+                needed = 2;
+                codePoint = byte & 0x0F;
+            }
+            else if (byte >= 0xF0 && byte <= 0xF4)
+            {
+                lower = (byte == 0xF0) ? 0x90 : 0x80;
+                upper = (byte == 0xF4) ? 0x8F : 0xBF;
+                needed = 3;
+                codePoint = byte & 0x07;
+            }
+            else
+            {
+                text.push_back(0xFFFD);
+                valid = false;
+            }
+            continue;
+        }
+        if (byte < lower || byte > upper)
+        {
+            // The byte that broke the sequence starts over on its own.
+            codePoint = 0;
+            needed = 0;
+            seen = 0;
+            lower = 0x80;
+            upper = 0xBF;
+            text.push_back(0xFFFD);
+            valid = false;
+            --i;
+            continue;
+        }
+        lower = 0x80;
+        upper = 0xBF;
+        codePoint = (codePoint << 6) | (byte & 0x3F);
+        if (++seen == needed)
+        {
+            AppendUtf16(text, codePoint);
+            codePoint = 0;
+            needed = 0;
+            seen = 0;
+        }
+    }
+    if (needed != 0)
+    {
+        text.push_back(0xFFFD);
+        valid = false;
+    }
+    return text;
+}
+
+// A code unit at a time; units past U+FFFF only occur where wchar_t is 32 bits.
+std::string EncodeUtf8Reference(std::wstring_view text)
+{
+    std::string bytes;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        uint32_t unit = static_cast<uint32_t>(text[i]);
+        uint32_t codePoint = unit;
+        if (unit >= 0xD800 && unit <= 0xDBFF && i + 1 < text.size()
+            && static_cast<uint32_t>(text[i + 1]) >= 0xDC00 && static_cast<uint32_t>(text[i + 1]) <= 0xDFFF)
+        {
+            codePoint = 0x10000 + ((unit - 0xD800) << 10) + (static_cast<uint32_t>(text[++i]) - 0xDC00);
+        }
+        else if ((unit >= 0xD800 && unit <= 0xDFFF) || unit > 0x10FFFF)
+        {
+            codePoint = 0xFFFD;
+        }
+        if (codePoint < 0x80)
+        {
+            bytes.push_back(static_cast<char>(codePoint));
+        }
+        else if (codePoint < 0x800)
+        {
+            bytes.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+            bytes.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else if (codePoint < 0x10000)
+        {
+            bytes.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+            bytes.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            bytes.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else
+        {
+            bytes.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+            bytes.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+            bytes.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            bytes.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+    }
+    return bytes;
+}
+
+// Both DecodeUtf8 modes agree with the reference: the lenient one character for character, the
+// strict one by refusing exactly the inputs the reference had to repair.
+bool DecodesLikeReference(std::string_view bytes)
+{
+    bool valid = false;
+    std::wstring expected = DecodeUtf8Reference(bytes, valid);
+    std::wstring lenient;
+    std::wstring strict = L"stale";
+    bool strictOk = Utf8ToWideStrict(bytes, strict);
+    return Utf8ToWide(bytes, lenient) && lenient == expected
+        && strictOk == valid && (valid ? strict == expected : strict.empty());
+}
+
+void TestDecodeUtf8()
+{
+    CHECK(DecodesLikeReference(""));
+    CHECK(DecodesLikeReference("plain ASCII, longer than one sixteen-byte block"));
+    CHECK(DecodesLikeReference("\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E \xF0\x9F\x98\x80 \xC3\xA9"));
+
+    // Unicode's examples of U+FFFD substitution (chapter 3, tables 3-8 to 3-11).
+    std::wstring text;
+    CHECK(Utf8ToWide("\xC0\xAF\xE0\x80\xBF\xF0\x81\x82\x41", text) && text == L"\xFFFD\xFFFD\xFFFD\xFFFD\xFFFD\xFFFD\xFFFD\xFFFD" L"A");
+    CHECK(Utf8ToWide("\xED\xA0\x80\xED\xBF\xBF\xED\xAF\x41", text) && text == L"\xFFFD\xFFFD\xFFFD\xFFFD\xFFFD\xFFFD\xFFFD\xFFFD" L"A");
+    CHECK(Utf8ToWide("\xF4\x91\x92\x93\xFF\x41\x80\xBF\x42", text) && text == L"\xFFFD\xFFFD\xFFFD\xFFFD\xFFFD" L"A\xFFFD\xFFFD" L"B");
+    CHECK(Utf8ToWide("\xE1\x80\xE2\xF0\x91\x92\xF1\xBF\x41", text) && text == L"\xFFFD\xFFFD\xFFFD\xFFFD" L"A");
+    CHECK(Utf8ToWide("\xF0\x9F\x98\x80", text) && text.size() == 2 && text[0] == 0xD83D && text[1] == 0xDE00);
+    CHECK(!Utf8ToWideStrict("valid until the very end \xE6\x97", text) && text.empty());
+
+    // Random mixes of ASCII runs (which the SSE2 path takes sixteen bytes at a time) with valid,
+    // truncated, overlong, surrogate and out-of-range sequences, at every alignment.
+    static constexpr std::string_view kPieces[] = {
+        "a", "0123456789abcdef", "\xC3\xA9", "\xE3\x81\x82", "\xF0\x9F\x98\x80", "\xF4\x8F\xBF\xBF",
+        "\xC3", "\xE3\x81", "\xF0\x9F\x98", "\x80", "\xBF", "\xC0\x80", "\xC1\xBF", "\xE0\x80\x80",
+        "\xE0\x9F\xBF", "\xED\xA0\x80", "\xED\xBF\xBF", "\xF0\x8F\xBF\xBF", "\xF4\x90\x80\x80",
+        "\xF5\x80\x80\x80", "\xFE", "\xFF", std::string_view("\0", 1), "\x7F",
+    };
+    TestRandom random{ 31 };
+    bool matches = true;
+    int invalid = 0;
+    for (int i = 0; i < 30000 && matches; ++i)
+    {
+        std::string bytes;
+        for (uint32_t piece = 0, count = random.Next(24); piece < count; ++piece)
+        {
+            if (random.Next(3) == 0)
+            {
+                bytes.append(random.Next(40), 'x');
+            }
+            bytes.append(kPieces[random.Next(static_cast<uint32_t>(std::size(kPieces)))]);
+        }
+        matches = DecodesLikeReference(bytes);
+        bool valid = false;
+        DecodeUtf8Reference(bytes, valid);
+        invalid += valid ? 0 : 1;
+    }
+    CHECK(matches);
+    CHECK(invalid > 10000 && invalid < 29000);
+}
+
+void TestWideToUtf8()
+{
+    std::string bytes;
+    CHECK(WideToUtf8(L"", bytes) && bytes.empty());
+    CHECK(WideToUtf8(L"caf\xE9 \x65E5\x672C", bytes) && bytes == "caf\xC3\xA9 \xE6\x97\xA5\xE6\x9C\xAC");
+    std::wstring pair = L"x";
+    pair.push_back(static_cast<wchar_t>(0xD83D));
+    pair.push_back(static_cast<wchar_t>(0xDE00));
+    CHECK(WideToUtf8(pair, bytes) && bytes == "x\xF0\x9F\x98\x80");
+    std::wstring lone;
+    lone.push_back(static_cast<wchar_t>(0xDE00));
+    lone.push_back(static_cast<wchar_t>(0xD83D));
+    CHECK(WideToUtf8(lone, bytes) && bytes == "\xEF\xBF\xBD\xEF\xBF\xBD");
+
+    // A pair straddling the 16384-unit chunk boundary stays one character.
+    std::wstring straddle(16383, L'a');
+    straddle += pair.substr(1);
+    straddle += std::wstring(40, L'b');
+    CHECK(WideToUtf8(straddle, bytes) && bytes == EncodeUtf8Reference(straddle));
+
+    TestRandom random{ 37 };
+    std::vector<uint32_t> units = { 'a', 0x7F, 0x80, 0x7FF, 0x800, 0xFFFF, 0xD800, 0xDBFF, 0xDC00, 0xDFFF, 0x3042, 0xFFFD };
+    if constexpr (sizeof(wchar_t) == 4)
+    {
+        units.insert(units.end(), { 0x10000, 0x1F600, 0x10FFFF, 0x110000 });
+    }
+    bool matches = true;
+    for (int i = 0; i < 20000 && matches; ++i)
+    {
+        std::wstring text;
+        for (uint32_t piece = 0, count = random.Next(24); piece < count; ++piece)
+        {
+            if (random.Next(3) == 0)
+            {
+                text.append(random.Next(40), L'x');
+            }
+            text.push_back(static_cast<wchar_t>(units[random.Next(static_cast<uint32_t>(units.size()))]));
+        }
+        matches = WideToUtf8(text, bytes) && bytes == EncodeUtf8Reference(text);
+
+        // Whatever survives encoding decodes back to the same UTF-16.
+        std::wstring decoded;
+        bool valid = false;
+        std::wstring expected = DecodeUtf8Reference(bytes, valid);
+        matches = matches && valid && Utf8ToWideStrict(bytes, decoded) && decoded == expected;
+    }
+    CHECK(matches);
+}
+
+// =====================
+// テキスト行索引
+// =====================
+
+// A mapper over text held in memory that adds up how many bytes were asked for.
+struct MemoryTextFile
+{
+    std::string bytes;
+    uint64_t mappedBytes = 0;
+
+    TextRangeMapper Mapper()
+    {
+        return [this](uint64_t offset, size_t length) -> const char*
+        {
+            if (offset > bytes.size() || length > bytes.size() - offset)
+            {
+                return nullptr;
+            }
+            mappedBytes += length;
+            return bytes.data() + offset;
+        };
+    }
+};
+
+// Indexes text in pieces of random size, as the indexer and follow mode hand it over.
+TextLineIndex IndexTextInPieces(const std::string& text, uint64_t dataStart, TestRandom& random)
+{
+    TextLineIndex index;
+    ResetTextLineIndex(index, dataStart);
+    size_t offset = static_cast<size_t>(dataStart);
+    while (offset < text.size())
+    {
+        size_t piece = (std::min)(text.size() - offset, static_cast<size_t>(1 + random.Next(70000)));
+        AppendTextLineIndex(index, text.data() + offset, piece);
+        offset += piece;
+    }
+    return index;
+}
+
+void TestTextLineIndex()
+{
+    TestRandom random{ 29 };
+    for (int round = 0; round < 40; ++round)
+    {
+        // Short lines with LF or CRLF, empty lines, and lines well over kTextMaxLineBytes.
+        MemoryTextFile file;
+        uint64_t dataStart = round % 4 == 0 ? 3 : 0;
+        file.bytes = dataStart ? "\xEF\xBB\xBF" : "";
+        std::vector<std::pair<uint64_t, uint64_t>> lines;
+        int lineCount = 1 + static_cast<int>(random.Next(round % 2 ? 1200 : 40));
+        for (int i = 0; i < lineCount; ++i)
+        {
+            uint32_t kind = random.Next(40);
+            size_t length = kind == 0 ? kTextMaxLineBytes + 1 + random.Next(100000) : kind == 1 ? kTextMaxLineBytes : kind < 4 ? 0 : random.Next(120);
+            uint64_t start = file.bytes.size();
+            for (size_t j = 0; j < length; ++j)
+            {
+                file.bytes.push_back(static_cast<char>('a' + (j + i) % 26));
+            }
+            lines.emplace_back(start, file.bytes.size());
+            if (i + 1 < lineCount || round % 3 != 0)
+            {
+                file.bytes += random.Next(2) ? "\r\n" : "\n";
+                if (file.bytes[file.bytes.size() - 2] == '\r')
+                {
+                    ++lines.back().second;
+                }
+            }
+        }
+        bool unterminated = round % 3 == 0 && lines.back().second > lines.back().first;
+        if (round % 3 == 0 && !unterminated)
+        {
+            lines.pop_back();
+        }
+
+        TextLineIndex index = IndexTextInPieces(file.bytes, dataStart, random);
+        CHECK(GetTextLineCount(index, true) == lines.size());
+        CHECK(GetTextLineCount(index, false) == lines.size() - (unterminated ? 1 : 0));
+        for (const TextLongLine& longLine : index.longLines)
+        {
+            CHECK(longLine.end - longLine.start > kTextMaxLineBytes && lines[longLine.line].first == longLine.start);
+        }
+        TextRangeMapper map = file.Mapper();
+        for (uint64_t line = 0; line < lines.size(); ++line)
+        {
+            uint64_t start = 0;
+            uint64_t end = 0;
+            CHECK(FindTextLineRange(index, true, line, map, start, end));
+            CHECK(start == lines[line].first && end == lines[line].second);
+        }
+        uint64_t start = 0;
+        uint64_t end = 0;
+        CHECK(!FindTextLineRange(index, true, lines.size(), map, start, end));
+        CHECK(unterminated == !FindTextLineRange(index, false, lines.size() - 1, map, start, end));
+    }
+}
+
+void TestReadTextLine()
+{
+    MemoryTextFile file;
+    // A CRLF line, an LF line, an empty CRLF line, a long line with a three-byte character
+    // across the clip, one whose clip ends on a whole character, and an unterminated last line.
+    std::string longCut(kTextMaxLineBytes - 1, 'x');
+    longCut += "\xE3\x81\x82 tail\r";
+    std::string longWhole(kTextMaxLineBytes - 3, 'y');
+    longWhole += "\xE3\x81\x82" + std::string(40000, 'z');
+    file.bytes = "first\r\nsecond\n\r\n" + longCut + "\n" + longWhole + "\nlast\r";
+    TestRandom random{ 30 };
+    TextLineIndex index = IndexTextInPieces(file.bytes, 0, random);
+    CHECK(index.longLines.size() == 2);
+    TextRangeMapper map = file.Mapper();
+
+    std::wstring text;
+    CHECK(ReadTextLine(index, true, 0, map, text) && text == L"first");
+    CHECK(ReadTextLine(index, true, 1, map, text) && text == L"second");
+    CHECK(ReadTextLine(index, true, 2, map, text) && text.empty());
+    CHECK(ReadTextLine(index, true, 3, map, text) && text == std::wstring(kTextMaxLineBytes - 1, L'x'));
+    CHECK(ReadTextLine(index, true, 4, map, text) && text == std::wstring(kTextMaxLineBytes - 3, L'y') + L"あ");
+    CHECK(ReadTextLine(index, true, 5, map, text) && text == L"last");
+    CHECK(!ReadTextLine(index, false, 5, map, text) && text.empty());
+}
+
+void TestTextLongLineLookup()
+{
+    // 300 lines of 64 KB between short ones: lookups jump over the long lines and read only a
+    // window per short line passed.
+    MemoryTextFile file;
+    for (int i = 0; i < 300; ++i)
+    {
+        file.bytes.append(64 << 10, static_cast<char>('a' + i % 26));
+        file.bytes += "\nshort\n";
+    }
+    TextLineIndex index;
+    ResetTextLineIndex(index, 0);
+    AppendTextLineIndex(index, file.bytes.data(), file.bytes.size());
+    CHECK(index.longLines.size() == 300 && index.checkpoints.size() == 3);
+    TextRangeMapper map = file.Mapper();
+    for (uint64_t line : { 0ull, 1ull, 255ull, 256ull, 511ull, 597ull })
+    {
+        file.mappedBytes = 0;
+        uint64_t start = 0;
+        uint64_t end = 0;
+        CHECK(FindTextLineRange(index, true, line, map, start, end));
+        CHECK(end - start == (line % 2 ? 5u : 64u << 10));
+        CHECK(file.mappedBytes == (line % kTextLineCheckpointStride + 1) / 2 * (kTextMaxLineBytes + 1));
+    }
+    std::wstring text;
+    file.mappedBytes = 0;
+    CHECK(ReadTextLine(index, true, 598, map, text) && text.size() == kTextMaxLineBytes);
+    CHECK(file.mappedBytes == (598 - 512) / 2 * (kTextMaxLineBytes + 1) + kTextMaxLineBytes);
+}
+
+void TestTextFollowAction()
+{
+    const TextFileIdentity open{ 7, 100 };
+    TextFollowProbe probe;
+    probe.pathExists = true;
+    probe.identityKnown = true;
+    probe.pathIdentity = open;
+    probe.sizeKnown = true;
+    probe.openSize = 1000;
+    CHECK(GetTextFollowAction(open, 1000, true, probe) == TextFollowAction::None);
+    probe.openSize = 1000 + kTextIndexChunkBytes;
+    CHECK(GetTextFollowAction(open, 1000, true, probe) == TextFollowAction::AppendInline);
+    probe.openSize = 1001 + kTextIndexChunkBytes;
+    CHECK(GetTextFollowAction(open, 1000, true, probe) == TextFollowAction::AppendInBackground);
+    // Nothing is decided while the indexer still runs.
+    CHECK(GetTextFollowAction(open, 1000, false, probe) == TextFollowAction::None);
+    // Truncated in place.
+    probe.openSize = 10;
+    CHECK(GetTextFollowAction(open, 1000, true, probe) == TextFollowAction::Reopen);
+    // Rotated: the path names another file, on the same volume or another, whatever its size.
+    probe.openSize = 1000;
+    probe.pathIdentity = TextFileIdentity{ 7, 101 };
+    CHECK(GetTextFollowAction(open, 1000, true, probe) == TextFollowAction::Reopen);
+    probe.pathIdentity = TextFileIdentity{ 8, 100 };
+    CHECK(GetTextFollowAction(open, 1000, true, probe) == TextFollowAction::Reopen);
+    // Mid-rotation the path is missing and the file held open is still followed; an unknown
+    // identity or size is not taken as a change.
+    probe.pathExists = false;
+    CHECK(GetTextFollowAction(open, 1000, true, probe) == TextFollowAction::None);
+    probe.openSize = 1100;
+    CHECK(GetTextFollowAction(open, 1000, true, probe) == TextFollowAction::AppendInline);
+    probe.pathExists = true;
+    probe.identityKnown = false;
+    probe.sizeKnown = false;
+    CHECK(GetTextFollowAction(open, 1000, true, probe) == TextFollowAction::None);
+    probe.sizeKnown = true;
+    probe.openSize = 1200;
+    CHECK(GetTextFollowAction(open, 1000, true, probe) == TextFollowAction::AppendInline);
+}
+
+// A log a writer appends to, rotates and truncates, followed the way the viewer follows it.
+struct FollowedLog
+{
+    // What the path names: a missing path between a rotation's rename and create.
+    bool exists = true;
+    TextFileIdentity identity{ 1, 1 };
+    std::string bytes;
+};
+
+struct LogFollower
+{
+    TextFileIdentity identity;
+    std::string bytes;
+    TextLineIndex index;
+    int reopens = 0;
+
+    void Open(const FollowedLog& log)
+    {
+        identity = log.identity;
+        bytes = log.bytes;
+        ResetTextLineIndex(index, 0);
+        AppendTextLineIndex(index, bytes.data(), bytes.size());
+        ++reopens;
+    }
+
+    // The open file is the one held since Open; after a rotation it no longer grows.
+    void Check(const FollowedLog& log, const std::string& openBytes)
+    {
+        TextFollowProbe probe;
+        probe.pathExists = log.exists;
+        probe.identityKnown = log.exists;
+        probe.pathIdentity = log.identity;
+        probe.sizeKnown = true;
+        probe.openSize = openBytes.size();
+        switch (GetTextFollowAction(identity, bytes.size(), true, probe))
+        {
+        case TextFollowAction::None:
+            break;
+        case TextFollowAction::AppendInline:
+        case TextFollowAction::AppendInBackground:
+            AppendTextLineIndex(index, openBytes.data() + bytes.size(), openBytes.size() - bytes.size());
+            bytes = openBytes;
+            break;
+        case TextFollowAction::Reopen:
+            Open(log);
+            break;
+        }
+    }
+};
+
+void TestTextFollowLog()
+{
+    TestRandom random{ 31 };
+    FollowedLog log;
+    LogFollower follower;
+    follower.Open(log);
+    std::string rotatedBytes;
+    bool rotating = false;
+    int expectedReopens = 1;
+    for (int step = 0; step < 400; ++step)
+    {
+        uint32_t event = random.Next(20);
+        if (rotating)
+        {
+            // The rotation completes: a new, empty file appears under the name.
+            log.exists = true;
+            log.identity.file += 1;
+            log.bytes.clear();
+            rotating = false;
+        }
+        else if (event == 0)
+        {
+            // Renamed away: the open handle keeps the old file, which may get one last write.
+            rotatedBytes = log.bytes + "last line before rotation\n";
+            log.exists = false;
+            rotating = true;
+        }
+        else if (event == 1 && !log.bytes.empty())
+        {
+            log.bytes.resize(random.Next(static_cast<uint32_t>(log.bytes.size())));
+        }
+        else
+        {
+            int lines = 1 + static_cast<int>(random.Next(5));
+            for (int i = 0; i < lines; ++i)
+            {
+                log.bytes += "step " + std::to_string(step) + (random.Next(3) ? " ok\n" : " partial");
+            }
+        }
+
+        const std::string& openBytes = rotating ? rotatedBytes : log.bytes;
+        size_t before = follower.reopens;
+        bool shrank = !rotating && follower.identity.file == log.identity.file && log.bytes.size() < follower.bytes.size();
+        bool replaced = log.exists && follower.identity.file != log.identity.file;
+        follower.Check(log, openBytes);
+        expectedReopens += shrank || replaced ? 1 : 0;
+        CHECK(follower.reopens == expectedReopens && follower.reopens >= static_cast<int>(before));
+
+        // Whatever happened, the index describes exactly the bytes the follower holds.
+        TextLineIndex reference;
+        ResetTextLineIndex(reference, 0);
+        AppendTextLineIndex(reference, follower.bytes.data(), follower.bytes.size());
+        CHECK(follower.index.lineCount == reference.lineCount && follower.index.lastLineStart == reference.lastLineStart
+            && follower.index.indexedEnd == follower.bytes.size() && follower.index.checkpoints == reference.checkpoints);
+        CHECK(follower.bytes == (rotating ? rotatedBytes : log.bytes));
+    }
+    CHECK(follower.reopens > 10);
+}
+
+// =====================
+// 設定ストア
+// =====================
+
+SettingsStore MakeSettingsStore(std::wstring_view content)
+{
+    SettingsStore store;
+    SplitSettingsLines(content, store.lines);
+    IndexSettingsLines(store);
+    return store;
+}
+
+bool LookupSetting(const SettingsStore& store, const std::wstring& section, const std::wstring& key, std::wstring& value)
+{
+    auto it = store.keyLines.find(MakeSettingsKey(section, key));
+    if (it == store.keyLines.end())
+    {
+        return false;
+    }
+    const std::wstring& line = store.lines[it->second];
+    value = TrimString(line.substr(line.find(L'=') + 1));
+    return true;
+}
+
+void TestSplitSettingsLines()
+{
+    std::vector<std::wstring> lines;
+    SplitSettingsLines(L"a\r\nb\n\nc", lines);
+    CHECK((lines == std::vector<std::wstring>{ L"a", L"b", L"", L"c" }));
+    lines.clear();
+    SplitSettingsLines(L"[S]\r\nK=1\r\n", lines);
+    CHECK((lines == std::vector<std::wstring>{ L"[S]", L"K=1" }));
+    lines.clear();
+    SplitSettingsLines(L"x\ry\r\n", lines);
+    CHECK((lines == std::vector<std::wstring>{ L"x\ry" }));
+    lines.clear();
+    SplitSettingsLines(L"", lines);
+    CHECK(lines.empty());
+    CHECK(TrimString(L" \t value \t") == L"value" && TrimString(L"   ").empty());
+}
+
+void TestIndexSettingsLines()
+{
+    SettingsStore store = MakeSettingsStore(
+        L"Orphan=1\r\n"
+        L"; comment=ignored\r\n"
+        L"[Settings]\r\n"
+        L"  ZoomMode = 2 \r\n"
+        L"# Hidden=1\r\n"
+        L"zoommode=3\r\n"
+        L"[TEXT]\r\n"
+        L"FontName=Yu Gothic UI\r\n"
+        L"NoValue\r\n");
+    std::wstring value;
+    CHECK(LookupSetting(store, L"settings", L"ZOOMMODE", value) && value == L"2");
+    CHECK(LookupSetting(store, L"Text", L"fontname", value) && value == L"Yu Gothic UI");
+    CHECK(!LookupSetting(store, L"", L"Orphan", value));
+    CHECK(!LookupSetting(store, L"Settings", L"Hidden", value));
+    CHECK(!LookupSetting(store, L"Text", L"NoValue", value));
+    CHECK(store.sectionEnds.at(L"settings") == 5 && store.sectionEnds.at(L"text") == 8);
+}
+
+void TestApplySettingsChange()
+{
+    SettingsStore store = MakeSettingsStore(
+        L"; FloatVision\r\n"
+        L"[Settings]\r\n"
+        L"ZoomMode = 2\r\n"
+        L"\r\n"
+        L"[Text]\r\n"
+        L"Wrap=1\r\n");
+
+    // A rewritten value keeps the key and the spacing written before it.
+    CHECK(ApplySettingsChange(store, { L"settings", L"zoommode", L"5", false }));
+    CHECK(store.lines[2] == L"ZoomMode = 5");
+    CHECK(!ApplySettingsChange(store, { L"Settings", L"ZoomMode", L"5", false }));
+
+    // A new key goes after the last line of its section, a new section at the end after a blank line.
+    CHECK(ApplySettingsChange(store, { L"Settings", L"AlwaysOnTop", L"1", false }));
+    CHECK(store.lines[3] == L"AlwaysOnTop=1");
+    CHECK(ApplySettingsChange(store, { L"Window", L"CustomX", L"-20", false }));
+    CHECK((std::vector<std::wstring>(store.lines.end() - 3, store.lines.end())
+        == std::vector<std::wstring>{ L"", L"[Window]", L"CustomX=-20" }));
+
+    CHECK(ApplySettingsChange(store, { L"Text", L"Wrap", L"", true }));
+    CHECK(!ApplySettingsChange(store, { L"Text", L"Wrap", L"", true }));
+    std::wstring value;
+    CHECK(!LookupSetting(store, L"Text", L"Wrap", value));
+    CHECK(LookupSetting(store, L"Window", L"CustomX", value) && value == L"-20");
+    CHECK(store.lines.front() == L"; FloatVision");
+
+    // Changes replayed onto a file edited meanwhile keep the other edits.
+    SettingsStore edited = MakeSettingsStore(L"[Settings]\r\nZoomMode=1\r\nUserKey=kept\r\n");
+    CHECK(ApplySettingsChange(edited, { L"Settings", L"ZoomMode", L"5", false }));
+    CHECK(LookupSetting(edited, L"Settings", L"UserKey", value) && value == L"kept");
+    CHECK(LookupSetting(edited, L"Settings", L"ZoomMode", value) && value == L"5");
+
+    // A key written twice reads as its first occurrence, and removing it removes both, leaving
+    // the same key in another section alone.
+    SettingsStore duplicated = MakeSettingsStore(
+        L"[Settings]\r\nZoomMode=1\r\n; note\r\nzoommode = 3\r\nAlwaysOnTop=1\r\n[Other]\r\nZoomMode=7\r\n");
+    CHECK(LookupSetting(duplicated, L"Settings", L"ZoomMode", value) && value == L"1");
+    CHECK(ApplySettingsChange(duplicated, { L"Settings", L"ZoomMode", L"", true }));
+    CHECK(!LookupSetting(duplicated, L"Settings", L"ZoomMode", value));
+    CHECK(LookupSetting(duplicated, L"Other", L"ZoomMode", value) && value == L"7");
+    CHECK((duplicated.lines == std::vector<std::wstring>{ L"[Settings]", L"; note", L"AlwaysOnTop=1", L"[Other]", L"ZoomMode=7" }));
+}
+
+// =====================
+// 設定スキーマ
+// =====================
+
+struct TestSettingField
+{
+    std::wstring_view section;
+    std::wstring_view key;
+    std::wstring_view markdownName;
+};
+
+constexpr std::array kTestSettingFields{
+    TestSettingField{ L"Settings", L"ZoomMode", L"" },
+    TestSettingField{ L"Settings", L"SortMode", L"" },
+    TestSettingField{ L"Settings", L"AlwaysOnTop", L"" },
+    TestSettingField{ L"Window", L"CustomX", L"" },
+    TestSettingField{ L"Window", L"CustomY", L"" },
+    TestSettingField{ L"Text", L"FontName", L"font" },
+    TestSettingField{ L"Text", L"FontColor", L"fontcolor" },
+    TestSettingField{ L"Text", L"BackgroundColor", L"background" },
+    TestSettingField{ L"Text", L"Wrap", L"wrap" },
+    TestSettingField{ L"KeyConfig", L"AlwaysOnTop", L"" },
+};
+constexpr auto kTestIniTable = BuildSettingHashTable<std::bit_ceil(kTestSettingFields.size() * 4)>(kTestSettingFields, false);
+constexpr auto kTestMarkdownTable = BuildSettingHashTable<16>(kTestSettingFields, true);
+static_assert(kTestIniTable.seed != 0 && kTestMarkdownTable.seed != 0);
+
+const TestSettingField* FindTestSetting(std::wstring_view name, bool markdown)
+{
+    uint8_t index = markdown ? FindSettingSlot(kTestMarkdownTable, name) : FindSettingSlot(kTestIniTable, name);
+    if (index == kSettingSlotEmpty)
+    {
+        return nullptr;
+    }
+    const TestSettingField& field = kTestSettingFields[index];
+    return MatchesSettingField(field, name, markdown) ? &field : nullptr;
+}
+
+void TestSettingHashTable()
+{
+    for (const TestSettingField& field : kTestSettingFields)
+    {
+        std::wstring name = std::wstring(field.section) + L'\n' + std::wstring(field.key);
+        FoldCaseText(name);
+        CHECK(FindTestSetting(name, false) == &field);
+        if (!field.markdownName.empty())
+        {
+            CHECK(FindTestSetting(field.markdownName, true) == &field);
+        }
+    }
+    // The same key in two sections is two settings.
+    CHECK(FindTestSetting(L"settings\nalwaysontop", false) != FindTestSetting(L"keyconfig\nalwaysontop", false));
+    CHECK(FindTestSetting(L"settings\nfontname", false) == nullptr);
+    CHECK(FindTestSetting(L"text\nfontname2", false) == nullptr);
+    CHECK(FindTestSetting(L"textfontname", false) == nullptr);
+    CHECK(FindTestSetting(L"", false) == nullptr);
+    CHECK(FindTestSetting(L"zoommode", true) == nullptr);
+    CHECK(FindTestSetting(L"font", false) == nullptr);
+
+    CHECK(HashSettingName(kSettingNameHashBasis, L"Settings") == HashSettingName(kSettingNameHashBasis, L"settings"));
+    CHECK(HashSettingName(kSettingNameHashBasis, L"Settings") != HashSettingName(kSettingNameHashBasis, L"Setting"));
+    CHECK(EqualsSettingName(L"fontcolor", L"FontColor") && !EqualsSettingName(L"FontColor", L"fontcolor"));
+}
+
+void TestSettingHashTableCollision()
+{
+    // Two fields under one name can never get slots of their own; the build reports no seed.
+    constexpr std::array duplicates{
+        TestSettingField{ L"Text", L"Wrap", L"" },
+        TestSettingField{ L"TEXT", L"wrap", L"" },
+    };
+    CHECK(BuildSettingHashTable<8>(duplicates, false).seed == 0);
+    CHECK(BuildSettingHashTable<8>(duplicates, true).seed != 0);
+}
+
+// =====================
+// フォントカタログ
+// =====================
+
+void TestFoldFontName()
+{
+    CHECK(FoldFontName(L"Yu Gothic UI") == L"yu gothic ui");
+    CHECK(FoldFontName(L"yu gothic ui") == L"yu gothic ui");
+    CHECK(FoldFontName(L"") == L"");
+    // Only case is folded: spaces, punctuation and CJK names are left as they are.
+    CHECK(FoldFontName(L"Segoe UI-Semibold_ 2") == L"segoe ui-semibold_ 2");
+    CHECK(FoldFontName(L"MS \u30B4\u30B7\u30C3\u30AF") == L"ms \u30B4\u30B7\u30C3\u30AF");
+    CHECK(FoldFontName(L"\u30E1\u30A4\u30EA\u30AA") == L"\u30E1\u30A4\u30EA\u30AA");
+}
+
+FontCatalogEntry MakeFontFace(const std::wstring& familyName, uint32_t weight, uint32_t style)
+{
+    FontCatalogEntry face;
+    face.familyName = familyName;
+    face.weight = weight;
+    face.style = style;
+    return face;
+}
+
+void TestFontCatalog()
+{
+    // Families added as the collection lists them: localized names, faces and their GDI names.
+    FontCatalogIndex index;
+    AddFontCatalogFamily(index, { L"Yu Gothic", L"游ゴシック" });
+    AddFontCatalogFace(index, MakeFontFace(L"Yu Gothic", 400, 0), { L"Yu Gothic Regular" }, { L"Yu Gothic" });
+    AddFontCatalogFace(index, MakeFontFace(L"Yu Gothic", 700, 0), { L"Yu Gothic Bold" }, { L"Yu Gothic" });
+    AddFontCatalogFace(index, MakeFontFace(L"Yu Gothic", 350, 0), { L"Yu Gothic Light" }, { L"Yu Gothic Light" });
+    AddFontCatalogFamily(index, { L"Segoe UI" });
+    AddFontCatalogFace(index, MakeFontFace(L"Segoe UI", 600, 0), { L"Segoe UI Semibold" }, { L"Segoe UI Semibold" });
+    AddFontCatalogFace(index, MakeFontFace(L"Segoe UI", 400, 2), { L"Segoe UI Italic" }, { L"Segoe UI" });
+    // A later family that reuses names already taken, and a family named like another's face.
+    AddFontCatalogFamily(index, { L"yu gothic" });
+    AddFontCatalogFace(index, MakeFontFace(L"yu gothic", 900, 0), { L"Yu Gothic Bold" }, { L"YU GOTHIC" });
+    AddFontCatalogFamily(index, { L"Segoe UI Semibold" });
+    AddFontCatalogFamily(index, {});
+
+    FontCatalogEntry entry;
+    CHECK(FindFontCatalogEntry(index, L"YU GOTHIC", entry) && entry.familyName == L"Yu Gothic" && entry.weight == 400 && entry.style == 0);
+    CHECK(FindFontCatalogEntry(index, L"游ゴシック", entry) && entry.familyName == L"游ゴシック");
+    // A face name resolves to its family with its weight and style; the first font keeps a name.
+    CHECK(FindFontCatalogEntry(index, L"yu gothic bold", entry) && entry.familyName == L"Yu Gothic" && entry.weight == 700);
+    CHECK(FindFontCatalogEntry(index, L"Segoe UI Italic", entry) && entry.familyName == L"Segoe UI" && entry.style == 2);
+    // Family names win over face names, whichever family the face belongs to.
+    CHECK(FindFontCatalogEntry(index, L"Segoe UI Semibold", entry) && entry.familyName == L"Segoe UI Semibold" && entry.weight == 400);
+    CHECK(FindFontCatalogEntry(index, L"Yu Gothic Light", entry) && entry.familyName == L"Yu Gothic" && entry.weight == 350);
+    CHECK(!FindFontCatalogEntry(index, L"Yu Gothic UI", entry) && !FindFontCatalogEntry(index, L"", entry));
+
+    std::wstring familyName;
+    CHECK(FindFontCatalogGdiFamily(index, L"yu gothic light", familyName) && familyName == L"Yu Gothic");
+    CHECK(FindFontCatalogGdiFamily(index, L"SEGOE UI SEMIBOLD", familyName) && familyName == L"Segoe UI");
+    CHECK(FindFontCatalogGdiFamily(index, L"Yu Gothic", familyName) && familyName == L"Yu Gothic");
+    CHECK(!FindFontCatalogGdiFamily(index, L"Yu Gothic Bold", familyName));
+    CHECK(index.families.size() == 4 && index.faces.size() == 5 && index.gdiFamilies.size() == 4);
+}
+
+// =====================
+// Markdown 分割
+// =====================
+
+void AppendMarkdownHtml(const MD_CHAR* text, MD_SIZE size, void* userdata)
+{
+    static_cast<std::string*>(userdata)->append(text, size);
+}
+
+std::string RenderMarkdownSerially(std::string_view markdown)
+{
+    std::string html;
+    md_html(markdown.data(), static_cast<MD_SIZE>(markdown.size()), AppendMarkdownHtml, &html, MD_DIALECT_GITHUB, 0);
+    return html;
+}
+
+// Renders every section on its own, behind the collected definitions, as the app does. False
+// when the splitter leaves the document to a serial pass.
+bool RenderMarkdownSplit(std::string_view markdown, size_t targetSectionBytes, std::string& html, size_t& sectionCount)
+{
+    std::vector<std::string_view> sections;
+    std::string definitions;
+    if (!SplitMarkdownIntoSections(markdown, targetSectionBytes, sections, definitions))
+    {
+        return false;
+    }
+    html.clear();
+    for (std::string_view section : sections)
+    {
+        html += RenderMarkdownSerially(definitions + std::string(section));
+    }
+    sectionCount = sections.size();
+    return true;
+}
+
+// The split rendering is byte-identical to md4c's serial one, or the splitter declined.
+bool MatchesSerialMarkdown(std::string_view markdown, size_t targetSectionBytes)
+{
+    std::string html;
+    size_t sectionCount = 0;
+    if (!RenderMarkdownSplit(markdown, targetSectionBytes, html, sectionCount) || html == RenderMarkdownSerially(markdown))
+    {
+        return true;
+    }
+    std::fprintf(stderr, "split markdown differs from md4c for:\n%.*s\n--\n", static_cast<int>(markdown.size()), markdown.data());
+    return false;
+}
+
+void TestMarkdownSplit()
+{
+    std::string html;
+    size_t sectionCount = 0;
+    const std::string plain = "# Title\n\nFirst paragraph.\n\nSecond [a] paragraph.\n\n[a]: https://example.com/\n\n## Next\n\n- item\n";
+    CHECK(RenderMarkdownSplit(plain, 0, html, sectionCount) && sectionCount == 4);
+    CHECK(html == RenderMarkdownSerially(plain));
+    CHECK(RenderMarkdownSplit(plain, plain.size(), html, sectionCount) && sectionCount == 1);
+
+    // No cut inside fenced code, or in front of a lazy paragraph continuation.
+    const std::string fenced = "```\ncode\n\nText in code\n```\n\nAfter\n";
+    CHECK(RenderMarkdownSplit(fenced, 0, html, sectionCount) && sectionCount == 2 && html == RenderMarkdownSerially(fenced));
+    const std::string quoted = "> quote\ncontinued\n\nAfter\n";
+    CHECK(RenderMarkdownSplit(quoted, 0, html, sectionCount) && sectionCount == 2 && html == RenderMarkdownSerially(quoted));
+
+    // A fence that opens inside a quote or list item ends where md4c says; left to a serial pass.
+    for (std::string_view markdown : {
+        std::string_view("> ```\n```\n  ```\n\n\xC3\x9Cn\xC3\xAF\n"),
+        std::string_view("> ```\n```\n```\n\nsee [a] and [b]\n"),
+        std::string_view("- ```\n```\n  ```\n\nText\n"),
+        std::string_view("1. ~~~\n~~~\n\nText\n"),
+        std::string_view("- item\n\t```\n```c\n```\n\n# Heading\n"),
+        std::string_view("<![CDATA[\n-->\n   ~~~\n]]>\n\nText\n") })
+    {
+        CHECK(!RenderMarkdownSplit(markdown, 0, html, sectionCount));
+        CHECK(MatchesSerialMarkdown(markdown, 0));
+    }
+    CHECK(!RenderMarkdownSplit("text\rmore\rend\n", 0, html, sectionCount));
+}
+
+// Documents assembled from lines that open, continue and close every kind of block, checked
+// against md4c's serial output.
+void TestMarkdownSplitDifferential()
+{
+    // Mostly lines that allow a cut, so that most documents are split somewhere.
+    static constexpr std::string_view kPlainLines[] = {
+        "", "", "", "Text", "\xC3\x9Cn\xC3\xAF", "see [a] and [b]", "# Heading", "text with `code`",
+    };
+    static constexpr std::string_view kLines[] = {
+        "Heading", "===", "---", "***", "```", "~~~", "````", "```c", "  ```", "   ~~~", "\t```", "    ```", "> ```", "- ```", "1. ```", "> ~~~", "  - ```", "> - ```",
+        "> quote", ">", "- item", "  - nested", "1. first", "2) second", "    indented", "\tindented",
+        "<!--", "-->", "<div>", "</div>", "<script>", "</script>", "<pre>", "</pre>", "<style>", "<?php", "?>", "<!DOCTYPE html>",
+        "<![CDATA[", "]]>", "| a | b |", "|---|---|", "| 1 | 2 |", "[a]: /a", "[b]: /b \"title\"", "[a]:", "[c]: <x>",
+        "* star", "+ plus", "Text\r", "Text  ", "| x",
+    };
+    TestRandom random{ 7 };
+    int splitCount = 0;
+    for (int round = 0; round < 20000; ++round)
+    {
+        std::string markdown;
+        for (uint32_t line = 0, lineCount = 1 + random.Next(14); line < lineCount; ++line)
+        {
+            markdown += (random.Next(3) == 0) ? kLines[random.Next(static_cast<uint32_t>(std::size(kLines)))]
+                                       : kPlainLines[random.Next(static_cast<uint32_t>(std::size(kPlainLines)))];
+            markdown += '\n';
+        }
+        std::string html;
+        size_t sectionCount = 0;
+        if (RenderMarkdownSplit(markdown, 0, html, sectionCount) && sectionCount > 1)
+        {
+            ++splitCount;
+        }
+        CHECK(MatchesSerialMarkdown(markdown, 0));
+        CHECK(MatchesSerialMarkdown(markdown, random.Next(64)));
+    }
+    // The check means nothing if the splitter declines everything.
+    CHECK(splitCount > 2000);
+}
+
+// =====================
+// コードハイライト
+// =====================
+
+std::string Highlight(std::string_view info, std::string_view code)
+{
+    std::string html;
+    if (const CodeLanguage* language = FindCodeLanguage(info))
+    {
+        HighlightCode(*language, code, html);
+    }
+    return html;
+}
+
+// Drops the token spans and decodes the entities. Any other markup means the highlighter let a
+// raw '<' through, and yields a marker no input contains.
+std::string StripHighlighting(std::string_view html)
+{
+    std::string escaped;
+    size_t pos = 0;
+    for (size_t tag = html.find('<'); tag != std::string_view::npos; tag = html.find('<', pos))
+    {
+        escaped.append(html.substr(pos, tag - pos));
+        size_t close = html.find('>', tag);
+        std::string_view markup = html.substr(tag, (close == std::string_view::npos) ? std::string_view::npos : close + 1 - tag);
+        if (markup != "</span>" && !(markup.starts_with("<span class=\"tok-") && markup.ends_with("\">")))
+        {
+            return "\x01";
+        }
+        pos = tag + markup.size();
+    }
+    escaped.append(html.substr(pos));
+    std::string text;
+    AppendHtmlUnescaped(escaped, text);
+    return text;
+}
+
+void TestFindCodeLanguage()
+{
+    CHECK(FindCodeLanguage("cpp") != nullptr);
+    CHECK(FindCodeLanguage("C++") == FindCodeLanguage("cpp"));
+    CHECK(FindCodeLanguage("PY") == FindCodeLanguage("python3"));
+    CHECK(FindCodeLanguage("yml") == FindCodeLanguage("yaml"));
+    CHECK(FindCodeLanguage("bash") != FindCodeLanguage("yaml"));
+    CHECK(FindCodeLanguage("") == nullptr);
+    CHECK(FindCodeLanguage("c+") == nullptr);
+    CHECK(FindCodeLanguage("cppx") == nullptr);
+    CHECK(FindCodeLanguage("rust") == nullptr);
+}
+
+void TestHighlightCode()
+{
+    CHECK(Highlight("cpp", "#include <vector>\nint main() { return 0x1F; } // done")
+        == "<span class=\"tok-meta\">#include &lt;vector&gt;</span>\n"
+           "<span class=\"tok-kw\">int</span> main() { <span class=\"tok-kw\">return</span> <span class=\"tok-num\">0x1F</span>; } "
+           "<span class=\"tok-com\">// done</span>");
+    CHECK(Highlight("c", "/* a < b */ char c = '\"'; s = \"x\\\"y\";")
+        == "<span class=\"tok-com\">/* a &lt; b */</span> <span class=\"tok-kw\">char</span> c = "
+           "<span class=\"tok-str\">'&quot;'</span>; s = <span class=\"tok-str\">&quot;x\\&quot;y&quot;</span>;");
+    // A continued preprocessor line stays one token; a keyword inside an identifier is not one.
+    CHECK(Highlight("cpp", "#define A \\\n  1\nintx") == "<span class=\"tok-meta\">#define A \\\n  1</span>\nintx");
+    CHECK(Highlight("python", "@dec\ndef f(x):\n    return r\"a\\d\" + '''a\nb''' # c")
+        == "<span class=\"tok-meta\">@dec</span>\n<span class=\"tok-kw\">def</span> f(x):\n    <span class=\"tok-kw\">return</span> "
+           "<span class=\"tok-str\">r&quot;a\\d&quot;</span> + <span class=\"tok-str\">'''a\nb'''</span> <span class=\"tok-com\"># c</span>");
+    CHECK(Highlight("json", "{\"key\": \"value\", \"n\": 1.5e3, \"z\": null}")
+        == "{<span class=\"tok-key\">&quot;key&quot;</span>: <span class=\"tok-str\">&quot;value&quot;</span>, "
+           "<span class=\"tok-key\">&quot;n&quot;</span>: <span class=\"tok-num\">1.5e3</span>, "
+           "<span class=\"tok-key\">&quot;z&quot;</span>: <span class=\"tok-kw\">null</span>}");
+    // Shell: no numbers, '...' without escapes, the $ forms, and '#' only starts a comment after a space.
+    CHECK(Highlight("sh", "echo a#b '$x\\' ${PATH} $# 2 # c")
+        == "echo a#b <span class=\"tok-str\">'$x\\'</span> <span class=\"tok-var\">${PATH}</span> "
+           "<span class=\"tok-var\">$#</span> 2 <span class=\"tok-com\"># c</span>");
+    CHECK(Highlight("yaml", "name: demo\n- item: 3\nurl: http://x#y # c\nflag: yes")
+        == "<span class=\"tok-key\">name</span>: demo\n- <span class=\"tok-key\">item</span>: <span class=\"tok-num\">3</span>\n"
+           "<span class=\"tok-key\">url</span>: http://x#y <span class=\"tok-com\"># c</span>\n"
+           "<span class=\"tok-key\">flag</span>: <span class=\"tok-kw\">yes</span>");
+    // Unterminated tokens run to the end of their line or of the block.
+    CHECK(Highlight("cpp", "\"open\nx /* open") == "<span class=\"tok-str\">&quot;open</span>\nx <span class=\"tok-com\">/* open</span>");
+    CHECK(Highlight("cpp", "").empty());
+}
+
+void TestHtmlUnescape()
+{
+    std::string text;
+    AppendHtmlUnescaped("a &amp;lt; &lt;b&gt; &quot;c&quot; &copy; & &amp", text);
+    CHECK(text == "a &lt; <b> \"c\" &copy; & &amp");
+}
+
+// Whatever the input, highlighting only adds spans: stripped and decoded it is the code again.
+// md4c's own escaping of a fenced block decodes back the same way.
+void TestHighlightRoundTrip()
+{
+    static constexpr std::string_view kFragments[] = {
+        " ", "\n", "\t", "\r\n", "x", "int", "return", "def", "true", "null", "yes", "fi", "42", "0x1F", ".5", "1e9",
+        "\"", "'", "'''", "\"\"\"", "\\", "//", "/*", "*/", "#", "#include", "@", "$", "${", "}", "$#", ":", "- ",
+        "<", ">", "&", "&amp;", "&lt;", "&quot;", "r\"", "b'", "\xC3\xA9", "\xE3\x81\x82", "\xFF",
+    };
+    static constexpr std::string_view kLanguages[] = { "cpp", "python", "json", "sh", "yaml" };
+    TestRandom random{ 11 };
+    for (int round = 0; round < 4000; ++round)
+    {
+        std::string code;
+        for (uint32_t i = 0, count = random.Next(40); i < count; ++i)
+        {
+            code += kFragments[random.Next(static_cast<uint32_t>(std::size(kFragments)))];
+        }
+        for (std::string_view language : kLanguages)
+        {
+            CHECK(StripHighlighting(Highlight(language, code)) == code);
+        }
+
+        constexpr std::string_view kOpen = "<pre><code>";
+        constexpr std::string_view kClose = "</code></pre>\n";
+        // md4c expands tabs in a line's indentation, so the block gets spaces instead.
+        std::string block = code;
+        std::replace(block.begin(), block.end(), '\t', ' ');
+        std::string html = RenderMarkdownSerially("```\n" + block + "\n```\n");
+        std::string text;
+        if (html.starts_with(kOpen) && html.ends_with(kClose))
+        {
+            AppendHtmlUnescaped(std::string_view(html).substr(kOpen.size(), html.size() - kOpen.size() - kClose.size()), text);
+        }
+        // md4c ends every line of the block with a bare LF.
+        std::string expected;
+        for (size_t i = 0; i < block.size(); ++i)
+        {
+            if (block.compare(i, 2, "\r\n") != 0)
+            {
+                expected.push_back(block[i]);
+            }
+        }
+        CHECK(text == expected + "\n");
+    }
+}
+
+// =====================
+// Markdown 見出し
+// =====================
+
+std::string MakeId(std::string_view text)
+{
+    std::string id;
+    MakeHeadingId(text, id);
+    return id;
+}
+
+// Renders markdown in one pass and numbers the outline as the app does.
+std::string RenderOutline(std::string_view markdown, std::vector<MarkdownHeading>& headings)
+{
+    std::string html;
+    MarkdownHtmlWriter writer;
+    writer.output = &html;
+    writer.headings = &headings;
+    headings.clear();
+    CHECK(RenderMarkdownHtml(markdown, writer));
+    std::vector<size_t> sectionStarts;
+    AssignMarkdownHeadingIds(html, headings, sectionStarts);
+    return html;
+}
+
+// Every entry points at its own opening tag, and no two ids are alike.
+bool IsOutlineConsistent(std::string_view html, const std::vector<MarkdownHeading>& headings)
+{
+    std::unordered_map<std::string, size_t> ids;
+    for (const MarkdownHeading& heading : headings)
+    {
+        std::string tag = "<h" + std::to_string(heading.level) + " id=\"" + heading.id + "\">";
+        if (html.compare(heading.offset, tag.size(), tag) != 0 || !ids.emplace(heading.id, 0).second)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TestMakeHeadingId()
+{
+    // The anchors GitHub gives these headings.
+    CHECK(MakeId("Key Features") == "key-features");
+    CHECK(MakeId("Installation & Uninstallation") == "installation--uninstallation");
+    CHECK(MakeId("Text, Markdown, & HTML") == "text-markdown--html");
+    CHECK(MakeId("snake_case and kebab-case v2.0") == "snake_case-and-kebab-case-v20");
+    // UTF-8 is kept as it is; only ASCII letters are lowercased.
+    CHECK(MakeId("\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E \xE8\xA6\x8B\xE5\x87\xBA\xE3\x81\x97") == "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E-\xE8\xA6\x8B\xE5\x87\xBA\xE3\x81\x97");
+    CHECK(MakeId("\xC3\x9C" "ber Alles") == "\xC3\x9C" "ber-alles");
+    CHECK(MakeId("!!!") == "section");
+    CHECK(MakeId("") == "section");
+}
+
+void TestMarkdownOutline()
+{
+    std::vector<MarkdownHeading> headings;
+    std::string html = RenderOutline("# A *b* `c<d>` &amp; e\n\nText\n\nMulti\nline\n===\n\n```\n# not a heading\n```\n\n> ### Quoted\n", headings);
+    CHECK(headings.size() == 3);
+    CHECK(IsOutlineConsistent(html, headings));
+    if (headings.size() == 3)
+    {
+        CHECK(headings[0].level == 1 && headings[0].text == "A b c<d> & e" && headings[0].id == "a-b-cd--e");
+        CHECK(headings[1].level == 1 && headings[1].text == "Multi line" && headings[1].id == "multi-line");
+        CHECK(headings[2].level == 3 && headings[2].text == "Quoted");
+    }
+    CHECK(html.starts_with("<h1 id=\"a-b-cd--e\">A <em>b</em> <code>c&lt;d&gt;</code> &amp; e</h1>\n"));
+}
+
+// Repeated slugs are numbered as github-slugger does, skipping ids an earlier heading spells out.
+void TestHeadingIdNumbering()
+{
+    std::vector<MarkdownHeading> headings;
+    std::string html = RenderOutline("# Usage\n## Usage\n# Usage-1\n### Usage\n# \xE8\xA6\x8B\n# \xE8\xA6\x8B\n", headings);
+    std::vector<std::string> ids;
+    for (const MarkdownHeading& heading : headings)
+    {
+        ids.push_back(heading.id);
+    }
+    CHECK((ids == std::vector<std::string>{ "usage", "usage-1", "usage-1-1", "usage-2", "\xE8\xA6\x8B", "\xE8\xA6\x8B-1" }));
+    CHECK(IsOutlineConsistent(html, headings));
+    CHECK(html.find("<h3 id=\"usage-2\">Usage</h3>") != std::string::npos);
+
+    // Sections rendered apart are numbered over the whole page, and the section offsets behind
+    // each rewritten id move with it.
+    std::string page;
+    std::vector<MarkdownHeading> pageHeadings;
+    std::vector<size_t> sectionStarts;
+    MarkdownHtmlWriter writer;
+    writer.output = &page;
+    writer.headings = &pageHeadings;
+    for (std::string_view section : { "# Usage\n", "Text\n", "# Usage\n", "# Usage\n\nEnd\n" })
+    {
+        sectionStarts.push_back(page.size());
+        page += "<!--s-->";
+        CHECK(RenderMarkdownHtml(section, writer));
+    }
+    AssignMarkdownHeadingIds(page, pageHeadings, sectionStarts);
+    CHECK(page == "<!--s--><h1 id=\"usage\">Usage</h1>\n<!--s--><p>Text</p>\n<!--s--><h1 id=\"usage-1\">Usage</h1>\n"
+                  "<!--s--><h1 id=\"usage-2\">Usage</h1>\n<p>End</p>\n");
+    CHECK(IsOutlineConsistent(page, pageHeadings));
+    bool markersFound = true;
+    for (size_t start : sectionStarts)
+    {
+        markersFound = markersFound && page.compare(start, 8, "<!--s-->") == 0;
+    }
+    CHECK(markersFound);
+}
+
+// The repository's own README as a real-world document.
+void TestReadmeOutline()
+{
+    std::ifstream file(FLOATVISION_SOURCE_DIR "/README.md", std::ios::binary);
+    std::string markdown((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    CHECK(!markdown.empty());
+    size_t headingLines = 0;
+    bool inFence = false;
+    for (size_t line = 0; line < markdown.size(); line = markdown.find('\n', line) + 1)
+    {
+        inFence = inFence != (markdown.compare(line, 3, "```") == 0);
+        headingLines += !inFence && markdown[line] == '#';
+        if (markdown.find('\n', line) == std::string::npos)
+        {
+            break;
+        }
+    }
+    std::vector<MarkdownHeading> headings;
+    std::string html = RenderOutline(markdown, headings);
+    CHECK(headings.size() == headingLines && headingLines > 0);
+    CHECK(IsOutlineConsistent(html, headings));
+}
+
+// =====================
+// Markdown キャッシュ
+// =====================
+
+uint64_t HashText(std::string_view text, uint64_t seed = 0)
+{
+    return HashBytes(text.data(), text.size(), seed);
+}
+
+void TestHashBytes()
+{
+    CHECK(HashText("markdown") == HashText("markdown"));
+    CHECK(HashText("markdown") != HashText("markdown", 1));
+    CHECK(HashText("") != HashText("", 1));
+    // Every length of a zero-filled buffer, and every single-bit flip of a 40-byte text, hashes
+    // differently: the length is mixed in and both the words and the tail reach every bit.
+    std::unordered_map<uint64_t, size_t> hashes;
+    const std::string zeros(64, '\0');
+    for (size_t size = 0; size <= zeros.size(); ++size)
+    {
+        hashes.emplace(HashText(std::string_view(zeros).substr(0, size)), 0);
+    }
+    std::string text = "The quick brown fox jumps over the dog.!";
+    for (size_t bit = 0; bit < text.size() * 8; ++bit)
+    {
+        text[bit / 8] ^= static_cast<char>(1 << (bit % 8));
+        hashes.emplace(HashText(text), 0);
+        text[bit / 8] ^= static_cast<char>(1 << (bit % 8));
+    }
+    hashes.emplace(HashText(text), 0);
+    CHECK(hashes.size() == zeros.size() + 1 + text.size() * 8 + 1);
+    // Only size bytes are read; a buffer that ends exactly there is fine under ASan.
+    std::vector<uint8_t> exact(13, 0x5A);
+    CHECK(HashBytes(exact.data(), exact.size(), 0) == HashText(std::string(13, 'Z')));
+}
+
+std::shared_ptr<const MarkdownPage> MakeCachedPage(size_t htmlBytes)
+{
+    auto page = std::make_shared<MarkdownPage>();
+    page->html.assign(htmlBytes, 'x');
+    return page;
+}
+
+void TestMarkdownHtmlCache()
+{
+    MarkdownHtmlCache cache;
+    cache.budgetBytes = 1000;
+    auto a = MakeCachedPage(300);
+    auto b = MakeCachedPage(300);
+    auto c = MakeCachedPage(300);
+    StoreCachedMarkdownHtml(cache, 1, 10, a);
+    StoreCachedMarkdownHtml(cache, 2, 20, b);
+    StoreCachedMarkdownHtml(cache, 3, 30, c);
+    CHECK(cache.entries.size() == 3 && cache.bytes == 900);
+
+    // A hit needs the source length as well as the key.
+    CHECK(FindCachedMarkdownHtml(cache, 1, 11) == nullptr);
+    const MarkdownHtmlCacheEntry* hit = FindCachedMarkdownHtml(cache, 1, 10);
+    CHECK(hit && hit->page == a);
+
+    // The fourth page evicts the least recently used one, which is b now that a was read.
+    StoreCachedMarkdownHtml(cache, 4, 40, MakeCachedPage(300));
+    CHECK(cache.entries.size() == 3 && cache.bytes == 900);
+    CHECK(FindCachedMarkdownHtml(cache, 2, 20) == nullptr);
+    CHECK(FindCachedMarkdownHtml(cache, 1, 10) && FindCachedMarkdownHtml(cache, 3, 30) && FindCachedMarkdownHtml(cache, 4, 40));
+
+    // Storing a key again replaces its page instead of counting it twice.
+    StoreCachedMarkdownHtml(cache, 3, 30, MakeCachedPage(100));
+    CHECK(cache.entries.size() == 3 && cache.bytes == 700);
+    hit = FindCachedMarkdownHtml(cache, 3, 30);
+    CHECK(hit && hit->page->html.size() == 100);
+
+    // One page larger than half the budget would only flush the others; it is not kept.
+    StoreCachedMarkdownHtml(cache, 5, 50, MakeCachedPage(501));
+    CHECK(FindCachedMarkdownHtml(cache, 5, 50) == nullptr && cache.entries.size() == 3);
+    // A large page evicts as many as it needs, oldest first.
+    StoreCachedMarkdownHtml(cache, 6, 60, MakeCachedPage(500));
+    CHECK(cache.bytes <= cache.budgetBytes && FindCachedMarkdownHtml(cache, 6, 60) && FindCachedMarkdownHtml(cache, 3, 30));
+    CHECK(FindCachedMarkdownHtml(cache, 1, 10) == nullptr);
+
+    ClearMarkdownHtmlCache(cache);
+    CHECK(cache.entries.empty() && cache.bytes == 0 && FindCachedMarkdownHtml(cache, 6, 60) == nullptr);
+}
+
+// =====================
+// Markdown ページ
+// =====================
+
+constexpr std::string_view kTestPagePrologue = "<!DOCTYPE html><html><body><article class=\"markdown-body\">";
+constexpr std::string_view kTestPageEpilogue = "</article></body></html>";
+
+std::string JoinBlocks(const std::vector<std::string>& blocks)
+{
+    std::string markdown;
+    for (const std::string& block : blocks)
+    {
+        markdown += block;
+        markdown += "\n\n";
+    }
+    return markdown;
+}
+
+bool SameHeadings(const std::vector<MarkdownHeading>& a, const std::vector<MarkdownHeading>& b)
+{
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const MarkdownHeading& x, const MarkdownHeading& y)
+        {
+            return x.level == y.level && x.offset == y.offset && x.slug == y.slug && x.id == y.id && x.text == y.text;
+        });
+}
+
+bool SamePage(const MarkdownPage& a, const MarkdownPage& b)
+{
+    return a.html == b.html && a.sectionStarts == b.sectionStarts && a.sectionHashes == b.sectionHashes
+        && a.bodyEnd == b.bodyEnd && a.definitionsHash == b.definitionsHash && SameHeadings(a.headings, b.headings);
+}
+
+// What the patch script does to the live DOM, done to the previous page's HTML: everything from
+// the first replaced marker up to the first kept one gives way to the fragment.
+std::string ApplyPatchToHtml(const MarkdownPage& previous, const MarkdownPagePatch& patch)
+{
+    auto start = [&previous](size_t index)
+    {
+        return index < previous.sectionStarts.size() ? previous.sectionStarts[index] : previous.bodyEnd;
+    };
+    std::string html = previous.html.substr(0, start(patch.firstSection));
+    html += std::string_view(patch.page->html).substr(patch.fragmentStart, patch.fragmentEnd - patch.fragmentStart);
+    html += std::string_view(previous.html).substr(start(patch.endSection));
+    return html;
+}
+
+void TestRenderMarkdownPage()
+{
+    MarkdownPage page;
+    std::string markdown = "# Title\n\nText [a].\n\n[a]: /a\n\n## Title\n\n```cpp\nint x;\n```\n";
+    CHECK(RenderMarkdownPage(markdown, kTestPagePrologue, kTestPageEpilogue, page));
+    CHECK(page.html.starts_with(kTestPagePrologue) && page.html.compare(page.bodyEnd, std::string::npos, kTestPageEpilogue) == 0);
+    CHECK(page.sectionStarts.size() == 3 && page.sectionHashes.size() == 3 && page.headings.size() == 2);
+    bool markers = !page.sectionStarts.empty() && page.sectionStarts.front() == kTestPagePrologue.size();
+    for (size_t start : page.sectionStarts)
+    {
+        markers = markers && page.html.compare(start, std::size(kMarkdownSectionMarker) - 1, kMarkdownSectionMarker) == 0;
+    }
+    CHECK(markers);
+    CHECK(page.html.find("<a href=\"/a\">a</a>") != std::string::npos);
+    CHECK(page.html.find("<span class=\"tok-kw\">int</span>") != std::string::npos);
+    CHECK(IsOutlineConsistent(page.html, page.headings) && page.headings.back().id == "title-1");
+
+    // A document the splitter declines is rendered in one pass, without markers.
+    MarkdownPage serial;
+    CHECK(RenderMarkdownPage("> ```\n```\n\nText\n", kTestPagePrologue, kTestPageEpilogue, serial));
+    CHECK(serial.sectionStarts.empty() && serial.html.find(kMarkdownSectionMarker) == std::string::npos);
+}
+
+// Paragraphs, lists and plain code blocks: nothing md4c renders differently once split.
+std::string MakeLargeMarkdown(size_t bytes)
+{
+    std::string markdown;
+    for (int block = 0; markdown.size() < bytes; ++block)
+    {
+        markdown += "Paragraph " + std::to_string(block) + " with *emphasis* and [a link](https://example.com/" + std::to_string(block) + ").\n\n";
+        if (block % 7 == 0)
+        {
+            markdown += "- item\n- item " + std::to_string(block) + "\n\n";
+        }
+        if (block % 11 == 0)
+        {
+            markdown += "```\ncode " + std::to_string(block) + "\n```\n\n";
+        }
+    }
+    return markdown;
+}
+
+// Past kMarkdownParallelMinBytes the sections are rendered on several threads; with the markers
+// taken out the body is still md4c's serial output.
+void TestRenderMarkdownPageParallel()
+{
+    std::string markdown = MakeLargeMarkdown(kMarkdownParallelMinBytes * 3 / 2);
+    MarkdownPage page;
+    CHECK(RenderMarkdownPage(markdown, "", "", page));
+    CHECK(page.sectionStarts.size() > 1000);
+    std::string body;
+    size_t pos = 0;
+    for (size_t marker = page.html.find(kMarkdownSectionMarker); marker != std::string::npos; marker = page.html.find(kMarkdownSectionMarker, pos))
+    {
+        body.append(page.html, pos, marker - pos);
+        pos = marker + std::size(kMarkdownSectionMarker) - 1;
+    }
+    body.append(page.html, pos, std::string::npos);
+    CHECK(body == RenderMarkdownSerially(markdown));
+}
+
+// Edit traces: each reload is patched onto the page the previous step left on screen, as the app
+// chains them, and must equal a full render of the new text. A failed patch navigates in full.
+void TestPatchMarkdownPage()
+{
+    static constexpr std::string_view kBlocks[] = {
+        "Plain paragraph.", "# Usage", "## Usage", "# Install", "### Notes", "Setext\n===", "See [a] and [b].",
+        "```cpp\nint x = 1; // one\n```", "```\n# not a heading\n```", "- one\n- two", "1. first\n2. second",
+        "> quoted\ntext", "| a | b |\n|---|---|\n| 1 | 2 |", "<div>\nraw\n</div>", "---", "\xC3\x9Cn\xC3\xAF text",
+    };
+    TestRandom random{ 5 };
+    int patched = 0;
+    int unchanged = 0;
+    for (int trace = 0; trace < 60; ++trace)
+    {
+        std::vector<std::string> blocks;
+        for (uint32_t i = 0, count = 2 + random.Next(12); i < count; ++i)
+        {
+            blocks.emplace_back(kBlocks[random.Next(static_cast<uint32_t>(std::size(kBlocks)))]);
+        }
+        if (random.Next(2) == 0)
+        {
+            blocks.emplace_back("[a]: https://example.com/a\n[b]: /b");
+        }
+        auto live = std::make_shared<MarkdownPage>();
+        CHECK(RenderMarkdownPage(JoinBlocks(blocks), kTestPagePrologue, kTestPageEpilogue, *live));
+
+        for (int step = 0; step < 40; ++step)
+        {
+            size_t at = random.Next(static_cast<uint32_t>(blocks.size() + 1));
+            std::string block(kBlocks[random.Next(static_cast<uint32_t>(std::size(kBlocks)))]);
+            switch (random.Next(5))
+            {
+            case 0:
+                blocks.insert(blocks.begin() + at, block);
+                break;
+            case 1:
+                if (at < blocks.size() && blocks.size() > 1)
+                {
+                    blocks.erase(blocks.begin() + at);
+                }
+                break;
+            case 2:
+                if (at < blocks.size())
+                {
+                    blocks[at] = block;
+                }
+                break;
+            case 3:
+                if (at < blocks.size())
+                {
+                    blocks[at] += " edited";
+                }
+                break;
+            default:
+                // Touch nothing: the reload that follows a save without changes.
+                break;
+            }
+            std::string markdown = JoinBlocks(blocks);
+            auto full = std::make_shared<MarkdownPage>();
+            CHECK(RenderMarkdownPage(markdown, kTestPagePrologue, kTestPageEpilogue, *full));
+
+            MarkdownPagePatch patch;
+            if (!PatchMarkdownPage(*live, markdown, patch))
+            {
+                live = full;
+                continue;
+            }
+            if (!patch.page)
+            {
+                ++unchanged;
+                CHECK(SamePage(*live, *full));
+                continue;
+            }
+            ++patched;
+            CHECK(SamePage(*patch.page, *full));
+            CHECK(ApplyPatchToHtml(*live, patch) == full->html);
+            CHECK(patch.firstSection <= patch.endSection && patch.endSection <= live->sectionStarts.size());
+            live = patch.page;
+        }
+    }
+    CHECK(patched > 600 && unchanged > 100);
+}
+
+// Stand-in for the WebView during progressive delivery: the first page is navigated, then each
+// batch lands at the end of the article one script round trip (one tick) after the previous.
+struct ProgressiveTestHost
+{
+    std::string document;
+    size_t articleEnd = 0;
+    std::vector<std::pair<int, size_t>> arrivals;
+    int tick = 0;
+
+    void Navigate(std::string page, size_t bodyEnd)
+    {
+        document = std::move(page);
+        articleEnd = bodyEnd;
+        arrivals.emplace_back(tick, articleEnd);
+    }
+
+    void AppendToArticle(std::string_view fragment)
+    {
+        ++tick;
+        document.insert(articleEnd, fragment);
+        articleEnd += fragment.size();
+        arrivals.emplace_back(tick, fragment.size());
+    }
+};
+
+void TestProgressiveDelivery()
+{
+    MarkdownPage page;
+    CHECK(RenderMarkdownPage(MakeLargeMarkdown(12 * 1024 * 1024), kTestPagePrologue, kTestPageEpilogue, page));
+    std::vector<size_t> bounds = GetMarkdownPageBlockBounds(page);
+    CHECK(bounds.size() > 20 && bounds.front() == page.sectionStarts.front() && bounds.back() == page.bodyEnd);
+    bool wholeBlocks = true;
+    for (size_t i = 1; i + 1 < bounds.size(); ++i)
+    {
+        wholeBlocks = wholeBlocks && bounds[i] - bounds[i - 1] >= kMarkdownParallelChunkBytes
+            && std::binary_search(page.sectionStarts.begin(), page.sectionStarts.end(), bounds[i]);
+    }
+    CHECK(wholeBlocks);
+
+    // Same loop as NavigatePendingHtml and SendNextProgressiveHtmlBatch.
+    size_t firstPaintBlock = FindProgressiveFirstPaintBlock(page.html.size(), bounds);
+    CHECK(firstPaintBlock > 0);
+    ProgressiveTestHost host;
+    host.Navigate(MakeProgressiveFirstPage(page.html, bounds, firstPaintBlock), bounds[firstPaintBlock]);
+    for (size_t next = firstPaintBlock; next + 1 < bounds.size();)
+    {
+        size_t end = FindProgressiveBatchEnd(bounds, next);
+        CHECK(end > next && end < bounds.size());
+        host.AppendToArticle(std::string_view(page.html).substr(bounds[next], bounds[end] - bounds[next]));
+        next = end;
+    }
+    CHECK(host.document == page.html);
+
+    // The first screenful arrives at tick 0 and is small; the rest follows in bounded batches.
+    CHECK(host.arrivals.front().first == 0);
+    CHECK(host.arrivals.front().second - bounds[0] >= kProgressiveFirstPaintBytes);
+    CHECK(host.arrivals.front().second - bounds[0] < kProgressiveFirstPaintBytes + 2 * kMarkdownParallelChunkBytes);
+    bool bounded = true;
+    for (size_t i = 1; i < host.arrivals.size(); ++i)
+    {
+        bounded = bounded && host.arrivals[i].first == static_cast<int>(i)
+            && host.arrivals[i].second < kProgressiveBatchBytes + 2 * kMarkdownParallelChunkBytes;
+    }
+    CHECK(bounded && host.arrivals.size() > 10);
+
+    // Small pages, pages the splitter declined and pages whose first screenful already takes every
+    // block but the last go in one navigation.
+    CHECK(FindProgressiveFirstPaintBlock(kProgressiveHtmlMinBytes - 1, bounds) == 0);
+    CHECK(FindProgressiveFirstPaintBlock(page.html.size(), {}) == 0);
+    std::vector<size_t> oneBatch = { 100, 150, 100 + kProgressiveHtmlMinBytes };
+    CHECK(FindProgressiveFirstPaintBlock(2 * kProgressiveHtmlMinBytes, oneBatch) == 0);
+    std::vector<size_t> twoBatches = { 100, 100 + kProgressiveFirstPaintBytes, 200 + kProgressiveFirstPaintBytes, 100 + kProgressiveHtmlMinBytes };
+    CHECK(FindProgressiveFirstPaintBlock(2 * kProgressiveHtmlMinBytes, twoBatches) == 1);
+    CHECK(FindProgressiveBatchEnd(twoBatches, 1) == 3);
+}
+}
+
+// =====================
+// HTML 挿入位置
+// =====================
+
+// The text in front of the insert position, so expectations read as the document does.
+std::string_view HeadPrefix(std::string_view html)
+{
+    return html.substr(0, FindHtmlHeadInsertPosition(html));
+}
+
+void TestHtmlHeadInsertPosition()
+{
+    CHECK(HeadPrefix("<!DOCTYPE html><html><head><title>t</title></head></html>") == "<!DOCTYPE html><html><head>");
+    CHECK(HeadPrefix("\xEF\xBB\xBF<!doctype html>\n<HTML lang=\"en\">\n<HEAD data-x='a>b'><meta>") == "\xEF\xBB\xBF<!doctype html>\n<HTML lang=\"en\">\n<HEAD data-x='a>b'>");
+    CHECK(HeadPrefix("<!-- a > b --><!DOCTYPE html><p>text") == "<!-- a > b --><!DOCTYPE html>");
+    CHECK(HeadPrefix("<?xml version=\"1.0\"?>\n<!DOCTYPE html>\n<html xmlns=\"x\"><body>") == "<?xml version=\"1.0\"?>\n<!DOCTYPE html>\n<html xmlns=\"x\">");
+    CHECK(HeadPrefix("<html><header>not the head</header>") == "<html>");
+    CHECK(HeadPrefix("<html><headless>") == "<html>");
+    CHECK(HeadPrefix("plain text") == "");
+    CHECK(HeadPrefix("") == "");
+    CHECK(HeadPrefix("  <p>implied head") == "  ");
+
+    // A comment longer than the prologue is followed to its end, so the doctype after it stays first.
+    std::string longComment = "<!--" + std::string(100 * 1024, 'c') + "-->";
+    CHECK(HeadPrefix(longComment + "<!DOCTYPE html><html><head>") == longComment + "<!DOCTYPE html><html><head>");
+
+    // Left open: just past the doctype or <html> tag, never in front of them.
+    std::string openComment = "<!DOCTYPE html><html lang=\"en\"><!-- " + std::string(100 * 1024, 'c');
+    CHECK(HeadPrefix(openComment) == "<!DOCTYPE html><html lang=\"en\">");
+    CHECK(HeadPrefix("<!DOCTYPE html><!-- never closed <head>") == "<!DOCTYPE html>");
+    CHECK(HeadPrefix("<!-- never closed <!DOCTYPE html>") == "");
+    std::string openHead = "<!DOCTYPE html><head title=\"" + std::string(100 * 1024, 't');
+    CHECK(HeadPrefix(openHead) == "<!DOCTYPE html>");
+    std::string openHtml = "<!DOCTYPE html><html class=\"" + std::string(100 * 1024, 'h');
+    CHECK(HeadPrefix(openHtml) == "<!DOCTYPE html>");
+
+    // Whatever the prologue, the doctype stays in front of the style.
+    TestRandom random{ 11 };
+    static constexpr std::string_view kParts[] = {
+        "<!-- c -->", "<!--", "-->", "<!DOCTYPE html>", "<html>", "<head>", "<?pi?>", " ", "\n", "<body>", "<p>", "text", "<html a='>'", "\"",
+    };
+    bool doctypeFirst = true;
+    for (int i = 0; i < 20000; ++i)
+    {
+        std::string html;
+        for (uint32_t part = 0, count = 1 + random.Next(8); part < count; ++part)
+        {
+            html += kParts[random.Next(static_cast<uint32_t>(std::size(kParts)))];
+        }
+        size_t insert = FindHtmlHeadInsertPosition(html);
+        size_t doctype = html.find("<!DOCTYPE");
+        size_t comment = html.find("<!--");
+        // Only a doctype that is a real token counts: one that starts the document after whitespace
+        // and complete comments, which the scanner sees as well.
+        if (doctype != std::string::npos && (comment == std::string::npos || comment > doctype)
+            && html.find_first_not_of(" \n") == doctype)
+        {
+            doctypeFirst = doctypeFirst && insert >= doctype + 15;
+        }
+        doctypeFirst = doctypeFirst && insert <= html.size();
+    }
+    CHECK(doctypeFirst);
+}
+
+void TestInjectHtmlStyle()
+{
+    constexpr std::string_view style = "<style>body{}</style>";
+    CHECK(InjectHtmlStyle("<!DOCTYPE html><html><head><title>t</title>", style)
+        == "<!DOCTYPE html><html><head><style>body{}</style><title>t</title>");
+    CHECK(InjectHtmlStyle("<p>fragment</p>", style) == "<style>body{}</style><p>fragment</p>");
+    CHECK(InjectHtmlStyle("", style) == style);
+    // A BOM stays in front, and UTF-8 text after the style is copied byte for byte.
+    CHECK(InjectHtmlStyle("\xEF\xBB\xBF<head>\xE6\x97\xA5\xE6\x9C\xAC", style) == "\xEF\xBB\xBF<head><style>body{}</style>\xE6\x97\xA5\xE6\x9C\xAC");
+}
+
+void TestWriteUtf8Html()
+{
+    // One BOM, then the page's own bytes: a page of CJK text is written at its UTF-8 size, not
+    // widened.
+    std::string html = "<!DOCTYPE html><p>";
+    for (int i = 0; i < 1000; ++i)
+    {
+        html += "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E";
+    }
+    std::ostringstream output;
+    CHECK(WriteUtf8Html(output, html));
+    CHECK(output.str() == std::string(kUtf8Bom) + html);
+
+    // A page that already starts with one does not get a second.
+    std::ostringstream marked;
+    CHECK(WriteUtf8Html(marked, "\xEF\xBB\xBF<p>x</p>") && marked.str() == "\xEF\xBB\xBF<p>x</p>");
+    std::ostringstream empty;
+    CHECK(WriteUtf8Html(empty, "") && empty.str() == kUtf8Bom);
+
+    // A failed stream is reported.
+    std::ostringstream failed;
+    failed.setstate(std::ios::badbit);
+    CHECK(!WriteUtf8Html(failed, html));
+}
+
+// =====================
+// 起動トレース
+// =====================
+
+void TestStartupTrace()
+{
+    using namespace std::chrono_literals;
+    StartupTrace trace;
+    std::chrono::steady_clock::time_point start{};
+    BeginStartupTrace(trace, start);
+    MarkStartupPhase(trace, L"COM", start + 2ms);
+    std::thread([&trace, start]() { MarkStartupPhase(trace, L"Settings read", start + 3ms); }).join();
+    MarkStartupPhase(trace, L"Window created", start + 5500us);
+    MarkStartupPhase(trace, L"First paint", start + 10ms);
+    CHECK(trace.phases.size() == 4 && trace.phases[1].background && !trace.phases[2].background);
+
+    // Task lines carry no step cost: the next UI step is measured from the one before the task.
+    std::wstring report = FormatStartupReport(trace);
+    CHECK(report == L"FloatVision startup (ms since start, ms since previous step):\n"
+                    L"     2.00      +2.00  COM\n"
+                    L"     3.00            [task] Settings read\n"
+                    L"     5.50      +3.50  Window created\n"
+                    L"    10.00      +4.50  First paint\n");
+
+    // Steps that finish after the report are not added to a trace that has gone out.
+    MarkStartupPhase(trace, L"Late task", start + 20ms);
+    CHECK(trace.reported && trace.phases.size() == 4);
+}
+
+void TestStartupTasks()
+{
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::vector<std::wstring> order;
+    int waiting = 0;
+    bool overlapped = false;
+    auto record = [&](const wchar_t* name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(name);
+    };
+    // Independent tasks run at once: each waits, with a timeout, until the other has started.
+    auto meet = [&]()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ++waiting;
+        arrived.notify_all();
+        if (arrived.wait_for(lock, std::chrono::seconds(5), [&]() { return waiting == 2; }))
+        {
+            overlapped = true;
+        }
+    };
+
+    StartupTrace trace;
+    BeginStartupTrace(trace, std::chrono::steady_clock::now());
+    {
+        StartupTasks tasks;
+        size_t settings = RunStartupTask(tasks, trace, L"Settings read", [&]() { meet(); record(L"settings"); });
+        size_t image = RunStartupTask(tasks, trace, L"Image read-ahead", [&]() { meet(); record(L"image"); });
+        size_t apply = RunStartupTask(tasks, trace, L"Apply", [&]() { record(L"apply"); }, { settings, image, kNoStartupTask });
+        size_t last = RunStartupTask(tasks, trace, L"Last", [&]() { record(L"last"); }, { apply });
+        RunStartupTask(tasks, trace, L"Unwaited", [&]() { std::this_thread::sleep_for(std::chrono::milliseconds(20)); record(L"unwaited"); });
+        WaitStartupTask(tasks, last);
+        WaitStartupTask(tasks, kNoStartupTask);
+        std::lock_guard<std::mutex> lock(mutex);
+        CHECK(overlapped);
+        auto position = [&order](const wchar_t* name) { return std::find(order.begin(), order.end(), name) - order.begin(); };
+        CHECK(position(L"settings") < position(L"apply") && position(L"image") < position(L"apply"));
+        CHECK(position(L"apply") < position(L"last") && position(L"last") < static_cast<ptrdiff_t>(order.size()));
+    }
+    // Leaving the scope joined the task nobody waited for.
+    CHECK(order.size() == 5 && std::find(order.begin(), order.end(), L"unwaited") != order.end());
+    CHECK(trace.phases.size() == 5 && std::all_of(trace.phases.begin(), trace.phases.end(), [](const StartupPhase& phase) { return phase.background; }));
+}
+
+int main()
+{
+    TestNaturalSortKey();
+    TestCatalogKeyPrecedes();
+    TestCatalogOrderEdits();
+    TestCatalogBatchMerge();
+    TestCrc32();
+    TestInflateStored();
+    TestInflateFixed();
+    TestInflateDynamic();
+    TestZipDirectory();
+    TestZip64EndRecord();
+    TestZipMemberSize();
+    TestZipLocalHeader();
+    TestPlaylistIndexRoundTrip();
+    TestPlaylistFrontCoding();
+    TestPlaylistIndexDamage();
+    TestMetadataCacheRoundTrip();
+    TestMetadataCacheDamage();
+    TestAdvanceAnimationTimeline();
+    TestAnimationPlayback();
+    TestCanvasDirtyRect();
+    TestAnimationSurface();
+    TestCheckerTile();
+    TestLayeredSurfaceCache();
+    TestDocumentBuffer();
+    TestDecodeUtf8();
+    TestWideToUtf8();
+    TestTextLineIndex();
+    TestReadTextLine();
+    TestTextLongLineLookup();
+    TestTextFollowAction();
+    TestTextFollowLog();
+    TestSplitSettingsLines();
+    TestIndexSettingsLines();
+    TestApplySettingsChange();
+    TestSettingHashTable();
+    TestSettingHashTableCollision();
+    TestFoldFontName();
+    TestFontCatalog();
+    TestMarkdownSplit();
+    TestMarkdownSplitDifferential();
+    TestFindCodeLanguage();
+    TestHighlightCode();
+    TestHtmlUnescape();
+    TestHighlightRoundTrip();
+    TestMakeHeadingId();
+    TestMarkdownOutline();
+    TestHeadingIdNumbering();
+    TestReadmeOutline();
+    TestHashBytes();
+    TestMarkdownHtmlCache();
+    TestRenderMarkdownPage();
+    TestRenderMarkdownPageParallel();
+    TestPatchMarkdownPage();
+    TestProgressiveDelivery();
+    TestHtmlHeadInsertPosition();
+    TestInjectHtmlStyle();
+    TestWriteUtf8Html();
+    TestStartupTrace();
+    TestStartupTasks();
+    if (g_failures != 0)
+    {
+        std::fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    std::puts("all tests passed");
+    return 0;
+}
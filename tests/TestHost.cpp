@@ -0,0 +1,29 @@
+﻿#include "FloatVisionCore.h"
+
+#include <cwctype>
+
+// The host functions FloatVisionCore.h leaves to the app, for the test and benchmark builds.
+
+// The app folds with CharLowerBuffW; the names used here are ASCII, where towlower agrees.
+void FoldCaseText(std::wstring& text)
+{
+    for (wchar_t& ch : text)
+    {
+        ch = static_cast<wchar_t>(towlower(ch));
+    }
+}
+
+// Member names in these archives are ASCII; anything else is refused like an invalid sequence.
+bool DecodeZipName(std::string_view raw, bool, std::wstring& name)
+{
+    name.clear();
+    for (char ch : raw)
+    {
+        if (static_cast<unsigned char>(ch) >= 0x80)
+        {
+            return false;
+        }
+        name.push_back(static_cast<wchar_t>(ch));
+    }
+    return true;
+}